@@ -0,0 +1,113 @@
+/**
+ * @file amg.h
+ * @brief Smoothed-aggregation algebraic multigrid V-cycle
+ *
+ * Builds a hierarchy of coarser operators from the distributed CSR
+ * matrix alone. On each level, strongly connected rows
+ * (|a_ij| > theta sqrt(|a_ii a_jj|)) of each process are grouped into
+ * aggregates. The piecewise-constant tentative prolongator is smoothed
+ * with one damped Jacobi step, P = (I - 4/(3 rho) D^{-1} A) P_tent, and
+ * the coarse operator is the Galerkin product P^T A P. Coarsening stops
+ * at AMG_COARSE_MAX rows, which are gathered on rank 0 and solved by a
+ * dense Cholesky factorization.
+ *
+ * When the coarse rows per process fall below AMG_MIN_ROWS_PER_RANK, the
+ * next level is agglomerated onto fewer processes: the others own no rows
+ * of it, so its ghost exchanges only involve the processes that do.
+ *
+ * One application of the preconditioner is a V-cycle with the same
+ * Jacobi or Chebyshev smoother before and after the coarse correction,
+ * which keeps it symmetric, as PCG requires.
+ */
+
+#ifndef AMG_H
+#define AMG_H
+
+#include "halo.h"
+
+#define AMG_MAX_LEVELS 20           // Upper bound on hierarchy depth
+#define AMG_COARSE_MAX 500          // Rows of a level solved directly
+#define AMG_DENSE_MAX 4000          // Largest coarsest level factored densely
+#define AMG_MIN_ROWS_PER_RANK 1000  // Agglomerate coarse levels below this many rows per process
+
+/**
+ * @brief Smoother of the V-cycle
+ */
+typedef enum {
+    AMG_SMOOTHER_JACOBI,     // Damped Jacobi, weight 4 / (3 rho(D^{-1} A))
+    AMG_SMOOTHER_CHEBYSHEV   // Chebyshev polynomial in D^{-1} A on [0.1 rho, 1.1 rho]
+} AmgSmoother;
+
+/**
+ * @brief Hierarchy parameters
+ */
+typedef struct {
+    AmgSmoother smoother;
+    int degree;             // Chebyshev degree, or Jacobi sweeps, on each side of a level
+    double theta;           // Strength of connection threshold
+} AmgOptions;
+
+/**
+ * @brief Multigrid hierarchy (opaque)
+ */
+typedef struct AmgHierarchy AmgHierarchy;
+
+/**
+ * @brief Fill options with the default hierarchy parameters
+ *
+ * @param opts Options to initialize
+ */
+void amg_options_default(AmgOptions* opts);
+
+/**
+ * @brief Parse a smoother name ("jacobi" or "chebyshev")
+ *
+ * @param name Smoother name
+ * @param smoother Output: parsed smoother
+ * @return 0 on success, -1 if the name is unknown
+ */
+int amg_smoother_from_string(const char* name, AmgSmoother* smoother);
+
+/**
+ * @brief Build the hierarchy of a distributed matrix (collective)
+ *
+ * The finest level uses the arrays and plan in place, so they must
+ * outlive the hierarchy.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices (see halo_setup())
+ * @param vals Non-zero values, both triangles
+ * @param local_n Number of local rows
+ * @param halo Ghost exchange plan of the matrix
+ * @param opts Hierarchy parameters
+ * @param verbose Print the hierarchy on rank 0
+ * @return New hierarchy, released with amg_free()
+ */
+AmgHierarchy* amg_setup(int* ptr, int* cols, double* vals, int local_n, HaloPlan* halo,
+                        const AmgOptions* opts, int verbose);
+
+/**
+ * @brief Apply one V-cycle: z = M^{-1} r (collective)
+ *
+ * @param amg Hierarchy
+ * @param r Input vector (size: local_n)
+ * @param z Output vector (size: local_n), must not alias r
+ */
+void amg_apply(AmgHierarchy* amg, const double* r, double* z);
+
+/**
+ * @brief Print the time spent on each level since the last report (collective)
+ *
+ * @param amg Hierarchy
+ * @param rank MPI rank of the calling process
+ */
+void amg_report(AmgHierarchy* amg, int rank);
+
+/**
+ * @brief Free a hierarchy
+ *
+ * @param amg Hierarchy, or NULL
+ */
+void amg_free(AmgHierarchy* amg);
+
+#endif // AMG_H
@@ -0,0 +1,156 @@
+/**
+ * @file autotune.h
+ * @brief Startup autotuning of the SpMV storage, thread count and row partition
+ *
+ * The fastest setup differs between banded, block-structured and
+ * irregular matrices. After the matrix is read, the tuner analyzes its
+ * structure (row lengths, bandwidth) and runs short timed trials on the
+ * local rows:
+ *
+ * - partition: one CSR product per process is fitted to a cost per row
+ *   and per nonzero, which gives the PART_MIXED weight balancing both;
+ *   rows shift between neighboring processes when the current split
+ *   is unbalanced (see repartition_matrix);
+ * - storage and threads: CSR, unrolled CSR, SELL-C-sigma with several C
+ *   and sigma (see sell_ops.h) and block CSR with each block size whose
+ *   measured fill reaches AUTOTUNE_BLOCK_FILL (see bcsr_ops.h), each
+ *   built on the interior and boundary row sets like the solver's copies
+ *   and run with the OpenMP thread counts T, T/2, T/4, ...; the slowest
+ *   process decides.
+ *
+ * The result is appended to a tuning file under a fingerprint of the
+ * sparsity pattern, together with the number of processes and threads,
+ * so later runs on the same pattern skip the trials.
+ */
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "partition.h"
+#include "reorder.h"
+#include "sparse_ops.h"
+
+#define AUTOTUNE_IMBALANCE 1.05       // Slowest over average process time that triggers repartitioning
+#define AUTOTUNE_TRIAL_SECONDS 0.02   // Target duration of each timed trial
+#define AUTOTUNE_BLOCK_FILL 0.6       // Nonzeros per stored BCSR value needed for a trial
+
+/**
+ * @brief Structure of the global matrix and the key of its tuning entry
+ */
+typedef struct {
+    unsigned long long fingerprint;   // Hash of the global (row, column) pattern
+    int global_n;
+    long long global_nnz;
+    int processes;        // Processes and OpenMP threads of the run (part of the key)
+    int max_threads;
+    int min_len;          // Shortest and longest row
+    int max_len;
+    double avg_len;
+    double cv_len;        // Coefficient of variation of the row lengths
+    int bandwidth;        // Largest |row - column|
+} TuneStats;
+
+/**
+ * @brief Tuned setup
+ */
+typedef struct {
+    SparseFormat format;  // Any format but SPARSE_FORMAT_COMPACT
+    int sell_chunk;
+    int sell_sigma;
+    int bcsr_block;
+    int threads;          // OpenMP threads per process (1 without OpenMP)
+    PartitionType part;
+    double part_weight;
+    int cached;           // Read from the tuning file instead of measured
+} TuneResult;
+
+/**
+ * @brief Analyze the matrix structure and compute its fingerprint (collective)
+ *
+ * Prints the statistics on rank 0.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Global column indices, as returned by read_csr_parallel()
+ * @param local_n Number of local rows
+ * @param dist Row distribution of the matrix
+ * @param rank MPI rank of the calling process
+ * @param stats Output: global statistics
+ */
+void autotune_analyze(const int* ptr, const int* cols, int local_n, const RowDist* dist,
+                      int rank, TuneStats* stats);
+
+/**
+ * @brief Look up the tuning entry of a matrix (collective)
+ *
+ * Rank 0 reads the file; the last entry whose fingerprint, size, process
+ * count, thread count, storage symmetry and reordering match wins.
+ *
+ * @param file Tuning file (may not exist yet)
+ * @param stats Statistics from autotune_analyze()
+ * @param symmetric Arrays hold only the upper triangle
+ * @param reorder Load-time reordering of the run
+ * @param res Output: cached setup, if found
+ * @param rank MPI rank of the calling process
+ * @return 1 if an entry was found, 0 otherwise
+ */
+int autotune_lookup(const char* file, const TuneStats* stats, int symmetric,
+                    ReorderType reorder, TuneResult* res, int rank);
+
+/**
+ * @brief Choose the row partition from a timed CSR product on each process (collective)
+ *
+ * Fits the times of all processes to a cost per row and per nonzero, and
+ * sets res->part to PART_MIXED with the weight balancing them when the
+ * current split is more than AUTOTUNE_IMBALANCE out of balance.
+ * Otherwise res->part and res->part_weight are left unchanged. Must be
+ * called while cols holds global column indices; the arrays are not
+ * modified.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Global column indices
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ * @param dist Row distribution of the matrix
+ * @param stats Statistics from autotune_analyze()
+ * @param rank MPI rank of the calling process
+ * @param res Setup to update, with the current partition on input
+ */
+void autotune_partition(int* ptr, const int* cols, double* vals, int local_n,
+                        const RowDist* dist, const TuneStats* stats, int rank,
+                        TuneResult* res);
+
+/**
+ * @brief Time the storage formats and thread counts on the local rows (collective)
+ *
+ * With symmetric storage or keep_format, only the thread count is tuned.
+ * Otherwise rank 0 prints the BCSR fill of each block size first.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices (see halo_setup())
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ * @param n_ghost Number of ghost entries of the input vector
+ * @param row_start Global index of local row 0
+ * @param symmetric Arrays hold only the upper triangle (see sym_ops.h)
+ * @param keep_format Do not change res->format and the SELL and BCSR parameters
+ * @param rank MPI rank of the calling process
+ * @param res Setup to update, with the current format on input
+ */
+void autotune_kernel(int* ptr, int* cols, double* vals, int local_n, int n_ghost,
+                     int row_start, int symmetric, int keep_format, int rank,
+                     TuneResult* res);
+
+/**
+ * @brief Append the tuning entry of a matrix to the tuning file (rank 0 writes)
+ *
+ * @param file Tuning file, created if missing
+ * @param stats Statistics from autotune_analyze()
+ * @param symmetric Arrays hold only the upper triangle
+ * @param reorder Load-time reordering of the run
+ * @param res Tuned setup
+ * @param rank MPI rank of the calling process
+ */
+void autotune_store(const char* file, const TuneStats* stats, int symmetric,
+                    ReorderType reorder, const TuneResult* res, int rank);
+
+#endif // AUTOTUNE_H
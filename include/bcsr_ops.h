@@ -0,0 +1,125 @@
+/**
+ * @file bcsr_ops.h
+ * @brief Block CSR storage with b x b dense blocks (b = 2, 3 or 6)
+ *
+ * Matrices from vector-valued PDEs (elasticity, several unknowns per
+ * grid point) couple groups of b consecutive rows with the same groups
+ * of b columns. Storing those couplings as dense b x b blocks keeps one
+ * column index per block instead of per nonzero, and the kernel, compiled
+ * separately for each supported b, multiplies a block with fully unrolled
+ * loops and one contiguous load of x. Missing entries of a block are
+ * stored as zeros, so the format pays off only when most blocks are full.
+ *
+ * Like SELL (sell_ops.h), a BCSR matrix can hold any subset of the rows,
+ * so the interior and boundary row sets of the overlapped SpMV each get
+ * their own copy.
+ */
+
+#ifndef BCSR_OPS_H
+#define BCSR_OPS_H
+
+// Default block size of -format bcsr
+#define BCSR_DEFAULT_BLOCK 3
+
+/**
+ * @brief Matrix (or subset of its rows) in block CSR format
+ *
+ * Row r of group g is local row g_rows[g * block + r]; the rows of a
+ * group share (i + shift) / block, so groups follow the global row
+ * numbering whatever the first local row. Block k of the group covers columns
+ * [block_cols[k], block_cols[k] + block) and stores its values row-major
+ * at vals + k * block * block.
+ */
+typedef struct {
+    int block;          // Block size b
+    int shift;          // Global index of local row 0, modulo block
+    int n_rows;         // Number of stored rows
+    int n_groups;       // Number of block rows
+    int* g_rows;        // Local row of each group slot, -1 for padding (size: n_groups * block)
+    int* group_ptr;     // First block of each group (size: n_groups + 1)
+    int* block_cols;    // First column of each block
+    double* vals;       // Block values, row-major within a block
+    long long nnz;      // Nonzeros, excluding explicit zeros of the blocks
+} BcsrMatrix;
+
+/**
+ * @brief Whether a block size has a compiled kernel (2, 3 or 6)
+ *
+ * @param block Block size
+ * @return 1 if supported, 0 otherwise
+ */
+int bcsr_block_supported(int block);
+
+/**
+ * @brief Convert CSR rows to block CSR
+ *
+ * Blocks of owned columns start at global multiples of block and
+ * blocks of ghost columns at n_owned plus multiples of block. A block that would
+ * reach past the end of its range is moved back to end there, so rows
+ * without ghost columns never read the ghost entries (which are still in
+ * flight while interior rows are computed) and no row reads beyond x_ext.
+ *
+ * @param A Output: BCSR matrix
+ * @param ptr Row pointer array
+ * @param cols Column indices (local numbering, see halo_setup())
+ * @param vals Non-zero values
+ * @param rows Row indices to store in increasing order, or NULL for rows [0, n_rows)
+ * @param n_rows Number of rows to store
+ * @param n_owned Number of owned entries of the input vector, at least block
+ * @param n_cols Length of the input vector (owned plus ghost entries)
+ * @param block Block size (see bcsr_block_supported())
+ * @param row_start Global index of local row 0
+ */
+void bcsr_from_csr(BcsrMatrix* A, const int* ptr, const int* cols, const double* vals,
+                   const int* rows, int n_rows, int n_owned, int n_cols, int block,
+                   int row_start);
+
+/**
+ * @brief Size of the block CSR copy of some rows, without building it
+ *
+ * The fill nnz / stored tells whether block size pays off: 1 for
+ * matrices made of dense blocks, 1 / (block * block) at worst.
+ *
+ * @param ptr Row pointer array
+ * @param cols Column indices (local numbering)
+ * @param rows Row indices in increasing order, or NULL for rows [0, n_rows)
+ * @param n_rows Number of rows
+ * @param n_owned Number of owned entries of the input vector, at least block
+ * @param n_cols Length of the input vector (owned plus ghost entries)
+ * @param block Block size (see bcsr_block_supported())
+ * @param row_start Global index of local row 0
+ * @param nnz Output: nonzeros of the rows
+ * @param stored Output: values bcsr_from_csr() would store
+ */
+void bcsr_count(const int* ptr, const int* cols, const int* rows, int n_rows,
+                int n_owned, int n_cols, int block, int row_start, long long* nnz,
+                long long* stored);
+
+/**
+ * @brief Sparse matrix-vector multiplication in block CSR format
+ *
+ * Computes y[i] = (A x_ext)[i] for each stored row i; other entries of
+ * y are not touched.
+ *
+ * @param A BCSR matrix
+ * @param x_ext Owned entries followed by ghost entries
+ * @param y Local output vector
+ */
+void mat_vec_bcsr(const BcsrMatrix* A, const double* x_ext, double* y);
+
+/**
+ * @brief Number of stored values including the zeros of partly filled blocks
+ *
+ * @param A BCSR matrix
+ * @return Number of blocks times block * block
+ */
+long long bcsr_stored_entries(const BcsrMatrix* A);
+
+/**
+ * @brief Release the memory held by a BCSR matrix
+ *
+ * @param A BCSR matrix
+ */
+void bcsr_free(BcsrMatrix* A);
+
+#endif // BCSR_OPS_H
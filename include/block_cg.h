@@ -0,0 +1,47 @@
+/**
+ * @file block_cg.h
+ * @brief CG for several right-hand sides of the same matrix
+ *
+ * Solves A X = B for k right-hand sides in one run. Blocks of vectors
+ * are stored row-major (entry (i, c) at i * k + c), so each iteration
+ * streams the matrix once for all k vectors (mat_mat_csr_rows()), sends
+ * one ghost message per neighbor for the whole block and fuses all inner
+ * products of the iteration into two reductions.
+ */
+
+#ifndef BLOCK_CG_H
+#define BLOCK_CG_H
+
+#include "cg_solver.h"
+#include "halo.h"
+
+/**
+ * @brief Solve A X = B for k right-hand sides with (P)CG
+ *
+ * With CG_RHS_SIMULTANEOUS, k independent CG recurrences run in lockstep;
+ * each reduction carries k values instead of one. With CG_RHS_BLOCK, the
+ * search directions of all right-hand sides span a common block Krylov
+ * space (O'Leary's block CG) and the reductions carry k x k Gram
+ * matrices, which usually cuts the iteration count. Converged
+ * right-hand sides are dropped from the block; block CG restarts its
+ * search directions when that happens.
+ *
+ * Uses the CSR arrays directly: opts->method, opts->format and
+ * opts->symmetric are ignored.
+ *
+ * @param ptr Row pointer array for local CSR matrix
+ * @param cols Local column indices for local CSR matrix (see halo_setup())
+ * @param vals Non-zero values for local CSR matrix
+ * @param B Right-hand sides (local rows, size: local_n * k)
+ * @param X Solutions (local rows, size: local_n * k, initial guess on input)
+ * @param k Number of right-hand sides
+ * @param local_n Number of rows assigned to this process
+ * @param halo Ghost exchange plan built by halo_setup() for this matrix
+ * @param rank MPI rank of the calling process
+ * @param opts Solver parameters
+ * @return Number of block iterations performed
+ */
+int block_cg_solver(int* ptr, int* cols, double* vals, const double* B, double* X, int k,
+                    int local_n, HaloPlan* halo, int rank, const CGOptions* opts);
+
+#endif // BLOCK_CG_H
@@ -1,7 +1,7 @@
 /**
  * @file cg_solver.h
  * @brief Conjugate Gradient iterative solver for sparse linear systems
- * 
+ *
  * Implements the parallel Conjugate Gradient algorithm for solving
  * symmetric positive definite linear systems Ax = b.
  */
@@ -9,28 +9,291 @@
 #ifndef CG_SOLVER_H
 #define CG_SOLVER_H
 
+#include "compact_ops.h"
+#include "halo.h"
+#include "partition.h"
+#include "precond_ops.h"
+#include "sparse_ops.h"
+
+/**
+ * @brief CG recurrence used by cg_solver()
+ */
+typedef enum {
+    CG_METHOD_CLASSIC,      // Hestenes-Stiefel CG, two reductions per iteration
+    CG_METHOD_CHRONO_GEAR,  // Chronopoulos-Gear CG, one fused reduction per iteration
+    CG_METHOD_PIPELINED,    // Ghysels-Vanroose pipelined CG, reduction overlapped with SpMV
+    CG_METHOD_SSTEP         // s-step CG, one exchange and one reduction per s iterations
+} CGMethod;
+
+// Largest s of s-step CG (its basis has 2 s + 1 vectors)
+#define CG_SSTEP_MAX 16
+
+/**
+ * @brief Polynomial basis of the Krylov vectors of s-step CG
+ */
+typedef enum {
+    CG_BASIS_MONOMIAL,      // v, A v, A^2 v, ...: ill-conditioned beyond s of about 5
+    CG_BASIS_NEWTON,        // Products of (A - theta_j) with Leja-ordered Ritz values theta_j
+    CG_BASIS_CHEBYSHEV      // Chebyshev polynomials on the interval of the Ritz values
+} CGBasis;
+
+/**
+ * @brief Recurrence used for several right-hand sides (see block_cg.h)
+ */
+typedef enum {
+    CG_RHS_SIMULTANEOUS,    // k independent CG recurrences sharing each SpMM and reduction
+    CG_RHS_BLOCK,           // O'Leary block CG with k x k Gram matrices
+    CG_RHS_SEQUENTIAL       // One solve per right-hand side on one context (see deflate_k)
+} CGRhsMethod;
+
+/**
+ * @brief Solver parameters
+ */
+typedef struct {
+    CGMethod method;        // CG recurrence
+    int max_iter;           // Maximum number of CG iterations
+    double tol;             // Convergence tolerance on ||r|| / ||b||
+    int replace_period;     // Residual replacement period of the reduced-sync methods (0: off)
+    int sstep_s;            // Iterations per block of s-step CG, 1 .. CG_SSTEP_MAX
+    CGBasis sstep_basis;    // Basis of s-step CG
+    PCType pc;              // Preconditioner
+    double pc_omega;        // SSOR relaxation factor
+    AmgOptions amg;         // Hierarchy parameters of PC_AMG
+    SparseFormat format;    // Storage format of the SpMV
+    int sell_chunk;         // SELL chunk height C
+    int sell_sigma;         // SELL sorting window sigma
+    int bcsr_block;         // Block size of BCSR, 2, 3 or 6
+    int symmetric;          // Matrix arrays hold only the upper triangle (see sym_ops.h)
+    int node_halo;          // Exchange ghosts once per node through shared memory (see node_halo.h)
+    int node_ranks;         // Processes per node of node_halo (0: all that share memory)
+    int deflate_k;          // Ritz vectors a context recycles between solves (0: off, see deflation.h)
+    int deflate_window;     // Directions of each solve harvested for them
+    CompactValueType compact_values;  // Value precision of the compact format
+    double refine_tol;      // Relative tolerance of each inner solve in iterative refinement
+    CGRhsMethod rhs_method; // Recurrence for several right-hand sides
+    const char* checkpoint_file;  // Periodic checkpoints of classical CG (NULL: off)
+    int checkpoint_every;   // Iterations between checkpoints (0: not by count)
+    double checkpoint_interval;   // Seconds between checkpoints (0: not by time)
+    const char* restart_file;     // Checkpoint to resume classical CG from (NULL: none)
+    long long checkpoint_order;   // Row ordering fingerprint checkpoints record (0: file order)
+    int verbose;            // Print setup reports and progress on rank 0
+} CGOptions;
+
+/**
+ * @brief Linear operator given by callbacks instead of matrix arrays
+ *
+ * apply() computes y = A x for the local rows and is called by all
+ * processes together, so it may communicate. Its input vector has room
+ * for n_ghost entries after the owned block, which the operator may fill
+ * with the off-process values it needs; it must not change the owned
+ * entries. The operator must be symmetric positive definite.
+ */
+typedef struct {
+    void* data;             // Passed to the callbacks
+    int local_n;            // Rows owned by this process
+    int n_ghost;            // Ghost room apply() needs after the owned entries
+    void (*apply)(void* data, double* x_ext, double* y);
+    void (*diagonal)(void* data, double* diag);  // Local diagonal for PC_JACOBI, or NULL
+} CGLinearOp;
+
+/**
+ * @brief Persistent solver for repeated solves with one sparsity pattern (opaque)
+ *
+ * Created once by cg_context_create(), it owns a copy of the local matrix,
+ * the ghost exchange plan, the SpMV row splits and storage copies, the
+ * preconditioner and the CG work vectors. Later solves reuse all of them,
+ * and cg_context_update_values() only refreshes what depends on the values.
+ * With opts->deflate_k, it also keeps the deflation space each solve
+ * refines for the next one.
+ */
+typedef struct CGContext CGContext;
+
+/**
+ * @brief Fill options with the default solver parameters
+ *
+ * @param opts Options to initialize
+ */
+void cg_options_default(CGOptions* opts);
+
+/**
+ * @brief Parse a CG method name ("cg", "cgcg", "pipecg" or "sstep")
+ *
+ * @param name Method name
+ * @param method Output: parsed method
+ * @return 0 on success, -1 if the name is unknown
+ */
+int cg_method_from_string(const char* name, CGMethod* method);
+
+/**
+ * @brief Parse an s-step basis name ("monomial", "newton" or "chebyshev")
+ *
+ * @param name Basis name
+ * @param basis Output: parsed basis
+ * @return 0 on success, -1 if the name is unknown
+ */
+int cg_basis_from_string(const char* name, CGBasis* basis);
+
+/**
+ * @brief Parse a multiple right-hand side method name ("simultaneous", "block" or "sequential")
+ *
+ * @param name Method name
+ * @param method Output: parsed method
+ * @return 0 on success, -1 if the name is unknown
+ */
+int cg_rhs_method_from_string(const char* name, CGRhsMethod* method);
+
 /**
  * @brief Solve a sparse linear system using the Conjugate Gradient method
- * 
+ *
  * Solves Ax = b where A is a sparse symmetric positive definite matrix
- * stored in CSR format. The matrix is distributed across processes by rows.
- * 
+ * stored in CSR format, optionally preconditioned (PCG). The matrix is
+ * distributed across processes by rows, and off-process entries of the
+ * direction vector are exchanged with neighboring processes only, as
+ * described by the halo plan.
+ *
+ * The reduced-synchronization methods recompute the true residual every
+ * replace_period iterations and once more when the recurrence reports
+ * convergence, so their final accuracy matches classical CG.
+ *
+ * s-step CG builds the basis of s iterations with the matrix powers
+ * kernel (see matrix_powers.h) after one deep ghost exchange, and takes
+ * the s iterations from one Gram matrix reduction. It supports CSR
+ * storage of the full matrix without a preconditioner.
+ *
+ * With the compact (reduced-precision) format, CG runs as the inner
+ * solver of a mixed-precision iterative refinement: residuals and
+ * solution updates use the double-precision matrix, so the final
+ * residual meets tol as with the other formats.
+ *
+ * Classical CG (any format but compact) can write checkpoints of its
+ * state while iterating and resume from one (see checkpoint.h); x is
+ * then overwritten by the checkpoint. A run that stops at max_iter
+ * without converging writes a last checkpoint.
+ *
  * @param ptr Row pointer array for local CSR matrix
- * @param cols Column indices for local CSR matrix
+ * @param cols Local column indices for local CSR matrix (see halo_setup())
  * @param vals Non-zero values for local CSR matrix
  * @param b Right-hand side vector (local portion)
  * @param x Solution vector (local portion, initial guess on input)
  * @param local_n Number of rows assigned to this process
  * @param local_nnz Number of non-zeros assigned to this process
- * @param global_n Total number of rows in the matrix
+ * @param dist Row distribution of the matrix and vectors
+ * @param halo Ghost exchange plan built by halo_setup() for this matrix
  * @param rank MPI rank of the calling process
  * @param p Total number of MPI processes
- * @param max_iter Maximum number of CG iterations
- * @param tol Relative convergence tolerance
+ * @param opts Solver parameters
+ * @return Number of iterations performed (inner iterations summed for refinement)
  */
-void cg_solver(int* ptr, int* cols, double* vals, double* b, double* x,
-               int local_n, int local_nnz, int global_n, 
-               int rank, int p, int max_iter, double tol);
+int cg_solver(int* ptr, int* cols, double* vals, double* b, double* x,
+              int local_n, int local_nnz, const RowDist* dist, HaloPlan* halo,
+              int rank, int p, const CGOptions* opts);
 
-#endif // CG_SOLVER_H
+/**
+ * @brief Solve A x = b for an operator given by callbacks (matrix-free)
+ *
+ * Runs the CG method selected in opts on A->apply() instead of a stored
+ * matrix. Only PC_NONE and PC_JACOBI (which needs A->diagonal) are
+ * available, and format, symmetric and the compact refinement do not
+ * apply; checkpoints work as with cg_solver().
+ *
+ * @param A Linear operator
+ * @param b Right-hand side vector (local portion)
+ * @param x Solution vector (local portion, initial guess on input)
+ * @param dist Row distribution of the vectors
+ * @param rank MPI rank of the calling process
+ * @param opts Solver parameters
+ * @return Number of iterations performed
+ */
+int cg_solver_op(const CGLinearOp* A, double* b, double* x, const RowDist* dist,
+                 int rank, const CGOptions* opts);
+
+/**
+ * @brief Set up a persistent solver for the local rows of a matrix (collective)
+ *
+ * Copies the arrays, so the caller keeps ownership of them. Builds the
+ * ghost exchange plan, the SpMV storage selected in opts and the
+ * preconditioner.
+ *
+ * @param ptr Row pointer array, starting at 0 (size: local_n + 1)
+ * @param cols Global column indices, as returned by read_csr_parallel()
+ * @param vals Non-zero values (upper triangle only with opts->symmetric)
+ * @param local_n Number of rows assigned to this process
+ * @param dist Row distribution of the matrix and vectors
+ * @param rank MPI rank of the calling process
+ * @param opts Solver parameters, copied into the context
+ * @return New context, released with cg_context_destroy()
+ */
+CGContext* cg_context_create(const int* ptr, const int* cols, const double* vals,
+                             int local_n, const RowDist* dist, int rank,
+                             const CGOptions* opts);
+
+/**
+ * @brief Set up a persistent solver on the caller's matrix and plan (collective)
+ *
+ * Like cg_solver(), uses the arrays in place instead of copying them, so
+ * they and the plan must stay valid and unchanged until the context is
+ * destroyed. cg_context_update_values() writes the new values into vals.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices, renumbered by halo_setup()
+ * @param vals Non-zero values (upper triangle only with opts->symmetric)
+ * @param local_n Number of rows assigned to this process
+ * @param dist Row distribution of the matrix and vectors
+ * @param halo Ghost exchange plan of the matrix
+ * @param rank MPI rank of the calling process
+ * @param opts Solver parameters, copied into the context
+ * @return New context, released with cg_context_destroy()
+ */
+CGContext* cg_context_create_halo(int* ptr, int* cols, double* vals, int local_n,
+                                  const RowDist* dist, HaloPlan* halo, int rank,
+                                  const CGOptions* opts);
 
+/**
+ * @brief Set up a persistent solver for an operator given by callbacks (collective)
+ *
+ * Same restrictions as cg_solver_op(). The description is copied, but
+ * A->data must stay valid until the context is destroyed.
+ *
+ * @param A Linear operator
+ * @param dist Row distribution of the vectors
+ * @param rank MPI rank of the calling process
+ * @param opts Solver parameters, copied into the context
+ * @return New context, released with cg_context_destroy()
+ */
+CGContext* cg_context_create_op(const CGLinearOp* A, const RowDist* dist, int rank,
+                                const CGOptions* opts);
+
+/**
+ * @brief Replace the matrix values, keeping the sparsity pattern (collective)
+ *
+ * Refreshes the value copies of the SELL, compact and symmetric storage
+ * and recomputes the preconditioner; the exchange plan, row splits and
+ * work vectors are kept. For a context on a CGLinearOp, vals is ignored
+ * and only the preconditioner is recomputed from the operator's diagonal,
+ * after the caller changed the operator.
+ *
+ * @param ctx Solver context
+ * @param vals New values, in the entry order given to cg_context_create()
+ */
+void cg_context_update_values(CGContext* ctx, const double* vals);
+
+/**
+ * @brief Solve A x = b with the cached setup (collective)
+ *
+ * Same algorithm and options as cg_solver().
+ *
+ * @param ctx Solver context
+ * @param b Right-hand side vector (local portion)
+ * @param x Solution vector (local portion, initial guess on input)
+ * @return Number of iterations performed
+ */
+int cg_context_solve(CGContext* ctx, const double* b, double* x);
+
+/**
+ * @brief Free a solver context and everything it caches
+ *
+ * @param ctx Solver context, or NULL
+ */
+void cg_context_destroy(CGContext* ctx);
+
+#endif // CG_SOLVER_H
@@ -0,0 +1,174 @@
+/**
+ * @file checkpoint.h
+ * @brief Checkpoint/restart of the CG iteration state
+ *
+ * A checkpoint holds everything classical CG needs to continue exactly
+ * where it stopped: the solution x, residual r and search direction d,
+ * and the scalars r^T z, r^T r, the stopping reference and the
+ * iteration count. The file starts with a CHECKPOINT_HEADER_BYTES header
+ * (magic, global_n and the number of vectors as int64, the iteration as
+ * int64, the three scalars and a spare as doubles, then the CG method,
+ * preconditioner and row ordering of CheckpointConfig as int64),
+ * followed by one row of x, r, d per matrix row in the solver's row
+ * order. A restart checks all of them, since x, r and d are only valid
+ * for the rows and recurrence they were written with.
+ *
+ * Checkpoints are written in the background: the state is copied to a
+ * staging buffer and written with nonblocking collective MPI-IO
+ * (MPI_File_iwrite_at_all) while CG keeps iterating. The decisions to
+ * start and to complete a write ride on the reduction CG performs anyway
+ * (checkpoint_flags()), so no process waits for another to decide. A
+ * write goes to "<file>.tmp", which rank 0 renames to the file once it
+ * is complete, so a job killed mid-write keeps its previous checkpoint.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <mpi.h>
+
+#define CHECKPOINT_MAGIC "CGCKPv2"      // 8 bytes including the terminating NUL
+#define CHECKPOINT_HEADER_BYTES 128
+#define CHECKPOINT_N_VECTORS 3          // x, r, d
+#define CHECKPOINT_DEFAULT_EVERY 100    // Iterations between checkpoints when no period is given
+
+/**
+ * @brief Scalar state of classical CG after an iteration
+ */
+typedef struct {
+    int iteration;      // Iterations completed
+    double delta;       // r^T z (r^T r without preconditioner)
+    double rr;          // r^T r
+    double rr0;         // Reference of the stopping criterion (b^T b)
+} CheckpointState;
+
+/**
+ * @brief Solver setup a checkpoint belongs to, recorded in its header
+ */
+typedef struct {
+    int method;         // CGMethod of the recurrence
+    int pc;             // PCType of the preconditioner
+    long long order;    // Row ordering fingerprint (0: file order, see reorder_fingerprint())
+} CheckpointConfig;
+
+/**
+ * @brief Periodic checkpoint writer
+ */
+typedef struct {
+    const char* file;       // Checkpoint file, or NULL when checkpointing is off
+    char* tmp_file;         // "<file>.tmp", renamed to file when a write completes
+    int every;              // Iterations between checkpoints (0: none)
+    double interval;        // Seconds between checkpoints (0: none)
+    int local_n;
+    int row_start;          // Solver row of the first local row
+    int global_n;
+    CheckpointConfig config;
+    int rank;
+    int p;
+    MPI_Datatype row_type;  // One row of x, r, d
+    double* stage;          // Copy of the local rows being written
+    char header[CHECKPOINT_HEADER_BYTES];
+    MPI_File fh;
+    MPI_Request req[2];
+    int n_req;
+    int active;             // A write is in flight
+    int active_iter;        // Iteration of the write in flight
+    double t_last;          // Start time of the last write
+} Checkpoint;
+
+/**
+ * @brief Set up a checkpoint writer
+ *
+ * With every and interval both 0, checkpoints are written every
+ * CHECKPOINT_DEFAULT_EVERY iterations. A NULL file disables checkpointing;
+ * the other functions then do nothing, and the writer only records the
+ * row layout used by checkpoint_read().
+ *
+ * @param ck Writer to initialize
+ * @param file Checkpoint file, or NULL
+ * @param every Iterations between checkpoints (0: not by iteration count)
+ * @param interval Seconds between checkpoints (0: not by time)
+ * @param local_n Number of local rows
+ * @param row_start Solver row of the first local row
+ * @param global_n Total number of rows
+ * @param config Solver setup recorded in the header and checked on restart
+ * @param rank MPI rank of the calling process
+ */
+void checkpoint_init(Checkpoint* ck, const char* file, int every, double interval,
+                     int local_n, int row_start, int global_n,
+                     const CheckpointConfig* config, int rank);
+
+/**
+ * @brief Local values to add to the solver's next global sum
+ *
+ * Appends two values: whether this process' timer asks for a checkpoint,
+ * and whether its part of the write in flight has completed (testing it
+ * also lets MPI progress the write). Their sums are passed to
+ * checkpoint_step().
+ *
+ * @param ck Checkpoint writer
+ * @param flags Output: values to reduce (size: 2)
+ * @return Number of values appended: 2, or 0 when checkpointing is off
+ */
+int checkpoint_flags(Checkpoint* ck, double* flags);
+
+/**
+ * @brief Complete and start checkpoints after an iteration (collective)
+ *
+ * Closes the write in flight once every process has finished it, and
+ * starts a new one when the iteration count or the timer of any process
+ * asks for it (completing a previous write first if needed).
+ *
+ * @param ck Checkpoint writer
+ * @param flags_sum Global sums of the values from checkpoint_flags()
+ * @param state Scalar state after the iteration
+ * @param x Solution vector (size: local_n)
+ * @param r Residual vector (size: local_n)
+ * @param d Search direction (size: local_n)
+ */
+void checkpoint_step(Checkpoint* ck, const double* flags_sum, const CheckpointState* state,
+                     const double* x, const double* r, const double* d);
+
+/**
+ * @brief Complete the write in flight and optionally write a final checkpoint (collective)
+ *
+ * @param ck Checkpoint writer
+ * @param state Final state to write, or NULL to only complete pending writes
+ * @param x Solution vector (size: local_n)
+ * @param r Residual vector (size: local_n)
+ * @param d Search direction (size: local_n)
+ */
+void checkpoint_finish(Checkpoint* ck, const CheckpointState* state,
+                       const double* x, const double* r, const double* d);
+
+/**
+ * @brief Free a checkpoint writer; pending writes must be finished
+ *
+ * @param ck Checkpoint writer
+ */
+void checkpoint_free(Checkpoint* ck);
+
+/**
+ * @brief Read the local rows of a checkpoint (collective)
+ *
+ * The file must have been written for the same matrix with the same row
+ * ordering, CG method and preconditioner; the number of processes may
+ * differ as long as the ordering does not.
+ *
+ * @param filename Checkpoint file
+ * @param local_n Number of local rows
+ * @param row_start Solver row of the first local row
+ * @param global_n Total number of rows
+ * @param config Solver setup the file must have been written with
+ * @param x Output: solution vector (size: local_n)
+ * @param r Output: residual vector (size: local_n)
+ * @param d Output: search direction (size: local_n)
+ * @param state Output: scalar state
+ * @param rank MPI rank of the calling process
+ * @return 0 on success, -1 if the file cannot be read or does not match
+ */
+int checkpoint_read(const char* filename, int local_n, int row_start, int global_n,
+                    const CheckpointConfig* config, double* x, double* r, double* d,
+                    CheckpointState* state, int rank);
+
+#endif // CHECKPOINT_H
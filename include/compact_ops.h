@@ -0,0 +1,96 @@
+/**
+ * @file compact_ops.h
+ * @brief Reduced-precision compressed CSR storage
+ *
+ * Stores values as float or bf16 and column indices as 16-bit deltas
+ * from the smallest column of each row, cutting the bytes per nonzero
+ * from 12 to 6 (float) or 4 (bf16). Deltas that do not fit are stored
+ * as an escape code followed by a full index in a separate array.
+ * Products are accumulated in double.
+ */
+
+#ifndef COMPACT_OPS_H
+#define COMPACT_OPS_H
+
+#include <stdint.h>
+
+// Delta value marking an entry whose column is in the escape array
+#define COMPACT_ESCAPE 0xFFFF
+
+/**
+ * @brief Value precision of the compact format
+ */
+typedef enum {
+    COMPACT_FLOAT,      // IEEE single precision
+    COMPACT_BF16        // bfloat16: float with the low 16 mantissa bits dropped
+} CompactValueType;
+
+/**
+ * @brief Subset of the local rows in compact format
+ */
+typedef struct {
+    CompactValueType value_type;
+    int n_rows;             // Number of stored rows
+    int* rows;              // Local row index of each stored row
+    int* ptr;               // Start of each stored row in delta/vals (size: n_rows + 1)
+    int* base;              // Smallest column of each stored row
+    int* esc_ptr;           // Start of each stored row in escapes (size: n_rows + 1)
+    uint16_t* delta;        // Column - base, or COMPACT_ESCAPE
+    int* escapes;           // Full column indices of escaped entries
+    float* vals_f;          // Values (COMPACT_FLOAT)
+    uint16_t* vals_h;       // Values (COMPACT_BF16)
+    long long nnz;          // Stored nonzeros
+    long long n_escape;     // Entries using the escape array
+} CompactMatrix;
+
+/**
+ * @brief Parse a value type name ("float" or "bf16")
+ *
+ * @param name Value type name
+ * @param type Output: parsed type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int compact_value_type_from_string(const char* name, CompactValueType* type);
+
+/**
+ * @brief Convert CSR rows to compact storage
+ *
+ * @param A Output: compact matrix
+ * @param ptr Row pointer array
+ * @param cols Column indices (local numbering, see halo_setup())
+ * @param vals Non-zero values
+ * @param rows Row indices to store, or NULL for rows [0, n_rows)
+ * @param n_rows Number of rows to store
+ * @param value_type Value precision
+ */
+void compact_from_csr(CompactMatrix* A, const int* ptr, const int* cols, const double* vals,
+                      const int* rows, int n_rows, CompactValueType value_type);
+
+/**
+ * @brief Sparse matrix-vector multiplication in compact format
+ *
+ * Computes y[i] = (A x_ext)[i] for each stored row i, accumulating in
+ * double; other entries of y are not touched.
+ *
+ * @param A Compact matrix
+ * @param x_ext Owned entries followed by ghost entries
+ * @param y Local output vector
+ */
+void mat_vec_compact(const CompactMatrix* A, const double* x_ext, double* y);
+
+/**
+ * @brief Bytes held by the compact matrix (all arrays)
+ *
+ * @param A Compact matrix
+ * @return Storage size in bytes
+ */
+double compact_bytes(const CompactMatrix* A);
+
+/**
+ * @brief Release the memory held by a compact matrix
+ *
+ * @param A Compact matrix
+ */
+void compact_free(CompactMatrix* A);
+
+#endif // COMPACT_OPS_H
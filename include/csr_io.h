@@ -4,16 +4,82 @@
  * 
  * Functions for parallel reading and writing of sparse matrices
  * in CSR format using MPI-IO.
+ *
+ * Versioned files start with a CsrHeader, followed by the partition
+ * table (n_parts + 1 int64 row offsets, if n_parts > 0), then ptr, cols
+ * and vals. Each of these sections starts at a multiple of 8 bytes.
+ * Older files are still read: they start with int32 [n][nnz] (or
+ * [-1][n][nnz] for the symmetric variant), followed by int32 ptr and
+ * cols and double vals.
  */
 
 #ifndef CSR_IO_H
 #define CSR_IO_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <mpi.h>
+#include "partition.h"
+
+/**
+ * @brief Leading integer of an unversioned symmetric CSR file
+ *
+ * Such a file starts with this value, followed by the int32
+ * [n][nnz][ptr][cols][vals] layout holding only the entries with
+ * column >= row. An unversioned plain file starts with n > 0.
+ */
+#define CSR_SYMMETRIC_MAGIC (-1)
+
+#define CSR_VERSIONED_MAGIC (-2)   // Leading integer of a versioned file
+#define CSR_FORMAT_VERSION 2
+
+#define CSR_VALUE_DOUBLE 0         // CsrHeader.value_type
+#define CSR_VALUE_FLOAT 1
+
+#define CSR_FLAG_SYMMETRIC 1       // Only the upper triangle is stored
+
+/**
+ * @brief Header of a versioned CSR file (40 bytes, native byte order)
+ */
+typedef struct {
+    int32_t magic;         // CSR_VERSIONED_MAGIC
+    int32_t version;       // CSR_FORMAT_VERSION
+    int64_t n;             // Number of rows and columns
+    int64_t nnz;           // Number of stored nonzeros
+    int32_t index_width;   // Bytes per ptr and cols entry: 4 or 8
+    int32_t value_type;    // CSR_VALUE_DOUBLE or CSR_VALUE_FLOAT
+    int32_t flags;         // CSR_FLAG_* bits
+    int32_t n_parts;       // Entries of the partition table, 0 for none
+} CsrHeader;
+
+/**
+ * @brief Memory-mapped cols and vals of a matrix read with -mmap
+ *
+ * The mappings are private, so in-place changes (e.g. the column
+ * renumbering of halo_setup()) copy only the touched pages. A NULL
+ * address means the array was read into a heap buffer instead.
+ */
+typedef struct {
+    void* cols_addr;
+    size_t cols_len;
+    void* vals_addr;
+    size_t vals_len;
+} CsrMapping;
 
 /**
  * @brief Read a sparse matrix in CSR format using parallel MPI-IO
  * 
+ * Reads both the plain and the symmetric (upper triangle) file variant.
+ * No process reads more of the file than its own rows: the row split is
+ * computed from equal slices of the row pointer, or taken from the
+ * file's partition table with PART_FILE (if it was written for p
+ * processes; otherwise the split falls back to PART_NNZ).
+ * 
+ * With map non-NULL, cols and vals are mapped from the file with mmap()
+ * rather than copied into heap buffers, when the file stores int32
+ * indices and double values at aligned offsets; otherwise they are read
+ * as usual. Release them with csr_release() in either case.
+ * 
  * @param filename Path to the CSR matrix file
  * @param ptr Output: row pointer array (size: local_n + 1)
  * @param cols Output: column indices array (size: local_nnz)
@@ -23,10 +89,49 @@
  * @param global_n Output: total number of rows in the matrix
  * @param rank MPI rank of the calling process
  * @param p Total number of MPI processes
+ * @param part How rows are split among processes
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED, in [0, 1]
+ * @param dist Output: row distribution shared by all processes
+ * @param symmetric Output: 1 if the file stores only the upper triangle
+ * @param map Output: mapping of cols and vals, or NULL to read them into
+ *            heap buffers
  */
 void read_csr_parallel(const char* filename, int** ptr, int** cols, double** vals,
                        int* local_n, int* local_nnz, int* global_n, 
-                       int rank, int p);
+                       int rank, int p, PartitionType part, double nnz_weight,
+                       RowDist* dist, int* symmetric, CsrMapping* map);
+
+/**
+ * @brief Release cols and vals returned by read_csr_parallel()
+ * 
+ * Unmaps mapped arrays and frees heap buffers.
+ * 
+ * @param map Mapping filled by read_csr_parallel(), or NULL for heap buffers
+ * @param cols Column indices
+ * @param vals Non-zero values
+ */
+void csr_release(CsrMapping* map, int* cols, double* vals);
+
+/**
+ * @brief Write a distributed CSR matrix using parallel MPI-IO
+ * 
+ * Each process writes its rows at their global offset, in the versioned
+ * format with the distribution as partition table. Indices are stored as
+ * int64 if the total number of nonzeros does not fit in int32. cols must
+ * hold global column indices (before halo_setup()).
+ * 
+ * @param filename Path to the output file
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Global column indices
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ * @param dist Row distribution of the matrix
+ * @param symmetric Write the symmetric variant (arrays hold the upper triangle)
+ * @param rank MPI rank of the calling process
+ */
+void write_csr_parallel(const char* filename, const int* ptr, const int* cols,
+                        const double* vals, int local_n, const RowDist* dist,
+                        int symmetric, int rank);
 
 #endif // CSR_IO_H
 
@@ -0,0 +1,129 @@
+/**
+ * @file deflation.h
+ * @brief Recycled deflation space for sequences of CG solves
+ *
+ * Deflated CG (Saad, Yeung, Erhel and Guyomarc'h) keeps its search
+ * directions A-orthogonal to a subspace W of approximate eigenvectors for
+ * the smallest eigenvalues of A, which removes those eigenvalues from the
+ * spectrum CG sees. The initial guess is corrected so that the residual
+ * is orthogonal to W, and each new direction loses its component W mu,
+ * with (W^T A W) mu = (AW)^T z.
+ *
+ * W is harvested from the solves themselves. A candidate space U starts
+ * as W, and the directions p_j of a solve are kept with their products
+ * A p_j. Whenever l of them have been kept, a Rayleigh-Ritz step on
+ * span{U, p_j, ..., p_{j+l-1}} compresses them into the k Ritz vectors
+ * with the smallest Ritz values, which become the new U. At the end of
+ * the solve U replaces W. The products A U come from the same
+ * combinations, so recycling costs no SpMV, and each solve refines the
+ * space the next one starts from.
+ *
+ * Blocks are stored row-major, as in block_cg.h.
+ */
+
+#ifndef DEFLATION_H
+#define DEFLATION_H
+
+#define DEFLATION_MAX 32    // Largest number of recycled vectors and of directions per Rayleigh-Ritz step
+
+/**
+ * @brief Deflation space kept between the solves of a CGContext
+ */
+typedef struct {
+    int local_n;
+    int k_max;            // Vectors recycled
+    int window;           // Directions harvested per solve
+    int k;                // Vectors in W (0 until the first solve ends)
+    double* W;            // Local rows of W (size: local_n * k_max)
+    double* AW;           // Local rows of A W
+    double E[DEFLATION_MAX * DEFLATION_MAX];  // Cholesky factor of W^T A W (k x k)
+    int u_k;              // Vectors in U
+    double* U;            // Candidate space of the current solve (size: local_n * k_max)
+    double* AU;
+    double* T;            // Rayleigh-Ritz output, swapped with U and AU
+    double* AT;
+    int n_p;              // Directions kept since the last Rayleigh-Ritz step
+    double* P;            // Local rows of the directions (size: local_n * window)
+    double* AP;
+    double ritz_min;      // Smallest and largest Ritz value kept in U
+    double ritz_max;
+    int first_iters;      // Iterations of the first solve (-1 before it)
+} Deflation;
+
+/**
+ * @brief Allocate an empty deflation space
+ *
+ * @param d Output: initialized space
+ * @param local_n Number of local rows
+ * @param k Vectors recycled, 1 .. DEFLATION_MAX
+ * @param window Directions per Rayleigh-Ritz step, 1 .. DEFLATION_MAX
+ */
+void deflation_init(Deflation* d, int local_n, int k, int window);
+
+/**
+ * @brief Deflate the initial guess: x += W mu, r -= A W mu with W^T r = 0 after (collective)
+ *
+ * Also factors W^T A W for deflation_direction(). AW must match the
+ * current matrix. If W^T A W is not positive definite the space is
+ * dropped (k = 0) and x and r are left unchanged.
+ *
+ * @param d Deflation space with k > 0
+ * @param x Initial guess (local rows)
+ * @param r Its residual b - A x (local rows)
+ */
+void deflation_start(Deflation* d, double* x, double* r);
+
+/**
+ * @brief Local part of (AW)^T z, to be summed over processes
+ *
+ * @param d Deflation space
+ * @param z Vector (local rows)
+ * @param c Output: k local inner products
+ */
+void deflation_coef_local(const Deflation* d, const double* z, double* c);
+
+/**
+ * @brief Remove the W component of a direction: p -= W (W^T A W)^{-1} c
+ *
+ * @param d Deflation space
+ * @param p Direction (local rows)
+ * @param c Global (AW)^T z from deflation_coef_local()
+ */
+void deflation_direction(const Deflation* d, double* p, const double* c);
+
+/**
+ * @brief Start harvesting a solve from the current W
+ *
+ * @param d Deflation space
+ */
+void deflation_begin(Deflation* d);
+
+/**
+ * @brief Keep a search direction and its product (collective)
+ *
+ * Compresses the kept directions into U first if window of them are held.
+ *
+ * @param d Deflation space
+ * @param p Direction (local rows)
+ * @param Ap A p (local rows)
+ */
+void deflation_record(Deflation* d, const double* p, const double* Ap);
+
+/**
+ * @brief Compress the remaining directions into U and make it the next W (collective)
+ *
+ * A Rayleigh-Ritz step whose projected problem is singular keeps the
+ * previous U.
+ *
+ * @param d Deflation space
+ */
+void deflation_update(Deflation* d);
+
+/**
+ * @brief Release all memory held by a deflation space
+ *
+ * @param d Deflation space
+ */
+void deflation_free(Deflation* d);
+
+#endif // DEFLATION_H
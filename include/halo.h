@@ -0,0 +1,170 @@
+/**
+ * @file halo.h
+ * @brief Neighbor-only ghost exchange for distributed CSR matrices
+ *
+ * Builds a send/receive plan from the column indices of each process's
+ * local rows, so that SpMV only communicates the off-process vector
+ * entries it actually references instead of the full global vector.
+ */
+
+#ifndef HALO_H
+#define HALO_H
+
+#include <mpi.h>
+#include "partition.h"
+
+/**
+ * @brief Communication plan for filling ghost entries of a distributed vector
+ *
+ * Vectors used with a plan are laid out as the local_n owned entries
+ * followed by n_ghost ghost entries. Ghosts are ordered by global index,
+ * so the entries received from each neighbor are contiguous.
+ */
+typedef struct {
+    MPI_Comm comm;
+    int local_n;          // Number of owned entries
+    int n_ghost;          // Number of ghost entries after the owned block
+    int* ghost_cols;      // Global index of each ghost entry (size: n_ghost)
+
+    int n_recv;           // Number of neighbors we receive ghosts from
+    int* recv_ranks;      // Neighbor ranks (size: n_recv)
+    int* recv_counts;     // Ghost entries received from each neighbor
+    int* recv_displs;     // Offset of each neighbor's entries in the ghost block
+
+    int n_send;           // Number of neighbors we send owned entries to
+    int* send_ranks;      // Neighbor ranks (size: n_send)
+    int* send_counts;     // Entries sent to each neighbor
+    int* send_displs;     // Offset of each neighbor's entries in send_idx
+    int* send_idx;        // Local indices of owned entries to pack
+    double* send_buf;     // Packing buffer (size: total entries sent)
+
+    MPI_Request* reqs;    // Outstanding requests (size: n_recv + n_send)
+
+    double* acc_buf;      // Receive buffer of the reverse exchange (size: total entries sent)
+    MPI_Request* acc_reqs;  // Outstanding reverse-exchange requests
+
+    double* block_buf;    // Packing buffer of block exchanges, grown on demand
+    int block_buf_k;      // Number of vectors block_buf has room for
+} HaloPlan;
+
+/**
+ * @brief Build a ghost exchange plan and renumber the local matrix
+ *
+ * Scans the global column indices of the local rows, collects the
+ * off-process columns as ghosts and agrees with their owners on what
+ * to send. On return, cols is renumbered in place: owned columns map to
+ * [0, local_n) and ghost columns to [local_n, local_n + n_ghost).
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Column indices (global on input, local on output)
+ * @param dist Row distribution of the matrix
+ * @param rank MPI rank of the calling process
+ * @param plan Output: initialized communication plan
+ */
+void halo_setup(int* ptr, int* cols, const RowDist* dist, int rank, HaloPlan* plan);
+
+/**
+ * @brief Build a ghost exchange plan for a rectangular block of rows
+ *
+ * Same as halo_setup() for n_rows rows whose columns index vectors
+ * distributed by dist rather than by the rows themselves, such as
+ * the prolongator between two multigrid levels. The plan's local_n is
+ * the number of owned vector entries, dist->counts[rank].
+ *
+ * @param ptr Row pointer array (size: n_rows + 1)
+ * @param n_rows Number of local rows
+ * @param cols Column indices (global in dist on input, local on output)
+ * @param dist Distribution of the vectors the columns index
+ * @param rank MPI rank of the calling process
+ * @param plan Output: initialized communication plan
+ */
+void halo_setup_rect(int* ptr, int n_rows, int* cols, const RowDist* dist, int rank,
+                     HaloPlan* plan);
+
+/**
+ * @brief Start filling the ghost entries of x
+ *
+ * Posts the receives into the ghost block of x and sends the owned
+ * entries neighbors need. x must not be modified until halo_exchange_end().
+ *
+ * @param plan Communication plan
+ * @param x Vector with owned and ghost entries (size: local_n + n_ghost)
+ */
+void halo_exchange_begin(HaloPlan* plan, double* x);
+
+/**
+ * @brief Wait for a ghost exchange started by halo_exchange_begin()
+ *
+ * @param plan Communication plan
+ */
+void halo_exchange_end(HaloPlan* plan);
+
+/**
+ * @brief Fill the ghost entries of x (blocking)
+ *
+ * @param plan Communication plan
+ * @param x Vector with owned and ghost entries (size: local_n + n_ghost)
+ */
+void halo_exchange(HaloPlan* plan, double* x);
+
+/**
+ * @brief Start filling the ghost rows of a block of k vectors
+ *
+ * Same as halo_exchange_begin() for a row-major block (entry (i, c) at
+ * i * k + c): each ghost index carries k values in one message.
+ * Complete with halo_exchange_end().
+ *
+ * @param plan Communication plan
+ * @param X Block with owned and ghost rows (size: (local_n + n_ghost) * k)
+ * @param k Number of vectors in the block
+ */
+void halo_exchange_block_begin(HaloPlan* plan, double* X, int k);
+
+/**
+ * @brief Start sending ghost contributions back to their owners
+ *
+ * Reverse of the ghost exchange, used when a process computes partial
+ * results for rows it does not own (symmetric storage). Each ghost entry
+ * is sent to the rank owning it. Uses its own buffers and requests, so
+ * it can overlap a forward exchange.
+ *
+ * @param plan Communication plan
+ * @param ghost_vals Contributions to the ghost entries (size: n_ghost);
+ *                   must not be modified until halo_accumulate_end()
+ */
+void halo_accumulate_begin(HaloPlan* plan, const double* ghost_vals);
+
+/**
+ * @brief Finish a reverse exchange and add the received contributions
+ *
+ * @param plan Communication plan
+ * @param y Owned entries to add the contributions to (size: local_n)
+ */
+void halo_accumulate_end(HaloPlan* plan, double* y);
+
+/**
+ * @brief Fetch the rows of a distributed matrix for each ghost entry (blocking)
+ *
+ * The matrix has the row distribution of the plan's vectors; ghost k
+ * receives the row of global index ghost_cols[k] from its owner. Column
+ * indices are sent as they are, so they should be global.
+ *
+ * @param plan Communication plan
+ * @param ptr Row pointer array of the local rows (size: local_n + 1)
+ * @param cols Column indices of the local rows
+ * @param vals Values of the local rows
+ * @param ghost_ptr Output: row pointer array of the ghost rows (size: n_ghost + 1)
+ * @param ghost_cols Output: column indices of the ghost rows
+ * @param ghost_vals Output: values of the ghost rows
+ */
+void halo_exchange_rows(HaloPlan* plan, const int* ptr, const int* cols, const double* vals,
+                        int** ghost_ptr, int** ghost_cols, double** ghost_vals);
+
+/**
+ * @brief Release all memory held by a plan
+ *
+ * @param plan Communication plan
+ */
+void halo_free(HaloPlan* plan);
+
+#endif // HALO_H
@@ -0,0 +1,93 @@
+/**
+ * @file matgen.h
+ * @brief Synthetic SPD test matrices generated in distributed form
+ *
+ * Builds the local CSR rows of model problems directly on each process,
+ * without a matrix file: Poisson stencils on regular 2D/3D grids, banded
+ * matrices and random sparse matrices. Every row is computed from its
+ * global index alone, so any row distribution can be generated in
+ * parallel and the result does not depend on the number of processes.
+ */
+
+#ifndef MATGEN_H
+#define MATGEN_H
+
+#include "partition.h"
+
+/**
+ * @brief Available generated matrices
+ */
+typedef enum {
+    MATGEN_POISSON2D,    // 5-point Laplacian on an nx x ny grid
+    MATGEN_POISSON3D,    // 7-point Laplacian on an nx x ny x nz grid
+    MATGEN_POISSON3D27,  // 27-point stencil on an nx x ny x nz grid
+    MATGEN_BANDED,       // All entries within width of the diagonal, nx rows
+    MATGEN_RANDOM        // width random off-diagonals per row, nx rows
+} MatGenType;
+
+/**
+ * @brief Parameters of a generated matrix
+ *
+ * Rows of grid problems are numbered x fastest, then y, then z. All
+ * matrices are symmetric and strictly or irreducibly diagonally dominant
+ * with a positive diagonal, hence SPD.
+ */
+typedef struct {
+    MatGenType type;
+    int nx, ny, nz;         // Grid points per dimension (nx: rows of banded/random)
+    int width;              // Half bandwidth (banded) or off-diagonals per row (random)
+    unsigned long long seed;  // Pattern and values of the random matrix
+} MatGenParams;
+
+/**
+ * @brief Parse a matrix name ("poisson2d", "poisson3d", "poisson3d27",
+ *        "banded" or "random")
+ *
+ * @param name Matrix name
+ * @param type Output: parsed type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int matgen_type_from_string(const char* name, MatGenType* type);
+
+/**
+ * @brief Return the name of a generated matrix type
+ *
+ * @param type Matrix type
+ * @return Static string with the name
+ */
+const char* matgen_type_name(MatGenType type);
+
+/**
+ * @brief Number of rows of a generated matrix
+ *
+ * @param params Matrix parameters
+ * @return Global number of rows (may exceed INT_MAX, which generation rejects)
+ */
+long long matgen_rows(const MatGenParams* params);
+
+/**
+ * @brief Generate the local rows of a matrix
+ *
+ * Same outputs as read_csr_parallel(): cols hold global indices, sorted
+ * within each row. The rows are split with the given partition type
+ * (PART_FILE splits by nonzeros). Collective.
+ *
+ * @param params Matrix parameters
+ * @param ptr Output: row pointer array (size: local_n + 1)
+ * @param cols Output: global column indices (size: local_nnz)
+ * @param vals Output: non-zero values (size: local_nnz)
+ * @param local_n Output: number of rows assigned to this process
+ * @param local_nnz Output: number of non-zeros assigned to this process
+ * @param global_n Output: total number of rows in the matrix
+ * @param rank MPI rank of the calling process
+ * @param p Total number of MPI processes
+ * @param part How rows are split among processes
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED, in [0, 1]
+ * @param dist Output: row distribution shared by all processes
+ */
+void matgen_generate(const MatGenParams* params, int** ptr, int** cols, double** vals,
+                     int* local_n, int* local_nnz, int* global_n,
+                     int rank, int p, PartitionType part, double nnz_weight,
+                     RowDist* dist);
+
+#endif // MATGEN_H
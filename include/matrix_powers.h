@@ -0,0 +1,95 @@
+/**
+ * @file matrix_powers.h
+ * @brief Matrix powers kernel: s products with A after one ghost exchange
+ *
+ * A halo_setup() plan brings in the entries one step away from the owned
+ * rows, enough for one SpMV. The matrix powers kernel extends it s steps
+ * deep: each process also fetches the rows of A of its ghosts up to
+ * distance s - 1 in the matrix graph. After a single exchange of the
+ * s-deep ghost region, it computes A x, A^2 x, ..., A^s x without further
+ * communication, recomputing the ghost rows it needs redundantly. The
+ * region shrinks by one layer per product: the k-th product is valid on
+ * the owned rows and the ghosts up to distance s - k.
+ *
+ * Vectors are stored as row-major blocks of m columns (entry (i, c) at
+ * i * m + c, as in block_cg.h) over the owned entries followed by
+ * n_ghost ghost entries, so a step reads and writes columns of one
+ * block and the exchange carries several columns per message
+ * (halo_exchange_block_begin()).
+ */
+
+#ifndef MATRIX_POWERS_H
+#define MATRIX_POWERS_H
+
+#include "halo.h"
+
+/**
+ * @brief Rows and exchange plan of an s-deep ghost region
+ */
+typedef struct {
+    int local_n;          // Owned rows
+    int depth;            // Products per exchange, s
+    int n_ghost;          // Ghost entries of all layers after the owned block
+    HaloPlan plan;        // Exchange of the s-deep ghost region
+
+    // Owned rows, columns renumbered to the s-deep region (values shared with the matrix)
+    int* ptr;
+    int* cols;
+    double* vals;
+
+    // Fetched ghost rows of layers 1 .. s - 1, layer by layer
+    int n_rows;           // Number of ghost rows
+    int* g_row;           // Index of each ghost row in the s-deep region (size: n_rows)
+    int* g_ptr;
+    int* g_cols;
+    double* g_vals;
+    int* layer_end;       // Ghost rows in layers 1 .. d (size: depth + 1, layer_end[0] = 0)
+} MatrixPowers;
+
+/**
+ * @brief Build the s-deep ghost region of a distributed matrix (collective)
+ *
+ * Fetches the ghost rows layer by layer from their owners, then builds
+ * one plan exchanging all ghost entries up to distance s.
+ *
+ * @param mp Output: initialized kernel
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices (see halo_setup())
+ * @param vals Non-zero values, both triangles; used in place for the owned rows
+ * @param local_n Number of local rows
+ * @param halo One-deep ghost plan of the matrix
+ * @param depth Products per exchange, s >= 1
+ */
+void matrix_powers_setup(MatrixPowers* mp, int* ptr, int* cols, double* vals, int local_n,
+                         HaloPlan* halo, int depth);
+
+/**
+ * @brief One product of the kernel on a block of basis vectors
+ *
+ * Computes W(:, dst) = scale * (A W(:, src) - shift W(:, src)) - prev_coef W(:, prev)
+ * on the owned rows and the ghost rows up to distance depth, which covers
+ * the Newton and Chebyshev recurrences of polynomial bases. W(:, src)
+ * must be valid up to distance depth + 1.
+ *
+ * @param mp Kernel
+ * @param W Block with owned and ghost rows (size: (local_n + n_ghost) * m)
+ * @param m Number of columns of W
+ * @param src Column multiplied by A
+ * @param dst Column written
+ * @param depth Ghost layers to compute, 0 .. s - 1
+ * @param shift Shift subtracted from A
+ * @param scale Factor of the shifted product
+ * @param prev Column subtracted from the result, or -1 for none
+ * @param prev_coef Factor of column prev
+ */
+void matrix_powers_step(const MatrixPowers* mp, double* W, int m, int src, int dst, int depth,
+                        double shift, double scale, int prev, double prev_coef);
+
+/**
+ * @brief Release all memory held by a kernel
+ *
+ * @param mp Kernel
+ */
+void matrix_powers_free(MatrixPowers* mp);
+
+#endif // MATRIX_POWERS_H
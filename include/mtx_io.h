@@ -0,0 +1,71 @@
+/**
+ * @file mtx_io.h
+ * @brief Parallel Matrix Market (.mtx) input
+ *
+ * Reads coordinate Matrix Market files (real, integer or pattern;
+ * general or symmetric) into the distributed CSR arrays used by the
+ * solver. Each process parses one byte range of the file; the entries
+ * are then sorted by (row, column) and moved to their owners with a
+ * distributed sample sort, and duplicates are summed.
+ */
+
+#ifndef MTX_IO_H
+#define MTX_IO_H
+
+#include "partition.h"
+
+/**
+ * @brief Counts and timings of a Matrix Market read
+ */
+typedef struct {
+    long long file_entries;    // Entries listed in the file
+    long long entries;         // Stored nonzeros (symmetric entries mirrored)
+    long long duplicates;      // Repeated (row, column) entries summed into one
+    double bytes;              // Size of the entry section of the file
+    double t_parse;            // Read and parse time of the slowest process
+    double t_sort;             // Sample sort and CSR assembly time of the slowest process
+} MtxStats;
+
+/**
+ * @brief Check whether a matrix file name selects Matrix Market input (".mtx")
+ *
+ * @param filename Path to matrix file
+ * @return 1 for Matrix Market, 0 for binary CSR
+ */
+int mtx_file_is_mtx(const char* filename);
+
+/**
+ * @brief Read a Matrix Market file into distributed CSR arrays
+ *
+ * Same outputs as read_csr_parallel() for a full (not upper-triangle)
+ * matrix: the lower triangle of symmetric files is filled in. cols hold
+ * global indices. PART_FILE has no table to use and splits by nonzeros.
+ *
+ * @param filename Path to the .mtx file
+ * @param ptr Output: row pointer array (size: local_n + 1)
+ * @param cols Output: global column indices (size: local_nnz)
+ * @param vals Output: non-zero values (size: local_nnz)
+ * @param local_n Output: number of rows assigned to this process
+ * @param local_nnz Output: number of non-zeros assigned to this process
+ * @param global_n Output: total number of rows in the matrix
+ * @param rank MPI rank of the calling process
+ * @param p Total number of MPI processes
+ * @param part How rows are split among processes
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED, in [0, 1]
+ * @param dist Output: row distribution shared by all processes
+ * @param stats Output: counts and timings (same on all processes), or NULL
+ */
+void read_mtx_parallel(const char* filename, int** ptr, int** cols, double** vals,
+                       int* local_n, int* local_nnz, int* global_n,
+                       int rank, int p, PartitionType part, double nnz_weight,
+                       RowDist* dist, MtxStats* stats);
+
+/**
+ * @brief Print the counts and throughput of a Matrix Market read on rank 0
+ *
+ * @param stats Statistics filled by read_mtx_parallel()
+ * @param rank MPI rank of the calling process
+ */
+void mtx_report(const MtxStats* stats, int rank);
+
+#endif // MTX_IO_H
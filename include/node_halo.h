@@ -0,0 +1,111 @@
+/**
+ * @file node_halo.h
+ * @brief Node-aware ghost exchange through MPI-3 shared-memory windows
+ *
+ * With one process per core, each process of a node receives its ghost
+ * entries in messages of its own, and an entry several of them need
+ * crosses the network once per process. A NodeHalo groups the processes
+ * that share memory (MPI_Comm_split_type() with MPI_COMM_TYPE_SHARED)
+ * and gives each a segment of a window from MPI_Win_allocate_shared():
+ *
+ * - every process copies the owned entries others need into its segment,
+ *   where the processes of its node read their ghosts directly;
+ * - entries owned on another node are received once per node, in one
+ *   message per pair of nodes, into the segment of the process handling
+ *   that remote node, and every process of the node reads them there.
+ *
+ * The messages of the node pairs are spread over the processes of both
+ * nodes. Segments are double-buffered, so an exchange needs two node
+ * barriers: one after the copy into the segments and one after the
+ * messages have arrived.
+ */
+
+#ifndef NODE_HALO_H
+#define NODE_HALO_H
+
+#include <mpi.h>
+#include "halo.h"
+
+/**
+ * @brief Node-level exchange plan equivalent to a HaloPlan
+ */
+typedef struct {
+    MPI_Comm node_comm;   // Processes of this node
+    int node_rank;
+    int node_size;
+    int node_id;          // Node number, 0 .. n_nodes - 1
+    int n_nodes;
+    int local_n;          // Owned entries of exchanged vectors
+    int n_ghost;          // Ghost entries filled after the owned block
+
+    MPI_Win win;          // Shared window; this process's segment holds
+    double* seg;          // exported[2] (n_export each), then imported[2] (n_import each)
+    int n_export;         // Owned entries other processes need
+    int* export_idx;      // Their local indices (size: n_export)
+    int n_import;         // Off-node entries received by this process for the node
+
+    int n_recv;           // Remote nodes this process receives from
+    int* recv_ranks;
+    int* recv_counts;
+    int* recv_displs;     // Offsets in the imported block
+    int n_send;           // Remote nodes this process sends to
+    int* send_ranks;
+    int* send_counts;
+    int* send_displs;
+    const double** send_src;   // Entries to send in the node's segments (size: 2 x sent)
+    double* send_buf;
+    MPI_Request* reqs;    // Outstanding requests (size: n_recv + n_send)
+
+    const double** ghost_src;  // Source of each ghost in the node's segments (size: 2 x n_ghost)
+    double* x;            // Vector of the exchange in progress
+    int parity;           // Segment copy used by the next exchange
+
+    int plan_msgs;        // Off-node messages of the per-process plan
+    int plan_entries;     // Off-node entries of the per-process plan
+} NodeHalo;
+
+/**
+ * @brief Build the node-level plan of a ghost exchange plan (collective)
+ *
+ * @param nh Output: initialized node-level plan
+ * @param plan Per-process plan, which keeps describing the same ghosts
+ * @param node_ranks Processes per node, 0 for all that share memory;
+ *                   smaller values emulate more nodes on one machine
+ */
+void node_halo_setup(NodeHalo* nh, const HaloPlan* plan, int node_ranks);
+
+/**
+ * @brief Start filling the ghost entries of x (collective over the node)
+ *
+ * Copies the exported entries into the segment, waits for the node and
+ * starts the messages between nodes. x must not be modified until
+ * node_halo_end().
+ *
+ * @param nh Node-level plan
+ * @param x Vector with owned and ghost entries (size: local_n + n_ghost)
+ */
+void node_halo_begin(NodeHalo* nh, double* x);
+
+/**
+ * @brief Complete an exchange started by node_halo_begin() (collective over the node)
+ *
+ * @param nh Node-level plan
+ */
+void node_halo_end(NodeHalo* nh);
+
+/**
+ * @brief Print the nodes and inter-node traffic of both plans on rank 0 (collective)
+ *
+ * @param nh Node-level plan
+ * @param rank MPI rank of the calling process
+ */
+void node_halo_report(const NodeHalo* nh, int rank);
+
+/**
+ * @brief Release the window, communicator and all memory held by a plan
+ *
+ * @param nh Node-level plan
+ */
+void node_halo_free(NodeHalo* nh);
+
+#endif // NODE_HALO_H
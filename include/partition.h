@@ -0,0 +1,119 @@
+/**
+ * @file partition.h
+ * @brief Row distribution of the matrix and vectors across processes
+ *
+ * A RowDist describes which contiguous block of rows each process owns.
+ * It is computed once when the matrix is read and shared by the halo
+ * setup, the solver and the gather/scatter of vectors in main.c.
+ */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+/**
+ * @brief How rows are split among processes
+ */
+typedef enum {
+    PART_ROWS,     // Equal number of rows per process
+    PART_NNZ,      // Equal number of nonzeros per process
+    PART_MIXED,    // Weighted mix of rows and nonzeros
+    PART_FILE      // Partition table stored in the matrix file (see csr_io.h)
+} PartitionType;
+
+/**
+ * @brief Contiguous block row distribution
+ *
+ * Process i owns rows [offsets[i], offsets[i+1]).
+ */
+typedef struct {
+    int p;            // Number of processes
+    int global_n;     // Total number of rows
+    int* offsets;     // First row of each process (size: p + 1)
+    int* counts;      // Rows owned by each process (size: p)
+} RowDist;
+
+/**
+ * @brief Parse a partition name ("rows", "nnz", "mixed" or "file")
+ *
+ * @param name Partition name
+ * @param type Output: parsed type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int partition_type_from_string(const char* name, PartitionType* type);
+
+/**
+ * @brief Return the name of a partition type
+ *
+ * @param type Partition type
+ * @return Static string with the name
+ */
+const char* partition_type_name(PartitionType type);
+
+/**
+ * @brief Split rows among processes using the global row pointer
+ *
+ * Each row costs (1 - w) * (average nonzeros per row) + w * (its nonzeros),
+ * where w is 0 for PART_ROWS, 1 for PART_NNZ (and PART_FILE, which has no
+ * table to use here) and nnz_weight for PART_MIXED. Processes get
+ * contiguous row blocks of roughly equal total cost. The computation is
+ * deterministic, so every process obtains the same result without
+ * communication.
+ *
+ * @param dist Output: row distribution
+ * @param full_ptr Global row pointer array (size: n + 1)
+ * @param n Total number of rows
+ * @param p Number of processes
+ * @param type Partition type
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED, in [0, 1]
+ */
+void rowdist_from_ptr(RowDist* dist, const int* full_ptr, int n, int p,
+                      PartitionType type, double nnz_weight);
+
+/**
+ * @brief Split rows among processes using a distributed row pointer
+ *
+ * Same split as rowdist_from_ptr(), but each process holds only the row
+ * pointer entries of rows [slice_start, slice_start + slice_n], e.g. an
+ * equal share read from the matrix file, so no process needs the whole
+ * array. Collective.
+ *
+ * @param dist Output: row distribution
+ * @param ptr_slice Row pointer entries slice_start .. slice_start + slice_n
+ * @param slice_start First row of the slice
+ * @param slice_n Number of rows in the slice (may be 0)
+ * @param n Total number of rows
+ * @param p Number of processes
+ * @param type Partition type
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED, in [0, 1]
+ */
+void rowdist_from_ptr_slice(RowDist* dist, const long long* ptr_slice, int slice_start,
+                            int slice_n, int n, int p, PartitionType type, double nnz_weight);
+
+/**
+ * @brief Build a row distribution from each process's row count
+ *
+ * Collective: gathers local_n from all processes in rank order.
+ *
+ * @param dist Output: row distribution
+ * @param local_n Number of rows owned by the calling process
+ * @param p Number of processes
+ */
+void rowdist_from_counts(RowDist* dist, int local_n, int p);
+
+/**
+ * @brief Rank owning a global row
+ *
+ * @param dist Row distribution
+ * @param row Global row index
+ * @return Owning rank
+ */
+int rowdist_owner(const RowDist* dist, int row);
+
+/**
+ * @brief Release the memory held by a row distribution
+ *
+ * @param dist Row distribution
+ */
+void rowdist_free(RowDist* dist);
+
+#endif // PARTITION_H
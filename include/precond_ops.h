@@ -0,0 +1,128 @@
+/**
+ * @file precond_ops.h
+ * @brief Preconditioners for the Conjugate Gradient solver
+ *
+ * Each preconditioner has a setup step, which builds its data from the
+ * local CSR block, and an apply step z = M^{-1} r used once per PCG
+ * iteration. All preconditioners but AMG act on the on-process diagonal
+ * block only, so applying them requires no communication. AMG (see
+ * amg.h) works on the whole distributed matrix: its setup and every
+ * application are collective.
+ */
+
+#ifndef PRECOND_OPS_H
+#define PRECOND_OPS_H
+
+#include "amg.h"
+
+/**
+ * @brief Available preconditioners
+ */
+typedef enum {
+    PC_NONE,       // Identity (plain CG)
+    PC_JACOBI,     // Point Jacobi: inverse of the diagonal
+    PC_BJACOBI,    // Block Jacobi: ILU(0) of the on-process diagonal block
+    PC_SSOR,       // Symmetric SOR sweep on the on-process diagonal block
+    PC_AMG         // Smoothed-aggregation algebraic multigrid V-cycle
+} PCType;
+
+/**
+ * @brief Preconditioner state built by precond_setup()
+ */
+typedef struct {
+    PCType type;
+    int local_n;
+    double omega;         // SSOR relaxation factor
+    double* inv_diag;     // Inverse diagonal (Jacobi, SSOR)
+
+    // On-process diagonal block with sorted columns (block Jacobi, SSOR)
+    int* ptr;
+    int* cols;
+    double* vals;         // ILU(0) factors for block Jacobi, A's values for SSOR
+    int* diag_pos;        // Position of the diagonal entry in each row
+
+    AmgHierarchy* amg;    // Multigrid hierarchy (AMG)
+    double* work;         // One column of a block in and out (AMG, size: 2 * local_n)
+} Preconditioner;
+
+/**
+ * @brief Parse a preconditioner name ("none", "jacobi", "bjacobi", "ssor" or "amg")
+ *
+ * @param name Preconditioner name
+ * @param type Output: parsed type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int pc_type_from_string(const char* name, PCType* type);
+
+/**
+ * @brief Return the name of a preconditioner type
+ *
+ * @param type Preconditioner type
+ * @return Static string with the name
+ */
+const char* pc_type_name(PCType type);
+
+/**
+ * @brief Build a preconditioner from the local CSR block
+ *
+ * Columns >= local_n (ghosts, see halo_setup()) are ignored.
+ *
+ * @param pc Output: initialized preconditioner
+ * @param type Preconditioner type
+ * @param omega Relaxation factor for SSOR (0 < omega < 2)
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ */
+void precond_setup(Preconditioner* pc, PCType type, double omega,
+                   int* ptr, int* cols, double* vals, int local_n);
+
+/**
+ * @brief Build an AMG preconditioner from the distributed matrix (collective)
+ *
+ * The hierarchy keeps using the matrix arrays and plan, which must
+ * outlive the preconditioner.
+ *
+ * @param pc Output: initialized preconditioner
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices (see halo_setup())
+ * @param vals Non-zero values, both triangles
+ * @param local_n Number of local rows
+ * @param halo Ghost exchange plan of the matrix
+ * @param opts Hierarchy parameters
+ * @param verbose Print the hierarchy on rank 0
+ */
+void precond_setup_amg(Preconditioner* pc, int* ptr, int* cols, double* vals, int local_n,
+                       HaloPlan* halo, const AmgOptions* opts, int verbose);
+
+/**
+ * @brief Apply the preconditioner: z = M^{-1} r
+ *
+ * @param pc Preconditioner
+ * @param r Input vector (size: local_n)
+ * @param z Output vector (size: local_n), must not alias r
+ */
+void precond_apply(const Preconditioner* pc, const double* r, double* z);
+
+/**
+ * @brief Apply the preconditioner to a block of k vectors: Z = M^{-1} R
+ *
+ * Blocks are row-major (entry (i, c) at i * k + c), so the triangular
+ * solves read the factors once for all k vectors.
+ *
+ * @param pc Preconditioner
+ * @param R Input block (size: local_n * k)
+ * @param Z Output block (size: local_n * k), must not alias R
+ * @param k Number of vectors in the block
+ */
+void precond_apply_block(const Preconditioner* pc, const double* R, double* Z, int k);
+
+/**
+ * @brief Release all memory held by a preconditioner
+ *
+ * @param pc Preconditioner
+ */
+void precond_free(Preconditioner* pc);
+
+#endif // PRECOND_OPS_H
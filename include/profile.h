@@ -0,0 +1,108 @@
+/**
+ * @file profile.h
+ * @brief Per-phase timers, MPI call profiling and timeline export
+ *
+ * The solver phases (SpMV, ghost exchange, dot products, reductions,
+ * vector updates, preconditioner) call prof_begin()/prof_end() around
+ * their work. MPI calls are timed through the PMPI profiling interface
+ * by a separate object, profile_pmpi.c, which defines MPI_Allreduce,
+ * MPI_Iallreduce, MPI_Isend, MPI_Irecv, MPI_Wait and MPI_Waitall; each
+ * records the call and forwards it to the PMPI_ version. Only
+ * bin/cg_solver and bin/cg_bench link it; libcgsolver.a leaves the MPI
+ * symbols of a host program alone, and its log then has no MPI rows. Until
+ * prof_init() enables logging, every hook is a single flag test.
+ *
+ * prof_finalize() prints, per event, the count and the min/avg/max time
+ * over processes with the slowest rank (-log_view), and can write a
+ * Chrome trace (chrome://tracing, Perfetto) of every event on every rank.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/**
+ * @brief Logged events
+ */
+typedef enum {
+    PROF_MAT_LOAD,       // Matrix read, reordering and conversion at load time
+    PROF_VEC_IO,         // Right-hand side and solution files
+    PROF_CHECKPOINT,     // Staging and completing checkpoint writes
+    PROF_HALO_SETUP,     // Ghost exchange plan
+    PROF_PC_SETUP,       // Preconditioner setup
+    PROF_SOLVE,          // Whole CG solve
+    PROF_SPMV,           // Distributed SpMV, including its ghost exchange
+    PROF_HALO_BEGIN,     // Posting a ghost exchange (packing, MPI_Isend/Irecv)
+    PROF_HALO_END,       // Waiting for a ghost exchange to complete
+    PROF_DOT,            // Local dot products
+    PROF_REDUCE,         // Global sums of dot products
+    PROF_UPDATE,         // Vector updates (axpy)
+    PROF_PC_APPLY,       // Preconditioner application
+    PROF_MPI_ALLREDUCE,  // MPI_Allreduce / MPI_Iallreduce calls
+    PROF_MPI_SYNC,       // Barrier before each allreduce with -log_sync (imbalance)
+    PROF_MPI_SEND,       // MPI_Isend / MPI_Irecv calls
+    PROF_MPI_WAIT,       // MPI_Wait / MPI_Waitall calls
+    PROF_N_EVENTS
+} ProfEvent;
+
+/**
+ * @brief Enable logging (collective)
+ *
+ * Also synchronizes the processes to give the timeline a common origin.
+ * With sync set, each MPI_Allreduce and MPI_Iallreduce is preceded by a
+ * barrier whose time is logged as PROF_MPI_SYNC, separating the wait for
+ * slower processes from the reduction itself.
+ *
+ * @param sync Time a barrier before each allreduce
+ * @param trace_file Chrome trace file written by prof_finalize(), or NULL
+ */
+void prof_init(int sync, const char* trace_file);
+
+/**
+ * @brief Start timing an event on this process
+ *
+ * Events of different types may nest; an event does not nest in itself.
+ *
+ * @param event Event type
+ */
+void prof_begin(ProfEvent event);
+
+/**
+ * @brief Stop timing an event started with prof_begin()
+ *
+ * @param event Event type
+ */
+void prof_end(ProfEvent event);
+
+/**
+ * @brief Print the log on rank 0, write the trace and stop logging (collective)
+ *
+ * Does nothing unless prof_init() was called.
+ *
+ * @param rank MPI rank of the calling process
+ * @param p Total number of MPI processes
+ */
+void prof_finalize(int rank, int p);
+
+/**
+ * @brief Whether logging is on; tested first by the PMPI hooks
+ *
+ * @return 1 between prof_init() and prof_finalize(), 0 otherwise
+ */
+int prof_mpi_logging(void);
+
+/**
+ * @brief Whether prof_init() asked for a barrier before each allreduce
+ *
+ * @return 1 with -log_sync, 0 otherwise
+ */
+int prof_mpi_sync(void);
+
+/**
+ * @brief Add sent or reduced bytes to an MPI event
+ *
+ * @param event MPI event type
+ * @param bytes Bytes of the call
+ */
+void prof_add_bytes(ProfEvent event, double bytes);
+
+#endif // PROFILE_H
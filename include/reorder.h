@@ -0,0 +1,106 @@
+/**
+ * @file reorder.h
+ * @brief Load-time matrix reordering and row redistribution
+ *
+ * Computes a bandwidth-reducing ordering of the matrix graph and moves
+ * rows so that each process owns a contiguous, well-connected block of
+ * the reordered matrix. This shrinks the set of off-process columns
+ * (less halo traffic) and improves the locality of the SpMV.
+ */
+
+#ifndef REORDER_H
+#define REORDER_H
+
+#include "partition.h"
+
+/**
+ * @brief Available reorderings
+ */
+typedef enum {
+    REORDER_NONE,   // Keep the file ordering
+    REORDER_RCM     // Reverse Cuthill-McKee ordering of the whole graph
+} ReorderType;
+
+/**
+ * @brief Parse a reordering name ("none" or "rcm")
+ *
+ * @param name Reordering name
+ * @param type Output: parsed type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int reorder_type_from_string(const char* name, ReorderType* type);
+
+/**
+ * @brief Reorder the matrix and redistribute its rows
+ *
+ * Must be called after read_csr_parallel() and before halo_setup(), while
+ * cols still holds global column indices. The graph structure is gathered
+ * on rank 0, which computes the ordering and relabels the columns; each
+ * process then receives only the new indices of its own rows and its
+ * relabeled columns, and rows are sent to their new owners with
+ * MPI_Alltoallv. The new row distribution is computed with the given
+ * partition type on the reordered matrix. On return the local arrays,
+ * local_n, local_nnz and dist describe the reordered matrix, and old_rows
+ * maps each new local row to its original global index, so vectors can be
+ * permuted on input and output.
+ *
+ * If the new ordering would not reduce a nonzero number of off-process
+ * nonzeros, a message is printed, the matrix is left unchanged and old_rows is set
+ * to NULL (the file ordering is kept).
+ *
+ * @param type Reordering to apply
+ * @param ptr Row pointer array (replaced)
+ * @param cols Global column indices (replaced)
+ * @param vals Non-zero values (replaced)
+ * @param local_n Number of local rows (updated)
+ * @param local_nnz Number of local non-zeros (updated)
+ * @param dist Row distribution (replaced)
+ * @param part Partition type for the new distribution
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED
+ * @param rank MPI rank of the calling process
+ * @param old_rows Output: allocated array of original global row indices
+ *                 (size: new local_n), or NULL if the ordering was kept
+ */
+void reorder_matrix(ReorderType type, int** ptr, int** cols, double** vals,
+                    int* local_n, int* local_nnz, RowDist* dist,
+                    PartitionType part, double nnz_weight, int rank, int** old_rows);
+
+/**
+ * @brief Move rows to a new partition, keeping their order
+ *
+ * Computes the split of the given partition type from the distributed
+ * row pointer (rowdist_from_ptr_slice()) and shifts rows between the
+ * processes whose old and new blocks overlap, usually neighbors. The row
+ * order and the global column indices do not change, so nothing is
+ * gathered and vectors keep their file ordering. Collective; cols must
+ * still hold global column indices.
+ *
+ * @param ptr Row pointer array (replaced)
+ * @param cols Global column indices (replaced)
+ * @param vals Non-zero values (replaced)
+ * @param local_n Number of local rows (updated)
+ * @param local_nnz Number of local non-zeros (updated)
+ * @param dist Row distribution (replaced)
+ * @param part Partition type for the new distribution
+ * @param nnz_weight Weight of the nonzero count for PART_MIXED
+ * @param rank MPI rank of the calling process
+ */
+void repartition_matrix(int** ptr, int** cols, double** vals, int* local_n, int* local_nnz,
+                        RowDist* dist, PartitionType part, double nnz_weight, int rank);
+
+/**
+ * @brief Fingerprint of a row ordering (collective)
+ *
+ * Sums a hash of every (new row, original row) pair that reorder_matrix()
+ * moved, so equal orderings give equal values on any number of processes
+ * and the file ordering gives 0. Checkpoints record it (see checkpoint.h).
+ *
+ * @param old_rows Original global index of each local row, as returned by
+ *                 reorder_matrix()
+ * @param local_n Number of local rows
+ * @param row_start Global index of the first local row in the new ordering
+ * @return Fingerprint, identical on all processes
+ */
+long long reorder_fingerprint(const int* old_rows, int local_n, int row_start);
+
+#endif // REORDER_H
@@ -0,0 +1,83 @@
+/**
+ * @file sell_ops.h
+ * @brief SELL-C-sigma (sliced ELLPACK) sparse matrix storage
+ *
+ * Rows are grouped into chunks of C rows stored column-major and padded
+ * to the longest row of the chunk, so one SIMD lane handles one row and
+ * the column indices of a chunk column can be gathered in one
+ * instruction. Within windows of sigma rows, rows are sorted by length
+ * before chunking to limit padding.
+ */
+
+#ifndef SELL_OPS_H
+#define SELL_OPS_H
+
+// Default chunk height C: one AVX-512 vector of doubles, two AVX2 vectors
+#define SELL_DEFAULT_CHUNK 8
+// Default sorting window sigma
+#define SELL_DEFAULT_SIGMA 256
+// Largest supported chunk height
+#define SELL_MAX_CHUNK 64
+
+/**
+ * @brief Matrix (or subset of its rows) in SELL-C-sigma format
+ *
+ * Entry k of slot s in chunk c is stored at chunk_ptr[c] + k * chunk + s.
+ * Padding entries have value 0 and a valid column index.
+ */
+typedef struct {
+    int chunk;          // Chunk height C
+    int sigma;          // Sorting window (rows)
+    int n_rows;         // Number of stored rows
+    int n_chunks;       // Number of chunks
+    int* rows;          // Local row index of each slot, -1 for padding (size: n_chunks * chunk)
+    int* chunk_ptr;     // Start of each chunk in cols/vals (size: n_chunks + 1)
+    int* cols;          // Column indices, column-major per chunk
+    double* vals;       // Values, column-major per chunk
+    long long nnz;      // Nonzeros, excluding padding
+} SellMatrix;
+
+/**
+ * @brief Convert CSR rows to SELL-C-sigma
+ *
+ * @param A Output: SELL matrix
+ * @param ptr Row pointer array
+ * @param cols Column indices (local numbering, see halo_setup())
+ * @param vals Non-zero values
+ * @param rows Row indices to store, or NULL for rows [0, n_rows)
+ * @param n_rows Number of rows to store
+ * @param chunk Chunk height C (1 .. SELL_MAX_CHUNK)
+ * @param sigma Sorting window in rows; values <= 1 keep the row order
+ */
+void sell_from_csr(SellMatrix* A, const int* ptr, const int* cols, const double* vals,
+                   const int* rows, int n_rows, int chunk, int sigma);
+
+/**
+ * @brief Sparse matrix-vector multiplication in SELL-C-sigma format
+ *
+ * Computes y[i] = (A x_ext)[i] for each stored row i; other entries of
+ * y are not touched. Uses AVX-512 or AVX2 gathers when the build enables
+ * them and the chunk height is a multiple of the vector width.
+ *
+ * @param A SELL matrix
+ * @param x_ext Owned entries followed by ghost entries
+ * @param y Local output vector
+ */
+void mat_vec_sell(const SellMatrix* A, const double* x_ext, double* y);
+
+/**
+ * @brief Number of stored entries including padding
+ *
+ * @param A SELL matrix
+ * @return Total number of stored entries
+ */
+long long sell_stored_entries(const SellMatrix* A);
+
+/**
+ * @brief Release the memory held by a SELL matrix
+ *
+ * @param A SELL matrix
+ */
+void sell_free(SellMatrix* A);
+
+#endif // SELL_OPS_H
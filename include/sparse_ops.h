@@ -9,23 +9,184 @@
 #ifndef SPARSE_OPS_H
 #define SPARSE_OPS_H
 
+/**
+ * @brief Storage format used by the SpMV in the solver
+ */
+typedef enum {
+    SPARSE_FORMAT_CSR,      // Compressed sparse row
+    SPARSE_FORMAT_SELL,     // SELL-C-sigma (see sell_ops.h)
+    SPARSE_FORMAT_COMPACT,  // Reduced-precision values and 16-bit column deltas (see compact_ops.h)
+    SPARSE_FORMAT_CSR_UNROLL,   // CSR with the unrolled kernel mat_vec_csr_rows_unroll()
+    SPARSE_FORMAT_BCSR      // Block CSR with dense b x b blocks (see bcsr_ops.h)
+} SparseFormat;
+
+/**
+ * @brief Parse a storage format name ("csr", "sell", "compact", "csr_unroll" or "bcsr")
+ *
+ * @param name Format name
+ * @param format Output: parsed format
+ * @return 0 on success, -1 if the name is unknown
+ */
+int sparse_format_from_string(const char* name, SparseFormat* format);
+
+/**
+ * @brief Name of a storage format
+ *
+ * @param format Storage format
+ * @return Static string with the format name
+ */
+const char* sparse_format_name(SparseFormat format);
+
 /**
  * @brief Sparse matrix-vector multiplication in CSR format
  * 
- * Computes y_local = A_local * x_global, where A_local is the local
- * portion of the sparse matrix stored in CSR format.
+ * Computes y_local = A_local * x_ext, where A_local is the local
+ * portion of the sparse matrix stored in CSR format with columns
+ * renumbered by halo_setup().
  * 
  * @param ptr Row pointer array (size: local_n + 1)
- * @param cols Column indices array (size: local_nnz)
+ * @param cols Local column indices array (size: local_nnz)
  * @param vals Non-zero values array (size: local_nnz)
- * @param x_global Global input vector (size: global_n)
+ * @param x_ext Owned entries followed by ghost entries (size: local_n + n_ghost)
  * @param y_local Local output vector (size: local_n)
  * @param local_n Number of local rows
- * @param global_n Total number of rows
  */
 void mat_vec_csr(int* ptr, int* cols, double* vals, 
-                 double* x_global, double* y_local,
-                 int local_n, int global_n);
+                 double* x_ext, double* y_local,
+                 int local_n);
 
-#endif // SPARSE_OPS_H
+/**
+ * @brief Sparse matrix-vector multiplication restricted to a set of rows
+ * 
+ * Computes y_local[i] = (A_local * x_ext)[i] for each row i in rows.
+ * Used to compute interior rows while ghost entries are in flight.
+ * 
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices array (size: local_nnz)
+ * @param vals Non-zero values array (size: local_nnz)
+ * @param x_ext Owned entries followed by ghost entries (size: local_n + n_ghost)
+ * @param y_local Local output vector (size: local_n)
+ * @param rows Row indices to compute
+ * @param n_rows Number of entries in rows
+ * @param bounds Nonzero-balanced thread split from csr_thread_bounds(),
+ *               or NULL to split rows evenly
+ */
+void mat_vec_csr_rows(int* ptr, int* cols, double* vals,
+                      double* x_ext, double* y_local,
+                      const int* rows, int n_rows, const int* bounds);
 
+/**
+ * @brief Row-restricted SpMV fused with the dot product x^T y over those rows
+ * 
+ * Same as mat_vec_csr_rows(), and also returns the sum of
+ * x_ext[i] * y_local[i] over the computed rows, so CG gets d^T A d
+ * without a second pass over d and q.
+ * 
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices array (size: local_nnz)
+ * @param vals Non-zero values array (size: local_nnz)
+ * @param x_ext Owned entries followed by ghost entries (size: local_n + n_ghost)
+ * @param y_local Local output vector (size: local_n)
+ * @param rows Row indices to compute
+ * @param n_rows Number of entries in rows
+ * @param bounds Nonzero-balanced thread split from csr_thread_bounds(),
+ *               or NULL to split rows evenly
+ * @return Local contribution of these rows to x^T y
+ */
+double mat_vec_csr_rows_dot(int* ptr, int* cols, double* vals,
+                            double* x_ext, double* y_local,
+                            const int* rows, int n_rows, const int* bounds);
+
+/**
+ * @brief Row-restricted SpMV with the row loop unrolled by four
+ * 
+ * Same as mat_vec_csr_rows_dot(), but each row is summed with four
+ * independent accumulators, so consecutive multiply-adds do not wait on
+ * each other. Pays off on rows long enough to hide the loop tail; the
+ * summation order, and so the rounding, differs from the plain kernel.
+ * 
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices array (size: local_nnz)
+ * @param vals Non-zero values array (size: local_nnz)
+ * @param x_ext Owned entries followed by ghost entries (size: local_n + n_ghost)
+ * @param y_local Local output vector (size: local_n)
+ * @param rows Row indices to compute
+ * @param n_rows Number of entries in rows
+ * @param bounds Nonzero-balanced thread split from csr_thread_bounds(),
+ *               or NULL to split rows evenly
+ * @return Local contribution of these rows to x^T y
+ */
+double mat_vec_csr_rows_unroll(int* ptr, int* cols, double* vals,
+                               double* x_ext, double* y_local,
+                               const int* rows, int n_rows, const int* bounds);
+
+/**
+ * @brief Sparse matrix times a block of vectors, restricted to a set of rows
+ * 
+ * Computes Y[i, c] = (A_local * X_ext)[i, c] for each row i in rows and
+ * each of the k columns. Blocks are stored row-major (entry (i, c) at
+ * i * k + c), so every matrix entry is loaded once for all k vectors.
+ * 
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices array (size: local_nnz)
+ * @param vals Non-zero values array (size: local_nnz)
+ * @param X_ext Owned rows followed by ghost rows (size: (local_n + n_ghost) * k)
+ * @param Y Local output block (size: local_n * k)
+ * @param k Number of vectors in the block
+ * @param rows Row indices to compute
+ * @param n_rows Number of entries in rows
+ * @param bounds Nonzero-balanced thread split from csr_thread_bounds(),
+ *               or NULL to split rows evenly
+ */
+void mat_mat_csr_rows(int* ptr, int* cols, double* vals,
+                      const double* X_ext, double* Y, int k,
+                      const int* rows, int n_rows, const int* bounds);
+
+/**
+ * @brief Nonzero-balanced row range of one thread
+ * 
+ * Splits rows [0, local_n) into n_threads contiguous ranges holding
+ * roughly the same number of nonzeros, and returns range tid. Used both
+ * by the threaded SpMV and to first-touch the CSR arrays with the same
+ * thread-to-memory mapping.
+ * 
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param local_n Number of local rows
+ * @param tid Thread index
+ * @param n_threads Number of threads
+ * @param row_begin Output: first row of the range
+ * @param row_end Output: one past the last row of the range
+ */
+void csr_thread_rows(const int* ptr, int local_n, int tid, int n_threads,
+                     int* row_begin, int* row_end);
+
+/**
+ * @brief Nonzero-balanced split of a row list among OpenMP threads
+ * 
+ * @param ptr Row pointer array
+ * @param rows Row indices
+ * @param n_rows Number of entries in rows
+ * @return Allocated array of omp_get_max_threads() + 1 offsets into rows
+ */
+int* csr_thread_bounds(const int* ptr, const int* rows, int n_rows);
+
+/**
+ * @brief Split local rows into interior and boundary rows
+ * 
+ * Interior rows reference only owned columns (index < local_n) and can be
+ * computed before the ghost exchange completes; boundary rows reference
+ * at least one ghost column.
+ * 
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices array (size: local_nnz)
+ * @param local_n Number of local rows
+ * @param interior_rows Output: allocated array of interior row indices
+ * @param n_interior Output: number of interior rows
+ * @param boundary_rows Output: allocated array of boundary row indices
+ * @param n_boundary Output: number of boundary rows
+ */
+void csr_split_rows(int* ptr, int* cols, int local_n,
+                    int** interior_rows, int* n_interior,
+                    int** boundary_rows, int* n_boundary);
+
+#endif // SPARSE_OPS_H
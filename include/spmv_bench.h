@@ -0,0 +1,36 @@
+/**
+ * @file spmv_bench.h
+ * @brief SpMV microbenchmark comparing storage formats
+ */
+
+#ifndef SPMV_BENCH_H
+#define SPMV_BENCH_H
+
+/**
+ * @brief Time the local SpMV kernel in each storage format
+ *
+ * Runs reps products of the local matrix (after halo_setup(), without
+ * the ghost exchange) in CSR, unrolled CSR, SELL-C-sigma, block CSR and
+ * compact format, or with the symmetric kernel when the arrays hold the
+ * upper triangle, and prints, on rank 0, the time per SpMV of the slowest
+ * process, the aggregate GFLOP/s and the effective memory bandwidth. Bandwidth assumes every
+ * matrix array and each vector entry is moved once per product.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices (see halo_setup())
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ * @param n_ghost Number of ghost entries of the input vector
+ * @param row_start Global index of local row 0
+ * @param sell_chunk SELL chunk height C
+ * @param sell_sigma SELL sorting window sigma
+ * @param bcsr_block Block size of block CSR (see bcsr_ops.h)
+ * @param symmetric Arrays hold only the upper triangle (see sym_ops.h)
+ * @param reps Number of timed products per format
+ * @param rank MPI rank of the calling process
+ */
+void spmv_benchmark(int* ptr, int* cols, double* vals, int local_n, int n_ghost,
+                    int row_start, int sell_chunk, int sell_sigma, int bcsr_block,
+                    int symmetric, int reps, int rank);
+
+#endif // SPMV_BENCH_H
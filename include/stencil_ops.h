@@ -0,0 +1,174 @@
+/**
+ * @file stencil_ops.h
+ * @brief Matrix-free Laplacians on regular 2D/3D grids
+ *
+ * Applies the 5-point (2D) or 7-point (3D) Laplacian with Dirichlet
+ * boundaries straight from the grid, without storing a matrix, so an
+ * SpMV only streams the vectors. With constant coefficients the operator
+ * is the matgen poisson2d/poisson3d matrix. With a coefficient field k it
+ * discretizes -div(k grad u): the coupling of two neighbors is the
+ * harmonic mean of their k, and a boundary face couples with k of its
+ * point, so the operator stays symmetric positive definite.
+ *
+ * Points are numbered x fastest, as in matgen.h. The grid is split into
+ * slabs of whole planes along the last dimension (z in 3D, y in 2D), so
+ * every process owns a contiguous range of rows and exchanges one plane
+ * with each of its two neighbors. Input vectors have room for those two
+ * ghost planes after the owned block (n_ghost entries).
+ *
+ * The kernel sweeps all planes of a slab tile by tile: a tile covers
+ * part of a plane, sized so that the three planes it reads stay in cache
+ * (STENCIL_TILE_BYTES) while it moves through the slab.
+ */
+
+#ifndef STENCIL_OPS_H
+#define STENCIL_OPS_H
+
+#include <mpi.h>
+#include "cg_solver.h"
+#include "partition.h"
+
+#define STENCIL_TILE_BYTES (256 * 1024)   // Cache budget of the tiles of one thread
+#define STENCIL_N_LAYERS 8                // Layers of stencil_fill_layers()
+
+/**
+ * @brief Available stencil operators
+ */
+typedef enum {
+    STENCIL_POISSON2D,  // 5-point Laplacian on an nx x ny grid
+    STENCIL_POISSON3D   // 7-point Laplacian on an nx x ny x nz grid
+} StencilType;
+
+/**
+ * @brief Local slab of a matrix-free Laplacian
+ */
+typedef struct {
+    StencilType type;
+    int nx, ny, nz;         // Grid points per dimension (nz = 1 in 2D)
+    int rank;
+    int p;
+    int plane;              // Points per plane: nx * ny in 3D, nx in 2D
+    int rows;               // Rows of x within a plane: ny in 3D, 1 in 2D
+    int n_planes;           // Planes of the grid: nz in 3D, ny in 2D
+    int plane_start;        // First plane owned by this process
+    int local_planes;       // Planes owned by this process
+    int local_n;            // Points owned by this process
+    int n_ghost;            // Ghost room of input vectors: two planes
+    int tile_x;             // Tile extent along x
+    int tile_y;             // Tile extent along y (1 in 2D)
+    double* zero;           // A plane of zeros, read beyond the grid boundary
+
+    // Variable coefficients (all NULL with constant coefficients)
+    double* diag;           // Sum of the couplings of each point (size: local_n)
+    double* cx;             // Coupling with the x - 1 neighbor, 0 at x = 0 (size: local_n)
+    double* cy;             // Coupling with the y - 1 neighbor, 0 at y = 0 (size: local_n, 3D)
+    double* cz;             // Coupling with the previous plane (size: local_n + plane:
+                            // the last plane is the coupling of the slab with the next one)
+    MPI_Request reqs[4];
+} StencilOp;
+
+/**
+ * @brief Parse a stencil name ("poisson2d" or "poisson3d")
+ *
+ * @param name Stencil name
+ * @param type Output: parsed type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int stencil_type_from_string(const char* name, StencilType* type);
+
+/**
+ * @brief Return the name of a stencil type
+ *
+ * @param type Stencil type
+ * @return Static string with the name
+ */
+const char* stencil_type_name(StencilType type);
+
+/**
+ * @brief Set up the local slab of a constant-coefficient Laplacian (collective)
+ *
+ * Planes are split as evenly as possible; every process needs at least
+ * one plane.
+ *
+ * @param st Operator to initialize
+ * @param type Stencil type
+ * @param nx Grid points along x
+ * @param ny Grid points along y
+ * @param nz Grid points along z (ignored in 2D)
+ * @param rank MPI rank of the calling process
+ * @param p Total number of MPI processes
+ * @param dist Output: row distribution of the slabs
+ */
+void stencil_setup(StencilOp* st, StencilType type, int nx, int ny, int nz,
+                   int rank, int p, RowDist* dist);
+
+/**
+ * @brief Switch to variable coefficients (collective)
+ *
+ * Precomputes the couplings of each point, exchanging one plane of k
+ * with the neighbors. May be called again to change the field.
+ *
+ * @param st Operator
+ * @param k Positive coefficient at each local point (size: local_n)
+ */
+void stencil_set_coefficients(StencilOp* st, const double* k);
+
+/**
+ * @brief Layered coefficient field: contrast in every other layer along x, 1 elsewhere
+ *
+ * The grid is cut into STENCIL_N_LAYERS layers of equal width across x,
+ * so every slab sees all of the jumps.
+ *
+ * @param st Operator
+ * @param contrast Coefficient of the odd layers
+ * @param k Output: coefficient at each local point (size: local_n)
+ */
+void stencil_fill_layers(const StencilOp* st, double contrast, double* k);
+
+/**
+ * @brief Matrix-free y = A x (collective)
+ *
+ * Exchanges the boundary planes of x with the neighbors while the planes
+ * that do not need them are computed. Matches the apply callback of
+ * CGLinearOp.
+ *
+ * @param data The StencilOp
+ * @param x_ext Input vector with room for n_ghost entries after the owned block
+ * @param y Output vector (size: local_n)
+ */
+void stencil_apply(void* data, double* x_ext, double* y);
+
+/**
+ * @brief Diagonal of the operator, for Jacobi preconditioning
+ *
+ * Matches the diagonal callback of CGLinearOp.
+ *
+ * @param data The StencilOp
+ * @param diag Output: diagonal entries (size: local_n)
+ */
+void stencil_diagonal(void* data, double* diag);
+
+/**
+ * @brief Describe the operator as a CGLinearOp for cg_solver_op()
+ *
+ * @param st Operator, which must outlive the description
+ * @param op Output: linear operator calling stencil_apply() and stencil_diagonal()
+ */
+void stencil_linear_op(StencilOp* st, CGLinearOp* op);
+
+/**
+ * @brief Number of nonzeros of the equivalent matrix
+ *
+ * @param st Operator
+ * @return Global nonzero count
+ */
+long long stencil_nnz(const StencilOp* st);
+
+/**
+ * @brief Free the arrays of an operator
+ *
+ * @param st Operator
+ */
+void stencil_free(StencilOp* st);
+
+#endif // STENCIL_OPS_H
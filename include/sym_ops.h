@@ -0,0 +1,107 @@
+/**
+ * @file sym_ops.h
+ * @brief Symmetric SpMV from the upper triangle
+ *
+ * For a symmetric matrix only the entries with global column >= global
+ * row are stored. Each stored off-diagonal entry a_ij contributes
+ * a_ij x_j to y_i and a_ij x_i to y_j. Contributions to rows owned by
+ * another process are accumulated in the ghost slots and sent back with
+ * halo_accumulate_begin(); contributions to local rows of another thread
+ * go to per-thread buffers that are summed afterwards.
+ */
+
+#ifndef SYM_OPS_H
+#define SYM_OPS_H
+
+/**
+ * @brief Upper-triangle matrix with the state of the threaded scatter
+ *
+ * The CSR arrays are borrowed, with columns renumbered by halo_setup().
+ */
+typedef struct {
+    int local_n;
+    int n_ghost;
+    int* ptr;
+    int* cols;
+    double* vals;
+    int n_threads;          // Thread slots of the scatter (omp_get_max_threads() at setup)
+    int* row_bounds;        // Nonzero-balanced row split (size: n_threads + 1)
+    double** bufs;          // Buffer of slot t covers indices [row_bounds[t + 1], local_n + n_ghost)
+    int* buf_hi;            // One past the highest index written to each buffer
+    int* boundary_rows;     // Rows with ghost columns
+    int n_boundary;
+    double* y_ghost;        // Contributions to the ghost rows (size: n_ghost)
+} SymMatrix;
+
+/**
+ * @brief Drop the strictly lower triangle of the local rows
+ *
+ * Must be called while cols holds global column indices. Compacts cols
+ * and vals in place and updates ptr and local_nnz.
+ *
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Global column indices
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ * @param local_nnz Number of local non-zeros (updated)
+ * @param row_start Global index of the first local row
+ */
+void csr_keep_upper(int* ptr, int* cols, double* vals, int local_n, int* local_nnz,
+                    int row_start);
+
+/**
+ * @brief Prepare the symmetric SpMV for an upper-triangle matrix
+ *
+ * Sorts the entries of each row by column in place.
+ *
+ * @param S Output: symmetric matrix
+ * @param ptr Row pointer array (size: local_n + 1)
+ * @param cols Local column indices (see halo_setup())
+ * @param vals Non-zero values
+ * @param local_n Number of local rows
+ * @param n_ghost Number of ghost columns
+ */
+void sym_setup(SymMatrix* S, int* ptr, int* cols, double* vals, int local_n, int n_ghost);
+
+/**
+ * @brief Local part of y = A x: owned columns and all transposed entries
+ *
+ * Overwrites y[0 .. local_n) and S->y_ghost. Needs only the owned
+ * entries of x_ext, so it can run while the ghost exchange is in flight.
+ *
+ * @param S Symmetric matrix
+ * @param x_ext Owned entries followed by ghost entries
+ * @param y Local output vector (size: local_n)
+ */
+void mat_vec_sym_local(SymMatrix* S, const double* x_ext, double* y);
+
+/**
+ * @brief Ghost part of y = A x: adds the entries with ghost columns
+ *
+ * @param S Symmetric matrix
+ * @param x_ext Owned entries followed by filled ghost entries
+ * @param y Local output vector (size: local_n)
+ */
+void mat_vec_sym_ghost(const SymMatrix* S, const double* x_ext, double* y);
+
+/**
+ * @brief Build the full on-process diagonal block in CSR
+ *
+ * Mirrors the stored local entries, so preconditioners that act on the
+ * diagonal block can be set up from symmetric storage.
+ *
+ * @param S Symmetric matrix
+ * @param ptr Output: allocated row pointer array (size: local_n + 1)
+ * @param cols Output: allocated local column indices
+ * @param vals Output: allocated values
+ */
+void sym_expand_local(const SymMatrix* S, int** ptr, int** cols, double** vals);
+
+/**
+ * @brief Release the memory held by a symmetric matrix (not the CSR arrays)
+ *
+ * @param S Symmetric matrix
+ */
+void sym_free(SymMatrix* S);
+
+#endif // SYM_OPS_H
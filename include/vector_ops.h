@@ -4,11 +4,31 @@
  * 
  * Basic vector operations including dot products, norms,
  * and parallel vector I/O.
+ *
+ * Binary vector files hold an 8-byte magic (VEC_BINARY_MAGIC), the
+ * number of rows and columns as int64, then the rows of doubles.
  */
 
 #ifndef VECTOR_OPS_H
 #define VECTOR_OPS_H
 
+#define VEC_BINARY_MAGIC "CGVECv1"      // 8 bytes including the terminating NUL
+#define VEC_BINARY_HEADER_BYTES 24
+#define VEC_ALIGN 64                    // Byte alignment of vec_alloc() (a cache line)
+
+/**
+ * @brief Allocate a zero-initialized vector with first-touch placement
+ * 
+ * Each OpenMP thread zeroes the part of the vector it later works on
+ * (static schedule), so pages land on that thread's NUMA node. The
+ * vector starts on a VEC_ALIGN boundary so SIMD loads do not straddle
+ * cache lines; release it with free().
+ * 
+ * @param n Length of the vector
+ * @return Pointer to allocated vector, or NULL on failure
+ */
+double* vec_alloc(int n);
+
 /**
  * @brief Compute local dot product of two vectors
  * 
@@ -23,6 +43,33 @@
  */
 double dot(double* u, double* v, int n);
 
+/**
+ * @brief Fused CG update: x += alpha * d, r -= alpha * q, return local r^T r
+ * 
+ * Streams the four vectors once instead of updating and then re-reading
+ * r for the residual norm.
+ * 
+ * @param x Solution vector, updated in place
+ * @param r Residual vector, updated in place
+ * @param d Search direction
+ * @param q A times the search direction
+ * @param alpha Step length
+ * @param n Length of vectors
+ * @return Local contribution to r^T r after the update
+ */
+double axpy2_dot(double* x, double* r, const double* d, const double* q,
+                 double alpha, int n);
+
+/**
+ * @brief Compute y = x + beta * y (search direction update)
+ * 
+ * @param y Vector, updated in place
+ * @param x Vector added to the scaled y
+ * @param beta Scale factor of y
+ * @param n Length of vectors
+ */
+void xpby(double* y, const double* x, double beta, int n);
+
 /**
  * @brief Perform MPI_Allreduce to sum local dot product contributions
  * 
@@ -32,28 +79,65 @@ double dot(double* u, double* v, int n);
 double dot_allreduce(double local);
 
 /**
- * @brief Read a vector from file and broadcast to all processes
+ * @brief Sum several local contributions with a single MPI_Allreduce
  * 
- * Rank 0 reads the vector from file and broadcasts to all processes.
+ * Fuses independent reductions (e.g. two dot products) into one
+ * global synchronization.
  * 
- * @param filename Path to vector file (one value per line)
- * @param n Length of the vector
+ * @param local Local contributions (size: count)
+ * @param global Output: global sums (size: count)
+ * @param count Number of values to reduce
+ */
+void allreduce_sum(double* local, double* global, int count);
+
+/**
+ * @brief Check whether a vector file name selects the binary format (".bin")
+ * 
+ * @param filename Path to vector file
+ * @return 1 for binary, 0 for text
+ */
+int vec_file_is_binary(const char* filename);
+
+/**
+ * @brief Read the local rows of one or more vectors from a file
+ * 
+ * Binary files (see VEC_BINARY_MAGIC) are read with collective MPI-IO,
+ * each process reading only its own rows; contiguous rows land directly
+ * in the returned block. Other files are parsed as text on rank 0, one
+ * row per line with the same number of whitespace-separated values on
+ * each line, and the rows are scattered to their owners.
+ * 
+ * @param filename Path to vector file
+ * @param global_n Number of rows in the file
+ * @param local_n Number of local rows
+ * @param row_start File row of the first local row (used when rows is NULL)
+ * @param rows File row of each local row, or NULL for contiguous rows
+ * @param k Output: number of vectors (columns)
  * @param rank MPI rank of the calling process
- * @return Pointer to allocated vector, or NULL on failure
+ * @return Allocated row-major block (entry (i, c) at i * k + c), or NULL
+ *         on failure (on all processes)
  */
-double* read_vector(const char* filename, int n, int rank);
+double* read_vectors(const char* filename, int global_n, int local_n, int row_start,
+                     const int* rows, int* k, int rank);
 
 /**
- * @brief Write a vector to file
+ * @brief Write the local rows of k vectors to a file
  * 
- * Only rank 0 writes the vector to the file.
+ * Names ending in ".bin" are written in the binary format with collective
+ * MPI-IO, each process writing only its own rows. Other names get text,
+ * one row per line, gathered and written by rank 0.
  * 
  * @param filename Path to output file
- * @param x Vector to write
- * @param n Length of the vector
+ * @param X Local rows, row-major (size: local_n * k)
+ * @param global_n Number of rows in the file
+ * @param local_n Number of local rows
+ * @param row_start File row of the first local row (used when rows is NULL)
+ * @param rows File row of each local row, or NULL for contiguous rows
+ * @param k Number of vectors (columns)
  * @param rank MPI rank of the calling process
  */
-void write_vector(const char* filename, double* x, int n, int rank);
+void write_vectors(const char* filename, const double* X, int global_n, int local_n,
+                   int row_start, const int* rows, int k, int rank);
 
 #endif // VECTOR_OPS_H
 
@@ -4,6 +4,75 @@
 # =============================================
 # Simple script to test the solver on your local machine
 
+# Usage:
+#   scripts/run_local.sh [nprocs]
+#       Solve examples/matrix.csr with nprocs processes (default: 4)
+#   scripts/run_local.sh bench strong|weak ["rank counts"] [cg_bench options]
+#       Run bin/cg_bench once per rank count (default: "1 2 4 8"),
+#       appending to $BENCH_OUTPUT (default: bench_results.csv);
+#       $MPIRUN overrides the launcher (default: mpirun)
+#   scripts/run_local.sh check [nprocs]
+#       Regression checks on a generated operator (no matrix file needed)
+
+if [ "$1" = "check" ]; then
+    NPROCS=${2:-2}
+    MPIRUN=${MPIRUN:-mpirun}
+    TMP=$(mktemp -d)
+    trap 'rm -rf "$TMP"' EXIT
+
+    if [ ! -f "bin/cg_solver" ]; then
+        echo "Error: bin/cg_solver not found. Please run 'make' first."
+        exit 1
+    fi
+    SOLVE="$MPIRUN -np $NPROCS bin/cg_solver -stencil poisson2d -stencil_size 100 -tol 1e-8"
+    iterations() {
+        sed -n 's/^CG solver complete: \([0-9]*\) iterations.*/\1/p' "$1"
+    }
+
+    # Warm start: a converged solution as -x0 must stop at once
+    FAILED=0
+    for METHOD in cg cgcg pipecg; do
+        $SOLVE -method $METHOD -output "$TMP/x.txt" > "$TMP/cold.log" || exit 1
+        $SOLVE -method $METHOD -x0 "$TMP/x.txt" -output "$TMP/x2.txt" > "$TMP/warm.log" || exit 1
+        COLD=$(iterations "$TMP/cold.log")
+        WARM=$(iterations "$TMP/warm.log")
+        if [ -n "$WARM" ] && [ "$WARM" -le 1 ]; then
+            echo "PASS warm start ($METHOD): $COLD iterations cold, $WARM from the solution"
+        else
+            echo "FAIL warm start ($METHOD): $COLD iterations cold, ${WARM:-?} from the solution"
+            FAILED=1
+        fi
+    done
+    exit $FAILED
+fi
+
+if [ "$1" = "bench" ]; then
+    MODE=${2:-strong}
+    RANKS=${3:-"1 2 4 8"}
+    shift $(( $# < 3 ? $# : 3 ))
+    BENCH_OUTPUT=${BENCH_OUTPUT:-bench_results.csv}
+    MPIRUN=${MPIRUN:-mpirun}
+
+    if [ ! -f "bin/cg_bench" ]; then
+        echo "Error: bin/cg_bench not found. Please run 'make' first."
+        exit 1
+    fi
+    case "$MODE" in
+        strong) SCALING="" ;;
+        weak)   SCALING="-weak" ;;
+        *)      echo "Error: scaling mode must be 'strong' or 'weak'"; exit 1 ;;
+    esac
+
+    echo "Running $MODE-scaling sweep over $RANKS processes"
+    echo "================================================"
+    for NP in $RANKS; do
+        $MPIRUN -np $NP bin/cg_bench $SCALING -output "$BENCH_OUTPUT" "$@" || exit 1
+    done
+    echo ""
+    echo "Results appended to $BENCH_OUTPUT"
+    exit 0
+fi
+
 # Number of MPI processes to use
 NPROCS=${1:-4}
 
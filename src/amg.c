@@ -0,0 +1,997 @@
+/**
+ * @file amg.c
+ * @brief Implementation of the smoothed-aggregation multigrid preconditioner
+ */
+
+#include "amg.h"
+#include "sparse_ops.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define AMG_POWER_ITERS 15      // Power iterations estimating rho(D^{-1} A)
+#define AMG_STALL_RATIO 0.9     // Stop when coarsening keeps more rows than this fraction
+
+/**
+ * @brief One level of the hierarchy
+ */
+typedef struct {
+    int n;                  // Local rows
+    int row_start;          // Global index of the first local row
+    long long global_nnz;
+    RowDist dist;
+    int active;             // Processes owning rows of the level
+
+    // Level operator, columns renumbered by halo_setup()
+    int* ptr;
+    int* cols;
+    double* vals;
+    HaloPlan* halo;
+    HaloPlan own_halo;
+    int owned;              // Matrix arrays and halo plan belong to the level (all but the finest)
+    double* inv_diag;
+    double rho;             // Estimate of rho(D^{-1} A)
+
+    // Prolongator from the next level, columns renumbered by halo_setup_rect()
+    int* p_ptr;
+    int* p_cols;
+    double* p_vals;
+    HaloPlan p_halo;
+
+    // Cycle vectors: ghost room for this level's plan and the prolongator's
+    double* x;              // Correction
+    double* b;              // Right-hand side
+    double* r;              // Residual
+    double* d;              // Chebyshev direction
+    double* w;              // Product of the operator with d
+
+    int direct;             // Coarsest level solved by dense Cholesky
+    double* dense;          // Cholesky factor (rank 0)
+    double* dense_rhs;      // Gathered right-hand side (rank 0)
+
+    double t_setup;
+    double t_cycle;
+} AmgLevel;
+
+struct AmgHierarchy {
+    AmgOptions opts;
+    int rank;
+    int p;
+    int n_levels;
+    int n_cycles;           // V-cycles since the last report
+    AmgLevel levels[AMG_MAX_LEVELS];
+};
+
+/**
+ * @brief Entry of the coarse operator, sent to the owner of its row
+ */
+typedef struct {
+    int row;
+    int col;
+    double val;
+} AmgEntry;
+
+void amg_options_default(AmgOptions* opts) {
+    opts->smoother = AMG_SMOOTHER_CHEBYSHEV;
+    opts->degree = 2;
+    opts->theta = 0.08;
+}
+
+int amg_smoother_from_string(const char* name, AmgSmoother* smoother) {
+    if (strcmp(name, "jacobi") == 0) {
+        *smoother = AMG_SMOOTHER_JACOBI;
+    } else if (strcmp(name, "chebyshev") == 0) {
+        *smoother = AMG_SMOOTHER_CHEBYSHEV;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void* amg_alloc(size_t bytes, const char* what) {
+    void* mem = malloc(bytes > 0 ? bytes : 1);
+    if (mem == NULL) {
+        fprintf(stderr, "Failed to allocate AMG %s\n", what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return mem;
+}
+
+static int compare_int(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_entry(const void* a, const void* b) {
+    const AmgEntry* x = a;
+    const AmgEntry* y = b;
+    if (x->row != y->row) return (x->row > y->row) - (x->row < y->row);
+    return (x->col > y->col) - (x->col < y->col);
+}
+
+// Sort and remove duplicates; returns the new length
+static int sort_unique(int* v, int n) {
+    qsort(v, n, sizeof(int), compare_int);
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        if (m == 0 || v[k] != v[m - 1]) v[m++] = v[k];
+    }
+    return m;
+}
+
+static int find_index(const int* v, int n, int key) {
+    const int* pos = bsearch(&key, v, n, sizeof(int), compare_int);
+    return pos != NULL ? (int)(pos - v) : -1;
+}
+
+static double global_sum(double local) {
+    double sum;
+    MPI_Allreduce(&local, &sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return sum;
+}
+
+// y = A x on a level; x needs room for the level's ghosts
+static void level_matvec(AmgLevel* L, double* x, double* y) {
+    halo_exchange(L->halo, x);
+    mat_vec_csr(L->ptr, L->cols, L->vals, x, y, L->n);
+}
+
+// Largest eigenvalue of D^{-1} A from Rayleigh quotients of a power iteration (collective)
+static double level_spectral_radius(AmgLevel* L) {
+    int n = L->n;
+    double* v = amg_alloc((n + L->halo->n_ghost) * sizeof(double), "eigenvalue estimate");
+    double* y = amg_alloc(n * sizeof(double), "eigenvalue estimate");
+    // Deterministic rough start, so every run builds the same hierarchy
+    for (int i = 0; i < n; i++) {
+        v[i] = (double)((L->row_start + i) * 7919L % 1000) / 1000.0 - 0.5;
+    }
+    double lambda = 0.0;
+    for (int it = 0; it < AMG_POWER_ITERS; it++) {
+        level_matvec(L, v, y);
+        double local[2] = {0.0, 0.0};   // {v^T A v, v^T D v}
+        for (int i = 0; i < n; i++) {
+            local[0] += v[i] * y[i];
+            local[1] += v[i] * v[i] / L->inv_diag[i];
+        }
+        double sum[2];
+        MPI_Allreduce(local, sum, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        if (sum[1] <= 0.0) break;
+        lambda = sum[0] / sum[1];
+        double norm2 = 0.0;
+        for (int i = 0; i < n; i++) {
+            v[i] = L->inv_diag[i] * y[i];
+            norm2 += v[i] * v[i];
+        }
+        double scale = sqrt(global_sum(norm2));
+        if (scale == 0.0) break;
+        for (int i = 0; i < n; i++) v[i] /= scale;
+    }
+    free(v);
+    free(y);
+    return lambda > 0.0 ? lambda : 1.0;
+}
+
+// Sizes, inverse diagonal and spectral radius of a level whose operator is set (collective)
+static void level_init(AmgHierarchy* amg, AmgLevel* L, int level) {
+    int n = L->n;
+    long long local_nnz = L->ptr[n];
+    MPI_Allreduce(&local_nnz, &L->global_nnz, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    int has_rows = n > 0;
+    MPI_Allreduce(&has_rows, &L->active, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    L->row_start = L->dist.offsets[amg->rank];
+
+    L->inv_diag = amg_alloc(n * sizeof(double), "diagonal");
+    for (int i = 0; i < n; i++) {
+        double diag = 0.0;
+        for (int j = L->ptr[i]; j < L->ptr[i + 1]; j++) {
+            if (L->cols[j] == i) diag += L->vals[j];
+        }
+        if (diag == 0.0) {
+            fprintf(stderr, "AMG setup: zero diagonal in local row %d of level %d\n", i, level);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        L->inv_diag[i] = 1.0 / diag;
+    }
+    L->rho = level_spectral_radius(L);
+}
+
+/**
+ * @brief Group the strongly connected local rows into aggregates
+ *
+ * Decoupled aggregation: every process aggregates its own rows, using
+ * strong connections to owned rows only. Rows without strong connections
+ * get -1 and are left to the smoother.
+ *
+ * @return Number of local aggregates
+ */
+static int level_aggregate(const AmgLevel* L, const double* diag_ext, double theta, int* agg) {
+    int n = L->n;
+    const int* ptr = L->ptr;
+    const int* cols = L->cols;
+    char* strong = amg_alloc(ptr[n] * sizeof(char), "strength graph");
+    char* connected = amg_alloc(n * sizeof(char), "strength graph");
+    for (int i = 0; i < n; i++) {
+        connected[i] = 0;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            int c = cols[j];
+            strong[j] = c != i &&
+                        fabs(L->vals[j]) > theta * sqrt(fabs(diag_ext[i] * diag_ext[c]));
+            if (strong[j]) connected[i] = 1;
+        }
+        agg[i] = -1;
+    }
+
+    // Phase 1: a row whose strong neighbors are all free seeds an aggregate with them
+    int n_agg = 0;
+    for (int i = 0; i < n; i++) {
+        if (!connected[i] || agg[i] >= 0) continue;
+        int all_free = 1;
+        for (int j = ptr[i]; j < ptr[i + 1] && all_free; j++) {
+            if (strong[j] && cols[j] < n && agg[cols[j]] >= 0) all_free = 0;
+        }
+        if (!all_free) continue;
+        agg[i] = n_agg;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            if (strong[j] && cols[j] < n) agg[cols[j]] = n_agg;
+        }
+        n_agg++;
+    }
+
+    // Phase 2: join the phase 1 aggregate of the strongest aggregated neighbor
+    int* seeded = amg_alloc(n * sizeof(int), "aggregates");
+    memcpy(seeded, agg, n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        if (!connected[i] || agg[i] >= 0) continue;
+        double best = 0.0;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            int c = cols[j];
+            if (strong[j] && c < n && seeded[c] >= 0 && fabs(L->vals[j]) > best) {
+                best = fabs(L->vals[j]);
+                agg[i] = seeded[c];
+            }
+        }
+    }
+
+    // Phase 3: the rest form aggregates with their free strong neighbors,
+    // or alone when they are only connected to other processes
+    for (int i = 0; i < n; i++) {
+        if (!connected[i] || agg[i] >= 0) continue;
+        agg[i] = n_agg;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            if (strong[j] && cols[j] < n && agg[cols[j]] < 0) agg[cols[j]] = n_agg;
+        }
+        n_agg++;
+    }
+
+    free(seeded);
+    free(strong);
+    free(connected);
+    return n_agg;
+}
+
+/**
+ * @brief Smoothed prolongator P = (I - omega D^{-1} A) P_tent
+ *
+ * agg_ext holds the global aggregate of each owned and ghost row (-1 if
+ * none). P's columns are global aggregate ids.
+ */
+static void level_prolongator(AmgLevel* L, const double* agg_ext, int agg_start, int n_agg) {
+    int n = L->n;
+    int n_ghost = L->halo->n_ghost;
+    double omega = 4.0 / (3.0 * L->rho);
+
+    // Compact numbering of the aggregates referenced: own ones, then the others
+    int* remote = amg_alloc(n_ghost * sizeof(int), "prolongator");
+    int n_remote = 0;
+    for (int g = 0; g < n_ghost; g++) {
+        int a = (int)agg_ext[n + g];
+        if (a >= 0 && (a < agg_start || a >= agg_start + n_agg)) remote[n_remote++] = a;
+    }
+    n_remote = sort_unique(remote, n_remote);
+    int* compact = amg_alloc((n + n_ghost) * sizeof(int), "prolongator");
+    for (int c = 0; c < n + n_ghost; c++) {
+        int a = (int)agg_ext[c];
+        if (a < 0) {
+            compact[c] = -1;
+        } else if (a >= agg_start && a < agg_start + n_agg) {
+            compact[c] = a - agg_start;
+        } else {
+            compact[c] = n_agg + find_index(remote, n_remote, a);
+        }
+    }
+
+    int m = n_agg + n_remote;
+    double* acc = amg_alloc(m * sizeof(double), "prolongator");
+    int* marker = amg_alloc(m * sizeof(int), "prolongator");
+    int* list = amg_alloc(m * sizeof(int), "prolongator");
+    for (int k = 0; k < m; k++) marker[k] = -1;
+
+    L->p_ptr = amg_alloc((n + 1) * sizeof(int), "prolongator");
+    L->p_cols = amg_alloc((L->ptr[n] + n) * sizeof(int), "prolongator");
+    L->p_vals = amg_alloc((L->ptr[n] + n) * sizeof(double), "prolongator");
+    L->p_ptr[0] = 0;
+    int nnz = 0;
+    for (int i = 0; i < n; i++) {
+        int len = 0;
+        if (compact[i] >= 0) {
+            marker[compact[i]] = i;
+            acc[compact[i]] = 1.0;
+            list[len++] = compact[i];
+        }
+        double scale = omega * L->inv_diag[i];
+        for (int j = L->ptr[i]; j < L->ptr[i + 1]; j++) {
+            int k = compact[L->cols[j]];
+            if (k < 0) continue;
+            if (marker[k] != i) {
+                marker[k] = i;
+                acc[k] = 0.0;
+                list[len++] = k;
+            }
+            acc[k] -= scale * L->vals[j];
+        }
+        for (int e = 0; e < len; e++) {
+            int k = list[e];
+            if (acc[k] == 0.0) continue;
+            L->p_cols[nnz] = k < n_agg ? agg_start + k : remote[k - n_agg];
+            L->p_vals[nnz] = acc[k];
+            nnz++;
+        }
+        L->p_ptr[i + 1] = nnz;
+    }
+
+    free(remote);
+    free(compact);
+    free(acc);
+    free(marker);
+    free(list);
+}
+
+// Append an entry, growing the arrays as needed
+static void entries_push(AmgEntry** entries, int* n, int* cap, int row, int col, double val) {
+    if (*n == *cap) {
+        *cap = *cap > 0 ? 2 * *cap : 1024;
+        AmgEntry* grown = realloc(*entries, (size_t)*cap * sizeof(AmgEntry));
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate AMG coarse operator\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        *entries = grown;
+    }
+    (*entries)[*n].row = row;
+    (*entries)[*n].col = col;
+    (*entries)[*n].val = val;
+    (*n)++;
+}
+
+/**
+ * @brief Local contributions to the Galerkin product P^T A P
+ *
+ * Fetches the prolongator rows of the ghosts, forms the rows of A P for
+ * the local rows, then P^T (A P) restricted to them. Each coarse entry is
+ * returned with global row and column, possibly for rows of other
+ * processes.
+ */
+static AmgEntry* level_galerkin(AmgLevel* L, int* n_entries) {
+    int n = L->n;
+    int n_ghost = L->halo->n_ghost;
+    int* gp_ptr;
+    int* gp_cols;
+    double* gp_vals;
+    halo_exchange_rows(L->halo, L->p_ptr, L->p_cols, L->p_vals, &gp_ptr, &gp_cols, &gp_vals);
+
+    // Compact numbering of every coarse column of the local and ghost prolongator rows
+    int local_pnnz = L->p_ptr[n];
+    int ghost_pnnz = gp_ptr[n_ghost];
+    int* cmap = amg_alloc((local_pnnz + ghost_pnnz) * sizeof(int), "coarse operator");
+    memcpy(cmap, L->p_cols, local_pnnz * sizeof(int));
+    memcpy(cmap + local_pnnz, gp_cols, ghost_pnnz * sizeof(int));
+    int m = sort_unique(cmap, local_pnnz + ghost_pnnz);
+    int* pc = amg_alloc(local_pnnz * sizeof(int), "coarse operator");
+    int* gpc = amg_alloc(ghost_pnnz * sizeof(int), "coarse operator");
+    for (int j = 0; j < local_pnnz; j++) pc[j] = find_index(cmap, m, L->p_cols[j]);
+    for (int j = 0; j < ghost_pnnz; j++) gpc[j] = find_index(cmap, m, gp_cols[j]);
+
+    double* acc = amg_alloc(m * sizeof(double), "coarse operator");
+    int* marker = amg_alloc(m * sizeof(int), "coarse operator");
+    for (int k = 0; k < m; k++) marker[k] = -1;
+
+    // A P row by row (Gustavson), in compact columns
+    int cap = L->ptr[n] + local_pnnz + 1;
+    int* ap_ptr = amg_alloc((n + 1) * sizeof(int), "coarse operator");
+    int* ap_cols = amg_alloc(cap * sizeof(int), "coarse operator");
+    double* ap_vals = amg_alloc(cap * sizeof(double), "coarse operator");
+    ap_ptr[0] = 0;
+    int ap_nnz = 0;
+    for (int i = 0; i < n; i++) {
+        int row_begin = ap_nnz;
+        for (int j = L->ptr[i]; j < L->ptr[i + 1]; j++) {
+            int c = L->cols[j];
+            double a = L->vals[j];
+            const int* rc = c < n ? pc + L->p_ptr[c] : gpc + gp_ptr[c - n];
+            const double* rv = c < n ? L->p_vals + L->p_ptr[c] : gp_vals + gp_ptr[c - n];
+            int len = c < n ? L->p_ptr[c + 1] - L->p_ptr[c] : gp_ptr[c - n + 1] - gp_ptr[c - n];
+            for (int e = 0; e < len; e++) {
+                int k = rc[e];
+                if (marker[k] < row_begin) {
+                    marker[k] = ap_nnz;
+                    if (ap_nnz == cap) {
+                        cap *= 2;
+                        ap_cols = realloc(ap_cols, cap * sizeof(int));
+                        ap_vals = realloc(ap_vals, cap * sizeof(double));
+                        if (ap_cols == NULL || ap_vals == NULL) {
+                            fprintf(stderr, "Failed to allocate AMG coarse operator\n");
+                            MPI_Abort(MPI_COMM_WORLD, 1);
+                        }
+                    }
+                    ap_cols[ap_nnz] = k;
+                    ap_vals[ap_nnz] = 0.0;
+                    ap_nnz++;
+                }
+                ap_vals[marker[k]] += a * rv[e];
+            }
+        }
+        ap_ptr[i + 1] = ap_nnz;
+    }
+
+    // P^T of the local rows, grouped by coarse row
+    int* pt_ptr = calloc(m + 1, sizeof(int));
+    int* pt_rows = amg_alloc(local_pnnz * sizeof(int), "coarse operator");
+    double* pt_vals = amg_alloc(local_pnnz * sizeof(double), "coarse operator");
+    if (pt_ptr == NULL) {
+        fprintf(stderr, "Failed to allocate AMG coarse operator\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int j = 0; j < local_pnnz; j++) pt_ptr[pc[j] + 1]++;
+    for (int k = 0; k < m; k++) pt_ptr[k + 1] += pt_ptr[k];
+    for (int i = 0; i < n; i++) {
+        for (int j = L->p_ptr[i]; j < L->p_ptr[i + 1]; j++) {
+            int pos = pt_ptr[pc[j]]++;
+            pt_rows[pos] = i;
+            pt_vals[pos] = L->p_vals[j];
+        }
+    }
+    for (int k = m; k > 0; k--) pt_ptr[k] = pt_ptr[k - 1];
+    pt_ptr[0] = 0;
+
+    // Coarse row I = sum over fine rows i of P(i, I) * (A P)(i, :)
+    AmgEntry* entries = NULL;
+    int n_out = 0, out_cap = 0;
+    int* list = amg_alloc(m * sizeof(int), "coarse operator");
+    for (int k = 0; k < m; k++) marker[k] = -1;
+    for (int I = 0; I < m; I++) {
+        int len = 0;
+        for (int t = pt_ptr[I]; t < pt_ptr[I + 1]; t++) {
+            int i = pt_rows[t];
+            double pv = pt_vals[t];
+            for (int e = ap_ptr[i]; e < ap_ptr[i + 1]; e++) {
+                int J = ap_cols[e];
+                if (marker[J] != I) {
+                    marker[J] = I;
+                    acc[J] = 0.0;
+                    list[len++] = J;
+                }
+                acc[J] += pv * ap_vals[e];
+            }
+        }
+        for (int e = 0; e < len; e++) {
+            entries_push(&entries, &n_out, &out_cap, cmap[I], cmap[list[e]], acc[list[e]]);
+        }
+    }
+
+    free(gp_ptr);
+    free(gp_cols);
+    free(gp_vals);
+    free(cmap);
+    free(pc);
+    free(gpc);
+    free(acc);
+    free(marker);
+    free(list);
+    free(ap_ptr);
+    free(ap_cols);
+    free(ap_vals);
+    free(pt_ptr);
+    free(pt_rows);
+    free(pt_vals);
+    *n_entries = n_out;
+    return entries;
+}
+
+/**
+ * @brief Send coarse entries to the owners of their rows and assemble them (collective)
+ *
+ * Entries of the same row and column are summed. The result is the CSR
+ * block of the rows owned in dist, with global column indices.
+ */
+static void assemble_coarse(AmgEntry* entries, int n_entries, const RowDist* dist, int rank,
+                            int** ptr_out, int** cols_out, double** vals_out) {
+    int p = dist->p;
+    int* send_counts = calloc(p, sizeof(int));
+    int* recv_counts = amg_alloc(p * sizeof(int), "coarse operator");
+    int* send_displs = amg_alloc((p + 1) * sizeof(int), "coarse operator");
+    int* recv_displs = amg_alloc((p + 1) * sizeof(int), "coarse operator");
+    int* dest = amg_alloc(n_entries * sizeof(int), "coarse operator");
+    if (send_counts == NULL) {
+        fprintf(stderr, "Failed to allocate AMG coarse operator\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int e = 0; e < n_entries; e++) {
+        dest[e] = rowdist_owner(dist, entries[e].row);
+        send_counts[dest[e]]++;
+    }
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    send_displs[0] = 0;
+    recv_displs[0] = 0;
+    for (int k = 0; k < p; k++) {
+        send_displs[k + 1] = send_displs[k] + send_counts[k];
+        recv_displs[k + 1] = recv_displs[k] + recv_counts[k];
+    }
+
+    // Group the entries by destination; counts and offsets in bytes for the exchange
+    AmgEntry* send = amg_alloc((size_t)n_entries * sizeof(AmgEntry), "coarse operator");
+    int* fill = amg_alloc(p * sizeof(int), "coarse operator");
+    memcpy(fill, send_displs, p * sizeof(int));
+    for (int e = 0; e < n_entries; e++) send[fill[dest[e]]++] = entries[e];
+    int n_recv = recv_displs[p];
+    AmgEntry* recv = amg_alloc((size_t)n_recv * sizeof(AmgEntry), "coarse operator");
+    for (int k = 0; k <= p; k++) {
+        if (k < p) {
+            send_counts[k] *= (int)sizeof(AmgEntry);
+            recv_counts[k] *= (int)sizeof(AmgEntry);
+        }
+        send_displs[k] *= (int)sizeof(AmgEntry);
+        recv_displs[k] *= (int)sizeof(AmgEntry);
+    }
+    // Processes are homogeneous, so the entries travel as bytes
+    MPI_Alltoallv(send, send_counts, send_displs, MPI_BYTE,
+                  recv, recv_counts, recv_displs, MPI_BYTE, MPI_COMM_WORLD);
+
+    qsort(recv, n_recv, sizeof(AmgEntry), compare_entry);
+    int local_n = dist->counts[rank];
+    int row_start = dist->offsets[rank];
+    int* ptr = calloc(local_n + 1, sizeof(int));
+    int* cols = amg_alloc(n_recv * sizeof(int), "coarse operator");
+    double* vals = amg_alloc(n_recv * sizeof(double), "coarse operator");
+    if (ptr == NULL) {
+        fprintf(stderr, "Failed to allocate AMG coarse operator\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int nnz = 0;
+    for (int e = 0; e < n_recv; e++) {
+        if (nnz > 0 && e > 0 && recv[e].row == recv[e - 1].row &&
+            recv[e].col == recv[e - 1].col) {
+            vals[nnz - 1] += recv[e].val;
+            continue;
+        }
+        cols[nnz] = recv[e].col;
+        vals[nnz] = recv[e].val;
+        ptr[recv[e].row - row_start + 1]++;
+        nnz++;
+    }
+    for (int i = 0; i < local_n; i++) ptr[i + 1] += ptr[i];
+
+    free(send_counts);
+    free(recv_counts);
+    free(send_displs);
+    free(recv_displs);
+    free(dest);
+    free(fill);
+    free(send);
+    free(recv);
+    *ptr_out = ptr;
+    *cols_out = cols;
+    *vals_out = vals;
+}
+
+/**
+ * @brief Build level l + 1 from level l (collective)
+ *
+ * @return 1 if a coarser level was added, 0 if coarsening stalled
+ */
+static int level_coarsen(AmgHierarchy* amg, int l) {
+    AmgLevel* L = &amg->levels[l];
+    int n = L->n;
+    int n_ext = n + L->halo->n_ghost;
+    double t_start = MPI_Wtime();
+
+    double* ext = amg_alloc(n_ext * sizeof(double), "aggregates");
+    for (int i = 0; i < n; i++) ext[i] = 1.0 / L->inv_diag[i];
+    halo_exchange(L->halo, ext);
+    int* agg = amg_alloc(n * sizeof(int), "aggregates");
+    int n_agg = level_aggregate(L, ext, amg->opts.theta, agg);
+
+    int agg_start = 0;
+    int nc = 0;
+    MPI_Exscan(&n_agg, &agg_start, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (amg->rank == 0) agg_start = 0;
+    MPI_Allreduce(&n_agg, &nc, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (nc == 0 || nc > AMG_STALL_RATIO * L->dist.global_n) {
+        free(ext);
+        free(agg);
+        return 0;
+    }
+
+    // Global aggregate of every owned and ghost row
+    for (int i = 0; i < n; i++) ext[i] = agg[i] >= 0 ? agg_start + agg[i] : -1.0;
+    halo_exchange(L->halo, ext);
+    level_prolongator(L, ext, agg_start, n_agg);
+    free(ext);
+    free(agg);
+
+    // Coarse rows stay with the processes that aggregated them, unless they
+    // are too few to keep that many busy: then they are split evenly over
+    // the first ones
+    AmgLevel* C = &amg->levels[l + 1];
+    memset(C, 0, sizeof(AmgLevel));
+    int p_target = nc / AMG_MIN_ROWS_PER_RANK;
+    if (p_target < 1) p_target = 1;
+    int coarse_n = n_agg;
+    if (p_target < L->active) {
+        int rank = amg->rank;
+        coarse_n = rank < p_target ?
+            (int)((long long)nc * (rank + 1) / p_target - (long long)nc * rank / p_target) : 0;
+    }
+    rowdist_from_counts(&C->dist, coarse_n, amg->p);
+
+    int n_entries;
+    AmgEntry* entries = level_galerkin(L, &n_entries);
+    assemble_coarse(entries, n_entries, &C->dist, amg->rank, &C->ptr, &C->cols, &C->vals);
+    free(entries);
+    halo_setup_rect(L->p_ptr, n, L->p_cols, &C->dist, amg->rank, &L->p_halo);
+
+    C->n = coarse_n;
+    C->owned = 1;
+    C->halo = &C->own_halo;
+    halo_setup(C->ptr, C->cols, &C->dist, amg->rank, C->halo);
+    L->t_setup += MPI_Wtime() - t_start;
+
+    t_start = MPI_Wtime();
+    level_init(amg, C, l + 1);
+    C->t_setup = MPI_Wtime() - t_start;
+    amg->n_levels++;
+    return 1;
+}
+
+// Dense Cholesky factor of the coarsest level on rank 0 (collective); 0 if not SPD
+static int level_factor_dense(AmgHierarchy* amg, AmgLevel* L) {
+    int n = L->n;
+    int N = L->dist.global_n;
+    int local_nnz = L->ptr[n];
+    AmgEntry* local = amg_alloc((size_t)local_nnz * sizeof(AmgEntry), "coarse solver");
+    for (int i = 0; i < n; i++) {
+        for (int j = L->ptr[i]; j < L->ptr[i + 1]; j++) {
+            int c = L->cols[j];
+            local[j].row = L->row_start + i;
+            local[j].col = c < n ? L->row_start + c : L->halo->ghost_cols[c - n];
+            local[j].val = L->vals[j];
+        }
+    }
+    int* counts = amg_alloc(amg->p * sizeof(int), "coarse solver");
+    int* displs = amg_alloc(amg->p * sizeof(int), "coarse solver");
+    int bytes = local_nnz * (int)sizeof(AmgEntry);
+    MPI_Gather(&bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int total = 0;
+    if (amg->rank == 0) {
+        for (int k = 0; k < amg->p; k++) {
+            displs[k] = total;
+            total += counts[k];
+        }
+    }
+    AmgEntry* all = amg->rank == 0 ? amg_alloc(total, "coarse solver") : NULL;
+    MPI_Gatherv(local, bytes, MPI_BYTE, all, counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    int ok = 1;
+    if (amg->rank == 0) {
+        double* a = calloc((size_t)N * N, sizeof(double));
+        if (a == NULL) {
+            fprintf(stderr, "Failed to allocate AMG coarse solver\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (int e = 0; e < total / (int)sizeof(AmgEntry); e++) {
+            a[(size_t)all[e].row * N + all[e].col] += all[e].val;
+        }
+        // Lower factor in place, row by row
+        for (int i = 0; i < N && ok; i++) {
+            for (int j = 0; j <= i; j++) {
+                double sum = a[(size_t)i * N + j];
+                for (int k = 0; k < j; k++) sum -= a[(size_t)i * N + k] * a[(size_t)j * N + k];
+                if (j < i) {
+                    a[(size_t)i * N + j] = sum / a[(size_t)j * N + j];
+                } else if (sum > 0.0) {
+                    a[(size_t)i * N + i] = sqrt(sum);
+                } else {
+                    ok = 0;
+                }
+            }
+        }
+        if (ok) {
+            L->dense = a;
+            L->dense_rhs = amg_alloc(N * sizeof(double), "coarse solver");
+        } else {
+            free(a);
+        }
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    free(local);
+    free(all);
+    free(counts);
+    free(displs);
+    return ok;
+}
+
+// x = A^{-1} b on the coarsest level: gather, solve on rank 0, scatter (collective)
+static void level_solve_dense(AmgHierarchy* amg, AmgLevel* L) {
+    int N = L->dist.global_n;
+    double* y = L->dense_rhs;
+    MPI_Gatherv(L->b, L->n, MPI_DOUBLE, y, L->dist.counts, L->dist.offsets, MPI_DOUBLE,
+                0, MPI_COMM_WORLD);
+    if (amg->rank == 0) {
+        const double* a = L->dense;
+        for (int i = 0; i < N; i++) {
+            double sum = y[i];
+            for (int k = 0; k < i; k++) sum -= a[(size_t)i * N + k] * y[k];
+            y[i] = sum / a[(size_t)i * N + i];
+        }
+        for (int i = N - 1; i >= 0; i--) {
+            double sum = y[i];
+            for (int k = i + 1; k < N; k++) sum -= a[(size_t)k * N + i] * y[k];
+            y[i] = sum / a[(size_t)i * N + i];
+        }
+    }
+    MPI_Scatterv(y, L->dist.counts, L->dist.offsets, MPI_DOUBLE, L->x, L->n, MPI_DOUBLE,
+                 0, MPI_COMM_WORLD);
+}
+
+/**
+ * @brief Smooth A x = b on a level
+ *
+ * With zero_guess, x is taken as zero on entry and the first product
+ * with A is skipped.
+ */
+static void level_smooth(const AmgOptions* opts, AmgLevel* L, int zero_guess) {
+    int n = L->n;
+    double* x = L->x;
+    const double* b = L->b;
+    double* r = L->r;
+    const double* inv_diag = L->inv_diag;
+
+    if (opts->smoother == AMG_SMOOTHER_JACOBI) {
+        double omega = 4.0 / (3.0 * L->rho);
+        for (int s = 0; s < opts->degree; s++) {
+            if (s == 0 && zero_guess) {
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < n; i++) x[i] = omega * inv_diag[i] * b[i];
+                continue;
+            }
+            level_matvec(L, x, r);
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; i++) x[i] += omega * inv_diag[i] * (b[i] - r[i]);
+        }
+        return;
+    }
+
+    // Chebyshev iteration for D^{-1} A on [0.1 rho, 1.1 rho]
+    double* d = L->d;
+    double* w = L->w;
+    double lmax = 1.1 * L->rho;
+    double lmin = 0.1 * L->rho;
+    double theta = 0.5 * (lmax + lmin);
+    double delta = 0.5 * (lmax - lmin);
+    double sigma = theta / delta;
+    double rho_k = 1.0 / sigma;
+    if (zero_guess) {
+        memcpy(r, b, n * sizeof(double));
+        memset(x, 0, n * sizeof(double));
+    } else {
+        level_matvec(L, x, r);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) r[i] = b[i] - r[i];
+    }
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) d[i] = inv_diag[i] * r[i] / theta;
+    for (int k = 0; k < opts->degree; k++) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) x[i] += d[i];
+        if (k == opts->degree - 1) break;
+        level_matvec(L, d, w);
+        double rho_next = 1.0 / (2.0 * sigma - rho_k);
+        double c1 = rho_next * rho_k;
+        double c2 = 2.0 * rho_next / delta;
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            r[i] -= w[i];
+            d[i] = c1 * d[i] + c2 * inv_diag[i] * r[i];
+        }
+        rho_k = rho_next;
+    }
+}
+
+// V-cycle from level l: x = M^{-1} b on that level
+static void amg_cycle(AmgHierarchy* amg, int l) {
+    AmgLevel* L = &amg->levels[l];
+    int n = L->n;
+    double t_start = MPI_Wtime();
+    if (l == amg->n_levels - 1) {
+        if (L->direct) {
+            level_solve_dense(amg, L);
+        } else {
+            level_smooth(&amg->opts, L, 1);
+            level_smooth(&amg->opts, L, 0);
+        }
+        L->t_cycle += MPI_Wtime() - t_start;
+        return;
+    }
+
+    AmgLevel* C = &amg->levels[l + 1];
+    level_smooth(&amg->opts, L, 1);
+    level_matvec(L, L->x, L->r);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) L->r[i] = L->b[i] - L->r[i];
+
+    // Restrict: b_c = P^T r; contributions to other processes' coarse rows go to their owners
+    memset(C->b, 0, (C->n + L->p_halo.n_ghost) * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        for (int j = L->p_ptr[i]; j < L->p_ptr[i + 1]; j++) {
+            C->b[L->p_cols[j]] += L->p_vals[j] * L->r[i];
+        }
+    }
+    halo_accumulate_begin(&L->p_halo, C->b + C->n);
+    halo_accumulate_end(&L->p_halo, C->b);
+    L->t_cycle += MPI_Wtime() - t_start;
+
+    amg_cycle(amg, l + 1);
+
+    // Prolong: x += P x_c, then smooth again
+    t_start = MPI_Wtime();
+    halo_exchange(&L->p_halo, C->x);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        double sum = 0.0;
+        for (int j = L->p_ptr[i]; j < L->p_ptr[i + 1]; j++) {
+            sum += L->p_vals[j] * C->x[L->p_cols[j]];
+        }
+        L->x[i] += sum;
+    }
+    level_smooth(&amg->opts, L, 0);
+    L->t_cycle += MPI_Wtime() - t_start;
+}
+
+// Print the levels of a new hierarchy on rank 0 (collective)
+static void amg_print_setup(AmgHierarchy* amg) {
+    double t_local[AMG_MAX_LEVELS];
+    double t_max[AMG_MAX_LEVELS];
+    for (int l = 0; l < amg->n_levels; l++) t_local[l] = amg->levels[l].t_setup;
+    MPI_Reduce(t_local, t_max, amg->n_levels, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (amg->rank != 0) return;
+
+    double rows = 0.0, nnz = 0.0;
+    for (int l = 0; l < amg->n_levels; l++) {
+        rows += amg->levels[l].dist.global_n;
+        nnz += (double)amg->levels[l].global_nnz;
+    }
+    const AmgLevel* fine = &amg->levels[0];
+    const AmgLevel* coarsest = &amg->levels[amg->n_levels - 1];
+    printf("AMG hierarchy: %d levels, operator complexity %.3f, grid complexity %.3f\n",
+           amg->n_levels, nnz / (double)fine->global_nnz, rows / (double)fine->dist.global_n);
+    printf("  %5s %12s %14s %7s %10s\n", "Level", "Rows", "Nonzeros", "Ranks", "Setup (s)");
+    for (int l = 0; l < amg->n_levels; l++) {
+        const AmgLevel* L = &amg->levels[l];
+        printf("  %5d %12d %14lld %7d %10.3f\n", l, L->dist.global_n, L->global_nnz,
+               L->active, t_max[l]);
+    }
+    printf("  Coarsest level: %s, %s smoother of degree %d\n",
+           coarsest->direct ? "dense Cholesky on rank 0" : "smoothed only",
+           amg->opts.smoother == AMG_SMOOTHER_JACOBI ? "Jacobi" : "Chebyshev",
+           amg->opts.degree);
+}
+
+AmgHierarchy* amg_setup(int* ptr, int* cols, double* vals, int local_n, HaloPlan* halo,
+                        const AmgOptions* opts, int verbose) {
+    AmgHierarchy* amg = calloc(1, sizeof(AmgHierarchy));
+    if (amg == NULL) {
+        fprintf(stderr, "Failed to allocate AMG hierarchy\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    amg->opts = *opts;
+    if (amg->opts.degree < 1) amg->opts.degree = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &amg->rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &amg->p);
+
+    double t_start = MPI_Wtime();
+    AmgLevel* fine = &amg->levels[0];
+    fine->n = local_n;
+    fine->ptr = ptr;
+    fine->cols = cols;
+    fine->vals = vals;
+    fine->halo = halo;
+    rowdist_from_counts(&fine->dist, local_n, amg->p);
+    level_init(amg, fine, 0);
+    fine->t_setup = MPI_Wtime() - t_start;
+    amg->n_levels = 1;
+    while (amg->n_levels < AMG_MAX_LEVELS) {
+        int l = amg->n_levels - 1;
+        if (amg->levels[l].dist.global_n <= AMG_COARSE_MAX || !level_coarsen(amg, l)) break;
+    }
+
+    AmgLevel* coarsest = &amg->levels[amg->n_levels - 1];
+    if (coarsest->dist.global_n <= AMG_DENSE_MAX) {
+        t_start = MPI_Wtime();
+        coarsest->direct = level_factor_dense(amg, coarsest);
+        coarsest->t_setup += MPI_Wtime() - t_start;
+    }
+
+    // Cycle vectors, with ghost room for both plans that fill them
+    for (int l = 0; l < amg->n_levels; l++) {
+        AmgLevel* L = &amg->levels[l];
+        int ghost = L->halo->n_ghost;
+        int ghost_in = l > 0 ? amg->levels[l - 1].p_halo.n_ghost : 0;
+        int ghost_max = ghost > ghost_in ? ghost : ghost_in;
+        L->x = amg_alloc((L->n + ghost_max) * sizeof(double), "vectors");
+        L->b = amg_alloc((L->n + ghost_in) * sizeof(double), "vectors");
+        L->r = amg_alloc(L->n * sizeof(double), "vectors");
+        L->d = amg_alloc((L->n + ghost) * sizeof(double), "vectors");
+        L->w = amg_alloc(L->n * sizeof(double), "vectors");
+    }
+    if (verbose) amg_print_setup(amg);
+    return amg;
+}
+
+void amg_apply(AmgHierarchy* amg, const double* r, double* z) {
+    AmgLevel* fine = &amg->levels[0];
+    memcpy(fine->b, r, fine->n * sizeof(double));
+    amg_cycle(amg, 0);
+    memcpy(z, fine->x, fine->n * sizeof(double));
+    amg->n_cycles++;
+}
+
+void amg_report(AmgHierarchy* amg, int rank) {
+    double t_local[AMG_MAX_LEVELS];
+    double t_max[AMG_MAX_LEVELS];
+    for (int l = 0; l < amg->n_levels; l++) {
+        t_local[l] = amg->levels[l].t_cycle;
+        amg->levels[l].t_cycle = 0.0;
+    }
+    MPI_Reduce(t_local, t_max, amg->n_levels, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0 && amg->n_cycles > 0) {
+        double total = 0.0;
+        for (int l = 0; l < amg->n_levels; l++) total += t_max[l];
+        printf("AMG: %d V-cycles, time per level of the slowest rank:\n", amg->n_cycles);
+        for (int l = 0; l < amg->n_levels; l++) {
+            printf("  Level %d: %.3e s (%.1f%%)\n", l, t_max[l],
+                   total > 0.0 ? 100.0 * t_max[l] / total : 0.0);
+        }
+    }
+    amg->n_cycles = 0;
+}
+
+void amg_free(AmgHierarchy* amg) {
+    if (amg == NULL) return;
+    for (int l = 0; l < amg->n_levels; l++) {
+        AmgLevel* L = &amg->levels[l];
+        if (L->owned) {
+            free(L->ptr);
+            free(L->cols);
+            free(L->vals);
+            halo_free(&L->own_halo);
+        }
+        if (l < amg->n_levels - 1) {
+            free(L->p_ptr);
+            free(L->p_cols);
+            free(L->p_vals);
+            halo_free(&L->p_halo);
+        }
+        rowdist_free(&L->dist);
+        free(L->inv_diag);
+        free(L->x);
+        free(L->b);
+        free(L->r);
+        free(L->d);
+        free(L->w);
+        free(L->dense);
+        free(L->dense_rhs);
+    }
+    free(amg);
+}
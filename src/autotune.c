@@ -0,0 +1,537 @@
+/**
+ * @file autotune.c
+ * @brief Implementation of the startup autotuner
+ */
+
+#include "autotune.h"
+#include "bcsr_ops.h"
+#include "halo.h"
+#include "sell_ops.h"
+#include "sym_ops.h"
+#include "vector_ops.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Bounds on the products of one timed trial
+#define AUTOTUNE_MIN_REPS 3
+#define AUTOTUNE_MAX_REPS 1000
+// Thread counts tried: T, T/2, ... (at most this many)
+#define AUTOTUNE_MAX_THREAD_TRIALS 4
+
+static const int block_sizes[3] = {2, 3, 6};
+static const int sell_chunks[3] = {4, 8, 16};
+static const int sell_sigmas[2] = {1, SELL_DEFAULT_SIGMA};
+
+static void* tune_alloc(size_t bytes, int rank) {
+    void* mem = malloc(bytes > 0 ? bytes : 1);
+    if (mem == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate autotuning buffers\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return mem;
+}
+
+static int max_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static void set_threads(int threads) {
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#else
+    (void)threads;
+#endif
+}
+
+static const char* reorder_name(ReorderType reorder) {
+    return reorder == REORDER_RCM ? "rcm" : "none";
+}
+
+// splitmix64 finalizer
+static unsigned long long mix64(unsigned long long z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void autotune_analyze(const int* ptr, const int* cols, int local_n, const RowDist* dist,
+                      int rank, TuneStats* stats) {
+    memset(stats, 0, sizeof(TuneStats));
+    int row_start = dist->offsets[rank];
+    int min_len = local_n > 0 ? ptr[1] - ptr[0] : 0, max_len = 0, bandwidth = 0;
+    double sum_sq = 0.0;
+    unsigned long long hash = 0;
+    for (int i = 0; i < local_n; i++) {
+        int len = ptr[i + 1] - ptr[i];
+        if (len < min_len) min_len = len;
+        if (len > max_len) max_len = len;
+        sum_sq += (double)len * len;
+        unsigned long long row = (unsigned long long)(row_start + i) << 32;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            int dist_ij = abs(cols[j] - (row_start + i));
+            if (dist_ij > bandwidth) bandwidth = dist_ij;
+            hash += mix64(row | (unsigned int)cols[j]);
+        }
+    }
+
+    double local[2] = {(double)ptr[local_n], sum_sq};
+    double sum[2];
+    MPI_Allreduce(local, sum, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    int ext_local[3] = {local_n > 0 ? -min_len : -2147483647, max_len, bandwidth};
+    int ext[3];
+    MPI_Allreduce(ext_local, ext, 3, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    unsigned long long hash_sum;
+    MPI_Allreduce(&hash, &hash_sum, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    int n = dist->global_n;
+    stats->global_n = n;
+    stats->global_nnz = (long long)sum[0];
+    stats->fingerprint = mix64(hash_sum ^ mix64((unsigned long long)n));
+    stats->processes = dist->p;
+    stats->max_threads = max_threads();
+    stats->min_len = -ext[0];
+    stats->max_len = ext[1];
+    stats->bandwidth = ext[2];
+    stats->avg_len = n > 0 ? sum[0] / n : 0.0;
+    double var = n > 0 ? sum[1] / n - stats->avg_len * stats->avg_len : 0.0;
+    stats->cv_len = stats->avg_len > 0.0 ? sqrt(var > 0.0 ? var : 0.0) / stats->avg_len : 0.0;
+
+    if (rank == 0) {
+        printf("Autotune analysis: fingerprint %016llx, row lengths %d/%.1f/%d "
+               "(min/avg/max, cv %.2f), bandwidth %d\n", stats->fingerprint, stats->min_len,
+               stats->avg_len, stats->max_len, stats->cv_len, stats->bandwidth);
+    }
+}
+
+int autotune_lookup(const char* file, const TuneStats* stats, int symmetric,
+                    ReorderType reorder, TuneResult* res, int rank) {
+    int ibuf[7] = {0};
+    double weight = 0.0;
+    FILE* f = rank == 0 ? fopen(file, "r") : NULL;
+    if (f != NULL) {
+        char line[512];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (line[0] == '#') continue;
+            unsigned long long fp;
+            int n, p, threads, sym, chunk, sigma, block, use_threads;
+            long long nnz;
+            double w;
+            char reo[16], fmt[16], part[16];
+            if (sscanf(line, "%llx %d %lld %d %d %d %15s %15s %d %d %d %d %15s %lf", &fp, &n,
+                       &nnz, &p, &threads, &sym, reo, fmt, &chunk, &sigma, &block, &use_threads,
+                       part, &w) != 14) {
+                continue;
+            }
+            SparseFormat format;
+            PartitionType part_type;
+            if (fp != stats->fingerprint || n != stats->global_n || nnz != stats->global_nnz ||
+                p != stats->processes || threads != stats->max_threads || sym != symmetric ||
+                strcmp(reo, reorder_name(reorder)) != 0 ||
+                sparse_format_from_string(fmt, &format) != 0 ||
+                partition_type_from_string(part, &part_type) != 0) {
+                continue;
+            }
+            ibuf[0] = 1;
+            ibuf[1] = format;
+            ibuf[2] = chunk;
+            ibuf[3] = sigma;
+            ibuf[4] = block;
+            ibuf[5] = use_threads;
+            ibuf[6] = part_type;
+            weight = w;
+        }
+        fclose(f);
+    }
+    MPI_Bcast(ibuf, 7, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&weight, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (!ibuf[0]) {
+        if (rank == 0) printf("Autotune: no entry in %s, running trials\n", file);
+        return 0;
+    }
+    res->format = (SparseFormat)ibuf[1];
+    res->sell_chunk = ibuf[2];
+    res->sell_sigma = ibuf[3];
+    res->bcsr_block = ibuf[4];
+    res->threads = ibuf[5];
+    res->part = (PartitionType)ibuf[6];
+    res->part_weight = weight;
+    res->cached = 1;
+    if (rank == 0) printf("Autotune: using the entry in %s\n", file);
+    return 1;
+}
+
+// Products per trial so that the slowest process runs about AUTOTUNE_TRIAL_SECONDS
+static int trial_reps(double t_once) {
+    double t_max;
+    MPI_Allreduce(&t_once, &t_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    double reps = t_max > 0.0 ? AUTOTUNE_TRIAL_SECONDS / t_max : AUTOTUNE_MAX_REPS;
+    if (reps < AUTOTUNE_MIN_REPS) return AUTOTUNE_MIN_REPS;
+    if (reps > AUTOTUNE_MAX_REPS) return AUTOTUNE_MAX_REPS;
+    return (int)reps;
+}
+
+static double time_csr(int* ptr, int* cols, double* vals, double* x, double* y,
+                       int local_n, int reps) {
+    double t0 = MPI_Wtime();
+    for (int r = 0; r < reps; r++) mat_vec_csr(ptr, cols, vals, x, y, local_n);
+    return MPI_Wtime() - t0;
+}
+
+void autotune_partition(int* ptr, const int* cols, double* vals, int local_n,
+                        const RowDist* dist, const TuneStats* stats, int rank,
+                        TuneResult* res) {
+    int p = dist->p;
+    if (p < 2) return;
+    int nnz = ptr[local_n];
+
+    // Local SpMV on a renumbered copy of the columns
+    int* lcols = tune_alloc((size_t)nnz * sizeof(int), rank);
+    memcpy(lcols, cols, (size_t)nnz * sizeof(int));
+    HaloPlan plan;
+    halo_setup(ptr, lcols, dist, rank, &plan);
+    double* x = vec_alloc(local_n + plan.n_ghost);
+    double* y = vec_alloc(local_n);
+    if (x == NULL || y == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate autotuning vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n + plan.n_ghost; i++) x[i] = 1.0;
+    int reps = trial_reps(time_csr(ptr, lcols, vals, x, y, local_n, 1));
+    MPI_Barrier(MPI_COMM_WORLD);
+    double sample[3] = {(double)local_n, (double)nnz, time_csr(ptr, lcols, vals, x, y,
+                                                                local_n, reps) / reps};
+    double* all = tune_alloc((size_t)3 * p * sizeof(double), rank);
+    MPI_Allgather(sample, 3, MPI_DOUBLE, all, 3, MPI_DOUBLE, MPI_COMM_WORLD);
+    free(x);
+    free(y);
+    free(lcols);
+    halo_free(&plan);
+
+    // Least-squares fit t = a * rows + b * nonzeros
+    double srr = 0.0, srz = 0.0, szz = 0.0, srt = 0.0, szt = 0.0, t_max = 0.0, t_sum = 0.0;
+    for (int k = 0; k < p; k++) {
+        double r = all[3 * k], z = all[3 * k + 1], t = all[3 * k + 2];
+        srr += r * r;
+        srz += r * z;
+        szz += z * z;
+        srt += r * t;
+        szt += z * t;
+        t_sum += t;
+        if (t > t_max) t_max = t;
+    }
+    double det = srr * szz - srz * srz;
+    int solvable = det > 1e-9 * srr * szz;
+    double a = solvable ? (srt * szz - szt * srz) / det : 0.0;
+    double b = solvable ? (szt * srr - srt * srz) / det : 0.0;
+    if (a < 0.0) a = 0.0;
+    if (b < 0.0) b = 0.0;
+
+    // Imbalance measured and predicted by the fit
+    double m_max = 0.0, m_sum = 0.0;
+    for (int k = 0; k < p; k++) {
+        double m = a * all[3 * k] + b * all[3 * k + 1];
+        m_sum += m;
+        if (m > m_max) m_max = m;
+    }
+    free(all);
+    double imbalance = t_sum > 0.0 ? t_max * p / t_sum : 1.0;
+    double predicted = m_sum > 0.0 ? m_max * p / m_sum : 1.0;
+    if (!solvable || a + b <= 0.0) {
+        if (rank == 0) {
+            printf("Autotune partition: SpMV imbalance %.3f, rows and nonzeros not separable, "
+                   "keeping %s\n", imbalance, partition_type_name(res->part));
+        }
+        return;
+    }
+    double weight = b * stats->avg_len / (a + b * stats->avg_len);
+    int change = imbalance > AUTOTUNE_IMBALANCE && predicted > AUTOTUNE_IMBALANCE;
+    if (rank == 0) {
+        printf("Autotune partition: SpMV imbalance %.3f (%.3f predicted), %.2e s per row + "
+               "%.2e s per nonzero -> %s\n", imbalance, predicted, a, b,
+               change ? "mixed" : partition_type_name(res->part));
+    }
+    if (change) {
+        res->part = PART_MIXED;
+        res->part_weight = weight;
+    }
+}
+
+// Slowest process time per product of the current candidate
+static double slowest(double t_local, int reps) {
+    double t_max;
+    MPI_Allreduce(&t_local, &t_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return t_max / reps;
+}
+
+/**
+ * @brief One storage candidate, with a copy per row set as in the solver
+ *
+ * Row set 0 holds the interior rows, row set 1 the boundary rows (see
+ * csr_split_rows()).
+ */
+typedef struct {
+    SparseFormat format;
+    int sell_chunk;
+    int sell_sigma;
+    int bcsr_block;
+    int row_start;        // Global index of local row 0, where BCSR blocks align
+    int* rows[2];
+    int n_rows[2];
+    int* bounds[2];       // Thread split of the CSR kernels for the current thread count
+    SellMatrix sell[2];
+    BcsrMatrix bcsr[2];
+} Candidate;
+
+static void candidate_setup(Candidate* c, int* ptr, int* cols, double* vals, int local_n,
+                            int n_ghost) {
+    for (int s = 0; s < 2; s++) {
+        if (c->format == SPARSE_FORMAT_SELL) {
+            sell_from_csr(&c->sell[s], ptr, cols, vals, c->rows[s], c->n_rows[s],
+                          c->sell_chunk, c->sell_sigma);
+        } else if (c->format == SPARSE_FORMAT_BCSR) {
+            bcsr_from_csr(&c->bcsr[s], ptr, cols, vals, c->rows[s], c->n_rows[s], local_n,
+                          local_n + n_ghost, c->bcsr_block, c->row_start);
+        }
+        c->bounds[s] = NULL;
+    }
+}
+
+// Rebuild the CSR thread splits after the thread count changed
+static void candidate_threads(Candidate* c, const int* ptr) {
+    if (c->format != SPARSE_FORMAT_CSR && c->format != SPARSE_FORMAT_CSR_UNROLL) return;
+    for (int s = 0; s < 2; s++) {
+        free(c->bounds[s]);
+        c->bounds[s] = csr_thread_bounds(ptr, c->rows[s], c->n_rows[s]);
+    }
+}
+
+static void candidate_apply(Candidate* c, int* ptr, int* cols, double* vals, double* x,
+                            double* y) {
+    for (int s = 0; s < 2; s++) {
+        if (c->format == SPARSE_FORMAT_SELL) {
+            mat_vec_sell(&c->sell[s], x, y);
+        } else if (c->format == SPARSE_FORMAT_BCSR) {
+            mat_vec_bcsr(&c->bcsr[s], x, y);
+        } else if (c->format == SPARSE_FORMAT_CSR_UNROLL) {
+            mat_vec_csr_rows_unroll(ptr, cols, vals, x, y, c->rows[s], c->n_rows[s],
+                                    c->bounds[s]);
+        } else {
+            mat_vec_csr_rows(ptr, cols, vals, x, y, c->rows[s], c->n_rows[s], c->bounds[s]);
+        }
+    }
+}
+
+static void candidate_free(Candidate* c) {
+    for (int s = 0; s < 2; s++) {
+        if (c->format == SPARSE_FORMAT_SELL) sell_free(&c->sell[s]);
+        if (c->format == SPARSE_FORMAT_BCSR) bcsr_free(&c->bcsr[s]);
+        free(c->bounds[s]);
+    }
+}
+
+static void candidate_label(const Candidate* c, int symmetric, char* label, size_t size) {
+    if (c->format == SPARSE_FORMAT_SELL) {
+        snprintf(label, size, "sell-%d-%d", c->sell_chunk, c->sell_sigma);
+    } else if (c->format == SPARSE_FORMAT_BCSR) {
+        snprintf(label, size, "bcsr-%dx%d", c->bcsr_block, c->bcsr_block);
+    } else {
+        snprintf(label, size, "%s", symmetric ? "csr-sym" : sparse_format_name(c->format));
+    }
+}
+
+/**
+ * @brief Block sizes whose BCSR fill reaches AUTOTUNE_BLOCK_FILL (collective)
+ *
+ * The fill, nonzeros per stored value, is measured on the row sets and
+ * local column numbering the solver would convert. A block size is out
+ * when some process owns fewer rows, since that process would keep CSR.
+ *
+ * @return Number of block sizes written to blocks
+ */
+static int select_blocks(const int* ptr, const int* cols, int local_n, int n_ghost,
+                         int row_start, int* const rows[2], const int n_rows[2], int rank,
+                         int* blocks) {
+    int min_n;
+    MPI_Allreduce(&local_n, &min_n, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    double local[6] = {0.0};
+    for (int k = 0; k < 3; k++) {
+        if (min_n < block_sizes[k]) continue;
+        for (int s = 0; s < 2; s++) {
+            long long nnz, stored;
+            bcsr_count(ptr, cols, rows[s], n_rows[s], local_n, local_n + n_ghost,
+                       block_sizes[k], row_start, &nnz, &stored);
+            local[2 * k] += (double)nnz;
+            local[2 * k + 1] += (double)stored;
+        }
+    }
+    double sum[6];
+    MPI_Allreduce(local, sum, 6, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    int n_blocks = 0;
+    char line[128] = "";
+    for (int k = 0; k < 3; k++) {
+        int b = block_sizes[k];
+        size_t len = strlen(line);
+        if (sum[2 * k + 1] > 0.0) {
+            double fill = sum[2 * k] / sum[2 * k + 1];
+            if (fill >= AUTOTUNE_BLOCK_FILL) blocks[n_blocks++] = b;
+            snprintf(line + len, sizeof(line) - len, "%s %dx%d %.2f", k > 0 ? "," : "", b, b,
+                     fill);
+        } else {
+            snprintf(line + len, sizeof(line) - len, "%s %dx%d -", k > 0 ? "," : "", b, b);
+        }
+    }
+    if (rank == 0) {
+        printf("Autotune BCSR fill (nonzeros per stored value):%s%s\n", line,
+               n_blocks > 0 ? "" : "; none reaches the threshold, no BCSR trials");
+    }
+    return n_blocks;
+}
+
+void autotune_kernel(int* ptr, int* cols, double* vals, int local_n, int n_ghost,
+                     int row_start, int symmetric, int keep_format, int rank,
+                     TuneResult* res) {
+    double* x = vec_alloc(local_n + n_ghost);
+    double* y = vec_alloc(local_n);
+    if (x == NULL || y == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate autotuning vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n + n_ghost; i++) x[i] = 1.0;
+
+    int threads[AUTOTUNE_MAX_THREAD_TRIALS];
+    int n_threads = 0;
+    for (int t = max_threads(); t >= 1 && n_threads < AUTOTUNE_MAX_THREAD_TRIALS; t /= 2) {
+        threads[n_threads++] = t;
+    }
+
+    // Candidates: CSR (or the symmetric kernel), unrolled CSR, the SELL
+    // variants, and BCSR with each block size filled densely enough
+    Candidate cand[2 + 6 + 3];
+    int n_cand = 1;
+    memset(cand, 0, sizeof(cand));
+    cand[0].format = SPARSE_FORMAT_CSR;
+    int* rows[2] = {NULL, NULL};
+    int n_rows[2] = {0, 0};
+    if (!symmetric) {
+        csr_split_rows(ptr, cols, local_n, &rows[0], &n_rows[0], &rows[1], &n_rows[1]);
+    }
+    if (!symmetric && !keep_format) {
+        cand[n_cand++].format = SPARSE_FORMAT_CSR_UNROLL;
+        for (int k = 0; k < 6; k++) {
+            cand[n_cand].format = SPARSE_FORMAT_SELL;
+            cand[n_cand].sell_chunk = sell_chunks[k / 2];
+            cand[n_cand].sell_sigma = sell_sigmas[k % 2];
+            n_cand++;
+        }
+        int blocks[3];
+        int n_blocks = select_blocks(ptr, cols, local_n, n_ghost, row_start, rows, n_rows,
+                                     rank, blocks);
+        for (int k = 0; k < n_blocks; k++) {
+            cand[n_cand].format = SPARSE_FORMAT_BCSR;
+            cand[n_cand].bcsr_block = blocks[k];
+            n_cand++;
+        }
+    }
+    for (int c = 0; c < n_cand; c++) {
+        for (int s = 0; s < 2; s++) {
+            cand[c].rows[s] = rows[s];
+            cand[c].n_rows[s] = n_rows[s];
+        }
+        cand[c].row_start = row_start;
+    }
+
+    int reps = trial_reps(time_csr(ptr, cols, vals, x, y, local_n, 1));
+    if (rank == 0) printf("Autotune trials (%d products each):\n", reps);
+    double t_default = 0.0, t_best = 0.0;
+    SymMatrix S;
+    if (symmetric) sym_setup(&S, ptr, cols, vals, local_n, n_ghost);
+    for (int c = 0; c < n_cand; c++) {
+        if (!symmetric) candidate_setup(&cand[c], ptr, cols, vals, local_n, n_ghost);
+        double t_format = 0.0;
+        int best_threads = threads[0];
+        for (int k = 0; k < n_threads; k++) {
+            set_threads(threads[k]);
+            if (!symmetric) candidate_threads(&cand[c], ptr);
+            MPI_Barrier(MPI_COMM_WORLD);
+            double t0 = MPI_Wtime();
+            for (int r = 0; r < reps; r++) {
+                if (symmetric) {
+                    mat_vec_sym_local(&S, x, y);
+                    mat_vec_sym_ghost(&S, x, y);
+                } else {
+                    candidate_apply(&cand[c], ptr, cols, vals, x, y);
+                }
+            }
+            double t = slowest(MPI_Wtime() - t0, reps);
+            if (c == 0 && k == 0) t_default = t;
+            if (k == 0 || t < t_format) {
+                t_format = t;
+                best_threads = threads[k];
+            }
+        }
+        if (!symmetric) candidate_free(&cand[c]);
+        if (rank == 0) {
+            char label[32];
+            candidate_label(&cand[c], symmetric, label, sizeof(label));
+            printf("  %-12s %10.3e s/SpMV with %d threads\n", label, t_format, best_threads);
+        }
+        if (c == 0 || t_format < t_best) {
+            t_best = t_format;
+            res->threads = best_threads;
+            if (!keep_format) {
+                res->format = cand[c].format;
+                if (cand[c].format == SPARSE_FORMAT_SELL) {
+                    res->sell_chunk = cand[c].sell_chunk;
+                    res->sell_sigma = cand[c].sell_sigma;
+                } else if (cand[c].format == SPARSE_FORMAT_BCSR) {
+                    res->bcsr_block = cand[c].bcsr_block;
+                }
+            }
+        }
+    }
+    if (symmetric) sym_free(&S);
+    set_threads(threads[0]);
+    if (rank == 0) {
+        printf("Autotune: %.2fx faster SpMV than %s with %d threads\n",
+               t_best > 0.0 ? t_default / t_best : 1.0, symmetric ? "csr-sym" : "csr",
+               threads[0]);
+    }
+    free(rows[0]);
+    free(rows[1]);
+    free(x);
+    free(y);
+}
+
+void autotune_store(const char* file, const TuneStats* stats, int symmetric,
+                    ReorderType reorder, const TuneResult* res, int rank) {
+    if (rank != 0) return;
+    FILE* f = fopen(file, "r");
+    int exists = f != NULL;
+    if (f != NULL) fclose(f);
+    f = fopen(file, "a");
+    if (f == NULL) {
+        fprintf(stderr, "Warning: Cannot write tuning file %s\n", file);
+        return;
+    }
+    if (!exists) {
+        fprintf(f, "# fingerprint n nnz processes threads symmetric reorder | "
+                "format sell_c sell_sigma bcsr_block threads partition weight\n");
+    }
+    fprintf(f, "%016llx %d %lld %d %d %d %s %s %d %d %d %d %s %.4f\n", stats->fingerprint,
+            stats->global_n, stats->global_nnz, stats->processes, stats->max_threads,
+            symmetric, reorder_name(reorder), sparse_format_name(res->format),
+            res->sell_chunk, res->sell_sigma, res->bcsr_block, res->threads,
+            partition_type_name(res->part), res->part_weight);
+    fclose(f);
+}
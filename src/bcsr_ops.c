@@ -0,0 +1,243 @@
+/**
+ * @file bcsr_ops.c
+ * @brief Implementation of block CSR storage and SpMV
+ */
+
+#include "bcsr_ops.h"
+#include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int bcsr_block_supported(int block) {
+    return block == 2 || block == 3 || block == 6;
+}
+
+static int compare_int(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// First column of the block holding column c. Blocks of owned columns end
+// before the ghost entries, which may still be in flight for interior rows.
+static int block_start(const BcsrMatrix* A, int c, int n_owned, int n_cols) {
+    int block = A->block;
+    if (c < n_owned) {
+        int c0 = (c + A->shift) / block * block - A->shift;
+        if (c0 < 0) return 0;
+        return c0 > n_owned - block ? n_owned - block : c0;
+    }
+    int c0 = n_owned + (c - n_owned) / block * block;
+    return c0 > n_cols - block ? n_cols - block : c0;
+}
+
+// Sorted distinct block starts of the rows of group g; returns their number
+static int group_blocks(const BcsrMatrix* A, int g, const int* ptr, const int* cols,
+                        int n_owned, int n_cols, int* keys) {
+    int len = 0;
+    for (int r = 0; r < A->block; r++) {
+        int i = A->g_rows[(size_t)g * A->block + r];
+        if (i < 0) continue;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            keys[len++] = block_start(A, cols[j], n_owned, n_cols);
+        }
+    }
+    qsort(keys, len, sizeof(int), compare_int);
+    int n = 0;
+    for (int k = 0; k < len; k++) {
+        if (n == 0 || keys[k] != keys[n - 1]) keys[n++] = keys[k];
+    }
+    return n;
+}
+
+// Group the rows and allocate group_ptr; returns the largest group length
+static int bcsr_groups(BcsrMatrix* A, const int* ptr, const int* rows, int n_rows,
+                       int n_owned, int block, int row_start) {
+    if (!bcsr_block_supported(block) || n_owned < block) {
+        fprintf(stderr, "BCSR: block size %d unsupported or larger than %d owned columns\n",
+                block, n_owned);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memset(A, 0, sizeof(BcsrMatrix));
+    A->block = block;
+    A->shift = row_start % block;
+    A->n_rows = n_rows;
+
+    // Rows sharing (i + shift) / block form a group
+    for (int k = 0, prev = -1; k < n_rows; k++) {
+        int i = rows ? rows[k] : k;
+        if ((i + A->shift) / block != prev) A->n_groups++;
+        prev = (i + A->shift) / block;
+    }
+    size_t n_slots = (size_t)A->n_groups * block;
+    A->g_rows = malloc((n_slots + 1) * sizeof(int));
+    A->group_ptr = malloc((A->n_groups + 1) * sizeof(int));
+    if (A->g_rows == NULL || A->group_ptr == NULL) {
+        fprintf(stderr, "BCSR: Failed to allocate group arrays\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (size_t s = 0; s < n_slots; s++) {
+        A->g_rows[s] = -1;
+    }
+    int max_len = 0;
+    for (int k = 0, g = -1, prev = -1, len = 0; k < n_rows; k++) {
+        int i = rows ? rows[k] : k;
+        if ((i + A->shift) / block != prev) {
+            g++;
+            len = 0;
+        }
+        prev = (i + A->shift) / block;
+        A->g_rows[(size_t)g * block + (i + A->shift) % block] = i;
+        len += ptr[i + 1] - ptr[i];
+        if (len > max_len) max_len = len;
+        A->nnz += ptr[i + 1] - ptr[i];
+    }
+    return max_len;
+}
+
+// Count the blocks of each group into group_ptr
+static void bcsr_count_blocks(BcsrMatrix* A, const int* ptr, const int* cols,
+                              int n_owned, int n_cols, int max_len) {
+    int* keys = malloc((max_len + 1) * sizeof(int));
+    if (keys == NULL) {
+        fprintf(stderr, "BCSR: Failed to allocate block keys\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    A->group_ptr[0] = 0;
+    for (int g = 0; g < A->n_groups; g++) {
+        A->group_ptr[g + 1] = A->group_ptr[g] +
+                              group_blocks(A, g, ptr, cols, n_owned, n_cols, keys);
+    }
+    free(keys);
+}
+
+void bcsr_from_csr(BcsrMatrix* A, const int* ptr, const int* cols, const double* vals,
+                   const int* rows, int n_rows, int n_owned, int n_cols, int block,
+                   int row_start) {
+    int max_len = bcsr_groups(A, ptr, rows, n_rows, n_owned, block, row_start);
+    bcsr_count_blocks(A, ptr, cols, n_owned, n_cols, max_len);
+
+    int n_blocks = A->group_ptr[A->n_groups];
+    size_t bb = (size_t)block * block;
+    A->block_cols = malloc((n_blocks + 1) * sizeof(int));
+    A->vals = malloc(((size_t)n_blocks * bb + 1) * sizeof(double));
+    if (A->block_cols == NULL || A->vals == NULL) {
+        fprintf(stderr, "BCSR: Failed to allocate %d blocks\n", n_blocks);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Fill with the kernel's group split so first touch matches the SpMV threads
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int g_begin, g_end;
+        csr_thread_rows(A->group_ptr, A->n_groups, tid, n_threads, &g_begin, &g_end);
+        int* group_keys = malloc((max_len + 1) * sizeof(int));
+        if (group_keys == NULL) {
+            fprintf(stderr, "BCSR: Failed to allocate block keys\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (int g = g_begin; g < g_end; g++) {
+            int n = group_blocks(A, g, ptr, cols, n_owned, n_cols, group_keys);
+            int* bcols = A->block_cols + A->group_ptr[g];
+            double* bvals = A->vals + (size_t)A->group_ptr[g] * bb;
+            memcpy(bcols, group_keys, n * sizeof(int));
+            memset(bvals, 0, n * bb * sizeof(double));
+            for (int r = 0; r < block; r++) {
+                int i = A->g_rows[(size_t)g * block + r];
+                if (i < 0) continue;
+                for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                    int c0 = block_start(A, cols[j], n_owned, n_cols);
+                    const int* hit = bsearch(&c0, bcols, n, sizeof(int), compare_int);
+                    bvals[(size_t)(hit - bcols) * bb + r * block + (cols[j] - c0)] += vals[j];
+                }
+            }
+        }
+        free(group_keys);
+    }
+}
+
+/*
+ * One kernel per block size: with B a constant the block loops unroll
+ * completely and the B partial sums stay in registers.
+ */
+#define BCSR_KERNEL(B)                                                              \
+    static void bcsr_groups_##B(const BcsrMatrix* A, const double* x_ext, double* y, \
+                                int g_begin, int g_end) {                            \
+        for (int g = g_begin; g < g_end; g++) {                                      \
+            double sum[B] = {0.0};                                                   \
+            for (int k = A->group_ptr[g]; k < A->group_ptr[g + 1]; k++) {            \
+                const double* a = A->vals + (size_t)k * (B * B);                     \
+                const double* x = x_ext + A->block_cols[k];                          \
+                for (int r = 0; r < B; r++) {                                        \
+                    for (int c = 0; c < B; c++) {                                    \
+                        sum[r] += a[r * B + c] * x[c];                               \
+                    }                                                                \
+                }                                                                    \
+            }                                                                        \
+            const int* slot_rows = A->g_rows + (size_t)g * B;                        \
+            for (int r = 0; r < B; r++) {                                            \
+                if (slot_rows[r] >= 0) y[slot_rows[r]] = sum[r];                     \
+            }                                                                        \
+        }                                                                            \
+    }
+
+BCSR_KERNEL(2)
+BCSR_KERNEL(3)
+BCSR_KERNEL(6)
+
+void mat_vec_bcsr(const BcsrMatrix* A, const double* x_ext, double* y) {
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int g_begin, g_end;
+        csr_thread_rows(A->group_ptr, A->n_groups, tid, n_threads, &g_begin, &g_end);
+        switch (A->block) {
+            case 2:
+                bcsr_groups_2(A, x_ext, y, g_begin, g_end);
+                break;
+            case 3:
+                bcsr_groups_3(A, x_ext, y, g_begin, g_end);
+                break;
+            default:
+                bcsr_groups_6(A, x_ext, y, g_begin, g_end);
+                break;
+        }
+    }
+}
+
+void bcsr_count(const int* ptr, const int* cols, const int* rows, int n_rows,
+                int n_owned, int n_cols, int block, int row_start, long long* nnz,
+                long long* stored) {
+    BcsrMatrix A;
+    bcsr_count_blocks(&A, ptr, cols, n_owned, n_cols,
+                      bcsr_groups(&A, ptr, rows, n_rows, n_owned, block, row_start));
+    *nnz = A.nnz;
+    *stored = bcsr_stored_entries(&A);
+    bcsr_free(&A);
+}
+
+long long bcsr_stored_entries(const BcsrMatrix* A) {
+    return A->n_groups > 0 ? (long long)A->group_ptr[A->n_groups] * A->block * A->block : 0;
+}
+
+void bcsr_free(BcsrMatrix* A) {
+    free(A->g_rows);
+    free(A->group_ptr);
+    free(A->block_cols);
+    free(A->vals);
+    memset(A, 0, sizeof(BcsrMatrix));
+}
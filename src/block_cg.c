@@ -0,0 +1,452 @@
+/**
+ * @file block_cg.c
+ * @brief Implementation of CG for several right-hand sides
+ */
+
+#include "block_cg.h"
+#include "precond_ops.h"
+#include "profile.h"
+#include "sparse_ops.h"
+#include "vector_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+/**
+ * @brief Distributed operator Y = A X on blocks, with overlapped ghost exchange
+ */
+typedef struct {
+    int* ptr;
+    int* cols;
+    double* vals;
+    HaloPlan* halo;
+    int* interior_rows;
+    int n_interior;
+    int* interior_bounds;
+    int* boundary_rows;
+    int n_boundary;
+    int* boundary_bounds;
+} BlockOperator;
+
+// Y = A X for a block of k vectors; X_ext has room for the ghost rows
+static void block_apply(BlockOperator* op, double* X_ext, double* Y, int k) {
+    prof_begin(PROF_SPMV);
+    halo_exchange_block_begin(op->halo, X_ext, k);
+    mat_mat_csr_rows(op->ptr, op->cols, op->vals, X_ext, Y, k,
+                     op->interior_rows, op->n_interior, op->interior_bounds);
+    halo_exchange_end(op->halo);
+    mat_mat_csr_rows(op->ptr, op->cols, op->vals, X_ext, Y, k,
+                     op->boundary_rows, op->n_boundary, op->boundary_bounds);
+    prof_end(PROF_SPMV);
+}
+
+/**
+ * @brief Local inner products of the columns of two n x m blocks
+ *
+ * With full set, stores all pairs, G[a * m + c] = U(:, a) . V(:, c),
+ * assuming U^T V is symmetric (only a <= c is computed);
+ * otherwise only the m matching pairs, G[c] = U(:, c) . V(:, c). With uu
+ * set, also stores uu[c] = U(:, c) . U(:, c) after them in the same pass
+ * (G must then have room for gs + m values).
+ */
+static void local_gram(const double* restrict U, const double* restrict V, int n, int m,
+                       int full, int uu, double* restrict G) {
+    int gs = full ? m * m : m;
+    int len = uu ? gs + m : gs;
+    prof_begin(PROF_DOT);
+    for (int t = 0; t < len; t++) {
+        G[t] = 0.0;
+    }
+    if (full) {
+        #pragma omp parallel for reduction(+:G[:len]) schedule(static)
+        for (int i = 0; i < n; i++) {
+            const double* u = U + (size_t)i * m;
+            const double* v = V + (size_t)i * m;
+            for (int a = 0; a < m; a++) {
+                for (int c = a; c < m; c++) {
+                    G[a * m + c] += u[a] * v[c];
+                }
+            }
+            if (uu) {
+                for (int c = 0; c < m; c++) {
+                    G[gs + c] += u[c] * u[c];
+                }
+            }
+        }
+        // Both Gram matrices of CG (P^T A P, R^T M^{-1} R) are symmetric
+        for (int a = 0; a < m; a++) {
+            for (int c = 0; c < a; c++) {
+                G[a * m + c] = G[c * m + a];
+            }
+        }
+    } else if (uu) {
+        #pragma omp parallel for reduction(+:G[:len]) schedule(static)
+        for (int i = 0; i < n; i++) {
+            const double* u = U + (size_t)i * m;
+            const double* v = V + (size_t)i * m;
+            for (int c = 0; c < m; c++) {
+                G[c] += u[c] * v[c];
+                G[gs + c] += u[c] * u[c];
+            }
+        }
+    } else {
+        #pragma omp parallel for reduction(+:G[:len]) schedule(static)
+        for (int i = 0; i < n; i++) {
+            const double* u = U + (size_t)i * m;
+            const double* v = V + (size_t)i * m;
+            for (int c = 0; c < m; c++) {
+                G[c] += u[c] * v[c];
+            }
+        }
+    }
+    prof_end(PROF_DOT);
+}
+
+// In-place Cholesky factor (lower triangle) of an SPD m x m matrix; -1 if not SPD
+static int chol_factor(double* H, int m) {
+    for (int j = 0; j < m; j++) {
+        double d = H[j * m + j];
+        for (int t = 0; t < j; t++) {
+            d -= H[j * m + t] * H[j * m + t];
+        }
+        if (!(d > 0.0)) return -1;
+        d = sqrt(d);
+        H[j * m + j] = d;
+        for (int i = j + 1; i < m; i++) {
+            double s = H[i * m + j];
+            for (int t = 0; t < j; t++) {
+                s -= H[i * m + t] * H[j * m + t];
+            }
+            H[i * m + j] = s / d;
+        }
+    }
+    return 0;
+}
+
+// Overwrite the m x m matrix C with H^{-1} C, given the Cholesky factor of H
+static void chol_solve(const double* L, double* C, int m) {
+    for (int c = 0; c < m; c++) {
+        for (int i = 0; i < m; i++) {
+            double s = C[i * m + c];
+            for (int t = 0; t < i; t++) {
+                s -= L[i * m + t] * C[t * m + c];
+            }
+            C[i * m + c] = s / L[i * m + i];
+        }
+        for (int i = m - 1; i >= 0; i--) {
+            double s = C[i * m + c];
+            for (int t = i + 1; t < m; t++) {
+                s -= L[t * m + i] * C[t * m + c];
+            }
+            C[i * m + c] = s / L[i * m + i];
+        }
+    }
+}
+
+// Keep columns keep[0 .. m_new) of an n x m row-major block, in place
+static void compact_columns(double* A, int n, int m, const int* keep, int m_new) {
+    for (size_t i = 0; i < (size_t)n; i++) {
+        for (int c = 0; c < m_new; c++) {
+            A[i * m_new + c] = A[i * m + keep[c]];
+        }
+    }
+}
+
+int block_cg_solver(int* ptr, int* cols, double* vals, const double* B, double* X, int k,
+                    int local_n, HaloPlan* halo, int rank, const CGOptions* opts) {
+    prof_begin(PROF_SOLVE);
+    BlockOperator op;
+    op.ptr = ptr;
+    op.cols = cols;
+    op.vals = vals;
+    op.halo = halo;
+    csr_split_rows(ptr, cols, local_n, &op.interior_rows, &op.n_interior,
+                   &op.boundary_rows, &op.n_boundary);
+    op.interior_bounds = csr_thread_bounds(ptr, op.interior_rows, op.n_interior);
+    op.boundary_bounds = csr_thread_bounds(ptr, op.boundary_rows, op.n_boundary);
+
+    Preconditioner pc;
+    if (opts->pc == PC_AMG) {
+        precond_setup_amg(&pc, ptr, cols, vals, local_n, halo, &opts->amg, opts->verbose);
+    } else {
+        precond_setup(&pc, opts->pc, opts->pc_omega, ptr, cols, vals, local_n);
+    }
+    int precond = pc.type != PC_NONE;
+    int full = opts->rhs_method == CG_RHS_BLOCK;
+
+    // Blocks shrink from k to m columns as right-hand sides converge
+    size_t ext_n = (size_t)local_n + halo->n_ghost;
+    double* R = vec_alloc(local_n * k);
+    double* Z = precond ? vec_alloc(local_n * k) : R;
+    double* Q = vec_alloc(local_n * k);
+    double* Xa = vec_alloc(local_n * k);
+    double* P = vec_alloc((int)(ext_n * k));
+    double* P_new = full ? vec_alloc((int)(ext_n * k)) : NULL;
+    double* red = malloc(((size_t)k * k + 2 * k) * sizeof(double));
+    double* red_sum = malloc(((size_t)k * k + 2 * k) * sizeof(double));
+    double* G = malloc((size_t)k * k * sizeof(double));
+    double* H = malloc((size_t)k * k * sizeof(double));
+    double* coef = malloc((size_t)k * k * sizeof(double));
+    double* rr0 = malloc(k * sizeof(double));
+    double* rr = malloc(k * sizeof(double));
+    double* res = malloc(k * sizeof(double));
+    int* col_of = malloc(k * sizeof(int));
+    int* keep = malloc(k * sizeof(int));
+    int* col_iter = malloc(k * sizeof(int));
+    if (R == NULL || Z == NULL || Q == NULL || Xa == NULL || P == NULL ||
+        (full && P_new == NULL) || red == NULL || red_sum == NULL || G == NULL ||
+        H == NULL || coef == NULL || rr0 == NULL || rr == NULL || res == NULL ||
+        col_of == NULL || keep == NULL || col_iter == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate block CG vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int m = k;
+    for (int c = 0; c < k; c++) {
+        col_of[c] = c;
+        col_iter[c] = 0;
+    }
+    memcpy(Xa, X, (size_t)local_n * k * sizeof(double));
+
+    // R = B - A X, Z = M^{-1} R; R^T Z, the residual norms and the norms of B
+    // (the stopping reference) in one reduction
+    memcpy(P, Xa, (size_t)local_n * k * sizeof(double));
+    block_apply(&op, P, Q, k);
+    prof_begin(PROF_UPDATE);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < local_n * k; i++) {
+        R[i] = B[i] - Q[i];
+    }
+    prof_end(PROF_UPDATE);
+    if (precond) precond_apply_block(&pc, R, Z, m);
+    int gs = full ? m * m : m;
+    local_gram(R, Z, local_n, m, full, 1, red);
+    for (int c = 0; c < k; c++) {
+        double bb = 0.0;
+        for (size_t i = 0; i < (size_t)local_n; i++) bb += B[i * k + c] * B[i * k + c];
+        red[gs + m + c] = bb;
+    }
+    allreduce_sum(red, red_sum, gs + 2 * m);
+    memcpy(G, red_sum, gs * sizeof(double));
+    for (int c = 0; c < k; c++) {
+        rr[c] = red_sum[gs + c];
+        rr0[c] = red_sum[gs + m + c] > 0.0 ? red_sum[gs + m + c] : rr[c];
+    }
+    memcpy(P, Z, (size_t)local_n * k * sizeof(double));
+
+    double tol2 = opts->tol * opts->tol;
+    int iter = 0;
+    for (;;) {
+        // Drop converged right-hand sides from the block
+        int m_new = 0;
+        for (int c = 0; c < m; c++) {
+            int col = col_of[c];
+            if (rr[c] <= tol2 * rr0[col]) {
+                #pragma omp parallel for schedule(static)
+                for (int i = 0; i < local_n; i++) {
+                    X[(size_t)i * k + col] = Xa[(size_t)i * m + c];
+                }
+                res[col] = rr0[col] > 0.0 ? sqrt(rr[c] / rr0[col]) : 0.0;
+            } else {
+                keep[m_new++] = c;
+            }
+        }
+        if (m_new < m) {
+            compact_columns(Xa, local_n, m, keep, m_new);
+            compact_columns(R, local_n, m, keep, m_new);
+            if (precond) compact_columns(Z, local_n, m, keep, m_new);
+            int gs_new = full ? m_new * m_new : m_new;
+            for (int a = 0; a < m_new; a++) {
+                col_of[a] = col_of[keep[a]];
+                rr[a] = rr[keep[a]];
+                if (!full) {
+                    G[a] = G[keep[a]];
+                }
+                for (int c = 0; full && c < m_new; c++) {
+                    coef[a * m_new + c] = G[keep[a] * m + keep[c]];
+                }
+            }
+            if (full) {
+                // Search directions mix all columns: restart from P = Z
+                memcpy(G, coef, gs_new * sizeof(double));
+                memcpy(P, Z, (size_t)local_n * m_new * sizeof(double));
+            } else {
+                compact_columns(P, local_n, m, keep, m_new);
+            }
+            m = m_new;
+            gs = gs_new;
+        }
+        if (m == 0 || iter >= opts->max_iter) break;
+
+        // Q = A P: one pass over the matrix for all m directions
+        block_apply(&op, P, Q, m);
+        local_gram(P, Q, local_n, m, full, 0, red);
+        allreduce_sum(red, H, gs);
+
+        // Step lengths: alpha = (P^T A P)^{-1} (R^T Z)
+        int breakdown = 0;
+        memcpy(coef, G, gs * sizeof(double));
+        if (full) {
+            if (chol_factor(H, m) != 0) {
+                breakdown = 1;
+            } else {
+                chol_solve(H, coef, m);
+            }
+        } else {
+            for (int c = 0; c < m; c++) {
+                if (H[c] == 0.0) breakdown = 1;
+                else coef[c] /= H[c];
+            }
+        }
+        if (breakdown) {
+            if (rank == 0) {
+                fprintf(stderr, "Block CG breakdown: P^T A P is singular "
+                        "(linearly dependent right-hand sides?)\n");
+            }
+            break;
+        }
+
+        const double* restrict alpha = coef;
+        prof_begin(PROF_UPDATE);
+        if (full) {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < local_n; i++) {
+                const double* restrict p = P + (size_t)i * m;
+                const double* restrict q = Q + (size_t)i * m;
+                double* restrict x = Xa + (size_t)i * m;
+                double* restrict r = R + (size_t)i * m;
+                for (int a = 0; a < m; a++) {
+                    for (int c = 0; c < m; c++) {
+                        x[c] += p[a] * alpha[a * m + c];
+                        r[c] -= q[a] * alpha[a * m + c];
+                    }
+                }
+            }
+        } else {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < local_n; i++) {
+                const double* restrict p = P + (size_t)i * m;
+                const double* restrict q = Q + (size_t)i * m;
+                double* restrict x = Xa + (size_t)i * m;
+                double* restrict r = R + (size_t)i * m;
+                for (int c = 0; c < m; c++) {
+                    x[c] += alpha[c] * p[c];
+                    r[c] -= alpha[c] * q[c];
+                }
+            }
+        }
+        prof_end(PROF_UPDATE);
+
+        if (precond) precond_apply_block(&pc, R, Z, m);
+        local_gram(R, Z, local_n, m, full, 1, red);
+        allreduce_sum(red, red_sum, gs + m);
+        iter++;
+
+        int converged = 0;
+        double worst = 0.0;
+        for (int c = 0; c < m; c++) {
+            rr[c] = red_sum[gs + c];
+            col_iter[col_of[c]] = iter;
+            double rel = rr0[col_of[c]] > 0.0 ? rr[c] / rr0[col_of[c]] : 0.0;
+            if (rel > worst) worst = rel;
+            if (rr[c] <= tol2 * rr0[col_of[c]]) converged = 1;
+        }
+        if (rank == 0 && iter % 10 == 0) {
+            printf("  Iteration %d: residual = %.6e (%d of %d right-hand sides active)\n",
+                   iter, worst, m, k);
+        }
+        if (converged && full) {
+            // Deflated at the top of the loop, where the directions restart
+            memcpy(G, red_sum, gs * sizeof(double));
+            continue;
+        }
+
+        // Directions: beta = (R^T Z)_old^{-1} (R^T Z)_new, P = Z + P beta
+        if (full) {
+            memcpy(H, G, gs * sizeof(double));
+            memcpy(coef, red_sum, gs * sizeof(double));
+            if (chol_factor(H, m) != 0) {
+                if (rank == 0) fprintf(stderr, "Block CG breakdown: R^T Z is singular\n");
+                break;
+            }
+            chol_solve(H, coef, m);
+            const double* restrict beta = coef;
+            prof_begin(PROF_UPDATE);
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < local_n; i++) {
+                const double* restrict p = P + (size_t)i * m;
+                const double* restrict z = Z + (size_t)i * m;
+                double* restrict pn = P_new + (size_t)i * m;
+                for (int c = 0; c < m; c++) {
+                    double s = z[c];
+                    for (int a = 0; a < m; a++) {
+                        s += p[a] * beta[a * m + c];
+                    }
+                    pn[c] = s;
+                }
+            }
+            prof_end(PROF_UPDATE);
+            double* tmp = P;
+            P = P_new;
+            P_new = tmp;
+        } else {
+            for (int c = 0; c < m; c++) {
+                coef[c] = G[c] != 0.0 ? red_sum[c] / G[c] : 0.0;
+            }
+            const double* restrict beta = coef;
+            prof_begin(PROF_UPDATE);
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < local_n; i++) {
+                double* restrict p = P + (size_t)i * m;
+                const double* restrict z = Z + (size_t)i * m;
+                for (int c = 0; c < m; c++) {
+                    p[c] = z[c] + beta[c] * p[c];
+                }
+            }
+            prof_end(PROF_UPDATE);
+        }
+        memcpy(G, red_sum, gs * sizeof(double));
+    }
+
+    // Columns still active at max_iter or breakdown
+    for (int c = 0; c < m; c++) {
+        int col = col_of[c];
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < local_n; i++) {
+            X[(size_t)i * k + col] = Xa[(size_t)i * m + c];
+        }
+        res[col] = rr0[col] > 0.0 ? sqrt(rr[c] / rr0[col]) : 0.0;
+    }
+    if (rank == 0) {
+        for (int c = 0; c < k; c++) {
+            printf("  RHS %d: %d iterations, residual = %.6e\n", c, col_iter[c], res[c]);
+        }
+    }
+
+    free(op.interior_rows);
+    free(op.boundary_rows);
+    free(op.interior_bounds);
+    free(op.boundary_bounds);
+    precond_free(&pc);
+    free(R);
+    if (precond) free(Z);
+    free(Q);
+    free(Xa);
+    free(P);
+    free(P_new);
+    free(red);
+    free(red_sum);
+    free(G);
+    free(H);
+    free(coef);
+    free(rr0);
+    free(rr);
+    free(res);
+    free(col_of);
+    free(keep);
+    free(col_iter);
+    prof_end(PROF_SOLVE);
+    return iter;
+}
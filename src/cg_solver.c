@@ -4,65 +4,471 @@
  */
 
 #include "cg_solver.h"
+#include "bcsr_ops.h"
+#include "checkpoint.h"
+#include "compact_ops.h"
+#include "deflation.h"
+#include "halo.h"
+#include "matrix_powers.h"
+#include "node_halo.h"
+#include "precond_ops.h"
+#include "profile.h"
+#include "sell_ops.h"
 #include "sparse_ops.h"
+#include "sym_ops.h"
 #include "vector_ops.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <mpi.h>
 
-void cg_solver(int* ptr, int* cols, double* vals, double* b, double* x,
-               int local_n, int local_nnz, int global_n, 
-               int rank, int p, int max_iter, double tol) {
-    double* r = calloc(local_n, sizeof(double));
-    double* d = calloc(local_n, sizeof(double));
-    double* q = calloc(local_n, sizeof(double));
-    double* x_global = calloc(global_n, sizeof(double));
-    if (r == NULL || d == NULL || q == NULL || x_global == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate CG vectors\n", rank);
-        MPI_Abort(MPI_COMM_WORLD, 1);
+// Number of blocking exchanges timed to estimate the unhidden exchange cost
+#define OVERLAP_PROBE_REPS 5
+// Number of local SpMVs timed to report the compact format's bandwidth
+#define COMPACT_PROBE_REPS 10
+// Upper bound on iterative refinement steps
+#define REFINE_MAX_STEPS 20
+// Work vectors an operator keeps between solves (pipelined CG uses the most)
+#define OP_WORK_SLOTS 10
+
+/**
+ * @brief Distributed operator y = A x with overlapped ghost exchange
+ *
+ * Input vectors passed to op_apply() must have room for the ghost
+ * entries after the owned block. A matrix-free operator (user) replaces
+ * the matrix arrays, the halo plan and the row splits.
+ */
+typedef struct {
+    int* ptr;
+    int* cols;
+    double* vals;
+    int local_n;
+    int row_start;        // Global index of local row 0
+    int n_ghost;          // Ghost room after the owned block of input vectors
+    HaloPlan* halo;
+    const CGLinearOp* user;   // Callbacks computing the product (matrix-free), or NULL
+    int* interior_rows;
+    int n_interior;
+    int* interior_bounds;   // Nonzero-balanced thread split of interior_rows
+    int* boundary_rows;
+    int n_boundary;
+    int* boundary_bounds;   // Nonzero-balanced thread split of boundary_rows
+    SparseFormat format;
+    SellMatrix interior_sell;   // SELL copies of the row sets (format == SELL)
+    SellMatrix boundary_sell;
+    CompactMatrix interior_cmp; // Compact copies of the row sets (format == COMPACT)
+    CompactMatrix boundary_cmp;
+    BcsrMatrix interior_bcsr;   // Block CSR copies of the row sets (format == BCSR)
+    BcsrMatrix boundary_bcsr;
+    int symmetric;
+    SymMatrix sym;              // Upper-triangle SpMV state (symmetric)
+    int has_powers;
+    MatrixPowers powers;        // s-deep ghost region of s-step CG (CG_METHOD_SSTEP)
+    int has_node;
+    NodeHalo node;              // Node-aware exchange replacing halo's (opts->node_halo)
+    double* work[OP_WORK_SLOTS];    // Solver vectors, reused by later solves
+    int work_n[OP_WORK_SLOTS];
+    int n_apply;          // Number of SpMVs performed
+    double t_interior;    // Time computing interior rows while the exchange is in flight
+    double t_wait;        // Time waiting for the exchange after the interior rows
+} CGOperator;
+
+static void op_setup(CGOperator* op, int* ptr, int* cols, double* vals,
+                     int local_n, int row_start, HaloPlan* halo, const CGOptions* opts) {
+    memset(op, 0, sizeof(CGOperator));
+    op->ptr = ptr;
+    op->cols = cols;
+    op->vals = vals;
+    op->local_n = local_n;
+    op->row_start = row_start;
+    op->n_ghost = halo->n_ghost;
+    op->halo = halo;
+    op->symmetric = opts->symmetric;
+    if (op->symmetric) {
+        sym_setup(&op->sym, ptr, cols, vals, local_n, halo->n_ghost);
+        return;
+    }
+    if (opts->node_halo) {
+        node_halo_setup(&op->node, halo, opts->node_ranks);
+        op->has_node = 1;
     }
+    // Interior rows are computed while ghost entries are in flight
+    csr_split_rows(ptr, cols, local_n, &op->interior_rows, &op->n_interior,
+                   &op->boundary_rows, &op->n_boundary);
+    op->interior_bounds = csr_thread_bounds(ptr, op->interior_rows, op->n_interior);
+    op->boundary_bounds = csr_thread_bounds(ptr, op->boundary_rows, op->n_boundary);
+    op->format = opts->format;
+    // A process owning fewer rows than a block keeps CSR
+    if (op->format == SPARSE_FORMAT_BCSR && local_n < opts->bcsr_block) {
+        op->format = SPARSE_FORMAT_CSR;
+    }
+    if (opts->method == CG_METHOD_SSTEP) {
+        matrix_powers_setup(&op->powers, ptr, cols, vals, local_n, halo, opts->sstep_s);
+        op->has_powers = 1;
+    }
+    if (op->format == SPARSE_FORMAT_SELL) {
+        sell_from_csr(&op->interior_sell, ptr, cols, vals, op->interior_rows, op->n_interior,
+                      opts->sell_chunk, opts->sell_sigma);
+        sell_from_csr(&op->boundary_sell, ptr, cols, vals, op->boundary_rows, op->n_boundary,
+                      opts->sell_chunk, opts->sell_sigma);
+    } else if (op->format == SPARSE_FORMAT_COMPACT) {
+        compact_from_csr(&op->interior_cmp, ptr, cols, vals, op->interior_rows, op->n_interior,
+                         opts->compact_values);
+        compact_from_csr(&op->boundary_cmp, ptr, cols, vals, op->boundary_rows, op->n_boundary,
+                         opts->compact_values);
+    } else if (op->format == SPARSE_FORMAT_BCSR) {
+        bcsr_from_csr(&op->interior_bcsr, ptr, cols, vals, op->interior_rows, op->n_interior,
+                      local_n, local_n + halo->n_ghost, opts->bcsr_block, row_start);
+        bcsr_from_csr(&op->boundary_bcsr, ptr, cols, vals, op->boundary_rows, op->n_boundary,
+                      local_n, local_n + halo->n_ghost, opts->bcsr_block, row_start);
+    }
+}
 
-    // Pre-allocate communication arrays once, outside the loop
-    int* recvcounts = malloc(p * sizeof(int));
-    int* displs = malloc(p * sizeof(int));
-    if (recvcounts == NULL || displs == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate recvcounts or displs\n", rank);
-        MPI_Abort(MPI_COMM_WORLD, 1);
+// Matrix-free operator: products come from the callbacks, which exchange their own ghosts
+static void op_setup_user(CGOperator* op, const CGLinearOp* user) {
+    memset(op, 0, sizeof(CGOperator));
+    op->local_n = user->local_n;
+    op->n_ghost = user->n_ghost;
+    op->user = user;
+}
+
+static void op_free(CGOperator* op) {
+    for (int k = 0; k < OP_WORK_SLOTS; k++) {
+        free(op->work[k]);
+    }
+    if (op->user) return;
+    if (op->symmetric) {
+        sym_free(&op->sym);
+        return;
     }
+    free(op->interior_rows);
+    free(op->boundary_rows);
+    free(op->interior_bounds);
+    free(op->boundary_bounds);
+    if (op->has_powers) matrix_powers_free(&op->powers);
+    if (op->has_node) node_halo_free(&op->node);
+    if (op->format == SPARSE_FORMAT_SELL) {
+        sell_free(&op->interior_sell);
+        sell_free(&op->boundary_sell);
+    } else if (op->format == SPARSE_FORMAT_COMPACT) {
+        compact_free(&op->interior_cmp);
+        compact_free(&op->boundary_cmp);
+    } else if (op->format == SPARSE_FORMAT_BCSR) {
+        bcsr_free(&op->interior_bcsr);
+        bcsr_free(&op->boundary_bcsr);
+    }
+}
 
-    // Calculate displacements and counts once
-    int rows_per_proc = (global_n + p - 1) / p;
-    for (int i = 0; i < p; i++) {
-        int start = i * rows_per_proc;
-        int end = (start + rows_per_proc > global_n) ? global_n : start + rows_per_proc;
-        recvcounts[i] = end - start;
-        displs[i] = start;
+// Rebuild the copies of the values held by symmetric, SELL, compact and BCSR storage
+// and the ghost rows of the matrix powers kernel (collective)
+static void op_update_values(CGOperator* op, const CGOptions* opts) {
+    if (op->user) return;
+    if (op->has_powers) {
+        matrix_powers_free(&op->powers);
+        matrix_powers_setup(&op->powers, op->ptr, op->cols, op->vals, op->local_n, op->halo,
+                            opts->sstep_s);
     }
+    if (op->symmetric) {
+        sym_free(&op->sym);
+        sym_setup(&op->sym, op->ptr, op->cols, op->vals, op->local_n, op->n_ghost);
+    } else if (op->format == SPARSE_FORMAT_SELL) {
+        sell_free(&op->interior_sell);
+        sell_free(&op->boundary_sell);
+        sell_from_csr(&op->interior_sell, op->ptr, op->cols, op->vals, op->interior_rows,
+                      op->n_interior, opts->sell_chunk, opts->sell_sigma);
+        sell_from_csr(&op->boundary_sell, op->ptr, op->cols, op->vals, op->boundary_rows,
+                      op->n_boundary, opts->sell_chunk, opts->sell_sigma);
+    } else if (op->format == SPARSE_FORMAT_COMPACT) {
+        compact_free(&op->interior_cmp);
+        compact_free(&op->boundary_cmp);
+        compact_from_csr(&op->interior_cmp, op->ptr, op->cols, op->vals, op->interior_rows,
+                         op->n_interior, opts->compact_values);
+        compact_from_csr(&op->boundary_cmp, op->ptr, op->cols, op->vals, op->boundary_rows,
+                         op->n_boundary, opts->compact_values);
+    } else if (op->format == SPARSE_FORMAT_BCSR) {
+        bcsr_free(&op->interior_bcsr);
+        bcsr_free(&op->boundary_bcsr);
+        bcsr_from_csr(&op->interior_bcsr, op->ptr, op->cols, op->vals, op->interior_rows,
+                      op->n_interior, op->local_n, op->local_n + op->n_ghost, opts->bcsr_block,
+                      op->row_start);
+        bcsr_from_csr(&op->boundary_bcsr, op->ptr, op->cols, op->vals, op->boundary_rows,
+                      op->n_boundary, op->local_n, op->local_n + op->n_ghost, opts->bcsr_block,
+                      op->row_start);
+    }
+}
 
-    // Initial residual calculation
-    mat_vec_csr(ptr, cols, vals, x_global, q, local_n, global_n);
-    for (int i = 0; i < local_n; i++) {
-        r[i] = b[i] - q[i];
-        d[i] = r[i];
+/**
+ * @brief Work vector of length at least n, kept by the operator between solves
+ *
+ * Contents are left over from the previous solve (zero on first use).
+ */
+static double* op_vec(CGOperator* op, int slot, int n) {
+    if (op->work_n[slot] < n) {
+        free(op->work[slot]);
+        op->work[slot] = vec_alloc(n);
+        if (op->work[slot] == NULL) {
+            fprintf(stderr, "Failed to allocate CG vectors\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        op->work_n[slot] = n;
     }
+    return op->work[slot];
+}
 
-    double delta = dot_allreduce(dot(r, r, local_n));
-    double delta0 = delta;
+// Start filling the ghost entries of x, through the node-level plan if there is one
+static void op_exchange_begin(CGOperator* op, double* x_ext) {
+    if (op->has_node) {
+        node_halo_begin(&op->node, x_ext);
+    } else {
+        halo_exchange_begin(op->halo, x_ext);
+    }
+}
 
-    if (rank == 0) {
-        printf("Starting CG iterations\n");
+static void op_exchange_end(CGOperator* op) {
+    if (op->has_node) {
+        node_halo_end(&op->node);
+    } else {
+        halo_exchange_end(op->halo);
+    }
+}
+
+/**
+ * @brief SpMV with the ghost exchange overlapped by the interior rows
+ *
+ * Accumulates the time spent computing interior rows and the time spent
+ * waiting for the exchange to complete afterwards. When xy is not NULL it
+ * receives the local x^T y, fused into the row loops for CSR and unrolled
+ * CSR and computed after the product for the other formats.
+ */
+static void op_apply_rows(CGOperator* op, double* x_ext, double* y, double* xy) {
+    prof_begin(PROF_SPMV);
+    if (op->user) {
+        op->user->apply(op->user->data, x_ext, y);
+        op->n_apply++;
+        prof_end(PROF_SPMV);
+        if (xy) *xy = dot(x_ext, y, op->local_n);
+        return;
+    }
+    op_exchange_begin(op, x_ext);
+
+    if (op->symmetric) {
+        // Transposed contributions to ghost rows travel back while the
+        // forward exchange completes
+        double t0 = MPI_Wtime();
+        mat_vec_sym_local(&op->sym, x_ext, y);
+        halo_accumulate_begin(op->halo, op->sym.y_ghost);
+        double t1 = MPI_Wtime();
+        halo_exchange_end(op->halo);
+        double t2 = MPI_Wtime();
+        mat_vec_sym_ghost(&op->sym, x_ext, y);
+        halo_accumulate_end(op->halo, y);
+
+        op->t_interior += t1 - t0;
+        op->t_wait += t2 - t1;
+        op->n_apply++;
+        prof_end(PROF_SPMV);
+        if (xy) *xy = dot(x_ext, y, op->local_n);
+        return;
+    }
+
+    double t0 = MPI_Wtime();
+    double xy_rows = 0.0;
+    if (op->format == SPARSE_FORMAT_SELL) {
+        mat_vec_sell(&op->interior_sell, x_ext, y);
+    } else if (op->format == SPARSE_FORMAT_COMPACT) {
+        mat_vec_compact(&op->interior_cmp, x_ext, y);
+    } else if (op->format == SPARSE_FORMAT_BCSR) {
+        mat_vec_bcsr(&op->interior_bcsr, x_ext, y);
+    } else if (op->format == SPARSE_FORMAT_CSR_UNROLL) {
+        xy_rows += mat_vec_csr_rows_unroll(op->ptr, op->cols, op->vals, x_ext, y,
+                                           op->interior_rows, op->n_interior,
+                                           op->interior_bounds);
+    } else if (xy) {
+        xy_rows += mat_vec_csr_rows_dot(op->ptr, op->cols, op->vals, x_ext, y,
+                                        op->interior_rows, op->n_interior, op->interior_bounds);
+    } else {
+        mat_vec_csr_rows(op->ptr, op->cols, op->vals, x_ext, y,
+                         op->interior_rows, op->n_interior, op->interior_bounds);
+    }
+    double t1 = MPI_Wtime();
+    op_exchange_end(op);
+    double t2 = MPI_Wtime();
+
+    if (op->format == SPARSE_FORMAT_SELL) {
+        mat_vec_sell(&op->boundary_sell, x_ext, y);
+    } else if (op->format == SPARSE_FORMAT_COMPACT) {
+        mat_vec_compact(&op->boundary_cmp, x_ext, y);
+    } else if (op->format == SPARSE_FORMAT_BCSR) {
+        mat_vec_bcsr(&op->boundary_bcsr, x_ext, y);
+    } else if (op->format == SPARSE_FORMAT_CSR_UNROLL) {
+        xy_rows += mat_vec_csr_rows_unroll(op->ptr, op->cols, op->vals, x_ext, y,
+                                           op->boundary_rows, op->n_boundary,
+                                           op->boundary_bounds);
+    } else if (xy) {
+        xy_rows += mat_vec_csr_rows_dot(op->ptr, op->cols, op->vals, x_ext, y,
+                                        op->boundary_rows, op->n_boundary, op->boundary_bounds);
+    } else {
+        mat_vec_csr_rows(op->ptr, op->cols, op->vals, x_ext, y,
+                         op->boundary_rows, op->n_boundary, op->boundary_bounds);
     }
 
-    for (int iter = 0; iter < max_iter && delta > tol * tol * delta0; iter++) {
-        // Single collective communication instead of Gatherv+Bcast
-        MPI_Allgatherv(d, local_n, MPI_DOUBLE, x_global, recvcounts, displs,
-                       MPI_DOUBLE, MPI_COMM_WORLD);
+    op->t_interior += t1 - t0;
+    op->t_wait += t2 - t1;
+    op->n_apply++;
+    prof_end(PROF_SPMV);
+    if (xy) {
+        int fused = op->format == SPARSE_FORMAT_CSR || op->format == SPARSE_FORMAT_CSR_UNROLL;
+        *xy = fused ? xy_rows : dot(x_ext, y, op->local_n);
+    }
+}
 
-        mat_vec_csr(ptr, cols, vals, x_global, q, local_n, global_n);
+static void op_apply(CGOperator* op, double* x_ext, double* y) {
+    op_apply_rows(op, x_ext, y, NULL);
+}
+
+// y = A x and the local x^T y
+static double op_apply_dot(CGOperator* op, double* x_ext, double* y) {
+    double xy;
+    op_apply_rows(op, x_ext, y, &xy);
+    return xy;
+}
+
+// y = A v for a vector without ghost room, staged through scratch_ext
+static void op_apply_copy(CGOperator* op, const double* v, double* y, double* scratch_ext) {
+    memcpy(scratch_ext, v, op->local_n * sizeof(double));
+    op_apply(op, scratch_ext, y);
+}
+
+// r = b - A x
+static void residual(CGOperator* op, const double* b, const double* x, double* r,
+                     double* scratch_ext) {
+    op_apply_copy(op, x, r, scratch_ext);
+    prof_begin(PROF_UPDATE);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < op->local_n; i++) {
+        r[i] = b[i] - r[i];
+    }
+    prof_end(PROF_UPDATE);
+}
+
+// Time a blocking exchange, used to report how much of it is hidden
+static double probe_exchange(CGOperator* op, double* scratch_ext) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_probe = MPI_Wtime();
+    for (int k = 0; k < OVERLAP_PROBE_REPS; k++) {
+        op_exchange_begin(op, scratch_ext);
+        op_exchange_end(op);
+    }
+    return (MPI_Wtime() - t_probe) / OVERLAP_PROBE_REPS;
+}
+
+// Report overlap of the slowest rank: fraction of the exchange cost hidden
+static void report_overlap(CGOperator* op, double t_exchange, int rank) {
+    int n = op->n_apply > 0 ? op->n_apply : 1;
+    double local_times[3] = {t_exchange, op->t_wait / n, op->t_interior / n};
+    double max_times[3];
+    MPI_Reduce(local_times, max_times, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0 && op->n_apply > 0) {
+        double hidden = 0.0;
+        if (max_times[0] > 0.0) {
+            hidden = 1.0 - max_times[1] / max_times[0];
+            if (hidden < 0.0) hidden = 0.0;
+        }
+        printf("Halo overlap: exchange %.3e s, exposed wait %.3e s, "
+               "interior SpMV %.3e s per SpMV (%.1f%% hidden)\n",
+               max_times[0], max_times[1], max_times[2], 100.0 * hidden);
+    }
+}
+
+// Reference of the stopping test: b^T b, so that a good initial guess stops
+// early; the initial residual only when b = 0
+static double stop_reference(double bb, double rr) {
+    return bb > 0.0 ? bb : rr;
+}
+
+static void print_progress(const CGOptions* opts, int rank, int iter, double gamma,
+                           double gamma0) {
+    if (rank == 0 && opts->verbose && iter > 0 && iter % 10 == 0) {
+        printf("  Iteration %d: residual = %.6e\n", iter, gamma / gamma0);
+    }
+}
+
+/**
+ * @brief Classical (Hestenes-Stiefel) PCG: two blocking reductions per iteration
+ *
+ * With a preconditioner, r.z and r.r are fused into one reduction so the
+ * stopping criterion stays on the unpreconditioned residual. The
+ * checkpoint flags (ck, may be NULL) ride on the same reduction.
+ *
+ * With a deflation space (defl, may be NULL) holding vectors, the initial
+ * guess is deflated and (AW)^T z joins the reduction so that each
+ * direction is A-orthogonal to W. The directions are harvested to refine
+ * W for the next solve.
+ */
+static int cg_classic(CGOperator* op, const Preconditioner* pc, double* b, double* x,
+                      int rank, const CGOptions* opts, Checkpoint* ck, Deflation* defl) {
+    int local_n = op->local_n;
+    int precond = pc->type != PC_NONE;
+    // d carries ghost entries after the owned block so SpMV can read it directly
+    int ext_n = local_n + op->n_ghost;
+    double* r = op_vec(op, 0, local_n);
+    double* d = op_vec(op, 1, ext_n);
+    double* q = op_vec(op, 2, local_n);
+    double* z = precond ? op_vec(op, 3, local_n) : r;
+
+    double delta, rr, rr0;
+    int iter = 0;
+    if (ck != NULL && opts->restart_file != NULL) {
+        CheckpointState state;
+        if (checkpoint_read(opts->restart_file, local_n, ck->row_start, ck->global_n,
+                            &ck->config, x, r, d, &state, rank) != 0) {
+            if (rank == 0) fprintf(stderr, "Error: Cannot restart from %s\n", opts->restart_file);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (rank == 0 && opts->verbose) {
+            printf("Restarting from %s at iteration %d\n", opts->restart_file, state.iteration);
+        }
+        iter = state.iteration;
+        delta = state.delta;
+        rr = state.rr;
+        rr0 = state.rr0;
+    } else {
+        // Initial residual calculation, using d as scratch for the initial guess
+        residual(op, b, x, r, d);
+        int n_defl = 0;
+        if (defl != NULL && defl->k > 0) {
+            deflation_start(defl, x, r);
+            n_defl = defl->k;
+        }
+        if (precond) precond_apply(pc, r, z);
+        // b^T b rides on the first reduction
+        double local[3 + DEFLATION_MAX], global[3 + DEFLATION_MAX];
+        int n_sums = 0;
+        if (precond) local[n_sums++] = dot(r, z, local_n);
+        local[n_sums++] = dot(r, r, local_n);
+        local[n_sums++] = dot(b, b, local_n);
+        if (n_defl > 0) deflation_coef_local(defl, z, local + n_sums);
+        allreduce_sum(local, global, n_sums + n_defl);
+        delta = global[0];
+        rr = global[n_sums - 2];
+        memcpy(d, z, local_n * sizeof(double));
+        if (n_defl > 0) deflation_direction(defl, d, global + n_sums);
+        rr0 = stop_reference(global[n_sums - 1], rr);
+    }
+    if (defl != NULL) deflation_begin(defl);
+    int n_defl = defl != NULL ? defl->k : 0;
+
+    double tol2 = opts->tol * opts->tol;
+
+    for (; iter < opts->max_iter && rr > tol2 * rr0; iter++) {
+        // Neighbor-only exchange of the ghost entries of d, overlapped with SpMV
+        // d^T q is accumulated while q is produced
+        double alpha_den_local = op_apply_dot(op, d, q);
+        if (defl != NULL) deflation_record(defl, d, q);
 
         double alpha_num = delta;
-        double alpha_den = dot_allreduce(dot(d, q, local_n));
+        double alpha_den = dot_allreduce(alpha_den_local);
 
         if (alpha_den == 0.0) {
             if (rank == 0) {
@@ -73,32 +479,1261 @@ void cg_solver(int* ptr, int* cols, double* vals, double* b, double* x,
 
         double alpha = alpha_num / alpha_den;
 
-        // Update solution and residual
+        // Update solution and residual, with r.r from the same pass
+        double rr_local = axpy2_dot(x, r, d, q, alpha, local_n);
+
+        // [r.z,] r.r, [(AW)^T z,] then the checkpoint flags
+        double local[4 + DEFLATION_MAX], global[4 + DEFLATION_MAX];
+        int n_sums = 0;
+        if (precond) {
+            precond_apply(pc, r, z);
+            local[n_sums++] = dot(r, z, local_n);
+        }
+        local[n_sums++] = rr_local;
+        if (n_defl > 0) deflation_coef_local(defl, z, local + n_sums);
+        int n_flags = ck ? checkpoint_flags(ck, local + n_sums + n_defl) : 0;
+        if (n_sums + n_defl + n_flags == 1) {
+            global[0] = dot_allreduce(local[0]);
+        } else {
+            allreduce_sum(local, global, n_sums + n_defl + n_flags);
+        }
+        double delta_new = global[0];
+        rr = global[n_sums - 1];
+        double beta = delta_new / delta;
+
+        xpby(d, z, beta, local_n);
+        if (n_defl > 0) deflation_direction(defl, d, global + n_sums);
+
+        delta = delta_new;
+        print_progress(opts, rank, iter + 1, rr, rr0);
+        if (n_flags > 0) {
+            CheckpointState state = {iter + 1, delta, rr, rr0};
+            checkpoint_step(ck, global + n_sums + n_defl, &state, x, r, d);
+        }
+    }
+
+    if (ck != NULL) {
+        // Unconverged runs leave a checkpoint to continue from
+        CheckpointState state = {iter, delta, rr, rr0};
+        int converged = rr <= tol2 * rr0;
+        checkpoint_finish(ck, converged ? NULL : &state, x, r, d);
+    }
+    if (defl != NULL) deflation_update(defl);
+
+    return iter;
+}
+
+/**
+ * @brief Chronopoulos-Gear PCG: r.u, (Au).u and r.r fused into one reduction
+ *
+ * Keeps s = A p by recurrence, so the only SpMV per iteration is w = A u
+ * with u = M^{-1} r.
+ */
+static int cg_chrono_gear(CGOperator* op, const Preconditioner* pc, double* b, double* x,
+                          int rank, const CGOptions* opts) {
+    int local_n = op->local_n;
+    int precond = pc->type != PC_NONE;
+    int ext_n = local_n + op->n_ghost;
+    double* r = op_vec(op, 0, ext_n);
+    double* u = precond ? op_vec(op, 1, ext_n) : r;
+    double* w = op_vec(op, 2, local_n);
+    double* p = op_vec(op, 3, local_n);
+    double* s = op_vec(op, 4, local_n);
+    double* scratch = op_vec(op, 5, ext_n);
+    // The first iteration takes beta = 0; clear what a previous solve left
+    memset(p, 0, local_n * sizeof(double));
+    memset(s, 0, local_n * sizeof(double));
+
+    double tol2 = opts->tol * opts->tol;
+    double rr0 = 0.0, gamma_old = 0.0, alpha_old = 0.0;
+    int have_rr0 = 0;
+    int replaced = 1;       // r and s are true products
+    int n_replace = 0;
+    int iter = 0;
+
+    residual(op, b, x, r, scratch);
+    for (;;) {
+        if (precond) precond_apply(pc, r, u);
+        op_apply(op, u, w);
+
+        double local[4] = {dot(r, u, local_n), dot(w, u, local_n), 0.0, 0.0};
+        local[2] = precond ? dot(r, r, local_n) : local[0];
+        // b^T b rides on the first reduction
+        int n_sums = 3;
+        if (!have_rr0) local[n_sums++] = dot(b, b, local_n);
+        double global[4];
+        allreduce_sum(local, global, n_sums);
+        double gamma = global[0];
+        double delta = global[1];
+        double rr = global[2];
+        if (!have_rr0) {
+            rr0 = stop_reference(global[3], rr);
+            have_rr0 = 1;
+        }
+
+        if (rr <= tol2 * rr0) {
+            if (replaced) break;
+            // Converged by recurrence: confirm against the true residual
+            residual(op, b, x, r, scratch);
+            op_apply_copy(op, p, s, scratch);
+            replaced = 1;
+            n_replace++;
+            continue;
+        }
+        if (iter >= opts->max_iter) break;
+
+        double alpha, beta;
+        if (iter == 0) {
+            beta = 0.0;
+            alpha = gamma / delta;
+        } else {
+            beta = gamma / gamma_old;
+            double den = delta - beta * gamma / alpha_old;
+            if (den == 0.0) {
+                if (rank == 0) fprintf(stderr, "CG breakdown: alpha_den = 0\n");
+                break;
+            }
+            alpha = gamma / den;
+        }
+
+        prof_begin(PROF_UPDATE);
+        #pragma omp parallel for schedule(static)
         for (int i = 0; i < local_n; i++) {
-            x[i] += alpha * d[i];
-            r[i] -= alpha * q[i];
+            p[i] = u[i] + beta * p[i];
+            s[i] = w[i] + beta * s[i];
+            x[i] += alpha * p[i];
+            r[i] -= alpha * s[i];
         }
+        prof_end(PROF_UPDATE);
+        gamma_old = gamma;
+        alpha_old = alpha;
+        iter++;
+        replaced = 0;
+        print_progress(opts, rank, iter, rr, rr0);
 
-        double delta_new = dot_allreduce(dot(r, r, local_n));
-        double beta = delta_new / delta;
+        if (opts->replace_period > 0 && iter % opts->replace_period == 0) {
+            residual(op, b, x, r, scratch);
+            op_apply_copy(op, p, s, scratch);
+            replaced = 1;
+            n_replace++;
+        }
+    }
+
+    if (rank == 0 && opts->verbose) printf("Residual replacements: %d\n", n_replace);
+
+    return iter;
+}
+
+/**
+ * @brief Ghysels-Vanroose pipelined PCG
+ *
+ * The fused reduction of r.u, w.u and r.r is started with MPI_Iallreduce
+ * and completes while m = M^{-1} w and n = A m (including its ghost
+ * exchange) are computed. Recurrences keep u = M^{-1} r, w = A u,
+ * s = A p, q = M^{-1} s and z = A q. Without a preconditioner u, m and q
+ * alias r, w and s.
+ */
+static int cg_pipelined(CGOperator* op, const Preconditioner* pc, double* b, double* x,
+                        int rank, const CGOptions* opts) {
+    int local_n = op->local_n;
+    int precond = pc->type != PC_NONE;
+    int ext_n = local_n + op->n_ghost;
+    double* r = op_vec(op, 0, local_n);
+    double* u = precond ? op_vec(op, 1, local_n) : r;
+    double* w = op_vec(op, 2, ext_n);
+    double* m = precond ? op_vec(op, 3, ext_n) : w;
+    double* nv = op_vec(op, 4, local_n);
+    double* p = op_vec(op, 5, local_n);
+    double* s = op_vec(op, 6, local_n);
+    double* q = precond ? op_vec(op, 7, local_n) : s;
+    double* z = op_vec(op, 8, local_n);
+    double* scratch = op_vec(op, 9, ext_n);
+    // The first iteration takes beta = 0; clear what a previous solve left
+    memset(p, 0, local_n * sizeof(double));
+    memset(s, 0, local_n * sizeof(double));
+    memset(q, 0, local_n * sizeof(double));
+    memset(z, 0, local_n * sizeof(double));
+
+    double tol2 = opts->tol * opts->tol;
+    double rr0 = 0.0, gamma_old = 0.0, alpha_old = 0.0;
+    int have_rr0 = 0;
+    int replaced = 1;       // r, u, w, s, q and z are true products
+    int n_replace = 0;
+    int iter = 0;
+
+    residual(op, b, x, r, scratch);
+    if (precond) precond_apply(pc, r, u);
+    op_apply_copy(op, u, w, scratch);
+    for (;;) {
+        double local[4] = {dot(r, u, local_n), dot(w, u, local_n), 0.0, 0.0};
+        local[2] = precond ? dot(r, r, local_n) : local[0];
+        // b^T b rides on the first reduction
+        int n_sums = 3;
+        if (!have_rr0) local[n_sums++] = dot(b, b, local_n);
+        double global[4];
+        MPI_Request req;
+        MPI_Iallreduce(local, global, n_sums, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &req);
+        if (precond) precond_apply(pc, w, m);
+        op_apply(op, m, nv);
+        prof_begin(PROF_REDUCE);
+        MPI_Wait(&req, MPI_STATUS_IGNORE);
+        prof_end(PROF_REDUCE);
+        double gamma = global[0];
+        double delta = global[1];
+        double rr = global[2];
+        if (!have_rr0) {
+            rr0 = stop_reference(global[3], rr);
+            have_rr0 = 1;
+        }
+
+        if (rr <= tol2 * rr0) {
+            if (replaced) break;
+            // Converged by recurrence: confirm against the true residual
+            residual(op, b, x, r, scratch);
+            if (precond) precond_apply(pc, r, u);
+            op_apply_copy(op, u, w, scratch);
+            op_apply_copy(op, p, s, scratch);
+            if (precond) precond_apply(pc, s, q);
+            op_apply_copy(op, q, z, scratch);
+            replaced = 1;
+            n_replace++;
+            continue;
+        }
+        if (iter >= opts->max_iter) break;
+
+        double alpha, beta;
+        if (iter == 0) {
+            beta = 0.0;
+            alpha = gamma / delta;
+        } else {
+            beta = gamma / gamma_old;
+            double den = delta - beta * gamma / alpha_old;
+            if (den == 0.0) {
+                if (rank == 0) fprintf(stderr, "CG breakdown: alpha_den = 0\n");
+                break;
+            }
+            alpha = gamma / den;
+        }
+
+        prof_begin(PROF_UPDATE);
+        if (precond) {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < local_n; i++) {
+                z[i] = nv[i] + beta * z[i];
+                q[i] = m[i] + beta * q[i];
+                s[i] = w[i] + beta * s[i];
+                p[i] = u[i] + beta * p[i];
+                x[i] += alpha * p[i];
+                r[i] -= alpha * s[i];
+                u[i] -= alpha * q[i];
+                w[i] -= alpha * z[i];
+            }
+        } else {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < local_n; i++) {
+                z[i] = nv[i] + beta * z[i];
+                s[i] = w[i] + beta * s[i];
+                p[i] = r[i] + beta * p[i];
+                x[i] += alpha * p[i];
+                r[i] -= alpha * s[i];
+                w[i] -= alpha * z[i];
+            }
+        }
+        prof_end(PROF_UPDATE);
+        gamma_old = gamma;
+        alpha_old = alpha;
+        iter++;
+        replaced = 0;
+        print_progress(opts, rank, iter, rr, rr0);
+
+        if (opts->replace_period > 0 && iter % opts->replace_period == 0) {
+            residual(op, b, x, r, scratch);
+            if (precond) precond_apply(pc, r, u);
+            op_apply_copy(op, u, w, scratch);
+            op_apply_copy(op, p, s, scratch);
+            if (precond) precond_apply(pc, s, q);
+            op_apply_copy(op, q, z, scratch);
+            replaced = 1;
+            n_replace++;
+        }
+    }
+
+    if (rank == 0 && opts->verbose) printf("Residual replacements: %d\n", n_replace);
+
+    return iter;
+}
 
+// Eigenvalues of T below x, for the symmetric tridiagonal T (Sturm sequence)
+static int sturm_count(const double* diag, const double* off, int n, double x) {
+    int count = 0;
+    double q = 1.0;
+    for (int j = 0; j < n; j++) {
+        double o2 = j > 0 ? off[j - 1] * off[j - 1] : 0.0;
+        q = diag[j] - x - (j > 0 ? o2 / q : 0.0);
+        if (q == 0.0) q = -1e-300;
+        if (q < 0.0) count++;
+    }
+    return count;
+}
+
+// Eigenvalues of a symmetric tridiagonal matrix by bisection, ascending
+static void tridiag_eigenvalues(const double* diag, const double* off, int n, double* eig) {
+    double lo = diag[0], hi = diag[0];
+    for (int j = 0; j < n; j++) {
+        double radius = (j > 0 ? fabs(off[j - 1]) : 0.0) + (j < n - 1 ? fabs(off[j]) : 0.0);
+        if (diag[j] - radius < lo) lo = diag[j] - radius;
+        if (diag[j] + radius > hi) hi = diag[j] + radius;
+    }
+    for (int k = 0; k < n; k++) {
+        double a = lo, b = hi;
+        for (int it = 0; it < 100 && b - a > 1e-14 * (fabs(a) + fabs(b)); it++) {
+            double mid = 0.5 * (a + b);
+            if (sturm_count(diag, off, n, mid) > k) {
+                b = mid;
+            } else {
+                a = mid;
+            }
+        }
+        eig[k] = 0.5 * (a + b);
+    }
+}
+
+// Reorder shifts so each one is farthest (in product of distances) from the previous ones
+static void leja_order(double* theta, int n) {
+    for (int k = 0; k < n; k++) {
+        int best = k;
+        double best_val = -1.0;
+        for (int j = k; j < n; j++) {
+            double val = fabs(theta[j]);
+            if (k > 0) {
+                val = 1.0;
+                for (int i = 0; i < k; i++) val *= fabs(theta[j] - theta[i]);
+            }
+            if (val > best_val) {
+                best_val = val;
+                best = j;
+            }
+        }
+        double t = theta[k];
+        theta[k] = theta[best];
+        theta[best] = t;
+    }
+}
+
+/**
+ * @brief Polynomial basis of s-step CG
+ *
+ * Column k + 1 of a block is rho_{k+1}(A) v, computed from column k (and
+ * k - 1 for Chebyshev); B expresses A times a basis vector in the basis.
+ */
+typedef struct {
+    CGBasis kind;
+    int s;
+    int m;                          // Basis vectors, 2 s + 1
+    double theta[CG_SSTEP_MAX];     // Newton shifts
+    double c, h;                    // Chebyshev interval center and half width
+    double B[(2 * CG_SSTEP_MAX + 1) * (2 * CG_SSTEP_MAX + 1)];  // Row-major m x m
+} SstepBasis;
+
+// Shifts or interval from the Ritz values of the Lanczos matrix of s CG iterations
+static void sstep_basis_setup(SstepBasis* sb, CGBasis kind, int s, const double* alpha,
+                              const double* beta) {
+    memset(sb, 0, sizeof(SstepBasis));
+    sb->kind = kind;
+    sb->s = s;
+    sb->m = 2 * s + 1;
+    if (kind != CG_BASIS_MONOMIAL) {
+        double diag[CG_SSTEP_MAX], off[CG_SSTEP_MAX], ritz[CG_SSTEP_MAX];
+        for (int j = 0; j < s; j++) {
+            diag[j] = 1.0 / alpha[j] + (j > 0 ? beta[j - 1] / alpha[j - 1] : 0.0);
+            off[j] = sqrt(beta[j]) / alpha[j];
+        }
+        tridiag_eigenvalues(diag, off, s, ritz);
+        memcpy(sb->theta, ritz, s * sizeof(double));
+        leja_order(sb->theta, s);
+        sb->c = 0.5 * (ritz[s - 1] + ritz[0]);
+        sb->h = 0.5 * (ritz[s - 1] - ritz[0]);
+        if (sb->h <= 0.0) sb->h = sb->c != 0.0 ? fabs(sb->c) : 1.0;
+    }
+
+    // P block (columns 0 .. s) and R block (s + 1 .. 2 s)
+    int m = sb->m;
+    for (int blk = 0; blk < 2; blk++) {
+        int o = blk == 0 ? 0 : s + 1;
+        int len = blk == 0 ? s + 1 : s;
+        for (int k = 0; k + 1 < len; k++) {
+            double* col_k = sb->B + o + k;
+            if (kind == CG_BASIS_CHEBYSHEV) {
+                col_k[(o + k) * m] = sb->c;
+                col_k[(o + k + 1) * m] = k == 0 ? sb->h : 0.5 * sb->h;
+                if (k > 0) col_k[(o + k - 1) * m] = 0.5 * sb->h;
+            } else {
+                col_k[(o + k + 1) * m] = 1.0;
+                if (kind == CG_BASIS_NEWTON) col_k[(o + k) * m] = sb->theta[k];
+            }
+        }
+    }
+}
+
+// Columns o + 1 .. o + len - 1 of W from column o, valid on fewer ghost layers each
+static void sstep_block(const MatrixPowers* mp, const SstepBasis* sb, double* W, int o,
+                        int len) {
+    for (int k = 1; k < len; k++) {
+        int depth = len - 1 - k;
+        if (sb->kind == CG_BASIS_CHEBYSHEV) {
+            if (k == 1) {
+                matrix_powers_step(mp, W, sb->m, o, o + 1, depth, sb->c, 1.0 / sb->h, -1, 0.0);
+            } else {
+                matrix_powers_step(mp, W, sb->m, o + k - 1, o + k, depth, sb->c, 2.0 / sb->h,
+                                   o + k - 2, 1.0);
+            }
+        } else {
+            double shift = sb->kind == CG_BASIS_NEWTON ? sb->theta[k - 1] : 0.0;
+            matrix_powers_step(mp, W, sb->m, o + k - 1, o + k, depth, shift, 1.0, -1, 0.0);
+        }
+    }
+}
+
+// Upper triangle of W^T W over the owned rows, mirrored
+static void sstep_gram(const double* restrict W, int n, int m, double* restrict G) {
+    int len = m * m;
+    prof_begin(PROF_DOT);
+    for (int t = 0; t < len; t++) {
+        G[t] = 0.0;
+    }
+    #pragma omp parallel for reduction(+:G[:len]) schedule(static)
+    for (int i = 0; i < n; i++) {
+        const double* w = W + (size_t)i * m;
+        for (int a = 0; a < m; a++) {
+            for (int c = a; c < m; c++) {
+                G[a * m + c] += w[a] * w[c];
+            }
+        }
+    }
+    for (int a = 0; a < m; a++) {
+        for (int c = 0; c < a; c++) {
+            G[a * m + c] = G[c * m + a];
+        }
+    }
+    prof_end(PROF_DOT);
+}
+
+// u^T G v for coordinate vectors of length m
+static double gram_form(const double* G, const double* u, const double* v, int m) {
+    double sum = 0.0;
+    for (int a = 0; a < m; a++) {
+        double row = 0.0;
+        for (int c = 0; c < m; c++) {
+            row += G[a * m + c] * v[c];
+        }
+        sum += u[a] * row;
+    }
+    return sum;
+}
+
+/**
+ * @brief s-step CG: one deep ghost exchange and one reduction per s iterations
+ *
+ * Each block builds W = [p, rho_1(A) p, ..., rho_s(A) p, r, ..., rho_{s-1}(A) r]
+ * with the matrix powers kernel and reduces its Gram matrix G = W^T W. The
+ * s iterations then run on coordinates in W: A applied to a coordinate
+ * vector is B times it, and dot products are forms in G. The Newton and
+ * Chebyshev bases take their shifts from the Ritz values of s classical
+ * iterations run first. The true residual is recomputed every
+ * replace_period iterations and when the recurrence reports convergence.
+ */
+static int cg_sstep(CGOperator* op, double* b, double* x, int rank, const CGOptions* opts) {
+    MatrixPowers* mp = &op->powers;
+    int local_n = op->local_n;
+    int s = opts->sstep_s;
+    int m = 2 * s + 1;
+    int deep_n = local_n + mp->n_ghost;
+    double* r = op_vec(op, 0, local_n);
+    double* p = op_vec(op, 1, local_n + op->n_ghost);
+    double* q = op_vec(op, 2, local_n);
+    double* seed = op_vec(op, 3, deep_n * 2);
+    double* W = op_vec(op, 4, deep_n * m);
+    double* scratch = op_vec(op, 5, local_n + op->n_ghost);
+
+    double tol2 = opts->tol * opts->tol;
+    residual(op, b, x, r, scratch);
+    double norms_local[2] = {dot(r, r, local_n), dot(b, b, local_n)}, norms[2];
+    allreduce_sum(norms_local, norms, 2);
+    double rr = norms[0];
+    double rr0 = stop_reference(norms[1], rr);
+    memcpy(p, r, local_n * sizeof(double));
+    int iter = 0;
+
+    // Classical iterations whose coefficients give the Ritz values of the basis
+    double alpha_ritz[CG_SSTEP_MAX] = {0.0}, beta_ritz[CG_SSTEP_MAX] = {0.0};
+    if (opts->sstep_basis != CG_BASIS_MONOMIAL) {
+        for (; iter < s && iter < opts->max_iter && rr > tol2 * rr0; iter++) {
+            double alpha = rr / dot_allreduce(op_apply_dot(op, p, q));
+            double rr_new = dot_allreduce(axpy2_dot(x, r, p, q, alpha, local_n));
+            alpha_ritz[iter] = alpha;
+            beta_ritz[iter] = rr_new / rr;
+            xpby(p, r, beta_ritz[iter], local_n);
+            rr = rr_new;
+            print_progress(opts, rank, iter + 1, rr, rr0);
+        }
+        if (iter < s) return iter;
+    }
+    SstepBasis sb;
+    sstep_basis_setup(&sb, opts->sstep_basis, s, alpha_ritz, beta_ritz);
+
+    double G[(2 * CG_SSTEP_MAX + 1) * (2 * CG_SSTEP_MAX + 1)];
+    double G_local[(2 * CG_SSTEP_MAX + 1) * (2 * CG_SSTEP_MAX + 1)];
+    double xc[2 * CG_SSTEP_MAX + 1], rc[2 * CG_SSTEP_MAX + 1];
+    double pc[2 * CG_SSTEP_MAX + 1], wc[2 * CG_SSTEP_MAX + 1];
+    int replaced = 1;       // r is the true residual
+    int n_replace = 0;
+    int breakdown = 0;
+    while (!breakdown) {
+        if (rr <= tol2 * rr0) {
+            if (replaced) break;
+            // Converged by recurrence: confirm against the true residual
+            residual(op, b, x, r, scratch);
+            rr = dot_allreduce(dot(r, r, local_n));
+            replaced = 1;
+            n_replace++;
+            continue;
+        }
+        if (iter >= opts->max_iter) break;
+
+        // One exchange of p and r over the s-deep region, then the whole basis
+        prof_begin(PROF_UPDATE);
+        #pragma omp parallel for schedule(static)
         for (int i = 0; i < local_n; i++) {
-            d[i] = r[i] + beta * d[i];
+            seed[2 * i] = p[i];
+            seed[2 * i + 1] = r[i];
+        }
+        prof_end(PROF_UPDATE);
+        halo_exchange_block_begin(&mp->plan, seed, 2);
+        halo_exchange_end(&mp->plan);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < deep_n; i++) {
+            W[(size_t)i * m] = seed[2 * i];
+            W[(size_t)i * m + s + 1] = seed[2 * i + 1];
         }
+        sstep_block(mp, &sb, W, 0, s + 1);
+        sstep_block(mp, &sb, W, s + 1, s);
 
-        delta = delta_new;
+        sstep_gram(W, local_n, m, G_local);
+        allreduce_sum(G_local, G, m * m);
 
-        // Optional: Print progress every 10 iterations
-        if (rank == 0 && (iter + 1) % 10 == 0) {
-            printf("  Iteration %d: residual = %.6e\n", iter + 1, delta / delta0);
+        // p = W e_0, r = W e_{s+1}, x - x_block = W xc
+        memset(xc, 0, m * sizeof(double));
+        memset(rc, 0, m * sizeof(double));
+        memset(pc, 0, m * sizeof(double));
+        pc[0] = 1.0;
+        rc[s + 1] = 1.0;
+        rr = G[(s + 1) * m + s + 1];
+        int iter_block = iter;
+        for (int j = 0; j < s && iter < opts->max_iter; j++) {
+            for (int a = 0; a < m; a++) {
+                double sum = 0.0;
+                for (int c = 0; c < m; c++) {
+                    sum += sb.B[a * m + c] * pc[c];
+                }
+                wc[a] = sum;
+            }
+            double den = gram_form(G, pc, wc, m);
+            if (!(den > 0.0)) {
+                if (rank == 0) {
+                    fprintf(stderr, "s-step CG breakdown: the basis lost rank, "
+                            "try a smaller -sstep_s or another -sstep_basis\n");
+                }
+                breakdown = 1;
+                break;
+            }
+            double alpha = rr / den;
+            for (int a = 0; a < m; a++) {
+                xc[a] += alpha * pc[a];
+                rc[a] -= alpha * wc[a];
+            }
+            double rr_new = gram_form(G, rc, rc, m);
+            double beta = rr_new / rr;
+            for (int a = 0; a < m; a++) {
+                pc[a] = rc[a] + beta * pc[a];
+            }
+            rr = rr_new;
+            iter++;
+            replaced = 0;
+            print_progress(opts, rank, iter, rr, rr0);
+            if (rr <= tol2 * rr0) break;
+        }
+
+        // Back from coordinates: x += W xc, r = W rc, p = W pc
+        prof_begin(PROF_UPDATE);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < local_n; i++) {
+            const double* w = W + (size_t)i * m;
+            double xi = 0.0, ri = 0.0, pi = 0.0;
+            for (int a = 0; a < m; a++) {
+                xi += w[a] * xc[a];
+                ri += w[a] * rc[a];
+                pi += w[a] * pc[a];
+            }
+            x[i] += xi;
+            r[i] = ri;
+            p[i] = pi;
+        }
+        prof_end(PROF_UPDATE);
+
+        if (opts->replace_period > 0 &&
+            iter / opts->replace_period > iter_block / opts->replace_period) {
+            residual(op, b, x, r, scratch);
+            rr = dot_allreduce(dot(r, r, local_n));
+            replaced = 1;
+            n_replace++;
         }
     }
 
-    free(r);
-    free(d);
-    free(q);
-    free(x_global);
-    free(recvcounts);
-    free(displs);
+    if (rank == 0 && opts->verbose) printf("Residual replacements: %d\n", n_replace);
+
+    return iter;
+}
+
+// Run the CG variant selected in opts
+static int cg_run(CGOperator* op, const Preconditioner* pc, double* b, double* x,
+                  int rank, const CGOptions* opts, Checkpoint* ck, Deflation* defl) {
+    switch (opts->method) {
+        case CG_METHOD_CHRONO_GEAR:
+            return cg_chrono_gear(op, pc, b, x, rank, opts);
+        case CG_METHOD_PIPELINED:
+            return cg_pipelined(op, pc, b, x, rank, opts);
+        case CG_METHOD_SSTEP:
+            return cg_sstep(op, b, x, rank, opts);
+        case CG_METHOD_CLASSIC:
+        default:
+            return cg_classic(op, pc, b, x, rank, opts, ck, defl);
+    }
 }
 
+/**
+ * @brief Mixed-precision iterative refinement
+ *
+ * Each step solves A e = r with CG on the reduced-precision operator
+ * op_lp, then updates x and recomputes r = b - A x with the double
+ * precision operator op_hp. Each inner solve only reduces its residual
+ * by max(refine_tol, what is left to reach tol), which the reduced
+ * precision matrix can deliver; the outer loop recovers full accuracy.
+ */
+static int cg_refine(CGOperator* op_lp, CGOperator* op_hp, const Preconditioner* pc,
+                     double* b, double* x, int rank, const CGOptions* opts) {
+    int local_n = op_hp->local_n;
+    // Inner solves use the work vectors of op_lp
+    double* r = op_vec(op_hp, 0, local_n);
+    double* e = op_vec(op_hp, 1, local_n);
+    double* scratch = op_vec(op_hp, 2, local_n + op_hp->n_ghost);
+
+    residual(op_hp, b, x, r, scratch);
+    double norms_local[2] = {dot(r, r, local_n), dot(b, b, local_n)}, norms[2];
+    allreduce_sum(norms_local, norms, 2);
+    double rnorm = sqrt(norms[0]);
+    double rnorm0 = sqrt(stop_reference(norms[1], norms[0]));
+    CGOptions inner = *opts;
+    int total = 0;
+
+    for (int step = 0; step < REFINE_MAX_STEPS && total < opts->max_iter; step++) {
+        if (rnorm <= opts->tol * rnorm0) break;
+
+        inner.tol = (rnorm > 0.0) ? opts->tol * rnorm0 / rnorm : opts->tol;
+        if (inner.tol < opts->refine_tol) inner.tol = opts->refine_tol;
+        inner.max_iter = opts->max_iter - total;
+        memset(e, 0, local_n * sizeof(double));
+        int its = cg_run(op_lp, pc, r, e, rank, &inner, NULL, NULL);
+        total += its;
+
+        prof_begin(PROF_UPDATE);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < local_n; i++) {
+            x[i] += e[i];
+        }
+        prof_end(PROF_UPDATE);
+        double rnorm_prev = rnorm;
+        residual(op_hp, b, x, r, scratch);
+        rnorm = sqrt(dot_allreduce(dot(r, r, local_n)));
+        if (rank == 0 && opts->verbose) {
+            printf("Refinement step %d: %d inner iterations, residual = %.6e\n",
+                   step + 1, its, rnorm0 > 0.0 ? rnorm / rnorm0 : 0.0);
+        }
+        if (rnorm >= rnorm_prev) {
+            if (rank == 0) fprintf(stderr, "Iterative refinement stagnated\n");
+            break;
+        }
+    }
+
+    return total;
+}
+
+// Storage of the compact format and bandwidth achieved by its local SpMV
+static void report_compact(CGOperator* op, int rank, const CGOptions* opts) {
+    double* x = vec_alloc(op->local_n + op->n_ghost);
+    double* y = vec_alloc(op->local_n);
+    if (x == NULL || y == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate probe vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t = MPI_Wtime();
+    for (int k = 0; k < COMPACT_PROBE_REPS; k++) {
+        mat_vec_compact(&op->interior_cmp, x, y);
+        mat_vec_compact(&op->boundary_cmp, x, y);
+    }
+    t = (MPI_Wtime() - t) / COMPACT_PROBE_REPS;
+    free(x);
+    free(y);
+
+    // Traffic per SpMV: matrix arrays plus reading x and writing y once
+    double vec_bytes = (2.0 * op->local_n + op->n_ghost) * sizeof(double);
+    double cmp_bytes = compact_bytes(&op->interior_cmp) + compact_bytes(&op->boundary_cmp);
+    double local[5] = {(double)(op->interior_cmp.nnz + op->boundary_cmp.nnz), cmp_bytes,
+                       (double)(op->interior_cmp.n_escape + op->boundary_cmp.n_escape),
+                       (op->local_n + 1.0) * sizeof(int), cmp_bytes + vec_bytes};
+    double sum[5];
+    double t_max;
+    MPI_Reduce(local, sum, 5, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&t, &t_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0 && sum[0] > 0.0) {
+        double csr_bytes = sum[0] * (sizeof(int) + sizeof(double)) + sum[3];
+        printf("Compact storage (%s values): %.2f bytes/nonzero vs %.2f for CSR, "
+               "%.2f%% escaped columns, %.1f MB saved\n",
+               opts->compact_values == COMPACT_BF16 ? "bf16" : "float",
+               sum[1] / sum[0], csr_bytes / sum[0], 100.0 * sum[2] / sum[0],
+               (csr_bytes - sum[1]) / 1e6);
+        printf("Compact SpMV: %.3e s, %.3f GB/s effective bandwidth\n", t_max,
+               t_max > 0.0 ? sum[4] / t_max * 1e-9 : 0.0);
+    }
+}
+
+void cg_options_default(CGOptions* opts) {
+    opts->method = CG_METHOD_CLASSIC;
+    opts->max_iter = 1000;
+    opts->tol = 1e-6;
+    opts->replace_period = 50;
+    opts->sstep_s = 4;
+    opts->sstep_basis = CG_BASIS_NEWTON;
+    opts->node_halo = 0;
+    opts->node_ranks = 0;
+    opts->deflate_k = 0;
+    opts->deflate_window = 16;
+    opts->pc = PC_NONE;
+    opts->pc_omega = 1.0;
+    amg_options_default(&opts->amg);
+    opts->format = SPARSE_FORMAT_CSR;
+    opts->sell_chunk = SELL_DEFAULT_CHUNK;
+    opts->sell_sigma = SELL_DEFAULT_SIGMA;
+    opts->bcsr_block = BCSR_DEFAULT_BLOCK;
+    opts->symmetric = 0;
+    opts->compact_values = COMPACT_FLOAT;
+    opts->refine_tol = 1e-4;
+    opts->rhs_method = CG_RHS_SIMULTANEOUS;
+    opts->checkpoint_file = NULL;
+    opts->checkpoint_every = 0;
+    opts->checkpoint_interval = 0.0;
+    opts->restart_file = NULL;
+    opts->checkpoint_order = 0;
+    opts->verbose = 1;
+}
+
+int cg_method_from_string(const char* name, CGMethod* method) {
+    if (strcmp(name, "cg") == 0) {
+        *method = CG_METHOD_CLASSIC;
+    } else if (strcmp(name, "cgcg") == 0) {
+        *method = CG_METHOD_CHRONO_GEAR;
+    } else if (strcmp(name, "pipecg") == 0) {
+        *method = CG_METHOD_PIPELINED;
+    } else if (strcmp(name, "sstep") == 0) {
+        *method = CG_METHOD_SSTEP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int cg_basis_from_string(const char* name, CGBasis* basis) {
+    if (strcmp(name, "monomial") == 0) {
+        *basis = CG_BASIS_MONOMIAL;
+    } else if (strcmp(name, "newton") == 0) {
+        *basis = CG_BASIS_NEWTON;
+    } else if (strcmp(name, "chebyshev") == 0) {
+        *basis = CG_BASIS_CHEBYSHEV;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int cg_rhs_method_from_string(const char* name, CGRhsMethod* method) {
+    if (strcmp(name, "simultaneous") == 0) {
+        *method = CG_RHS_SIMULTANEOUS;
+    } else if (strcmp(name, "block") == 0) {
+        *method = CG_RHS_BLOCK;
+    } else if (strcmp(name, "sequential") == 0) {
+        *method = CG_RHS_SEQUENTIAL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Solver state kept between solves: operators with their work
+ * vectors, the preconditioner and, for a context, the matrix and halo plan
+ * or the callbacks of a matrix-free operator
+ */
+struct CGContext {
+    int matrix_free;        // user replaces the matrix arrays and halo plan
+    CGLinearOp user;
+    int* ptr;
+    int* cols;
+    double* vals;
+    int* sym_cols;          // Columns before sym_setup() sorted the rows (symmetric)
+    int local_n;
+    int local_nnz;
+    int row_start;
+    int global_n;
+    HaloPlan* halo;
+    HaloPlan own_halo;
+    int owned;              // Matrix arrays and halo plan belong to the context
+    int rank;
+    CGOptions opts;
+    CGOperator op;
+    CGOperator op_hp;       // Double-precision operator of the refinement (compact format)
+    Preconditioner pc;
+    double t_exchange;      // Blocking exchange time, for the overlap report
+    int has_defl;
+    Deflation defl;         // Vectors recycled between solves (opts.deflate_k)
+    int defl_stale;         // defl.AW predates the current matrix values
+};
+
+// Jacobi for a matrix-free operator, from the diagonal its callback returns
+static void context_pc_setup_diagonal(CGContext* ctx) {
+    int n = ctx->local_n;
+    int* diag_ptr = malloc((n + 1) * sizeof(int));
+    int* diag_cols = malloc((n > 0 ? n : 1) * sizeof(int));
+    double* diag = malloc((n > 0 ? n : 1) * sizeof(double));
+    if (diag_ptr == NULL || diag_cols == NULL || diag == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate the operator diagonal\n", ctx->rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    ctx->user.diagonal(ctx->user.data, diag);
+    for (int i = 0; i < n; i++) {
+        diag_ptr[i] = i;
+        diag_cols[i] = i;
+    }
+    diag_ptr[n] = n;
+    precond_setup(&ctx->pc, PC_JACOBI, ctx->opts.pc_omega, diag_ptr, diag_cols, diag, n);
+    free(diag_ptr);
+    free(diag_cols);
+    free(diag);
+}
+
+static void context_pc_setup(CGContext* ctx) {
+    const CGOptions* opts = &ctx->opts;
+    double t_setup = MPI_Wtime();
+    if (ctx->matrix_free) {
+        if (opts->pc == PC_JACOBI) {
+            context_pc_setup_diagonal(ctx);
+        } else {
+            precond_setup(&ctx->pc, PC_NONE, opts->pc_omega, NULL, NULL, NULL, ctx->local_n);
+        }
+    } else if (opts->pc == PC_AMG) {
+        if (opts->symmetric) {
+            if (ctx->rank == 0) fprintf(stderr, "Error: AMG needs a fully stored matrix\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        precond_setup_amg(&ctx->pc, ctx->ptr, ctx->cols, ctx->vals, ctx->local_n, ctx->halo,
+                          &opts->amg, opts->verbose);
+    } else if (opts->symmetric && opts->pc != PC_NONE) {
+        // Preconditioners need both triangles of the diagonal block
+        int* block_ptr;
+        int* block_cols;
+        double* block_vals;
+        sym_expand_local(&ctx->op.sym, &block_ptr, &block_cols, &block_vals);
+        precond_setup(&ctx->pc, opts->pc, opts->pc_omega, block_ptr, block_cols, block_vals,
+                      ctx->local_n);
+        free(block_ptr);
+        free(block_cols);
+        free(block_vals);
+    } else {
+        precond_setup(&ctx->pc, opts->pc, opts->pc_omega, ctx->ptr, ctx->cols, ctx->vals,
+                      ctx->local_n);
+    }
+    t_setup = MPI_Wtime() - t_setup;
+    double t_setup_max;
+    MPI_Reduce(&t_setup, &t_setup_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (ctx->rank == 0 && opts->verbose && opts->pc != PC_NONE) {
+        printf("Preconditioner %s set up in %.3fs\n", pc_type_name(opts->pc), t_setup_max);
+    }
+}
+
+// Options s-step CG cannot honour
+static void context_check_sstep(const CGContext* ctx) {
+    const CGOptions* opts = &ctx->opts;
+    const char* error = NULL;
+    if (opts->sstep_s < 1 || opts->sstep_s > CG_SSTEP_MAX) {
+        if (ctx->rank == 0) {
+            fprintf(stderr, "Error: s-step CG needs 1 <= s <= %d\n", CG_SSTEP_MAX);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (ctx->matrix_free) {
+        error = "needs the matrix arrays, not a matrix-free operator";
+    } else if (opts->pc != PC_NONE) {
+        error = "supports no preconditioner";
+    } else if (opts->format != SPARSE_FORMAT_CSR || opts->symmetric) {
+        error = "needs CSR storage of the full matrix";
+    }
+    if (error != NULL) {
+        if (ctx->rank == 0) fprintf(stderr, "Error: s-step CG %s\n", error);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// Options deflated CG cannot honour
+static void context_check_deflation(const CGContext* ctx) {
+    const CGOptions* opts = &ctx->opts;
+    const char* error = NULL;
+    if (opts->deflate_k > DEFLATION_MAX || opts->deflate_window < 1 ||
+        opts->deflate_window > DEFLATION_MAX) {
+        if (ctx->rank == 0) {
+            fprintf(stderr, "Error: Deflation needs at most %d vectors and a window of 1 to %d "
+                    "directions\n", DEFLATION_MAX, DEFLATION_MAX);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (opts->method != CG_METHOD_CLASSIC) {
+        error = "runs only with the cg method";
+    } else if (opts->format == SPARSE_FORMAT_COMPACT) {
+        error = "does not support the compact format";
+    } else if (opts->checkpoint_file != NULL || opts->restart_file != NULL) {
+        error = "does not support checkpointing";
+    }
+    if (error != NULL) {
+        if (ctx->rank == 0) fprintf(stderr, "Error: Deflated CG %s\n", error);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// Recompute A W after the matrix values changed, one product per vector
+static void deflation_refresh(CGOperator* op, Deflation* defl) {
+    int n = op->local_n, k = defl->k;
+    double* v = op_vec(op, 4, n + op->n_ghost);
+    double* y = op_vec(op, 5, n);
+    for (int c = 0; c < k; c++) {
+        for (int i = 0; i < n; i++) v[i] = defl->W[(size_t)i * k + c];
+        op_apply(op, v, y);
+        for (int i = 0; i < n; i++) defl->AW[(size_t)i * k + c] = y[i];
+    }
+}
+
+// Size of the deflation space and iterations saved against the first solve
+static void report_deflation(const Deflation* defl, int iter, int rank) {
+    if (rank != 0) return;
+    if (defl->k == 0) {
+        printf("Deflation: no vectors kept yet\n");
+        return;
+    }
+    printf("Deflation: %d vectors (Ritz values %.3e to %.3e), %d iterations saved "
+           "against the first solve\n", defl->k, defl->ritz_min, defl->ritz_max,
+           defl->first_iters - iter);
+}
+
+// Ghost entries and redundantly computed rows of the s-deep region
+static void report_powers(CGOperator* op, int rank) {
+    long long local[3] = {op->n_ghost, op->powers.n_ghost, op->powers.n_rows};
+    long long sum[3];
+    MPI_Reduce(local, sum, 3, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Matrix powers (s = %d): %lld ghost entries per exchange vs %lld for one SpMV, "
+               "%lld ghost rows recomputed\n", op->powers.depth, sum[1], sum[0], sum[2]);
+    }
+}
+
+// Build the operators and the preconditioner for the matrix in ctx
+static void context_setup(CGContext* ctx) {
+    const CGOptions* opts = &ctx->opts;
+    int rank = ctx->rank;
+    if (opts->method == CG_METHOD_SSTEP) context_check_sstep(ctx);
+    if (opts->deflate_k > 0) {
+        context_check_deflation(ctx);
+        deflation_init(&ctx->defl, ctx->local_n, opts->deflate_k, opts->deflate_window);
+        ctx->has_defl = 1;
+    }
+    if (opts->node_halo && (ctx->matrix_free || opts->symmetric)) {
+        if (rank == 0) fprintf(stderr, "Error: The node-aware halo needs a fully stored matrix\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (ctx->matrix_free) {
+        op_setup_user(&ctx->op, &ctx->user);
+        context_pc_setup(ctx);
+        return;
+    }
+    op_setup(&ctx->op, ctx->ptr, ctx->cols, ctx->vals, ctx->local_n, ctx->row_start, ctx->halo,
+             opts);
+    if (ctx->op.has_powers && opts->verbose) report_powers(&ctx->op, rank);
+    if (ctx->op.has_node && opts->verbose) node_halo_report(&ctx->op.node, rank);
+    if (opts->format == SPARSE_FORMAT_SELL && opts->verbose) {
+        CGOperator* op = &ctx->op;
+        long long sell_local[2] = {op->interior_sell.nnz + op->boundary_sell.nnz,
+                                   sell_stored_entries(&op->interior_sell) +
+                                   sell_stored_entries(&op->boundary_sell)};
+        long long sell_sum[2];
+        MPI_Reduce(sell_local, sell_sum, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("SELL-%d-%d storage: %.3f stored entries per nonzero\n", opts->sell_chunk,
+                   opts->sell_sigma, sell_sum[0] > 0 ? (double)sell_sum[1] / sell_sum[0] : 1.0);
+        }
+    }
+    if (opts->format == SPARSE_FORMAT_BCSR && opts->verbose) {
+        // Processes that kept CSR store each nonzero once
+        CGOperator* op = &ctx->op;
+        long long bcsr_local[2] = {ctx->ptr[ctx->local_n], ctx->ptr[ctx->local_n]};
+        if (op->format == SPARSE_FORMAT_BCSR) {
+            bcsr_local[1] = bcsr_stored_entries(&op->interior_bcsr) +
+                            bcsr_stored_entries(&op->boundary_bcsr);
+        }
+        long long bcsr_sum[2];
+        MPI_Reduce(bcsr_local, bcsr_sum, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("BCSR %dx%d storage: %.3f stored entries per nonzero\n", opts->bcsr_block,
+                   opts->bcsr_block,
+                   bcsr_sum[0] > 0 ? (double)bcsr_sum[1] / bcsr_sum[0] : 1.0);
+        }
+    }
+
+    if (opts->format == SPARSE_FORMAT_COMPACT) {
+        if (opts->verbose) report_compact(&ctx->op, rank, opts);
+        // Refinement residuals use the matrix in double precision
+        CGOptions hp_opts = *opts;
+        hp_opts.format = SPARSE_FORMAT_CSR;
+        op_setup(&ctx->op_hp, ctx->ptr, ctx->cols, ctx->vals, ctx->local_n, ctx->row_start,
+                 ctx->halo, &hp_opts);
+    }
+
+    double* scratch = op_vec(&ctx->op, 0, ctx->local_n + ctx->halo->n_ghost);
+    ctx->t_exchange = probe_exchange(&ctx->op, scratch);
+
+    context_pc_setup(ctx);
+}
+
+static int context_solve(CGContext* ctx, double* b, double* x) {
+    const CGOptions* opts = &ctx->opts;
+    int rank = ctx->rank;
+    prof_begin(PROF_SOLVE);
+    if (rank == 0 && opts->verbose) printf("Starting CG iterations\n");
+    ctx->op.n_apply = 0;
+    ctx->op.t_interior = 0.0;
+    ctx->op.t_wait = 0.0;
+
+    int iter;
+    if (opts->format == SPARSE_FORMAT_COMPACT) {
+        iter = cg_refine(&ctx->op, &ctx->op_hp, &ctx->pc, b, x, rank, opts);
+    } else {
+        if (ctx->defl_stale) {
+            deflation_refresh(&ctx->op, &ctx->defl);
+            ctx->defl_stale = 0;
+        }
+        Checkpoint ck;
+        CheckpointConfig ck_config = {opts->method, opts->pc, opts->checkpoint_order};
+        checkpoint_init(&ck, opts->checkpoint_file, opts->checkpoint_every,
+                        opts->checkpoint_interval, ctx->local_n, ctx->row_start,
+                        ctx->global_n, &ck_config, rank);
+        int use_ck = opts->checkpoint_file != NULL || opts->restart_file != NULL;
+        iter = cg_run(&ctx->op, &ctx->pc, b, x, rank, opts, use_ck ? &ck : NULL,
+                      ctx->has_defl ? &ctx->defl : NULL);
+        checkpoint_free(&ck);
+    }
+    if (ctx->has_defl) {
+        if (ctx->defl.first_iters < 0) ctx->defl.first_iters = iter;
+        if (opts->verbose) report_deflation(&ctx->defl, iter, rank);
+    }
+
+    if (opts->verbose && !ctx->matrix_free) report_overlap(&ctx->op, ctx->t_exchange, rank);
+    if (opts->verbose && ctx->pc.amg != NULL) amg_report(ctx->pc.amg, rank);
+    prof_end(PROF_SOLVE);
+    return iter;
+}
+
+static void context_free(CGContext* ctx) {
+    if (ctx->has_defl) deflation_free(&ctx->defl);
+    precond_free(&ctx->pc);
+    op_free(&ctx->op);
+    if (ctx->opts.format == SPARSE_FORMAT_COMPACT) op_free(&ctx->op_hp);
+}
+
+int cg_solver(int* ptr, int* cols, double* vals, double* b, double* x,
+              int local_n, int local_nnz, const RowDist* dist, HaloPlan* halo,
+              int rank, int p, const CGOptions* opts) {
+    // One-shot solve on the caller's arrays and plan
+    CGContext ctx;
+    memset(&ctx, 0, sizeof(CGContext));
+    ctx.ptr = ptr;
+    ctx.cols = cols;
+    ctx.vals = vals;
+    ctx.local_n = local_n;
+    ctx.local_nnz = local_nnz;
+    ctx.row_start = dist->offsets[rank];
+    ctx.global_n = dist->global_n;
+    ctx.halo = halo;
+    ctx.rank = rank;
+    ctx.opts = *opts;
+    context_setup(&ctx);
+    int iter = context_solve(&ctx, b, x);
+    context_free(&ctx);
+    return iter;
+}
+
+// Options a matrix-free operator cannot honour
+static void context_check_op(const CGLinearOp* A, int rank, const CGOptions* opts) {
+    const char* error = NULL;
+    if (opts->pc != PC_NONE && opts->pc != PC_JACOBI) {
+        error = "supports only the none and jacobi preconditioners";
+    } else if (opts->pc == PC_JACOBI && A->diagonal == NULL) {
+        error = "needs a diagonal callback for the jacobi preconditioner";
+    } else if (opts->format != SPARSE_FORMAT_CSR || opts->symmetric) {
+        error = "has no storage format or symmetric storage";
+    }
+    if (error != NULL) {
+        if (rank == 0) fprintf(stderr, "Error: A matrix-free operator %s\n", error);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+int cg_solver_op(const CGLinearOp* A, double* b, double* x, const RowDist* dist,
+                 int rank, const CGOptions* opts) {
+    context_check_op(A, rank, opts);
+    CGContext ctx;
+    memset(&ctx, 0, sizeof(CGContext));
+    ctx.matrix_free = 1;
+    ctx.user = *A;
+    ctx.local_n = A->local_n;
+    ctx.row_start = dist->offsets[rank];
+    ctx.global_n = dist->global_n;
+    ctx.rank = rank;
+    ctx.opts = *opts;
+    context_setup(&ctx);
+    int iter = context_solve(&ctx, b, x);
+    context_free(&ctx);
+    return iter;
+}
+
+static void* checked_copy(const void* src, size_t size, int rank) {
+    void* dst = malloc(size > 0 ? size : 1);
+    if (dst == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate CG context\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memcpy(dst, src, size);
+    return dst;
+}
+
+CGContext* cg_context_create(const int* ptr, const int* cols, const double* vals,
+                             int local_n, const RowDist* dist, int rank,
+                             const CGOptions* opts) {
+    CGContext* ctx = calloc(1, sizeof(CGContext));
+    if (ctx == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate CG context\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int nnz = ptr[local_n];
+    ctx->ptr = checked_copy(ptr, (local_n + 1) * sizeof(int), rank);
+    ctx->cols = checked_copy(cols, (size_t)nnz * sizeof(int), rank);
+    ctx->vals = checked_copy(vals, (size_t)nnz * sizeof(double), rank);
+    ctx->local_n = local_n;
+    ctx->local_nnz = nnz;
+    ctx->row_start = dist->offsets[rank];
+    ctx->global_n = dist->global_n;
+    ctx->rank = rank;
+    ctx->opts = *opts;
+    ctx->owned = 1;
+
+    // The plan renumbers the copied columns to local indices
+    halo_setup(ctx->ptr, ctx->cols, dist, rank, &ctx->own_halo);
+    ctx->halo = &ctx->own_halo;
+    if (opts->symmetric) {
+        ctx->sym_cols = checked_copy(ctx->cols, (size_t)nnz * sizeof(int), rank);
+    }
+    context_setup(ctx);
+    return ctx;
+}
+
+CGContext* cg_context_create_halo(int* ptr, int* cols, double* vals, int local_n,
+                                  const RowDist* dist, HaloPlan* halo, int rank,
+                                  const CGOptions* opts) {
+    CGContext* ctx = calloc(1, sizeof(CGContext));
+    if (ctx == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate CG context\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    ctx->ptr = ptr;
+    ctx->cols = cols;
+    ctx->vals = vals;
+    ctx->local_n = local_n;
+    ctx->local_nnz = ptr[local_n];
+    ctx->row_start = dist->offsets[rank];
+    ctx->global_n = dist->global_n;
+    ctx->halo = halo;
+    ctx->rank = rank;
+    ctx->opts = *opts;
+    if (opts->symmetric) {
+        ctx->sym_cols = checked_copy(cols, (size_t)ctx->local_nnz * sizeof(int), rank);
+    }
+    context_setup(ctx);
+    return ctx;
+}
+
+CGContext* cg_context_create_op(const CGLinearOp* A, const RowDist* dist, int rank,
+                                const CGOptions* opts) {
+    context_check_op(A, rank, opts);
+    CGContext* ctx = calloc(1, sizeof(CGContext));
+    if (ctx == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate CG context\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    ctx->matrix_free = 1;
+    ctx->user = *A;
+    ctx->local_n = A->local_n;
+    ctx->row_start = dist->offsets[rank];
+    ctx->global_n = dist->global_n;
+    ctx->rank = rank;
+    ctx->opts = *opts;
+    context_setup(ctx);
+    return ctx;
+}
+
+void cg_context_update_values(CGContext* ctx, const double* vals) {
+    ctx->defl_stale = ctx->has_defl && ctx->defl.k > 0;
+    if (ctx->matrix_free) {
+        precond_free(&ctx->pc);
+        context_pc_setup(ctx);
+        return;
+    }
+    if (vals != ctx->vals) memcpy(ctx->vals, vals, (size_t)ctx->local_nnz * sizeof(double));
+    if (ctx->sym_cols != NULL) {
+        // sym_setup() sorts the rows again, from the entry order of vals
+        memcpy(ctx->cols, ctx->sym_cols, (size_t)ctx->local_nnz * sizeof(int));
+    }
+    op_update_values(&ctx->op, &ctx->opts);
+    precond_free(&ctx->pc);
+    context_pc_setup(ctx);
+}
+
+int cg_context_solve(CGContext* ctx, const double* b, double* x) {
+    return context_solve(ctx, (double*)b, x);
+}
+
+void cg_context_destroy(CGContext* ctx) {
+    if (ctx == NULL) return;
+    context_free(ctx);
+    if (ctx->owned) {
+        halo_free(&ctx->own_halo);
+        free(ctx->ptr);
+        free(ctx->cols);
+        free(ctx->vals);
+    }
+    free(ctx->sym_cols);
+    free(ctx);
+}
@@ -0,0 +1,219 @@
+/**
+ * @file checkpoint.c
+ * @brief Implementation of CG checkpoint/restart with nonblocking MPI-IO
+ */
+
+#include "checkpoint.h"
+#include "precond_ops.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void checkpoint_init(Checkpoint* ck, const char* file, int every, double interval,
+                     int local_n, int row_start, int global_n,
+                     const CheckpointConfig* config, int rank) {
+    memset(ck, 0, sizeof(Checkpoint));
+    // The layout is also needed to restart without writing checkpoints
+    ck->local_n = local_n;
+    ck->row_start = row_start;
+    ck->global_n = global_n;
+    ck->config = *config;
+    ck->rank = rank;
+    if (file == NULL) return;
+    ck->file = file;
+    ck->every = every;
+    ck->interval = interval;
+    if (every <= 0 && interval <= 0.0) ck->every = CHECKPOINT_DEFAULT_EVERY;
+    MPI_Comm_size(MPI_COMM_WORLD, &ck->p);
+    ck->tmp_file = malloc(strlen(file) + 5);
+    ck->stage = malloc(((size_t)local_n * CHECKPOINT_N_VECTORS + 1) * sizeof(double));
+    if (ck->tmp_file == NULL || ck->stage == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate checkpoint buffers\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    sprintf(ck->tmp_file, "%s.tmp", file);
+    MPI_Type_contiguous(CHECKPOINT_N_VECTORS, MPI_DOUBLE, &ck->row_type);
+    MPI_Type_commit(&ck->row_type);
+    ck->t_last = MPI_Wtime();
+}
+
+int checkpoint_flags(Checkpoint* ck, double* flags) {
+    if (ck->file == NULL) return 0;
+    flags[0] = (ck->interval > 0.0 && MPI_Wtime() - ck->t_last >= ck->interval) ? 1.0 : 0.0;
+    int done = 1;
+    if (ck->active) {
+        MPI_Testall(ck->n_req, ck->req, &done, MPI_STATUSES_IGNORE);
+    }
+    flags[1] = done ? 1.0 : 0.0;
+    return 2;
+}
+
+static void fill_header(char* header, int global_n, const CheckpointConfig* config,
+                        const CheckpointState* state) {
+    long long ints[3] = {global_n, CHECKPOINT_N_VECTORS, state->iteration};
+    double scalars[4] = {state->delta, state->rr, state->rr0, 0.0};
+    long long setup[3] = {config->method, config->pc, config->order};
+    memset(header, 0, CHECKPOINT_HEADER_BYTES);
+    memcpy(header, CHECKPOINT_MAGIC, 8);
+    memcpy(header + 8, ints, sizeof(ints));
+    memcpy(header + 8 + sizeof(ints), scalars, sizeof(scalars));
+    memcpy(header + 8 + sizeof(ints) + sizeof(scalars), setup, sizeof(setup));
+}
+
+// Copy the state and post the writes; returns without waiting for them
+static void checkpoint_start(Checkpoint* ck, const CheckpointState* state,
+                             const double* x, const double* r, const double* d) {
+    prof_begin(PROF_CHECKPOINT);
+    double* stage = ck->stage;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ck->local_n; i++) {
+        stage[(size_t)i * CHECKPOINT_N_VECTORS] = x[i];
+        stage[(size_t)i * CHECKPOINT_N_VECTORS + 1] = r[i];
+        stage[(size_t)i * CHECKPOINT_N_VECTORS + 2] = d[i];
+    }
+    int err = MPI_File_open(MPI_COMM_WORLD, ck->tmp_file, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                            MPI_INFO_NULL, &ck->fh);
+    if (err != MPI_SUCCESS) {
+        if (ck->rank == 0) {
+            fprintf(stderr, "Rank 0: Failed to open %s for writing\n", ck->tmp_file);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_set_size(ck->fh, 0);
+    ck->n_req = 0;
+    if (ck->rank == 0) {
+        fill_header(ck->header, ck->global_n, &ck->config, state);
+        MPI_File_iwrite_at(ck->fh, 0, ck->header, CHECKPOINT_HEADER_BYTES, MPI_BYTE,
+                           &ck->req[ck->n_req++]);
+    }
+    MPI_Offset offset = CHECKPOINT_HEADER_BYTES +
+                        (MPI_Offset)ck->row_start * CHECKPOINT_N_VECTORS * sizeof(double);
+    MPI_File_iwrite_at_all(ck->fh, offset, stage, ck->local_n, ck->row_type,
+                           &ck->req[ck->n_req++]);
+    ck->active = 1;
+    ck->active_iter = state->iteration;
+    ck->t_last = MPI_Wtime();
+    prof_end(PROF_CHECKPOINT);
+}
+
+// Wait for the write in flight, close the file and move it into place
+static void checkpoint_complete(Checkpoint* ck) {
+    prof_begin(PROF_CHECKPOINT);
+    MPI_Waitall(ck->n_req, ck->req, MPI_STATUSES_IGNORE);
+    MPI_File_close(&ck->fh);
+    ck->active = 0;
+    if (ck->rank == 0) {
+        if (rename(ck->tmp_file, ck->file) != 0) {
+            fprintf(stderr, "Rank 0: Failed to rename %s to %s\n", ck->tmp_file, ck->file);
+        } else {
+            printf("  Checkpoint at iteration %d written to %s\n", ck->active_iter, ck->file);
+        }
+    }
+    prof_end(PROF_CHECKPOINT);
+}
+
+void checkpoint_step(Checkpoint* ck, const double* flags_sum, const CheckpointState* state,
+                     const double* x, const double* r, const double* d) {
+    if (ck->file == NULL) return;
+    // Every process has finished its part of the write
+    if (ck->active && flags_sum[1] >= ck->p) {
+        checkpoint_complete(ck);
+    }
+    int due = (ck->every > 0 && state->iteration % ck->every == 0) || flags_sum[0] > 0.0;
+    if (due) {
+        if (ck->active) checkpoint_complete(ck);
+        checkpoint_start(ck, state, x, r, d);
+    }
+}
+
+void checkpoint_finish(Checkpoint* ck, const CheckpointState* state,
+                       const double* x, const double* r, const double* d) {
+    if (ck->file == NULL) return;
+    int written = ck->active && state != NULL && ck->active_iter == state->iteration;
+    if (ck->active) checkpoint_complete(ck);
+    if (state != NULL && !written) {
+        checkpoint_start(ck, state, x, r, d);
+        checkpoint_complete(ck);
+    }
+}
+
+void checkpoint_free(Checkpoint* ck) {
+    if (ck->file == NULL) return;
+    MPI_Type_free(&ck->row_type);
+    free(ck->stage);
+    free(ck->tmp_file);
+    ck->file = NULL;
+}
+
+int checkpoint_read(const char* filename, int local_n, int row_start, int global_n,
+                    const CheckpointConfig* config, double* x, double* r, double* d,
+                    CheckpointState* state, int rank) {
+    // Rank 0 checks the header and shares the scalars
+    double info[5] = {-1.0, 0.0, 0.0, 0.0, 0.0};   // {status, iteration, delta, rr, rr0}
+    if (rank == 0) {
+        FILE* f = fopen(filename, "rb");
+        char header[CHECKPOINT_HEADER_BYTES];
+        if (f == NULL) {
+            fprintf(stderr, "Rank 0: Failed to open %s\n", filename);
+        } else if (fread(header, 1, CHECKPOINT_HEADER_BYTES, f) != CHECKPOINT_HEADER_BYTES ||
+                   memcmp(header, CHECKPOINT_MAGIC, 8) != 0) {
+            fprintf(stderr, "Rank 0: %s is not a checkpoint file\n", filename);
+        } else {
+            long long ints[3];
+            double scalars[4];
+            long long setup[3];
+            memcpy(ints, header + 8, sizeof(ints));
+            memcpy(scalars, header + 8 + sizeof(ints), sizeof(scalars));
+            memcpy(setup, header + 8 + sizeof(ints) + sizeof(scalars), sizeof(setup));
+            if (ints[0] != global_n || ints[1] != CHECKPOINT_N_VECTORS) {
+                fprintf(stderr, "Rank 0: %s holds %lld rows, the matrix has %d\n",
+                        filename, ints[0], global_n);
+            } else if (setup[0] != config->method) {
+                fprintf(stderr, "Rank 0: %s was written by a different CG method\n", filename);
+            } else if (setup[1] != config->pc) {
+                fprintf(stderr, "Rank 0: %s was written with -pc %s, not -pc %s\n", filename,
+                        pc_type_name((PCType)setup[1]), pc_type_name((PCType)config->pc));
+            } else if (setup[2] != config->order) {
+                fprintf(stderr, "Rank 0: %s was written for a different row ordering "
+                        "(-reorder)\n", filename);
+            } else {
+                info[0] = 0.0;
+                info[1] = (double)ints[2];
+                info[2] = scalars[0];
+                info[3] = scalars[1];
+                info[4] = scalars[2];
+            }
+        }
+        if (f != NULL) fclose(f);
+    }
+    MPI_Bcast(info, 5, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (info[0] < 0.0) return -1;
+    state->iteration = (int)info[1];
+    state->delta = info[2];
+    state->rr = info[3];
+    state->rr0 = info[4];
+
+    double* stage = malloc(((size_t)local_n * CHECKPOINT_N_VECTORS + 1) * sizeof(double));
+    if (stage == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate checkpoint buffer\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(CHECKPOINT_N_VECTORS, MPI_DOUBLE, &row_type);
+    MPI_Type_commit(&row_type);
+    MPI_File fh;
+    MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    MPI_Offset offset = CHECKPOINT_HEADER_BYTES +
+                        (MPI_Offset)row_start * CHECKPOINT_N_VECTORS * sizeof(double);
+    MPI_File_read_at_all(fh, offset, stage, local_n, row_type, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&row_type);
+    for (int i = 0; i < local_n; i++) {
+        x[i] = stage[(size_t)i * CHECKPOINT_N_VECTORS];
+        r[i] = stage[(size_t)i * CHECKPOINT_N_VECTORS + 1];
+        d[i] = stage[(size_t)i * CHECKPOINT_N_VECTORS + 2];
+    }
+    free(stage);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file compact_ops.c
+ * @brief Implementation of the reduced-precision compressed CSR storage
+ */
+
+#include "compact_ops.h"
+#include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int compact_value_type_from_string(const char* name, CompactValueType* type) {
+    if (strcmp(name, "float") == 0) {
+        *type = COMPACT_FLOAT;
+    } else if (strcmp(name, "bf16") == 0) {
+        *type = COMPACT_BF16;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Round a double to bf16 (round to nearest even on the float bits)
+static uint16_t to_bf16(double v) {
+    float f = (float)v;
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+static inline float from_bf16(uint16_t h) {
+    uint32_t u = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static void* checked_malloc(size_t size, const char* what) {
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Compact storage: Failed to allocate %s\n", what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+void compact_from_csr(CompactMatrix* A, const int* ptr, const int* cols, const double* vals,
+                      const int* rows, int n_rows, CompactValueType value_type) {
+    memset(A, 0, sizeof(CompactMatrix));
+    A->value_type = value_type;
+    A->n_rows = n_rows;
+    A->rows = checked_malloc(n_rows * sizeof(int), "rows");
+    A->ptr = checked_malloc((n_rows + 1) * sizeof(int), "row pointer");
+    A->base = checked_malloc(n_rows * sizeof(int), "row bases");
+    A->esc_ptr = checked_malloc((n_rows + 1) * sizeof(int), "escape pointer");
+
+    // Row bases and escape counts
+    A->ptr[0] = 0;
+    A->esc_ptr[0] = 0;
+    for (int k = 0; k < n_rows; k++) {
+        int i = rows ? rows[k] : k;
+        A->rows[k] = i;
+        int base = 0;
+        if (ptr[i + 1] > ptr[i]) {
+            base = cols[ptr[i]];
+            for (int j = ptr[i] + 1; j < ptr[i + 1]; j++) {
+                if (cols[j] < base) base = cols[j];
+            }
+        }
+        int n_esc = 0;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            if ((long long)cols[j] - base >= COMPACT_ESCAPE) n_esc++;
+        }
+        A->base[k] = base;
+        A->ptr[k + 1] = A->ptr[k] + (ptr[i + 1] - ptr[i]);
+        A->esc_ptr[k + 1] = A->esc_ptr[k] + n_esc;
+    }
+    A->nnz = A->ptr[n_rows];
+    A->n_escape = A->esc_ptr[n_rows];
+
+    A->delta = checked_malloc(A->nnz * sizeof(uint16_t), "column deltas");
+    A->escapes = checked_malloc(A->n_escape * sizeof(int), "escaped columns");
+    if (value_type == COMPACT_BF16) {
+        A->vals_h = checked_malloc(A->nnz * sizeof(uint16_t), "values");
+    } else {
+        A->vals_f = checked_malloc(A->nnz * sizeof(float), "values");
+    }
+
+    // Fill with the kernel's row split so first touch matches the SpMV threads
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int k_begin, k_end;
+        csr_thread_rows(A->ptr, n_rows, tid, n_threads, &k_begin, &k_end);
+        for (int k = k_begin; k < k_end; k++) {
+            int i = A->rows[k];
+            int pos = A->ptr[k];
+            int esc = A->esc_ptr[k];
+            for (int j = ptr[i]; j < ptr[i + 1]; j++, pos++) {
+                long long d = (long long)cols[j] - A->base[k];
+                if (d >= COMPACT_ESCAPE) {
+                    A->delta[pos] = COMPACT_ESCAPE;
+                    A->escapes[esc++] = cols[j];
+                } else {
+                    A->delta[pos] = (uint16_t)d;
+                }
+                if (value_type == COMPACT_BF16) {
+                    A->vals_h[pos] = to_bf16(vals[j]);
+                } else {
+                    A->vals_f[pos] = (float)vals[j];
+                }
+            }
+        }
+    }
+}
+
+void mat_vec_compact(const CompactMatrix* A, const double* x_ext, double* y) {
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int k_begin, k_end;
+        csr_thread_rows(A->ptr, A->n_rows, tid, n_threads, &k_begin, &k_end);
+        for (int k = k_begin; k < k_end; k++) {
+            const double* xb = x_ext + A->base[k];
+            const int* esc = A->escapes + A->esc_ptr[k];
+            double sum = 0.0;
+            if (A->esc_ptr[k + 1] == A->esc_ptr[k]) {
+                // Common case: every column fits in 16 bits
+                if (A->value_type == COMPACT_BF16) {
+                    for (int j = A->ptr[k]; j < A->ptr[k + 1]; j++) {
+                        sum += (double)from_bf16(A->vals_h[j]) * xb[A->delta[j]];
+                    }
+                } else {
+                    for (int j = A->ptr[k]; j < A->ptr[k + 1]; j++) {
+                        sum += (double)A->vals_f[j] * xb[A->delta[j]];
+                    }
+                }
+            } else {
+                for (int j = A->ptr[k]; j < A->ptr[k + 1]; j++) {
+                    double v = (A->value_type == COMPACT_BF16) ? from_bf16(A->vals_h[j])
+                                                                : A->vals_f[j];
+                    double xv = (A->delta[j] == COMPACT_ESCAPE) ? x_ext[*esc++]
+                                                               : xb[A->delta[j]];
+                    sum += v * xv;
+                }
+            }
+            y[A->rows[k]] = sum;
+        }
+    }
+}
+
+double compact_bytes(const CompactMatrix* A) {
+    size_t value_size = (A->value_type == COMPACT_BF16) ? sizeof(uint16_t) : sizeof(float);
+    return (double)A->nnz * (sizeof(uint16_t) + value_size) +
+           (double)A->n_escape * sizeof(int) +
+           (double)A->n_rows * 2 * sizeof(int) + 2.0 * (A->n_rows + 1) * sizeof(int);
+}
+
+void compact_free(CompactMatrix* A) {
+    free(A->rows);
+    free(A->ptr);
+    free(A->base);
+    free(A->esc_ptr);
+    free(A->delta);
+    free(A->escapes);
+    free(A->vals_f);
+    free(A->vals_h);
+    memset(A, 0, sizeof(CompactMatrix));
+}
@@ -4,13 +4,175 @@
  */
 
 #include "csr_io.h"
+#include "sparse_ops.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Byte offsets and types of the sections of a matrix file
+typedef struct {
+    long long n;
+    long long nnz;
+    int index_width;            // Bytes per ptr and cols entry
+    int value_type;             // CSR_VALUE_*
+    int symmetric;
+    int n_parts;                // Entries of the partition table
+    MPI_Offset off_parts;
+    MPI_Offset off_ptr;
+    MPI_Offset off_cols;
+    MPI_Offset off_vals;
+} CsrLayout;
+
+static MPI_Offset align8(MPI_Offset offset) {
+    return (offset + 7) / 8 * 8;
+}
+
+static void* checked_malloc(size_t size, const char* what) {
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Failed to allocate %s\n", what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+// Section offsets of a versioned file
+static void versioned_layout(CsrLayout* L) {
+    L->off_parts = sizeof(CsrHeader);
+    L->off_ptr = align8(L->off_parts + (L->n_parts > 0 ? (L->n_parts + 1) * 8 : 0));
+    L->off_cols = align8(L->off_ptr + (MPI_Offset)(L->n + 1) * L->index_width);
+    L->off_vals = align8(L->off_cols + (MPI_Offset)L->nnz * L->index_width);
+}
+
+// Rank 0 parses the header of either file version; the result is broadcast
+static void read_layout(MPI_File fh, int rank, CsrLayout* L) {
+    memset(L, 0, sizeof(CsrLayout));
+    if (rank == 0) {
+        int lead[3];
+        MPI_File_read_at(fh, 0, lead, 3, MPI_INT, MPI_STATUS_IGNORE);
+        if (lead[0] == CSR_VERSIONED_MAGIC) {
+            CsrHeader h;
+            MPI_File_read_at(fh, 0, &h, sizeof(h), MPI_BYTE, MPI_STATUS_IGNORE);
+            if (h.version != CSR_FORMAT_VERSION || (h.index_width != 4 && h.index_width != 8) ||
+                (h.value_type != CSR_VALUE_DOUBLE && h.value_type != CSR_VALUE_FLOAT) ||
+                h.n_parts < 0) {
+                fprintf(stderr, "Rank 0: Unsupported matrix file (version %d, index width %d, "
+                        "value type %d)\n", h.version, h.index_width, h.value_type);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            L->n = h.n;
+            L->nnz = h.nnz;
+            L->index_width = h.index_width;
+            L->value_type = h.value_type;
+            L->symmetric = (h.flags & CSR_FLAG_SYMMETRIC) != 0;
+            L->n_parts = h.n_parts;
+            versioned_layout(L);
+        } else {
+            // Unversioned: int32 [n][nnz] or [-1][n][nnz]
+            L->symmetric = (lead[0] == CSR_SYMMETRIC_MAGIC);
+            L->n = L->symmetric ? lead[1] : lead[0];
+            L->nnz = L->symmetric ? lead[2] : lead[1];
+            L->index_width = sizeof(int);
+            L->value_type = CSR_VALUE_DOUBLE;
+            L->off_ptr = (L->symmetric ? 3 : 2) * sizeof(int);
+            L->off_cols = L->off_ptr + (MPI_Offset)(L->n + 1) * sizeof(int);
+            L->off_vals = L->off_cols + (MPI_Offset)L->nnz * sizeof(int);
+        }
+        if (L->n <= 0 || L->nnz <= 0 || L->n > INT_MAX) {
+            fprintf(stderr, "Rank 0: Invalid matrix dimensions: n=%lld, nnz=%lld\n",
+                    L->n, L->nnz);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Bcast(L, sizeof(CsrLayout), MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+// Collective read of count indices starting at entry start, widened to long long
+static void read_ptr_entries(MPI_File fh, const CsrLayout* L, long long start, int count,
+                             long long* out) {
+    MPI_Offset offset = L->off_ptr + (MPI_Offset)start * L->index_width;
+    if (L->index_width == 8) {
+        MPI_File_read_at_all(fh, offset, out, count, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+        return;
+    }
+    int* buf = checked_malloc(count * sizeof(int), "row pointer buffer");
+    MPI_File_read_at_all(fh, offset, buf, count, MPI_INT, MPI_STATUS_IGNORE);
+    for (int i = 0; i < count; i++) {
+        out[i] = buf[i];
+    }
+    free(buf);
+}
+
+/**
+ * @brief Row distribution without the whole row pointer on any process
+ *
+ * PART_FILE takes the partition table when it matches p. Otherwise each
+ * process reads an equal slice of the row pointer and the split is found
+ * with rowdist_from_ptr_slice().
+ */
+static void read_distribution(MPI_File fh, const CsrLayout* L, const char* filename,
+                              int rank, int p, PartitionType part, double nnz_weight,
+                              RowDist* dist) {
+    int n = (int)L->n;
+    if (part == PART_FILE) {
+        if (L->n_parts == p) {
+            long long range[2];
+            MPI_File_read_at_all(fh, L->off_parts + (MPI_Offset)rank * 8, range, 2,
+                                 MPI_LONG_LONG, MPI_STATUS_IGNORE);
+            rowdist_from_counts(dist, (int)(range[1] - range[0]), p);
+            if (dist->global_n != n) {
+                if (rank == 0) fprintf(stderr, "Rank 0: Invalid partition table in %s\n", filename);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            return;
+        }
+        if (rank == 0) {
+            printf("No partition table for %d processes in %s, using -partition nnz\n",
+                   p, filename);
+        }
+        part = PART_NNZ;
+    }
+    int slice_start = (int)((long long)n * rank / p);
+    int slice_n = (int)((long long)n * (rank + 1) / p) - slice_start;
+    long long* slice = checked_malloc((slice_n + 1) * sizeof(long long), "row pointer slice");
+    read_ptr_entries(fh, L, slice_start, slice_n + 1, slice);
+    rowdist_from_ptr_slice(dist, slice, slice_start, slice_n, n, p, part, nnz_weight);
+    free(slice);
+}
+
+/**
+ * @brief Map count elements of size bytes at a file offset
+ *
+ * Returns the address of the first element and the mapping in *base and
+ * *len, or NULL if mapping failed.
+ */
+static void* map_section(int fd, MPI_Offset offset, size_t count, size_t size,
+                         void** base, size_t* len) {
+    long page = sysconf(_SC_PAGESIZE);
+    off_t start = (off_t)(offset / page * page);
+    *len = (size_t)(offset - start) + count * size;
+    if (*len == 0) *len = 1;
+    void* addr = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, start);
+    if (addr == MAP_FAILED) {
+        *base = NULL;
+        return NULL;
+    }
+    *base = addr;
+    return (char*)addr + (offset - start);
+}
 
 void read_csr_parallel(const char* filename, int** ptr, int** cols, double** vals,
                        int* local_n, int* local_nnz, int* global_n, 
-                       int rank, int p) {
+                       int rank, int p, PartitionType part, double nnz_weight,
+                       RowDist* dist, int* symmetric, CsrMapping* map) {
     MPI_File fh;
     int err = MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_RDONLY, 
                             MPI_INFO_NULL, &fh);
@@ -22,66 +184,213 @@ void read_csr_parallel(const char* filename, int** ptr, int** cols, double** val
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
-    int n, nnz;
-    if (rank == 0) {
-        MPI_File_read(fh, &n, 1, MPI_INT, MPI_STATUS_IGNORE);
-        MPI_File_read(fh, &nnz, 1, MPI_INT, MPI_STATUS_IGNORE);
-        if (n <= 0 || nnz <= 0) {
-            fprintf(stderr, "Rank 0: Invalid matrix dimensions: n=%d, nnz=%d\n", n, nnz);
+    CsrLayout L;
+    read_layout(fh, rank, &L);
+    *global_n = (int)L.n;
+    *symmetric = L.symmetric;
+
+    // Contiguous block distribution balanced by rows and/or nonzeros
+    read_distribution(fh, &L, filename, rank, p, part, nnz_weight, dist);
+    int row_start = dist->offsets[rank];
+    int row_end = dist->offsets[rank + 1];
+    *local_n = row_end - row_start;
+
+    // Only our slice of the row pointer
+    long long* file_ptr = checked_malloc((*local_n + 1) * sizeof(long long), "row pointer");
+    read_ptr_entries(fh, &L, row_start, *local_n + 1, file_ptr);
+    long long nnz_start = file_ptr[0];
+    long long nnz_count = file_ptr[*local_n] - nnz_start;
+    if (nnz_count > INT_MAX) {
+        fprintf(stderr, "Rank %d: %lld local nonzeros exceed the 32-bit local index range; "
+                "use more processes\n", rank, nnz_count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    *local_nnz = (int)nnz_count;
+
+    *ptr = checked_malloc((*local_n + 1) * sizeof(int), "ptr");
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i <= *local_n; i++) {
+        (*ptr)[i] = (int)(file_ptr[i] - nnz_start);
+    }
+    free(file_ptr);
+
+    MPI_Offset offset_cols = L.off_cols + (MPI_Offset)nnz_start * L.index_width;
+    size_t value_size = (L.value_type == CSR_VALUE_FLOAT) ? sizeof(float) : sizeof(double);
+    MPI_Offset offset_vals = L.off_vals + (MPI_Offset)nnz_start * value_size;
+
+    if (map != NULL) {
+        memset(map, 0, sizeof(CsrMapping));
+        // Mapped arrays must have the in-memory types and alignment
+        int mappable = L.index_width == sizeof(int) && L.value_type == CSR_VALUE_DOUBLE &&
+                       offset_vals % sizeof(double) == 0;
+        int fd = mappable ? open(filename, O_RDONLY) : -1;
+        if (fd >= 0) {
+            *cols = map_section(fd, offset_cols, *local_nnz, sizeof(int),
+                                &map->cols_addr, &map->cols_len);
+            *vals = map_section(fd, offset_vals, *local_nnz, sizeof(double),
+                                &map->vals_addr, &map->vals_len);
+            close(fd);
+        }
+        int mapped = (map->cols_addr != NULL && map->vals_addr != NULL);
+        int all_mapped;
+        MPI_Allreduce(&mapped, &all_mapped, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if (all_mapped) {
             MPI_File_close(&fh);
-            MPI_Abort(MPI_COMM_WORLD, 1);
+            return;
         }
+        // Every process falls back, since the reads below are collective
+        csr_release(map, NULL, NULL);
+        if (rank == 0) printf("Could not map %s, reading it instead\n", filename);
     }
-    MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&nnz, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    *global_n = n;
 
-    int* full_ptr = malloc((n + 1) * sizeof(int));
-    if (full_ptr == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate full_ptr\n", rank);
-        MPI_File_close(&fh);
-        MPI_Abort(MPI_COMM_WORLD, 1);
+    *cols = checked_malloc(*local_nnz * sizeof(int), "cols");
+    *vals = checked_malloc(*local_nnz * sizeof(double), "vals");
+
+    // First touch with the nonzero-balanced row split used by the threaded SpMV,
+    // so each thread's slice of cols/vals lands on its own NUMA node
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int row_begin, row_end;
+        csr_thread_rows(*ptr, *local_n, tid, n_threads, &row_begin, &row_end);
+        for (int j = (*ptr)[row_begin]; j < (*ptr)[row_end]; j++) {
+            (*cols)[j] = 0;
+            (*vals)[j] = 0.0;
+        }
     }
-    MPI_File_read_at_all(fh, 2 * sizeof(int), full_ptr, n + 1, MPI_INT, MPI_STATUS_IGNORE);
 
-    // Simple block distribution 
-    int rows_per_proc = (n + p - 1) / p;
-    int row_start = rank * rows_per_proc;
-    int row_end = (rank == p - 1) ? n : (rank + 1) * rows_per_proc;
+    if (L.index_width == sizeof(int)) {
+        MPI_File_read_at_all(fh, offset_cols, *cols, *local_nnz, MPI_INT, MPI_STATUS_IGNORE);
+    } else {
+        long long* buf = checked_malloc(*local_nnz * sizeof(long long), "column buffer");
+        MPI_File_read_at_all(fh, offset_cols, buf, *local_nnz, MPI_LONG_LONG,
+                             MPI_STATUS_IGNORE);
+        for (int j = 0; j < *local_nnz; j++) {
+            (*cols)[j] = (int)buf[j];
+        }
+        free(buf);
+    }
+    if (L.value_type == CSR_VALUE_DOUBLE) {
+        MPI_File_read_at_all(fh, offset_vals, *vals, *local_nnz, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    } else {
+        float* buf = checked_malloc(*local_nnz * sizeof(float), "value buffer");
+        MPI_File_read_at_all(fh, offset_vals, buf, *local_nnz, MPI_FLOAT, MPI_STATUS_IGNORE);
+        for (int j = 0; j < *local_nnz; j++) {
+            (*vals)[j] = buf[j];
+        }
+        free(buf);
+    }
 
-    *local_n = row_end - row_start;
-    *local_nnz = full_ptr[row_end] - full_ptr[row_start];
+    MPI_File_close(&fh);
+}
 
-    *ptr = malloc((*local_n + 1) * sizeof(int));
-    if (*ptr == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate ptr\n", rank);
-        free(full_ptr);
-        MPI_File_close(&fh);
-        MPI_Abort(MPI_COMM_WORLD, 1);
+void csr_release(CsrMapping* map, int* cols, double* vals) {
+    if (map != NULL && map->cols_addr != NULL) {
+        munmap(map->cols_addr, map->cols_len);
+    } else {
+        free(cols);
     }
-    for (int i = 0; i <= *local_n; i++) {
-        (*ptr)[i] = full_ptr[row_start + i] - full_ptr[row_start];
+    if (map != NULL && map->vals_addr != NULL) {
+        munmap(map->vals_addr, map->vals_len);
+    } else {
+        free(vals);
     }
+    if (map != NULL) memset(map, 0, sizeof(CsrMapping));
+}
+
+
+void write_csr_parallel(const char* filename, const int* ptr, const int* cols,
+                        const double* vals, int local_n, const RowDist* dist,
+                        int symmetric, int rank) {
+    int p = dist->p;
+    int row_start = dist->offsets[rank];
+    long long local_nnz = ptr[local_n] - ptr[0];
+
+    // Global offset of our first nonzero and total nonzeros
+    long long nnz_start = 0;
+    long long nnz = 0;
+    MPI_Exscan(&local_nnz, &nnz_start, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) nnz_start = 0;
+    MPI_Allreduce(&local_nnz, &nnz, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
 
-    *cols = malloc(*local_nnz * sizeof(int));
-    *vals = malloc(*local_nnz * sizeof(double));
-    if (*cols == NULL || *vals == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate cols or vals\n", rank);
-        free(*ptr); 
-        free(full_ptr); 
-        MPI_File_close(&fh); 
+    MPI_File fh;
+    int err = MPI_File_open(MPI_COMM_WORLD, (char*)filename,
+                            MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+    if (err != MPI_SUCCESS) {
+        char err_str[MPI_MAX_ERROR_STRING];
+        int len;
+        MPI_Error_string(err, err_str, &len);
+        fprintf(stderr, "Rank %d: Failed to open %s: %s\n", rank, filename, err_str);
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
+    MPI_File_set_size(fh, 0);
 
-    size_t offset_cols = 2 * sizeof(int) + (n + 1) * sizeof(int);
-    size_t offset_vals = offset_cols + nnz * sizeof(int);
+    CsrHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CSR_VERSIONED_MAGIC;
+    h.version = CSR_FORMAT_VERSION;
+    h.n = dist->global_n;
+    h.nnz = nnz;
+    h.index_width = (nnz > INT_MAX) ? 8 : 4;
+    h.value_type = CSR_VALUE_DOUBLE;
+    h.flags = symmetric ? CSR_FLAG_SYMMETRIC : 0;
+    h.n_parts = p;
+    CsrLayout L;
+    memset(&L, 0, sizeof(L));
+    L.n = h.n;
+    L.nnz = nnz;
+    L.index_width = h.index_width;
+    L.n_parts = p;
+    versioned_layout(&L);
 
-    MPI_File_read_at_all(fh, offset_cols + full_ptr[row_start] * sizeof(int),
-                         *cols, *local_nnz, MPI_INT, MPI_STATUS_IGNORE);
-    MPI_File_read_at_all(fh, offset_vals + full_ptr[row_start] * sizeof(double),
-                         *vals, *local_nnz, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    // Header and partition table from rank 0
+    long long* table = checked_malloc((p + 1) * sizeof(long long), "partition table");
+    for (int k = 0; k <= p; k++) {
+        table[k] = dist->offsets[k];
+    }
+    MPI_File_write_at_all(fh, 0, &h, rank == 0 ? (int)sizeof(h) : 0, MPI_BYTE,
+                          MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, L.off_parts, table, rank == 0 ? p + 1 : 0, MPI_LONG_LONG,
+                          MPI_STATUS_IGNORE);
+    free(table);
+
+    // The last process also writes the closing entry of the row pointer
+    int n_ptr = (rank == p - 1) ? local_n + 1 : local_n;
+    MPI_Offset offset_ptr = L.off_ptr + (MPI_Offset)row_start * L.index_width;
+    MPI_Offset offset_cols = L.off_cols + (MPI_Offset)nnz_start * L.index_width;
+    MPI_Offset offset_vals = L.off_vals + (MPI_Offset)nnz_start * sizeof(double);
+    if (L.index_width == sizeof(int)) {
+        int* global_ptr = checked_malloc((n_ptr + 1) * sizeof(int), "row pointer buffer");
+        for (int i = 0; i < n_ptr; i++) {
+            global_ptr[i] = (int)(ptr[i] - ptr[0] + nnz_start);
+        }
+        MPI_File_write_at_all(fh, offset_ptr, global_ptr, n_ptr, MPI_INT, MPI_STATUS_IGNORE);
+        MPI_File_write_at_all(fh, offset_cols, cols + ptr[0], (int)local_nnz, MPI_INT,
+                              MPI_STATUS_IGNORE);
+        free(global_ptr);
+    } else {
+        long long* global_ptr = checked_malloc((n_ptr + 1) * sizeof(long long),
+                                               "row pointer buffer");
+        long long* wide_cols = checked_malloc(local_nnz * sizeof(long long), "column buffer");
+        for (int i = 0; i < n_ptr; i++) {
+            global_ptr[i] = ptr[i] - ptr[0] + nnz_start;
+        }
+        for (long long j = 0; j < local_nnz; j++) {
+            wide_cols[j] = cols[ptr[0] + j];
+        }
+        MPI_File_write_at_all(fh, offset_ptr, global_ptr, n_ptr, MPI_LONG_LONG,
+                              MPI_STATUS_IGNORE);
+        MPI_File_write_at_all(fh, offset_cols, wide_cols, (int)local_nnz, MPI_LONG_LONG,
+                              MPI_STATUS_IGNORE);
+        free(global_ptr);
+        free(wide_cols);
+    }
+    MPI_File_write_at_all(fh, offset_vals, vals + ptr[0], (int)local_nnz, MPI_DOUBLE,
+                          MPI_STATUS_IGNORE);
 
-    free(full_ptr);
     MPI_File_close(&fh);
 }
-
@@ -0,0 +1,351 @@
+/**
+ * @file deflation.c
+ * @brief Implementation of the recycled deflation space
+ */
+
+#include "deflation.h"
+#include "vector_ops.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define JACOBI_SWEEPS 50
+
+static double* defl_alloc(size_t count) {
+    double* mem = malloc((count > 0 ? count : 1) * sizeof(double));
+    if (mem == NULL) {
+        fprintf(stderr, "Failed to allocate deflation space\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return mem;
+}
+
+// In-place lower Cholesky factor of an m x m SPD matrix; -1 if not SPD
+static int chol_factor(double* H, int m) {
+    for (int j = 0; j < m; j++) {
+        double d = H[j * m + j];
+        for (int k = 0; k < j; k++) d -= H[j * m + k] * H[j * m + k];
+        if (!(d > 0.0)) return -1;
+        d = sqrt(d);
+        H[j * m + j] = d;
+        for (int i = j + 1; i < m; i++) {
+            double s = H[i * m + j];
+            for (int k = 0; k < j; k++) s -= H[i * m + k] * H[j * m + k];
+            H[i * m + j] = s / d;
+        }
+        for (int k = j + 1; k < m; k++) H[j * m + k] = 0.0;
+    }
+    return 0;
+}
+
+// v = (L L^T)^{-1} v for a lower factor L
+static void chol_solve_vec(const double* L, double* v, int m) {
+    for (int i = 0; i < m; i++) {
+        double s = v[i];
+        for (int k = 0; k < i; k++) s -= L[i * m + k] * v[k];
+        v[i] = s / L[i * m + i];
+    }
+    for (int i = m - 1; i >= 0; i--) {
+        double s = v[i];
+        for (int k = i + 1; k < m; k++) s -= L[k * m + i] * v[k];
+        v[i] = s / L[i * m + i];
+    }
+}
+
+// Eigenvalues (diagonal of A on return) and eigenvectors (columns of V) of a symmetric matrix
+static void jacobi_eigen(double* A, double* V, int m) {
+    for (int i = 0; i < m * m; i++) V[i] = 0.0;
+    for (int i = 0; i < m; i++) V[i * m + i] = 1.0;
+    for (int sweep = 0; sweep < JACOBI_SWEEPS; sweep++) {
+        double off = 0.0, diag = 0.0;
+        for (int i = 0; i < m; i++) {
+            diag += A[i * m + i] * A[i * m + i];
+            for (int j = i + 1; j < m; j++) off += A[i * m + j] * A[i * m + j];
+        }
+        if (off <= 1e-30 * diag) break;
+        for (int p = 0; p < m; p++) {
+            for (int q = p + 1; q < m; q++) {
+                double apq = A[p * m + q];
+                if (apq == 0.0) continue;
+                double theta = (A[q * m + q] - A[p * m + p]) / (2.0 * apq);
+                double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+                for (int k = 0; k < m; k++) {
+                    double akp = A[k * m + p], akq = A[k * m + q];
+                    A[k * m + p] = c * akp - s * akq;
+                    A[k * m + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < m; k++) {
+                    double apk = A[p * m + k], aqk = A[q * m + k];
+                    A[p * m + k] = c * apk - s * aqk;
+                    A[q * m + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < m; k++) {
+                    double vkp = V[k * m + p], vkq = V[k * m + q];
+                    V[k * m + p] = c * vkp - s * vkq;
+                    V[k * m + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+void deflation_init(Deflation* d, int local_n, int k, int window) {
+    memset(d, 0, sizeof(Deflation));
+    d->local_n = local_n;
+    d->k_max = k;
+    d->window = window;
+    d->first_iters = -1;
+    d->W = defl_alloc((size_t)local_n * k);
+    d->AW = defl_alloc((size_t)local_n * k);
+    d->U = defl_alloc((size_t)local_n * k);
+    d->AU = defl_alloc((size_t)local_n * k);
+    d->T = defl_alloc((size_t)local_n * k);
+    d->AT = defl_alloc((size_t)local_n * k);
+    d->P = defl_alloc((size_t)local_n * window);
+    d->AP = defl_alloc((size_t)local_n * window);
+}
+
+void deflation_start(Deflation* d, double* x, double* r) {
+    int n = d->local_n, k = d->k;
+    int len = k * k + k;
+    double local[DEFLATION_MAX * DEFLATION_MAX + DEFLATION_MAX];
+    double global[DEFLATION_MAX * DEFLATION_MAX + DEFLATION_MAX];
+    for (int i = 0; i < len; i++) local[i] = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:local[:len])
+    for (int i = 0; i < n; i++) {
+        const double* w = d->W + (size_t)i * k;
+        const double* aw = d->AW + (size_t)i * k;
+        for (int a = 0; a < k; a++) {
+            for (int b = 0; b < k; b++) local[a * k + b] += w[a] * aw[b];
+            local[k * k + a] += w[a] * r[i];
+        }
+    }
+    allreduce_sum(local, global, len);
+
+    // E = W^T A W, symmetrized against rounding
+    for (int a = 0; a < k; a++) {
+        for (int b = 0; b < k; b++) {
+            d->E[a * k + b] = 0.5 * (global[a * k + b] + global[b * k + a]);
+        }
+    }
+    if (chol_factor(d->E, k) != 0) {
+        d->k = 0;
+        return;
+    }
+    double mu[DEFLATION_MAX];
+    for (int a = 0; a < k; a++) mu[a] = global[k * k + a];
+    chol_solve_vec(d->E, mu, k);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        const double* w = d->W + (size_t)i * k;
+        const double* aw = d->AW + (size_t)i * k;
+        double dx = 0.0, dr = 0.0;
+        for (int a = 0; a < k; a++) {
+            dx += w[a] * mu[a];
+            dr += aw[a] * mu[a];
+        }
+        x[i] += dx;
+        r[i] -= dr;
+    }
+}
+
+void deflation_coef_local(const Deflation* d, const double* z, double* c) {
+    int n = d->local_n, k = d->k;
+    for (int a = 0; a < k; a++) c[a] = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:c[:k])
+    for (int i = 0; i < n; i++) {
+        const double* aw = d->AW + (size_t)i * k;
+        for (int a = 0; a < k; a++) c[a] += aw[a] * z[i];
+    }
+}
+
+void deflation_direction(const Deflation* d, double* p, const double* c) {
+    int n = d->local_n, k = d->k;
+    double mu[DEFLATION_MAX];
+    for (int a = 0; a < k; a++) mu[a] = c[a];
+    chol_solve_vec(d->E, mu, k);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        const double* w = d->W + (size_t)i * k;
+        double s = 0.0;
+        for (int a = 0; a < k; a++) s += w[a] * mu[a];
+        p[i] -= s;
+    }
+}
+
+// Compress span{U, P} into the k_max Ritz vectors of smallest Ritz values (collective)
+static void compress(Deflation* d) {
+    int n = d->local_n, k = d->u_k, np = d->n_p, l = d->window;
+    int m = k + np;
+    d->n_p = 0;
+    if (np == 0) return;
+
+    // G = Z^T A Z and F = Z^T Z over Z = [U, P], in one reduction
+    int len = 2 * m * m;
+    double* local = defl_alloc((size_t)len);
+    double* global = defl_alloc((size_t)len);
+    for (int i = 0; i < len; i++) local[i] = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:local[:len])
+    for (int i = 0; i < n; i++) {
+        double z[2 * DEFLATION_MAX], az[2 * DEFLATION_MAX];
+        for (int a = 0; a < k; a++) {
+            z[a] = d->U[(size_t)i * k + a];
+            az[a] = d->AU[(size_t)i * k + a];
+        }
+        for (int a = 0; a < np; a++) {
+            z[k + a] = d->P[(size_t)i * l + a];
+            az[k + a] = d->AP[(size_t)i * l + a];
+        }
+        for (int a = 0; a < m; a++) {
+            for (int b = 0; b < m; b++) {
+                local[a * m + b] += z[a] * az[b];
+                local[m * m + a * m + b] += z[a] * z[b];
+            }
+        }
+    }
+    allreduce_sum(local, global, len);
+    double* L = local;
+    double* F = global + m * m;
+    for (int a = 0; a < m; a++) {
+        for (int b = 0; b < m; b++) L[a * m + b] = 0.5 * (global[a * m + b] + global[b * m + a]);
+    }
+    if (chol_factor(L, m) != 0) {
+        free(local);
+        free(global);
+        return;
+    }
+
+    // The pencil (F, G) as C = L^{-1} F L^{-T}; its largest eigenvalues are 1 / (smallest Ritz values)
+    double* C = defl_alloc((size_t)m * m);
+    double* V = defl_alloc((size_t)m * m);
+    for (int b = 0; b < m; b++) {
+        for (int a = 0; a < m; a++) {
+            double s = F[a * m + b];
+            for (int q = 0; q < a; q++) s -= L[a * m + q] * C[q * m + b];
+            C[a * m + b] = s / L[a * m + a];
+        }
+    }
+    for (int a = 0; a < m; a++) {
+        for (int b = 0; b < m; b++) F[a * m + b] = C[b * m + a];
+    }
+    for (int b = 0; b < m; b++) {
+        for (int a = 0; a < m; a++) {
+            double s = F[a * m + b];
+            for (int q = 0; q < a; q++) s -= L[a * m + q] * C[q * m + b];
+            C[a * m + b] = s / L[a * m + a];
+        }
+    }
+    for (int a = 0; a < m; a++) {
+        for (int b = a + 1; b < m; b++) {
+            double s = 0.5 * (C[a * m + b] + C[b * m + a]);
+            C[a * m + b] = C[b * m + a] = s;
+        }
+    }
+    jacobi_eigen(C, V, m);
+
+    // Keep the k_max largest eigenvalues, Y = L^{-T} V, so that Y^T G Y = I
+    int order[2 * DEFLATION_MAX];
+    for (int a = 0; a < m; a++) order[a] = a;
+    for (int a = 1; a < m; a++) {
+        int t = order[a], b = a;
+        while (b > 0 && C[order[b - 1] * m + order[b - 1]] < C[t * m + t]) {
+            order[b] = order[b - 1];
+            b--;
+        }
+        order[b] = t;
+    }
+    int k_new = 0;
+    while (k_new < d->k_max && k_new < m && C[order[k_new] * m + order[k_new]] > 0.0) k_new++;
+    if (k_new == 0) {
+        free(local);
+        free(global);
+        free(C);
+        free(V);
+        return;
+    }
+    double* Y = F;
+    for (int c = 0; c < k_new; c++) {
+        for (int a = m - 1; a >= 0; a--) {
+            double s = V[a * m + order[c]];
+            for (int q = a + 1; q < m; q++) s -= L[q * m + a] * Y[q * k_new + c];
+            Y[a * k_new + c] = s / L[a * m + a];
+        }
+    }
+    d->ritz_min = 1.0 / C[order[0] * m + order[0]];
+    d->ritz_max = 1.0 / C[order[k_new - 1] * m + order[k_new - 1]];
+
+    // U = Z Y and AU = A Z Y
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < k_new; c++) {
+            double w = 0.0, aw = 0.0;
+            for (int a = 0; a < k; a++) {
+                w += d->U[(size_t)i * k + a] * Y[a * k_new + c];
+                aw += d->AU[(size_t)i * k + a] * Y[a * k_new + c];
+            }
+            for (int a = 0; a < np; a++) {
+                w += d->P[(size_t)i * l + a] * Y[(k + a) * k_new + c];
+                aw += d->AP[(size_t)i * l + a] * Y[(k + a) * k_new + c];
+            }
+            d->T[(size_t)i * k_new + c] = w;
+            d->AT[(size_t)i * k_new + c] = aw;
+        }
+    }
+    double* t = d->U;
+    d->U = d->T;
+    d->T = t;
+    t = d->AU;
+    d->AU = d->AT;
+    d->AT = t;
+    d->u_k = k_new;
+
+    free(local);
+    free(global);
+    free(C);
+    free(V);
+}
+
+void deflation_begin(Deflation* d) {
+    int n = d->local_n, k = d->k;
+    memcpy(d->U, d->W, (size_t)n * k * sizeof(double));
+    memcpy(d->AU, d->AW, (size_t)n * k * sizeof(double));
+    d->u_k = k;
+    d->n_p = 0;
+}
+
+void deflation_record(Deflation* d, const double* p, const double* Ap) {
+    if (d->n_p == d->window) compress(d);
+    int n = d->local_n, l = d->window, j = d->n_p++;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        d->P[(size_t)i * l + j] = p[i];
+        d->AP[(size_t)i * l + j] = Ap[i];
+    }
+}
+
+void deflation_update(Deflation* d) {
+    if (d->n_p > 0) compress(d);
+    double* t = d->W;
+    d->W = d->U;
+    d->U = t;
+    t = d->AW;
+    d->AW = d->AU;
+    d->AU = t;
+    d->k = d->u_k;
+}
+
+void deflation_free(Deflation* d) {
+    free(d->W);
+    free(d->AW);
+    free(d->U);
+    free(d->AU);
+    free(d->T);
+    free(d->AT);
+    free(d->P);
+    free(d->AP);
+    memset(d, 0, sizeof(Deflation));
+}
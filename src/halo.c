@@ -0,0 +1,348 @@
+/**
+ * @file halo.c
+ * @brief Implementation of neighbor-only ghost exchange
+ */
+
+#include "halo.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define HALO_TAG 1001
+#define HALO_ACC_TAG 1002
+#define HALO_ROWS_TAG 1004
+
+static int compare_int(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+void halo_setup(int* ptr, int* cols, const RowDist* dist, int rank, HaloPlan* plan) {
+    halo_setup_rect(ptr, dist->counts[rank], cols, dist, rank, plan);
+}
+
+void halo_setup_rect(int* ptr, int n_rows, int* cols, const RowDist* dist, int rank,
+                     HaloPlan* plan) {
+    prof_begin(PROF_HALO_SETUP);
+    int p = dist->p;
+    int global_n = dist->global_n;
+    int local_n = dist->counts[rank];
+    memset(plan, 0, sizeof(HaloPlan));
+    plan->comm = MPI_COMM_WORLD;
+    plan->local_n = local_n;
+
+    int row_start = dist->offsets[rank];
+    int row_end = dist->offsets[rank + 1];
+    int local_nnz = ptr[n_rows];
+
+    // Collect the distinct off-process columns, sorted by global index
+    int n_off = 0;
+    for (int j = 0; j < local_nnz; j++) {
+        if (cols[j] < row_start || cols[j] >= row_end) n_off++;
+    }
+    int* ghosts = malloc((n_off > 0 ? n_off : 1) * sizeof(int));
+    if (ghosts == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate ghost list\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    n_off = 0;
+    for (int j = 0; j < local_nnz; j++) {
+        if (cols[j] < row_start || cols[j] >= row_end) ghosts[n_off++] = cols[j];
+    }
+    qsort(ghosts, n_off, sizeof(int), compare_int);
+    int n_ghost = 0;
+    for (int k = 0; k < n_off; k++) {
+        if (n_ghost == 0 || ghosts[k] != ghosts[n_ghost - 1]) {
+            ghosts[n_ghost++] = ghosts[k];
+        }
+    }
+    plan->n_ghost = n_ghost;
+    plan->ghost_cols = ghosts;
+
+    // Renumber columns: owned -> [0, local_n), ghost -> local_n + position
+    for (int j = 0; j < local_nnz; j++) {
+        int c = cols[j];
+        if (c >= row_start && c < row_end) {
+            cols[j] = c - row_start;
+        } else {
+            int* pos = bsearch(&c, ghosts, n_ghost, sizeof(int), compare_int);
+            cols[j] = local_n + (int)(pos - ghosts);
+        }
+    }
+
+    // Count how many ghosts each rank owns; ghosts are sorted so they are grouped
+    int* need = calloc(p, sizeof(int));
+    int* give = malloc(p * sizeof(int));
+    if (need == NULL || give == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate halo counts\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int k = 0; k < n_ghost; k++) {
+        if (ghosts[k] < 0 || ghosts[k] >= global_n) {
+            fprintf(stderr, "Rank %d: Column index %d out of range\n", rank, ghosts[k]);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        need[rowdist_owner(dist, ghosts[k])]++;
+    }
+    MPI_Alltoall(need, 1, MPI_INT, give, 1, MPI_INT, MPI_COMM_WORLD);
+
+    for (int i = 0; i < p; i++) {
+        if (need[i] > 0) plan->n_recv++;
+        if (give[i] > 0) plan->n_send++;
+    }
+    plan->recv_ranks = malloc((plan->n_recv + 1) * sizeof(int));
+    plan->recv_counts = malloc((plan->n_recv + 1) * sizeof(int));
+    plan->recv_displs = malloc((plan->n_recv + 1) * sizeof(int));
+    plan->send_ranks = malloc((plan->n_send + 1) * sizeof(int));
+    plan->send_counts = malloc((plan->n_send + 1) * sizeof(int));
+    plan->send_displs = malloc((plan->n_send + 1) * sizeof(int));
+    plan->reqs = malloc((plan->n_recv + plan->n_send + 1) * sizeof(MPI_Request));
+    if (plan->recv_ranks == NULL || plan->recv_counts == NULL || plan->recv_displs == NULL ||
+        plan->send_ranks == NULL || plan->send_counts == NULL || plan->send_displs == NULL ||
+        plan->reqs == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate halo plan\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int nr = 0, ns = 0, recv_total = 0, send_total = 0;
+    for (int i = 0; i < p; i++) {
+        if (need[i] > 0) {
+            plan->recv_ranks[nr] = i;
+            plan->recv_counts[nr] = need[i];
+            plan->recv_displs[nr] = recv_total;
+            recv_total += need[i];
+            nr++;
+        }
+        if (give[i] > 0) {
+            plan->send_ranks[ns] = i;
+            plan->send_counts[ns] = give[i];
+            plan->send_displs[ns] = send_total;
+            send_total += give[i];
+            ns++;
+        }
+    }
+
+    plan->send_idx = malloc((send_total + 1) * sizeof(int));
+    plan->send_buf = malloc((send_total + 1) * sizeof(double));
+    plan->acc_buf = malloc((send_total + 1) * sizeof(double));
+    plan->acc_reqs = malloc((plan->n_recv + plan->n_send + 1) * sizeof(MPI_Request));
+    if (plan->send_idx == NULL || plan->send_buf == NULL ||
+        plan->acc_buf == NULL || plan->acc_reqs == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate halo send buffers\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Tell each owner which of its entries we need
+    for (int i = 0; i < plan->n_send; i++) {
+        MPI_Irecv(plan->send_idx + plan->send_displs[i], plan->send_counts[i], MPI_INT,
+                  plan->send_ranks[i], HALO_TAG, MPI_COMM_WORLD, &plan->reqs[i]);
+    }
+    for (int i = 0; i < plan->n_recv; i++) {
+        MPI_Isend(ghosts + plan->recv_displs[i], plan->recv_counts[i], MPI_INT,
+                  plan->recv_ranks[i], HALO_TAG, MPI_COMM_WORLD,
+                  &plan->reqs[plan->n_send + i]);
+    }
+    MPI_Waitall(plan->n_send + plan->n_recv, plan->reqs, MPI_STATUSES_IGNORE);
+
+    for (int k = 0; k < send_total; k++) {
+        plan->send_idx[k] -= row_start;
+    }
+
+    free(need);
+    free(give);
+    prof_end(PROF_HALO_SETUP);
+}
+
+void halo_exchange_begin(HaloPlan* plan, double* x) {
+    prof_begin(PROF_HALO_BEGIN);
+    double* ghost = x + plan->local_n;
+    for (int i = 0; i < plan->n_recv; i++) {
+        MPI_Irecv(ghost + plan->recv_displs[i], plan->recv_counts[i], MPI_DOUBLE,
+                  plan->recv_ranks[i], HALO_TAG, plan->comm, &plan->reqs[i]);
+    }
+    for (int i = 0; i < plan->n_send; i++) {
+        double* buf = plan->send_buf + plan->send_displs[i];
+        const int* idx = plan->send_idx + plan->send_displs[i];
+        for (int k = 0; k < plan->send_counts[i]; k++) {
+            buf[k] = x[idx[k]];
+        }
+        MPI_Isend(buf, plan->send_counts[i], MPI_DOUBLE, plan->send_ranks[i],
+                  HALO_TAG, plan->comm, &plan->reqs[plan->n_recv + i]);
+    }
+    prof_end(PROF_HALO_BEGIN);
+}
+
+void halo_exchange_block_begin(HaloPlan* plan, double* X, int k) {
+    prof_begin(PROF_HALO_BEGIN);
+    int send_total = plan->n_send > 0 ?
+        plan->send_displs[plan->n_send - 1] + plan->send_counts[plan->n_send - 1] : 0;
+    if (k > plan->block_buf_k) {
+        free(plan->block_buf);
+        plan->block_buf = malloc(((size_t)send_total * k + 1) * sizeof(double));
+        if (plan->block_buf == NULL) {
+            fprintf(stderr, "Failed to allocate block halo buffer\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        plan->block_buf_k = k;
+    }
+
+    double* ghost = X + (size_t)plan->local_n * k;
+    for (int i = 0; i < plan->n_recv; i++) {
+        MPI_Irecv(ghost + (size_t)plan->recv_displs[i] * k, plan->recv_counts[i] * k,
+                  MPI_DOUBLE, plan->recv_ranks[i], HALO_TAG, plan->comm, &plan->reqs[i]);
+    }
+    for (int i = 0; i < plan->n_send; i++) {
+        double* buf = plan->block_buf + (size_t)plan->send_displs[i] * k;
+        const int* idx = plan->send_idx + plan->send_displs[i];
+        for (int j = 0; j < plan->send_counts[i]; j++) {
+            memcpy(buf + (size_t)j * k, X + (size_t)idx[j] * k, k * sizeof(double));
+        }
+        MPI_Isend(buf, plan->send_counts[i] * k, MPI_DOUBLE, plan->send_ranks[i],
+                  HALO_TAG, plan->comm, &plan->reqs[plan->n_recv + i]);
+    }
+    prof_end(PROF_HALO_BEGIN);
+}
+
+void halo_exchange_end(HaloPlan* plan) {
+    prof_begin(PROF_HALO_END);
+    MPI_Waitall(plan->n_recv + plan->n_send, plan->reqs, MPI_STATUSES_IGNORE);
+    prof_end(PROF_HALO_END);
+}
+
+void halo_exchange(HaloPlan* plan, double* x) {
+    halo_exchange_begin(plan, x);
+    halo_exchange_end(plan);
+}
+
+void halo_accumulate_begin(HaloPlan* plan, const double* ghost_vals) {
+    prof_begin(PROF_HALO_BEGIN);
+    for (int i = 0; i < plan->n_send; i++) {
+        MPI_Irecv(plan->acc_buf + plan->send_displs[i], plan->send_counts[i], MPI_DOUBLE,
+                  plan->send_ranks[i], HALO_ACC_TAG, plan->comm, &plan->acc_reqs[i]);
+    }
+    for (int i = 0; i < plan->n_recv; i++) {
+        MPI_Isend(ghost_vals + plan->recv_displs[i], plan->recv_counts[i], MPI_DOUBLE,
+                  plan->recv_ranks[i], HALO_ACC_TAG, plan->comm,
+                  &plan->acc_reqs[plan->n_send + i]);
+    }
+    prof_end(PROF_HALO_BEGIN);
+}
+
+void halo_accumulate_end(HaloPlan* plan, double* y) {
+    prof_begin(PROF_HALO_END);
+    MPI_Waitall(plan->n_recv + plan->n_send, plan->acc_reqs, MPI_STATUSES_IGNORE);
+    // An owned entry may be a ghost of several neighbors, so add sequentially
+    for (int i = 0; i < plan->n_send; i++) {
+        const int* idx = plan->send_idx + plan->send_displs[i];
+        const double* buf = plan->acc_buf + plan->send_displs[i];
+        for (int k = 0; k < plan->send_counts[i]; k++) {
+            y[idx[k]] += buf[k];
+        }
+    }
+    prof_end(PROF_HALO_END);
+}
+
+void halo_exchange_rows(HaloPlan* plan, const int* ptr, const int* cols, const double* vals,
+                        int** ghost_ptr, int** ghost_cols, double** ghost_vals) {
+    prof_begin(PROF_HALO_BEGIN);
+    int n_req = plan->n_recv + plan->n_send;
+    int send_total = plan->n_send > 0 ?
+        plan->send_displs[plan->n_send - 1] + plan->send_counts[plan->n_send - 1] : 0;
+    int* send_len = malloc((send_total + 1) * sizeof(int));
+    int* recv_len = malloc((plan->n_ghost + 1) * sizeof(int));
+    int* send_ptr = malloc((send_total + 1) * sizeof(int));
+    int* g_ptr = malloc((plan->n_ghost + 1) * sizeof(int));
+    if (send_len == NULL || recv_len == NULL || send_ptr == NULL || g_ptr == NULL) {
+        fprintf(stderr, "Failed to allocate ghost row buffers\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Row lengths first, so the entries can be received in place
+    send_ptr[0] = 0;
+    for (int k = 0; k < send_total; k++) {
+        int row = plan->send_idx[k];
+        send_len[k] = ptr[row + 1] - ptr[row];
+        send_ptr[k + 1] = send_ptr[k] + send_len[k];
+    }
+    for (int i = 0; i < plan->n_recv; i++) {
+        MPI_Irecv(recv_len + plan->recv_displs[i], plan->recv_counts[i], MPI_INT,
+                  plan->recv_ranks[i], HALO_ROWS_TAG, plan->comm, &plan->reqs[i]);
+    }
+    for (int i = 0; i < plan->n_send; i++) {
+        MPI_Isend(send_len + plan->send_displs[i], plan->send_counts[i], MPI_INT,
+                  plan->send_ranks[i], HALO_ROWS_TAG, plan->comm, &plan->reqs[plan->n_recv + i]);
+    }
+    MPI_Waitall(n_req, plan->reqs, MPI_STATUSES_IGNORE);
+    g_ptr[0] = 0;
+    for (int k = 0; k < plan->n_ghost; k++) {
+        g_ptr[k + 1] = g_ptr[k] + recv_len[k];
+    }
+
+    int send_nnz = send_ptr[send_total];
+    int recv_nnz = g_ptr[plan->n_ghost];
+    int* send_cols = malloc((send_nnz + 1) * sizeof(int));
+    double* send_vals = malloc((send_nnz + 1) * sizeof(double));
+    int* g_cols = malloc((recv_nnz + 1) * sizeof(int));
+    double* g_vals = malloc((recv_nnz + 1) * sizeof(double));
+    MPI_Request* reqs = malloc((2 * n_req + 1) * sizeof(MPI_Request));
+    if (send_cols == NULL || send_vals == NULL || g_cols == NULL || g_vals == NULL ||
+        reqs == NULL) {
+        fprintf(stderr, "Failed to allocate ghost row buffers\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int k = 0; k < send_total; k++) {
+        int row = plan->send_idx[k];
+        memcpy(send_cols + send_ptr[k], cols + ptr[row], send_len[k] * sizeof(int));
+        memcpy(send_vals + send_ptr[k], vals + ptr[row], send_len[k] * sizeof(double));
+    }
+    // The ghosts of one neighbor are contiguous, and so are their rows
+    int r = 0;
+    for (int i = 0; i < plan->n_recv; i++) {
+        int first = g_ptr[plan->recv_displs[i]];
+        int len = g_ptr[plan->recv_displs[i] + plan->recv_counts[i]] - first;
+        MPI_Irecv(g_cols + first, len, MPI_INT, plan->recv_ranks[i], HALO_ROWS_TAG,
+                  plan->comm, &reqs[r++]);
+        MPI_Irecv(g_vals + first, len, MPI_DOUBLE, plan->recv_ranks[i], HALO_ROWS_TAG,
+                  plan->comm, &reqs[r++]);
+    }
+    for (int i = 0; i < plan->n_send; i++) {
+        int first = send_ptr[plan->send_displs[i]];
+        int len = send_ptr[plan->send_displs[i] + plan->send_counts[i]] - first;
+        MPI_Isend(send_cols + first, len, MPI_INT, plan->send_ranks[i], HALO_ROWS_TAG,
+                  plan->comm, &reqs[r++]);
+        MPI_Isend(send_vals + first, len, MPI_DOUBLE, plan->send_ranks[i], HALO_ROWS_TAG,
+                  plan->comm, &reqs[r++]);
+    }
+    MPI_Waitall(r, reqs, MPI_STATUSES_IGNORE);
+
+    free(send_len);
+    free(recv_len);
+    free(send_ptr);
+    free(send_cols);
+    free(send_vals);
+    free(reqs);
+    *ghost_ptr = g_ptr;
+    *ghost_cols = g_cols;
+    *ghost_vals = g_vals;
+    prof_end(PROF_HALO_BEGIN);
+}
+
+void halo_free(HaloPlan* plan) {
+    free(plan->ghost_cols);
+    free(plan->recv_ranks);
+    free(plan->recv_counts);
+    free(plan->recv_displs);
+    free(plan->send_ranks);
+    free(plan->send_counts);
+    free(plan->send_displs);
+    free(plan->send_idx);
+    free(plan->send_buf);
+    free(plan->reqs);
+    free(plan->acc_buf);
+    free(plan->acc_reqs);
+    free(plan->block_buf);
+    memset(plan, 0, sizeof(HaloPlan));
+}
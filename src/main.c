@@ -10,8 +10,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "autotune.h"
+#include "bcsr_ops.h"
+#include "block_cg.h"
 #include "csr_io.h"
 #include "cg_solver.h"
+#include "checkpoint.h"
+#include "halo.h"
+#include "mtx_io.h"
+#include "partition.h"
+#include "profile.h"
+#include "reorder.h"
+#include "sell_ops.h"
+#include "spmv_bench.h"
+#include "stencil_ops.h"
+#include "sym_ops.h"
 #include "vector_ops.h"
 
 /**
@@ -20,25 +36,106 @@
 void print_usage(const char* prog_name) {
     printf("Usage: %s [options]\n", prog_name);
     printf("Options:\n");
-    printf("  -matrix <file>    CSR matrix file (required)\n");
-    printf("  -b <file>         Right-hand side vector file (optional, default: ones)\n");
-    printf("  -output <file>    Output solution file (required)\n");
+    printf("  -matrix <file>    CSR matrix file, or Matrix Market if named *.mtx (required)\n");
+    printf("  -stencil <name>   Matrix-free operator instead of -matrix: poisson2d, poisson3d\n");
+    printf("  -stencil_size <n> Grid points per dimension of -stencil (default: 1000 2D, 100 3D)\n");
+    printf("  -stencil_contrast <c> Coefficient of every other layer along x (default: 1, constant)\n");
+    printf("  -b <file>         Right-hand side file, one column per right-hand side;\n");
+    printf("                    may be repeated (optional, default: ones)\n");
+    printf("  -output <file>    Output solution file, binary if named *.bin (required)\n");
     printf("  -max_iter <n>     Maximum iterations (default: 1000)\n");
-    printf("  -tol <value>      Convergence tolerance (default: 1e-6)\n");
+    printf("  -tol <value>      Tolerance on ||r|| / ||b|| (default: 1e-6)\n");
+    printf("  -method <name>    CG variant: cg, cgcg (fused reduction), pipecg,\n");
+    printf("                    sstep (s iterations per exchange and reduction) (default: cg)\n");
+    printf("  -rr_period <n>    Residual replacement period for cgcg/pipecg/sstep (default: 50, 0: off)\n");
+    printf("  -sstep_s <n>      Iterations per block of -method sstep, 1 to %d (default: 4)\n",
+           CG_SSTEP_MAX);
+    printf("  -sstep_basis <name> Basis of -method sstep: monomial, newton, chebyshev (default: newton)\n");
+    printf("  -pc <name>        Preconditioner: none, jacobi, bjacobi (ILU(0)), ssor,\n");
+    printf("                    amg (smoothed aggregation) (default: none)\n");
+    printf("  -pc_omega <w>     SSOR relaxation factor, 0 < w < 2 (default: 1.0)\n");
+    printf("  -amg_smoother <name> AMG smoother: jacobi, chebyshev (default: chebyshev)\n");
+    printf("  -amg_degree <n>   Chebyshev degree or Jacobi sweeps of the AMG smoother (default: 2)\n");
+    printf("  -amg_theta <t>    AMG strength of connection threshold (default: 0.08)\n");
+    printf("  -partition <name> Row split: rows, nnz, mixed, file (default: nnz)\n");
+    printf("  -partition_weight <w> Nonzero weight in [0, 1] for -partition mixed (default: 0.5)\n");
+    printf("  -reorder <name>   Reorder rows at load time: none, rcm (default: none)\n");
+    printf("  -format <name>    SpMV storage format: csr, csr_unroll, sell, bcsr, compact "
+           "(default: csr)\n");
+    printf("  -sell_c <n>       SELL chunk height C (default: %d)\n", SELL_DEFAULT_CHUNK);
+    printf("  -sell_sigma <n>   SELL sorting window sigma, 1: no sorting (default: %d)\n",
+           SELL_DEFAULT_SIGMA);
+    printf("  -bcsr_block <b>   Block size of -format bcsr: 2, 3, 6 (default: %d)\n",
+           BCSR_DEFAULT_BLOCK);
+    printf("  -compact_values <t> Value type of -format compact: float, bf16 (default: float)\n");
+    printf("  -refine_tol <t>   Inner tolerance of -format compact refinement (default: 1e-4)\n");
+    printf("  -rhs_method <name> Several right-hand sides: simultaneous, block, sequential "
+           "(default: simultaneous)\n");
+    printf("  -bench_spmv <n>   Time n SpMVs in each format before solving\n");
+    printf("  -symmetric        Store only the upper triangle of a symmetric matrix\n");
+    printf("  -write_matrix <file> Write the loaded matrix (symmetric variant with -symmetric)\n");
+    printf("  -mmap             Map the matrix file instead of reading it (single node)\n");
+    printf("  -node_halo        Exchange ghosts once per node through shared memory\n");
+    printf("  -node_ranks <n>   Processes per node of -node_halo (default: all sharing memory)\n");
+    printf("  -deflate <k>      Recycle k Ritz vectors between sequential solves (default: off)\n");
+    printf("  -deflate_window <n> Directions of each solve harvested for -deflate (default: 16)\n");
+    printf("  -autotune <file>  Tune format, threads and partition; cache the result in file\n");
+    printf("  -log_view         Print time per phase and MPI call (min/avg/max over processes)\n");
+    printf("  -log_sync         With -log_view, time a barrier before each allreduce (imbalance)\n");
+    printf("  -log_trace <file> Write a Chrome trace (JSON) timeline of all processes\n");
+    printf("  -x0 <file>        Initial guess, one column per right-hand side (default: zero)\n");
+    printf("  -checkpoint <file> Write the CG state to file in the background (-method cg)\n");
+    printf("  -checkpoint_every <n> Iterations between checkpoints (default: %d)\n",
+           CHECKPOINT_DEFAULT_EVERY);
+    printf("  -checkpoint_interval <s> Seconds between checkpoints (default: off)\n");
+    printf("  -restart <file>   Resume CG from a checkpoint (same matrix and options)\n");
 }
 
 int main(int argc, char* argv[]) {
+#ifdef _OPENMP
+    // Only the master thread makes MPI calls; threads work between them
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#else
     MPI_Init(&argc, &argv);
+#endif
 
     int rank, p;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &p);
 
+#ifdef _OPENMP
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) fprintf(stderr, "Error: MPI library does not support MPI_THREAD_FUNNELED\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (rank == 0) {
+        printf("Running with %d MPI processes x %d OpenMP threads\n", p, omp_get_max_threads());
+    }
+#endif
+
     const char* matrix_file = NULL;
-    const char* b_file = NULL;
+    const char** b_files = malloc(argc * sizeof(const char*));
+    int n_b_files = 0;
     const char* x_file = NULL;
-    int max_iter = 1000;
-    double tol = 1e-6;
+    const char* x0_file = NULL;
+    CGOptions opts;
+    cg_options_default(&opts);
+    PartitionType part = PART_NNZ;
+    double part_weight = 0.5;
+    ReorderType reorder = REORDER_NONE;
+    int bench_reps = 0;
+    int symmetric = 0;
+    int use_mmap = 0;
+    const char* matrix_out = NULL;
+    int log_view = 0;
+    int log_sync = 0;
+    const char* log_trace = NULL;
+    int use_stencil = 0;
+    StencilType stencil_type = STENCIL_POISSON3D;
+    int stencil_size = 0;
+    double stencil_contrast = 1.0;
+    const char* tune_file = NULL;
 
     // Parse command-line arguments
     for (int i = 1; i < argc; i++) {
@@ -51,9 +148,46 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
         }
+        else if (strcmp(argv[i], "-stencil") == 0) {
+            if (++i < argc) {
+                if (stencil_type_from_string(argv[i], &stencil_type) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown stencil '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+                use_stencil = 1;
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -stencil requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-stencil_size") == 0) {
+            if (++i < argc) {
+                stencil_size = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -stencil_size requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-stencil_contrast") == 0) {
+            if (++i < argc) {
+                stencil_contrast = atof(argv[i]);
+                if (stencil_contrast <= 0.0) {
+                    if (rank == 0) fprintf(stderr, "Error: -stencil_contrast must be positive\n");
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -stencil_contrast requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "-b") == 0) {
             if (++i < argc) {
-                b_file = argv[i];
+                b_files[n_b_files++] = argv[i];
             } else {
                 if (rank == 0) fprintf(stderr, "Error: -b requires a filename\n");
                 MPI_Finalize();
@@ -71,7 +205,7 @@ int main(int argc, char* argv[]) {
         }
         else if (strcmp(argv[i], "-max_iter") == 0) {
             if (++i < argc) {
-                max_iter = atoi(argv[i]);
+                opts.max_iter = atoi(argv[i]);
             } else {
                 if (rank == 0) fprintf(stderr, "Error: -max_iter requires a value\n");
                 MPI_Finalize();
@@ -80,13 +214,372 @@ int main(int argc, char* argv[]) {
         }
         else if (strcmp(argv[i], "-tol") == 0) {
             if (++i < argc) {
-                tol = atof(argv[i]);
+                opts.tol = atof(argv[i]);
             } else {
                 if (rank == 0) fprintf(stderr, "Error: -tol requires a value\n");
                 MPI_Finalize();
                 return 1;
             }
         }
+        else if (strcmp(argv[i], "-method") == 0) {
+            if (++i < argc) {
+                if (cg_method_from_string(argv[i], &opts.method) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown method '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -method requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-sstep_s") == 0) {
+            if (++i < argc) {
+                opts.sstep_s = atoi(argv[i]);
+                if (opts.sstep_s < 1 || opts.sstep_s > CG_SSTEP_MAX) {
+                    if (rank == 0) {
+                        fprintf(stderr, "Error: -sstep_s must be between 1 and %d\n", CG_SSTEP_MAX);
+                    }
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -sstep_s requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-sstep_basis") == 0) {
+            if (++i < argc) {
+                if (cg_basis_from_string(argv[i], &opts.sstep_basis) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown basis '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -sstep_basis requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-rr_period") == 0) {
+            if (++i < argc) {
+                opts.replace_period = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -rr_period requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-pc") == 0) {
+            if (++i < argc) {
+                if (pc_type_from_string(argv[i], &opts.pc) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown preconditioner '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -pc requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-pc_omega") == 0) {
+            if (++i < argc) {
+                opts.pc_omega = atof(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -pc_omega requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-amg_smoother") == 0) {
+            if (++i < argc) {
+                if (amg_smoother_from_string(argv[i], &opts.amg.smoother) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown AMG smoother '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -amg_smoother requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-amg_degree") == 0) {
+            if (++i < argc) {
+                opts.amg.degree = atoi(argv[i]);
+                if (opts.amg.degree < 1) {
+                    if (rank == 0) fprintf(stderr, "Error: -amg_degree must be at least 1\n");
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -amg_degree requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-amg_theta") == 0) {
+            if (++i < argc) {
+                opts.amg.theta = atof(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -amg_theta requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-partition") == 0) {
+            if (++i < argc) {
+                if (partition_type_from_string(argv[i], &part) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown partition '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -partition requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-partition_weight") == 0) {
+            if (++i < argc) {
+                part_weight = atof(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -partition_weight requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-reorder") == 0) {
+            if (++i < argc) {
+                if (reorder_type_from_string(argv[i], &reorder) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown reordering '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -reorder requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-format") == 0) {
+            if (++i < argc) {
+                if (sparse_format_from_string(argv[i], &opts.format) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown format '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -format requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-sell_c") == 0) {
+            if (++i < argc) {
+                opts.sell_chunk = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -sell_c requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-sell_sigma") == 0) {
+            if (++i < argc) {
+                opts.sell_sigma = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -sell_sigma requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-bcsr_block") == 0) {
+            if (++i < argc) {
+                opts.bcsr_block = atoi(argv[i]);
+                if (!bcsr_block_supported(opts.bcsr_block)) {
+                    if (rank == 0) fprintf(stderr, "Error: -bcsr_block must be 2, 3 or 6\n");
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -bcsr_block requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-compact_values") == 0) {
+            if (++i < argc) {
+                if (compact_value_type_from_string(argv[i], &opts.compact_values) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown value type '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -compact_values requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-refine_tol") == 0) {
+            if (++i < argc) {
+                opts.refine_tol = atof(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -refine_tol requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-rhs_method") == 0) {
+            if (++i < argc) {
+                if (cg_rhs_method_from_string(argv[i], &opts.rhs_method) != 0) {
+                    if (rank == 0) fprintf(stderr, "Error: Unknown method '%s'\n", argv[i]);
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -rhs_method requires a name\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-bench_spmv") == 0) {
+            if (++i < argc) {
+                bench_reps = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -bench_spmv requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-symmetric") == 0) {
+            symmetric = 1;
+        }
+        else if (strcmp(argv[i], "-mmap") == 0) {
+            use_mmap = 1;
+        }
+        else if (strcmp(argv[i], "-node_halo") == 0) {
+            opts.node_halo = 1;
+        }
+        else if (strcmp(argv[i], "-node_ranks") == 0) {
+            if (++i < argc) {
+                opts.node_ranks = atoi(argv[i]);
+                if (opts.node_ranks < 0) {
+                    if (rank == 0) fprintf(stderr, "Error: -node_ranks must be non-negative\n");
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -node_ranks requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-deflate") == 0) {
+            if (++i < argc) {
+                opts.deflate_k = atoi(argv[i]);
+                if (opts.deflate_k < 0) {
+                    if (rank == 0) fprintf(stderr, "Error: -deflate must be non-negative\n");
+                    MPI_Finalize();
+                    return 1;
+                }
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -deflate requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-deflate_window") == 0) {
+            if (++i < argc) {
+                opts.deflate_window = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -deflate_window requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-autotune") == 0) {
+            if (++i < argc) {
+                tune_file = argv[i];
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -autotune requires a filename\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-log_view") == 0) {
+            log_view = 1;
+        }
+        else if (strcmp(argv[i], "-log_sync") == 0) {
+            log_view = 1;
+            log_sync = 1;
+        }
+        else if (strcmp(argv[i], "-log_trace") == 0) {
+            if (++i < argc) {
+                log_view = 1;
+                log_trace = argv[i];
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -log_trace requires a filename\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-x0") == 0) {
+            if (++i < argc) {
+                x0_file = argv[i];
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -x0 requires a filename\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-checkpoint") == 0) {
+            if (++i < argc) {
+                opts.checkpoint_file = argv[i];
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -checkpoint requires a filename\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-checkpoint_every") == 0) {
+            if (++i < argc) {
+                opts.checkpoint_every = atoi(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -checkpoint_every requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-checkpoint_interval") == 0) {
+            if (++i < argc) {
+                opts.checkpoint_interval = atof(argv[i]);
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -checkpoint_interval requires a value\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-restart") == 0) {
+            if (++i < argc) {
+                opts.restart_file = argv[i];
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -restart requires a filename\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-write_matrix") == 0) {
+            if (++i < argc) {
+                matrix_out = argv[i];
+            } else {
+                if (rank == 0) fprintf(stderr, "Error: -write_matrix requires a filename\n");
+                MPI_Finalize();
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             if (rank == 0) print_usage(argv[0]);
             MPI_Finalize();
@@ -95,52 +588,339 @@ int main(int argc, char* argv[]) {
     }
 
     // Validate required arguments
-    if (matrix_file == NULL || x_file == NULL) {
+    if ((matrix_file == NULL && !use_stencil) || x_file == NULL) {
         if (rank == 0) {
             fprintf(stderr, "Error: Missing required arguments\n\n");
             print_usage(argv[0]);
-            if (matrix_file == NULL) fprintf(stderr, "\n  Missing: -matrix argument\n");
+            if (matrix_file == NULL && !use_stencil) {
+                fprintf(stderr, "\n  Missing: -matrix argument\n");
+            }
             if (x_file == NULL) fprintf(stderr, "  Missing: -output argument\n");
         }
         MPI_Finalize();
         return 1;
     }
+    if (matrix_file != NULL && use_stencil) {
+        if (rank == 0) fprintf(stderr, "Error: -matrix and -stencil are exclusive\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (log_view) {
+        prof_init(log_sync, log_trace);
+    }
 
-    // Read matrix
-    if (rank == 0) printf("Reading matrix from %s\n", matrix_file);
     int local_n, local_nnz, global_n;
     int* ptr = NULL;
     int* cols = NULL;
     double* vals = NULL;
-    read_csr_parallel(matrix_file, &ptr, &cols, &vals, 
-                      &local_n, &local_nnz, &global_n, rank, p);
-    if (rank == 0) printf("Matrix read complete: global_n=%d\n", global_n);
+    RowDist dist;
+    CsrMapping map = {0};
+    int* old_rows = NULL;
+    HaloPlan halo;
+    TuneStats tune_stats;
+    TuneResult tune = {0};
+    StencilOp stencil;
+    CGLinearOp stencil_op;
+    if (use_stencil) {
+        // Matrix-free operator on a generated grid
+        if (reorder != REORDER_NONE || use_mmap || symmetric || matrix_out != NULL ||
+            bench_reps > 0 || opts.format != SPARSE_FORMAT_CSR || tune_file != NULL) {
+            if (rank == 0) {
+                fprintf(stderr, "Error: -stencil cannot be combined with -reorder, -mmap, "
+                        "-symmetric, -write_matrix, -bench_spmv, -format or -autotune\n");
+            }
+            MPI_Finalize();
+            return 1;
+        }
+        int n = stencil_size > 0 ? stencil_size : (stencil_type == STENCIL_POISSON2D ? 1000 : 100);
+        stencil_setup(&stencil, stencil_type, n, n, n, rank, p, &dist);
+        if (stencil_contrast != 1.0) {
+            double* k = vec_alloc(stencil.local_n);
+            if (k == NULL) {
+                fprintf(stderr, "Rank %d: Failed to allocate coefficients\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            stencil_fill_layers(&stencil, stencil_contrast, k);
+            stencil_set_coefficients(&stencil, k);
+            free(k);
+        }
+        stencil_linear_op(&stencil, &stencil_op);
+        local_n = stencil.local_n;
+        local_nnz = 0;
+        global_n = dist.global_n;
+        if (rank == 0) {
+            printf("Matrix-free %s operator: global_n=%d, %s coefficients\n",
+                   stencil_type_name(stencil_type), global_n,
+                   stencil_contrast != 1.0 ? "layered" : "constant");
+        }
+    } else {
+        if (rank == 0) printf("Reading matrix from %s\n", matrix_file);
+        int sym_file;
+        if (use_mmap && reorder != REORDER_NONE) {
+            if (rank == 0) fprintf(stderr, "Error: -mmap cannot be combined with -reorder\n");
+            MPI_Finalize();
+            return 1;
+        }
+        prof_begin(PROF_MAT_LOAD);
+        if (mtx_file_is_mtx(matrix_file)) {
+            MtxStats mtx_stats;
+            read_mtx_parallel(matrix_file, &ptr, &cols, &vals, &local_n, &local_nnz, &global_n,
+                              rank, p, part, part_weight, &dist, &mtx_stats);
+            mtx_report(&mtx_stats, rank);
+            sym_file = 0;
+        } else {
+            read_csr_parallel(matrix_file, &ptr, &cols, &vals, 
+                              &local_n, &local_nnz, &global_n, rank, p, part, part_weight, &dist,
+                              &sym_file, use_mmap ? &map : NULL);
+        }
+        if (rank == 0) {
+            printf("Matrix read complete: global_n=%d%s\n", global_n,
+                   sym_file ? " (symmetric, upper triangle)" : "");
+        }
+        if (sym_file && reorder != REORDER_NONE) {
+            if (rank == 0) fprintf(stderr, "Error: -reorder needs a file with both triangles\n");
+            MPI_Finalize();
+            return 1;
+        }
+        opts.symmetric = symmetric || sym_file;
+        if (opts.symmetric && opts.format != SPARSE_FORMAT_CSR) {
+            if (rank == 0) fprintf(stderr, "Error: Symmetric storage supports -format csr only\n");
+            MPI_Finalize();
+            return 1;
+        }
+        if (opts.symmetric && opts.pc == PC_AMG) {
+            if (rank == 0) fprintf(stderr, "Error: -pc amg needs a fully stored matrix\n");
+            MPI_Finalize();
+            return 1;
+        }
 
-    // Allocate and initialize right-hand side vector
-    double* b = malloc(local_n * sizeof(double));
-    if (b == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate b\n", rank);
-        MPI_Abort(MPI_COMM_WORLD, 1);
+        // Optional reordering; old_rows maps local rows back to the file ordering
+        if (reorder != REORDER_NONE) {
+            reorder_matrix(reorder, &ptr, &cols, &vals, &local_n, &local_nnz, &dist,
+                           part, part_weight, rank, &old_rows);
+        }
+
+        // Autotuning: a cached or measured partition is applied by shifting rows between
+        // neighbors
+        if (tune_file != NULL) {
+            autotune_analyze(ptr, cols, local_n, &dist, rank, &tune_stats);
+            tune.part = part;
+            tune.part_weight = part_weight;
+            int movable = !use_mmap && !sym_file && reorder == REORDER_NONE;
+            if (!autotune_lookup(tune_file, &tune_stats, opts.symmetric, reorder, &tune, rank) &&
+                movable) {
+                autotune_partition(ptr, cols, vals, local_n, &dist, &tune_stats, rank, &tune);
+            }
+            if (movable && (tune.part != part || tune.part_weight != part_weight)) {
+                part = tune.part;
+                part_weight = tune.part_weight;
+                repartition_matrix(&ptr, &cols, &vals, &local_n, &local_nnz, &dist, part,
+                                   part_weight, rank);
+            }
+        }
+
+        // Symmetric storage: drop the lower triangle while columns are still global
+        if (symmetric && !sym_file) {
+            csr_keep_upper(ptr, cols, vals, local_n, &local_nnz, dist.offsets[rank]);
+        }
+        prof_end(PROF_MAT_LOAD);
+        if (matrix_out) {
+            if (rank == 0) printf("Writing matrix to %s\n", matrix_out);
+            write_csr_parallel(matrix_out, ptr, cols, vals, local_n, &dist, opts.symmetric, rank);
+        }
+
+        // Load imbalance: max/avg nonzeros and rows per process
+        double load_local[2] = {(double)local_nnz, (double)local_n};
+        double load_max[2], load_sum[2];
+        MPI_Reduce(load_local, load_max, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(load_local, load_sum, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("Partition %s: load imbalance (max/avg) nnz=%.3f, rows=%.3f\n",
+                   partition_type_name(part), load_max[0] * p / load_sum[0],
+                   load_max[1] * p / load_sum[1]);
+        }
+
+        // Build the ghost exchange plan; this renumbers cols to local indices
+        halo_setup(ptr, cols, &dist, rank, &halo);
+        int halo_stats[2] = {halo.n_ghost, halo.n_recv};
+        int halo_max[2];
+        MPI_Reduce(halo_stats, halo_max, 2, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("Halo plan complete: max ghosts/rank=%d, max neighbors/rank=%d\n",
+                   halo_max[0], halo_max[1]);
+        }
+
+        if (bench_reps > 0) {
+            spmv_benchmark(ptr, cols, vals, local_n, halo.n_ghost, dist.offsets[rank],
+                           opts.sell_chunk, opts.sell_sigma, opts.bcsr_block, opts.symmetric,
+                           bench_reps, rank);
+        }
     }
-    
-    if (b_file) {
-        if (rank == 0) printf("Reading vector from %s\n", b_file);
-        double* full_b = read_vector(b_file, global_n, rank);
-        if (full_b == NULL) {
-            fprintf(stderr, "Rank %d: Failed to read vector from %s\n", rank, b_file);
+
+    // Read the local rows of the right-hand sides: the columns of all -b files
+    int n_rhs = 1;
+    double* b = NULL;
+    for (int f = 0; f < n_b_files; f++) {
+        if (rank == 0) printf("Reading vector from %s\n", b_files[f]);
+        int file_k;
+        prof_begin(PROF_VEC_IO);
+        double* file_b = read_vectors(b_files[f], global_n, local_n, dist.offsets[rank],
+                                      old_rows, &file_k, rank);
+        prof_end(PROF_VEC_IO);
+        if (file_b == NULL) {
+            fprintf(stderr, "Rank %d: Failed to read vector from %s\n", rank, b_files[f]);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (b == NULL) {
+            b = file_b;
+            n_rhs = file_k;
+            continue;
+        }
+        double* merged = vec_alloc(local_n * (n_rhs + file_k));
+        if (merged == NULL) {
+            fprintf(stderr, "Rank %d: Failed to allocate right-hand sides\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (size_t i = 0; i < (size_t)local_n; i++) {
+            memcpy(merged + i * (n_rhs + file_k), b + i * n_rhs, n_rhs * sizeof(double));
+            memcpy(merged + i * (n_rhs + file_k) + n_rhs, file_b + i * file_k,
+                   file_k * sizeof(double));
+        }
+        free(b);
+        free(file_b);
+        b = merged;
+        n_rhs += file_k;
+    }
+    int sequential = n_rhs > 1 && opts.rhs_method == CG_RHS_SEQUENTIAL;
+    if (n_rhs > 1) {
+        if (!sequential && (opts.method != CG_METHOD_CLASSIC || opts.format != SPARSE_FORMAT_CSR ||
+                            opts.symmetric || use_stencil)) {
+            if (rank == 0) {
+                fprintf(stderr, "Error: Several right-hand sides need -method cg, "
+                        "-format csr and a fully stored matrix\n");
+            }
+            MPI_Finalize();
+            return 1;
+        }
+        if (rank == 0) {
+            printf("Solving for %d right-hand sides (%s)\n", n_rhs,
+                   opts.rhs_method == CG_RHS_BLOCK ? "block CG" :
+                   sequential ? "one solve each" : "simultaneous CG");
+        }
+    }
+
+    if ((opts.checkpoint_file != NULL || opts.restart_file != NULL) &&
+        (n_rhs > 1 || opts.method != CG_METHOD_CLASSIC || opts.format == SPARSE_FORMAT_COMPACT)) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: -checkpoint and -restart need -method cg, one right-hand "
+                    "side and a -format other than compact\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (opts.method == CG_METHOD_SSTEP &&
+        (opts.pc != PC_NONE || opts.format != SPARSE_FORMAT_CSR || opts.symmetric || use_stencil)) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: -method sstep needs -pc none, -format csr and a fully "
+                    "stored -matrix\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (opts.node_halo && (opts.symmetric || use_stencil || (n_rhs > 1 && !sequential))) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: -node_halo needs a fully stored -matrix and one "
+                    "right-hand side or -rhs_method sequential\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (opts.deflate_k > 0 && n_rhs > 1 && !sequential) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: -deflate needs one right-hand side or -rhs_method "
+                    "sequential\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (opts.restart_file != NULL && x0_file != NULL) {
+        if (rank == 0) fprintf(stderr, "Error: -x0 cannot be combined with -restart\n");
+        MPI_Finalize();
+        return 1;
+    }
+    // Checkpoints hold rows in solver order and record which ordering that was
+    if (old_rows != NULL && (opts.checkpoint_file != NULL || opts.restart_file != NULL)) {
+        opts.checkpoint_order = reorder_fingerprint(old_rows, local_n, dist.offsets[rank]);
+    }
+
+    // Autotuning of the kernel; the format stays when the solve path needs it, and
+    // such partial results are not cached
+    if (tune_file != NULL) {
+        int keep_format = opts.format == SPARSE_FORMAT_COMPACT || (n_rhs > 1 && !sequential) ||
+                          opts.method == CG_METHOD_SSTEP;
+        if (!tune.cached) {
+            tune.format = opts.format;
+            tune.sell_chunk = opts.sell_chunk;
+            tune.sell_sigma = opts.sell_sigma;
+            tune.bcsr_block = opts.bcsr_block;
+            autotune_kernel(ptr, cols, vals, local_n, halo.n_ghost, dist.offsets[rank],
+                            opts.symmetric, keep_format, rank, &tune);
+            if (!keep_format) {
+                autotune_store(tune_file, &tune_stats, opts.symmetric, reorder, &tune, rank);
+            }
+        }
+        if (!keep_format) {
+            opts.format = tune.format;
+            opts.sell_chunk = tune.sell_chunk;
+            opts.sell_sigma = tune.sell_sigma;
+            opts.bcsr_block = tune.bcsr_block;
+        }
+#ifdef _OPENMP
+        omp_set_num_threads(tune.threads);
+#endif
+        if (rank == 0) {
+            printf("Autotune: %s storage, %d threads per process, %s partition\n",
+                   sparse_format_name(opts.format), tune.threads, partition_type_name(part));
+        }
+    }
+
+    if (b == NULL) {
+        b = vec_alloc(local_n);
+        if (b == NULL) {
+            fprintf(stderr, "Rank %d: Failed to allocate b\n", rank);
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        memcpy(b, full_b + rank * local_n, local_n * sizeof(double));
-        free(full_b);
-    } else {
         if (rank == 0) printf("No b file specified, using vector of ones\n");
         for (int i = 0; i < local_n; i++) {
             b[i] = 1.0;
         }
     }
 
-    // Allocate solution vector (initial guess: zero)
-    double* x_local = calloc(local_n, sizeof(double));
+    // Allocate solution vector (initial guess: -x0 file, or zero)
+    double* x_local;
+    if (x0_file != NULL) {
+        if (rank == 0) printf("Reading initial guess from %s\n", x0_file);
+        int x0_k;
+        prof_begin(PROF_VEC_IO);
+        x_local = read_vectors(x0_file, global_n, local_n, dist.offsets[rank], old_rows,
+                               &x0_k, rank);
+        prof_end(PROF_VEC_IO);
+        if (x_local == NULL) {
+            fprintf(stderr, "Rank %d: Failed to read vector from %s\n", rank, x0_file);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (x0_k != n_rhs) {
+            if (rank == 0) {
+                fprintf(stderr, "Error: %s has %d columns for %d right-hand sides\n",
+                        x0_file, x0_k, n_rhs);
+            }
+            MPI_Finalize();
+            return 1;
+        }
+    } else {
+        x_local = vec_alloc(local_n * n_rhs);
+    }
     if (x_local == NULL) {
         fprintf(stderr, "Rank %d: Failed to allocate x_local\n", rank);
         MPI_Abort(MPI_COMM_WORLD, 1);
@@ -149,55 +929,69 @@ int main(int argc, char* argv[]) {
     // Solve the system
     if (rank == 0) printf("Starting CG solver\n");
     double start = MPI_Wtime();
-    cg_solver(ptr, cols, vals, b, x_local, local_n, local_nnz, global_n, 
-              rank, p, max_iter, tol);
-    double elapsed = MPI_Wtime() - start;
-    if (rank == 0) {
-        printf("CG solver complete\n");
-        fflush(stdout);
-    }
-
-    // Gather solution on rank 0
-    double* x_global = NULL;
-    int* recvcounts = NULL;
-    int* displs = NULL;
-    if (rank == 0) {
-        x_global = malloc(global_n * sizeof(double));
-        recvcounts = malloc(p * sizeof(int));
-        displs = malloc(p * sizeof(int));
-        if (x_global == NULL || recvcounts == NULL || displs == NULL) {
-            fprintf(stderr, "Rank 0: Failed to allocate x_global or gather arrays\n");
+    int iterations;
+    if (sequential) {
+        // One context for all right-hand sides, so deflation carries over between them
+        CGContext* ctx = use_stencil
+            ? cg_context_create_op(&stencil_op, &dist, rank, &opts)
+            : cg_context_create_halo(ptr, cols, vals, local_n, &dist, &halo, rank, &opts);
+        double* b_col = vec_alloc(local_n);
+        double* x_col = vec_alloc(local_n);
+        if (b_col == NULL || x_col == NULL) {
+            fprintf(stderr, "Rank %d: Failed to allocate solve vectors\n", rank);
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
+        iterations = 0;
+        for (int c = 0; c < n_rhs; c++) {
+            for (size_t i = 0; i < (size_t)local_n; i++) {
+                b_col[i] = b[i * n_rhs + c];
+                x_col[i] = x_local[i * n_rhs + c];
+            }
+            int its = cg_context_solve(ctx, b_col, x_col);
+            for (size_t i = 0; i < (size_t)local_n; i++) x_local[i * n_rhs + c] = x_col[i];
+            if (rank == 0) printf("Right-hand side %d: %d iterations\n", c + 1, its);
+            iterations += its;
+        }
+        cg_context_destroy(ctx);
+        free(b_col);
+        free(x_col);
+    } else if (n_rhs > 1) {
+        iterations = block_cg_solver(ptr, cols, vals, b, x_local, n_rhs, local_n, &halo,
+                                     rank, &opts);
+    } else if (use_stencil) {
+        iterations = cg_solver_op(&stencil_op, b, x_local, &dist, rank, &opts);
+    } else {
+        iterations = cg_solver(ptr, cols, vals, b, x_local, local_n, local_nnz, &dist,
+                               &halo, rank, p, &opts);
     }
-    
-    int rows_per_proc = (global_n + p - 1) / p;
+    double elapsed = MPI_Wtime() - start;
     if (rank == 0) {
-        for (int i = 0; i < p; i++) {
-            int start = i * rows_per_proc;
-            int end = (start + rows_per_proc > global_n) ? global_n : start + rows_per_proc;
-            recvcounts[i] = end - start;
-            displs[i] = start;
-        }
+        printf("CG solver complete: %d iterations\n", iterations);
+        fflush(stdout);
     }
-    MPI_Gatherv(x_local, local_n, MPI_DOUBLE, x_global, recvcounts, displs, 
-                MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
-    // Write solution and cleanup
+    // Write the solution in the file ordering; each process writes its own rows
     if (rank == 0) {
         printf("Solved system in %.3fs\n", elapsed);
         fflush(stdout);
-        write_vector(x_file, x_global, global_n, rank);
-        free(x_global);
-        free(recvcounts);
-        free(displs);
     }
+    prof_begin(PROF_VEC_IO);
+    write_vectors(x_file, x_local, global_n, local_n, dist.offsets[rank], old_rows, n_rhs, rank);
+    prof_end(PROF_VEC_IO);
+    prof_finalize(rank, p);
 
+    if (use_stencil) {
+        stencil_free(&stencil);
+    } else {
+        halo_free(&halo);
+    }
+    rowdist_free(&dist);
     free(ptr);
-    free(cols);
-    free(vals);
+    csr_release(&map, cols, vals);
     free(b);
     free(x_local);
+    free(old_rows);
+    free(b_files);
     
     MPI_Finalize();
     return 0;
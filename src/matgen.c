@@ -0,0 +1,266 @@
+/**
+ * @file matgen.c
+ * @brief Implementation of the synthetic matrix generators
+ */
+
+#include "matgen.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+int matgen_type_from_string(const char* name, MatGenType* type) {
+    if (strcmp(name, "poisson2d") == 0) {
+        *type = MATGEN_POISSON2D;
+    } else if (strcmp(name, "poisson3d") == 0) {
+        *type = MATGEN_POISSON3D;
+    } else if (strcmp(name, "poisson3d27") == 0) {
+        *type = MATGEN_POISSON3D27;
+    } else if (strcmp(name, "banded") == 0) {
+        *type = MATGEN_BANDED;
+    } else if (strcmp(name, "random") == 0) {
+        *type = MATGEN_RANDOM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* matgen_type_name(MatGenType type) {
+    switch (type) {
+        case MATGEN_POISSON2D:   return "poisson2d";
+        case MATGEN_POISSON3D:   return "poisson3d";
+        case MATGEN_POISSON3D27: return "poisson3d27";
+        case MATGEN_BANDED:      return "banded";
+        case MATGEN_RANDOM:
+        default:                 return "random";
+    }
+}
+
+long long matgen_rows(const MatGenParams* params) {
+    switch (params->type) {
+        case MATGEN_POISSON2D:
+            return (long long)params->nx * params->ny;
+        case MATGEN_POISSON3D:
+        case MATGEN_POISSON3D27:
+            return (long long)params->nx * params->ny * params->nz;
+        default:
+            return params->nx;
+    }
+}
+
+static void* checked_malloc(size_t size, const char* what) {
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Failed to allocate %s\n", what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+// SplitMix64: a well-mixed 64-bit value from any 64-bit input
+static unsigned long long mix64(unsigned long long z) {
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Shared state of a generator: the size and, for the random
+ * matrix, the sorted distinct diagonal offsets present in every row
+ */
+typedef struct {
+    const MatGenParams* params;
+    long long n;
+    long long* offsets;
+    int n_offsets;
+} MatGen;
+
+// Random matrix: width distinct offsets d in [1, n), giving entries
+// (i, i - d) and (i, i + d) where they fall inside the matrix, so the
+// pattern is symmetric and spread over the whole row range
+static void matgen_init(MatGen* gen, const MatGenParams* params, long long n) {
+    gen->params = params;
+    gen->n = n;
+    gen->offsets = NULL;
+    gen->n_offsets = 0;
+    if (params->type != MATGEN_RANDOM || n < 2) return;
+
+    int m = params->width;
+    if (m > n - 1) m = (int)(n - 1);
+    gen->offsets = checked_malloc(m * sizeof(long long), "random matrix offsets");
+    unsigned long long state = params->seed;
+    while (gen->n_offsets < m) {
+        state = mix64(state);
+        long long d = 1 + (long long)(state % (unsigned long long)(n - 1));
+        int pos = 0;
+        while (pos < gen->n_offsets && gen->offsets[pos] < d) pos++;
+        if (pos < gen->n_offsets && gen->offsets[pos] == d) continue;
+        memmove(gen->offsets + pos + 1, gen->offsets + pos,
+                (gen->n_offsets - pos) * sizeof(long long));
+        gen->offsets[pos] = d;
+        gen->n_offsets++;
+    }
+}
+
+// Value of the symmetric off-diagonal pair (i, j) of the random matrix, in [-1, -0.1)
+static double random_value(const MatGenParams* params, long long n, long long i, long long j) {
+    long long lo = i < j ? i : j;
+    long long hi = i < j ? j : i;
+    unsigned long long h = mix64(params->seed ^ mix64((unsigned long long)(lo * n + hi)));
+    return -(0.1 + 0.9 * (double)(h >> 11) / 9007199254740992.0);
+}
+
+/**
+ * @brief Compute row i in ascending column order
+ *
+ * Writes the columns and values when cols is not NULL and returns the
+ * number of entries.
+ */
+static int matgen_row(const MatGen* gen, long long i, int* cols, double* vals) {
+    const MatGenParams* g = gen->params;
+    int len = 0;
+    switch (g->type) {
+        case MATGEN_POISSON2D:
+        case MATGEN_POISSON3D:
+        case MATGEN_POISSON3D27: {
+            long long nx = g->nx, ny = g->ny, nxy = nx * ny;
+            int three_d = (g->type != MATGEN_POISSON2D);
+            int full = (g->type == MATGEN_POISSON3D27);
+            long long x = i % nx, y = (i / nx) % ny, z = three_d ? i / nxy : 0;
+            double diag = full ? 26.0 : (three_d ? 6.0 : 4.0);
+            int zr = three_d ? 1 : 0;
+            for (int dz = -zr; dz <= zr; dz++) {
+                if (z + dz < 0 || z + dz >= (three_d ? g->nz : 1)) continue;
+                for (int dy = -1; dy <= 1; dy++) {
+                    if (y + dy < 0 || y + dy >= ny) continue;
+                    for (int dx = -1; dx <= 1; dx++) {
+                        if (x + dx < 0 || x + dx >= nx) continue;
+                        int dist = abs(dx) + abs(dy) + abs(dz);
+                        if (!full && dist > 1) continue;
+                        if (cols) {
+                            cols[len] = (int)(i + dx + dy * nx + dz * nxy);
+                            vals[len] = (dist == 0) ? diag : -1.0;
+                        }
+                        len++;
+                    }
+                }
+            }
+            break;
+        }
+        case MATGEN_BANDED: {
+            long long lo = i - g->width < 0 ? 0 : i - g->width;
+            long long hi = i + g->width >= gen->n ? gen->n - 1 : i + g->width;
+            for (long long j = lo; j <= hi; j++) {
+                if (cols) {
+                    cols[len] = (int)j;
+                    vals[len] = (j == i) ? 2.0 * g->width + 1.0 : -1.0;
+                }
+                len++;
+            }
+            break;
+        }
+        case MATGEN_RANDOM: {
+            // Strictly dominant diagonal; the margin varies from row to row
+            // so that the vector of ones is not an eigenvector
+            double sum = 0.0;
+            int diag_pos = 0;
+            for (int t = gen->n_offsets - 1; t >= 0; t--) {
+                long long j = i - gen->offsets[t];
+                if (j < 0) continue;
+                if (cols) {
+                    cols[len] = (int)j;
+                    vals[len] = random_value(g, gen->n, i, j);
+                    sum -= vals[len];
+                }
+                len++;
+            }
+            diag_pos = len++;
+            for (int t = 0; t < gen->n_offsets; t++) {
+                long long j = i + gen->offsets[t];
+                if (j >= gen->n) break;
+                if (cols) {
+                    cols[len] = (int)j;
+                    vals[len] = random_value(g, gen->n, i, j);
+                    sum -= vals[len];
+                }
+                len++;
+            }
+            if (cols) {
+                cols[diag_pos] = (int)i;
+                vals[diag_pos] = 1.0 + 1.1 * sum;
+            }
+            break;
+        }
+    }
+    return len;
+}
+
+void matgen_generate(const MatGenParams* params, int** ptr, int** cols, double** vals,
+                     int* local_n, int* local_nnz, int* global_n,
+                     int rank, int p, PartitionType part, double nnz_weight,
+                     RowDist* dist) {
+    long long n = matgen_rows(params);
+    int bad_grid = params->nx < 1 ||
+                   (params->type != MATGEN_BANDED && params->type != MATGEN_RANDOM &&
+                    params->ny < 1) ||
+                   ((params->type == MATGEN_POISSON3D || params->type == MATGEN_POISSON3D27) &&
+                    params->nz < 1);
+    if (bad_grid || n > INT_MAX || params->width < 0) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Invalid %s size (%lld rows, at most %d supported)\n",
+                    matgen_type_name(params->type), n, INT_MAX);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MatGen gen;
+    matgen_init(&gen, params, n);
+
+    // Row lengths of an equal share of rows decide the split
+    int slice_start = (int)(n * rank / p);
+    int slice_n = (int)(n * (rank + 1) / p) - slice_start;
+    long long* ptr_slice = checked_malloc((slice_n + 1) * sizeof(long long), "row pointer slice");
+    ptr_slice[0] = 0;
+    for (int i = 0; i < slice_n; i++) {
+        ptr_slice[i + 1] = ptr_slice[i] + matgen_row(&gen, (long long)slice_start + i, NULL, NULL);
+    }
+    long long slice_nnz = ptr_slice[slice_n];
+    long long before = 0;
+    MPI_Exscan(&slice_nnz, &before, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) before = 0;
+    for (int i = 0; i <= slice_n; i++) {
+        ptr_slice[i] += before;
+    }
+    rowdist_from_ptr_slice(dist, ptr_slice, slice_start, slice_n, (int)n, p, part, nnz_weight);
+    free(ptr_slice);
+
+    int row_start = dist->offsets[rank];
+    int rows = dist->counts[rank];
+    int* row_ptr = checked_malloc((rows + 1) * sizeof(int), "row pointer");
+    long long nnz = 0;
+    row_ptr[0] = 0;
+    for (int i = 0; i < rows; i++) {
+        nnz += matgen_row(&gen, (long long)row_start + i, NULL, NULL);
+        if (nnz > INT_MAX) {
+            fprintf(stderr, "Rank %d: More than %d local nonzeros\n", rank, INT_MAX);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        row_ptr[i + 1] = (int)nnz;
+    }
+    int* col_idx = checked_malloc(nnz * sizeof(int), "column indices");
+    double* values = checked_malloc(nnz * sizeof(double), "values");
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < rows; i++) {
+        matgen_row(&gen, (long long)row_start + i, col_idx + row_ptr[i], values + row_ptr[i]);
+    }
+    free(gen.offsets);
+
+    *ptr = row_ptr;
+    *cols = col_idx;
+    *vals = values;
+    *local_n = rows;
+    *local_nnz = (int)nnz;
+    *global_n = (int)n;
+}
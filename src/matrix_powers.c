@@ -0,0 +1,220 @@
+/**
+ * @file matrix_powers.c
+ * @brief Implementation of the matrix powers kernel
+ */
+
+#include "matrix_powers.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+static void* mp_alloc(size_t bytes) {
+    void* mem = malloc(bytes > 0 ? bytes : 1);
+    if (mem == NULL) {
+        fprintf(stderr, "Failed to allocate matrix powers kernel\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return mem;
+}
+
+static int compare_int(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int find_index(const int* v, int n, int key) {
+    const int* pos = bsearch(&key, v, n, sizeof(int), compare_int);
+    return pos != NULL ? (int)(pos - v) : -1;
+}
+
+// Merge two sorted lists of distinct entries into a new sorted list
+static int* merge_sorted(const int* a, int na, const int* b, int nb) {
+    int* out = mp_alloc((size_t)(na + nb) * sizeof(int));
+    int i = 0, j = 0, k = 0;
+    while (i < na || j < nb) {
+        if (j == nb || (i < na && a[i] < b[j])) {
+            out[k++] = a[i++];
+        } else {
+            out[k++] = b[j++];
+        }
+    }
+    return out;
+}
+
+// Plan fetching the entries of the given sorted off-process global indices (collective)
+static void plan_for(HaloPlan* plan, const int* globals, int n, const RowDist* dist, int rank) {
+    int ptr[2] = {0, n};
+    int* cols = mp_alloc((size_t)n * sizeof(int));
+    memcpy(cols, globals, (size_t)n * sizeof(int));
+    halo_setup_rect(ptr, 1, cols, dist, rank, plan);
+    free(cols);
+}
+
+void matrix_powers_setup(MatrixPowers* mp, int* ptr, int* cols, double* vals, int local_n,
+                         HaloPlan* halo, int depth) {
+    int rank, p;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &p);
+    memset(mp, 0, sizeof(MatrixPowers));
+    mp->local_n = local_n;
+    mp->depth = depth;
+    RowDist dist;
+    rowdist_from_counts(&dist, local_n, p);
+    int row_start = dist.offsets[rank];
+    int row_end = row_start + local_n;
+
+    // Global columns of the owned rows, as the owners send them
+    int nnz = ptr[local_n];
+    int* gcols = mp_alloc((size_t)nnz * sizeof(int));
+    for (int j = 0; j < nnz; j++) {
+        int c = cols[j];
+        gcols[j] = c < local_n ? row_start + c : halo->ghost_cols[c - local_n];
+    }
+
+    // Ghosts found so far (sorted) and the last layer, starting from the one-deep plan
+    int n_known = halo->n_ghost;
+    int* known = mp_alloc((size_t)n_known * sizeof(int));
+    memcpy(known, halo->ghost_cols, (size_t)n_known * sizeof(int));
+    int n_front = n_known;
+    int* front = mp_alloc((size_t)n_front * sizeof(int));
+    memcpy(front, known, (size_t)n_front * sizeof(int));
+
+    // Rows of layers 1 .. depth - 1, with global columns until the region is known
+    int* row_glob = mp_alloc(sizeof(int));
+    int* rptr = mp_alloc(sizeof(int));
+    int* rcols = mp_alloc(sizeof(int));
+    double* rvals = mp_alloc(sizeof(double));
+    rptr[0] = 0;
+    int n_rows = 0;
+    mp->layer_end = mp_alloc((size_t)(depth + 1) * sizeof(int));
+    mp->layer_end[0] = 0;
+
+    for (int d = 1; d < depth; d++) {
+        HaloPlan fetch;
+        plan_for(&fetch, front, n_front, &dist, rank);
+        int* fp;
+        int* fc;
+        double* fv;
+        halo_exchange_rows(&fetch, ptr, gcols, vals, &fp, &fc, &fv);
+        halo_free(&fetch);
+
+        int n_rows_added = n_front;
+        int add_nnz = fp[n_front];
+        row_glob = realloc(row_glob, (size_t)(n_rows + n_front + 1) * sizeof(int));
+        rptr = realloc(rptr, (size_t)(n_rows + n_front + 1) * sizeof(int));
+        rcols = realloc(rcols, (size_t)(rptr[n_rows] + add_nnz + 1) * sizeof(int));
+        rvals = realloc(rvals, (size_t)(rptr[n_rows] + add_nnz + 1) * sizeof(double));
+        if (row_glob == NULL || rptr == NULL || rcols == NULL || rvals == NULL) {
+            fprintf(stderr, "Failed to allocate matrix powers kernel\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        memcpy(rcols + rptr[n_rows], fc, (size_t)add_nnz * sizeof(int));
+        memcpy(rvals + rptr[n_rows], fv, (size_t)add_nnz * sizeof(double));
+        for (int k = 0; k < n_front; k++) {
+            row_glob[n_rows + k] = front[k];
+            rptr[n_rows + k + 1] = rptr[n_rows] + fp[k + 1];
+        }
+
+        // The next layer: columns of these rows neither owned nor known
+        int n_next = 0;
+        int* next = mp_alloc((size_t)add_nnz * sizeof(int));
+        for (int j = 0; j < add_nnz; j++) {
+            int c = fc[j];
+            if ((c < row_start || c >= row_end) && find_index(known, n_known, c) < 0) {
+                next[n_next++] = c;
+            }
+        }
+        qsort(next, n_next, sizeof(int), compare_int);
+        int n_unique = 0;
+        for (int k = 0; k < n_next; k++) {
+            if (n_unique == 0 || next[k] != next[n_unique - 1]) next[n_unique++] = next[k];
+        }
+        int* merged = merge_sorted(known, n_known, next, n_unique);
+        free(known);
+        known = merged;
+        n_known += n_unique;
+        free(front);
+        front = next;
+        n_front = n_unique;
+
+        n_rows += n_rows_added;
+        mp->layer_end[d] = n_rows;
+        free(fp);
+        free(fc);
+        free(fv);
+    }
+    for (int d = depth > 1 ? depth : 1; d <= depth; d++) mp->layer_end[d] = n_rows;
+
+    // One plan for the whole region; its ghosts are ordered like known
+    plan_for(&mp->plan, known, n_known, &dist, rank);
+    mp->n_ghost = n_known;
+
+    mp->ptr = ptr;
+    mp->vals = vals;
+    mp->cols = mp_alloc((size_t)nnz * sizeof(int));
+    for (int j = 0; j < nnz; j++) {
+        int c = cols[j];
+        mp->cols[j] = c < local_n ? c : local_n + find_index(known, n_known, gcols[j]);
+    }
+    mp->n_rows = n_rows;
+    mp->g_row = mp_alloc((size_t)n_rows * sizeof(int));
+    mp->g_ptr = rptr;
+    mp->g_cols = rcols;
+    mp->g_vals = rvals;
+    for (int k = 0; k < n_rows; k++) {
+        mp->g_row[k] = local_n + find_index(known, n_known, row_glob[k]);
+    }
+    for (int j = 0; j < rptr[n_rows]; j++) {
+        int c = rcols[j];
+        rcols[j] = (c >= row_start && c < row_end) ? c - row_start
+                                                   : local_n + find_index(known, n_known, c);
+    }
+
+    free(gcols);
+    free(known);
+    free(front);
+    free(row_glob);
+    rowdist_free(&dist);
+}
+
+void matrix_powers_step(const MatrixPowers* mp, double* W, int m, int src, int dst, int depth,
+                        double shift, double scale, int prev, double prev_coef) {
+    prof_begin(PROF_SPMV);
+    int n = mp->local_n;
+    int has_prev = prev >= 0;
+    if (!has_prev) prev = src;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        double sum = 0.0;
+        for (int j = mp->ptr[i]; j < mp->ptr[i + 1]; j++) {
+            sum += mp->vals[j] * W[(size_t)mp->cols[j] * m + src];
+        }
+        double* w = W + (size_t)i * m;
+        w[dst] = scale * (sum - shift * w[src]) - (has_prev ? prev_coef * w[prev] : 0.0);
+    }
+    int rows = mp->layer_end[depth];
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < rows; k++) {
+        double sum = 0.0;
+        for (int j = mp->g_ptr[k]; j < mp->g_ptr[k + 1]; j++) {
+            sum += mp->g_vals[j] * W[(size_t)mp->g_cols[j] * m + src];
+        }
+        double* w = W + (size_t)mp->g_row[k] * m;
+        w[dst] = scale * (sum - shift * w[src]) - (has_prev ? prev_coef * w[prev] : 0.0);
+    }
+    prof_end(PROF_SPMV);
+}
+
+void matrix_powers_free(MatrixPowers* mp) {
+    halo_free(&mp->plan);
+    free(mp->cols);
+    free(mp->g_row);
+    free(mp->g_ptr);
+    free(mp->g_cols);
+    free(mp->g_vals);
+    free(mp->layer_end);
+    memset(mp, 0, sizeof(MatrixPowers));
+}
@@ -0,0 +1,510 @@
+/**
+ * @file mtx_io.c
+ * @brief Implementation of the parallel Matrix Market reader
+ */
+
+#include "mtx_io.h"
+#include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define MTX_MAX_LINE 1024           // Longest entry line accepted
+#define MTX_READ_BLOCK (1 << 30)    // Bytes per MPI_File_read_at call
+#define MTX_SAMPLES 256             // Sample sort samples per process
+
+typedef struct {
+    int row;
+    int col;
+    double val;
+} MtxEntry;
+
+// Size line and type of the file, parsed by rank 0
+typedef struct {
+    long long n_rows;
+    long long n_cols;
+    long long nnz;
+    long long data_start;       // Byte offset of the first entry line
+    long long file_size;
+    int symmetric;
+    int pattern;
+} MtxHeader;
+
+static void* checked_malloc(size_t size, const char* what) {
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Failed to allocate %s\n", what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+int mtx_file_is_mtx(const char* filename) {
+    size_t len = strlen(filename);
+    return len >= 4 && strcasecmp(filename + len - 4, ".mtx") == 0;
+}
+
+static int int_compare(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int entry_compare(const void* a, const void* b) {
+    const MtxEntry* x = a;
+    const MtxEntry* y = b;
+    if (x->row != y->row) return (x->row > y->row) - (x->row < y->row);
+    return (x->col > y->col) - (x->col < y->col);
+}
+
+static void read_header(const char* filename, int rank, MtxHeader* H) {
+    memset(H, 0, sizeof(MtxHeader));
+    if (rank == 0) {
+        FILE* f = fopen(filename, "rb");
+        if (f == NULL) {
+            fprintf(stderr, "Rank 0: Failed to open %s\n", filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        char line[MTX_MAX_LINE];
+        char object[32], format[32], field[32], symmetry[32];
+        if (fgets(line, sizeof(line), f) == NULL ||
+            sscanf(line, "%%%%MatrixMarket %31s %31s %31s %31s",
+                   object, format, field, symmetry) != 4) {
+            fprintf(stderr, "Rank 0: %s is not a Matrix Market file\n", filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (strcasecmp(object, "matrix") != 0 || strcasecmp(format, "coordinate") != 0) {
+            fprintf(stderr, "Rank 0: Only coordinate matrices are supported (%s: %s %s)\n",
+                    filename, object, format);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        H->pattern = (strcasecmp(field, "pattern") == 0);
+        if (!H->pattern && strcasecmp(field, "real") != 0 &&
+            strcasecmp(field, "integer") != 0) {
+            fprintf(stderr, "Rank 0: Unsupported Matrix Market field '%s'\n", field);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        H->symmetric = (strcasecmp(symmetry, "symmetric") == 0);
+        if (!H->symmetric && strcasecmp(symmetry, "general") != 0) {
+            fprintf(stderr, "Rank 0: Unsupported Matrix Market symmetry '%s'\n", symmetry);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        // Comments, then the size line
+        int found = 0;
+        while (!found && fgets(line, sizeof(line), f) != NULL) {
+            if (line[0] == '%') continue;
+            found = sscanf(line, "%lld %lld %lld", &H->n_rows, &H->n_cols, &H->nnz) == 3;
+        }
+        if (!found || H->n_rows <= 0 || H->n_rows != H->n_cols || H->n_rows > 2147483647LL ||
+            H->nnz < 0) {
+            fprintf(stderr, "Rank 0: Invalid size line in %s (a square matrix is required)\n",
+                    filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        H->data_start = ftell(f);
+        fseek(f, 0, SEEK_END);
+        H->file_size = ftell(f);
+        fclose(f);
+    }
+    MPI_Bcast(H, sizeof(MtxHeader), MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+static void push_entry(MtxEntry** E, long long* count, long long* cap, int row, int col,
+                       double val) {
+    if (*count == *cap) {
+        *cap = 2 * *cap + 16;
+        *E = realloc(*E, *cap * sizeof(MtxEntry));
+        if (*E == NULL) {
+            fprintf(stderr, "Failed to allocate matrix entries\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    (*E)[*count].row = row;
+    (*E)[*count].col = col;
+    (*E)[*count].val = val;
+    (*count)++;
+}
+
+/**
+ * @brief Parse the entry lines that start in this process's byte range
+ *
+ * The entry section is split into p equal byte ranges. A line belongs to
+ * the process whose range holds its first byte, so each process reads
+ * one byte before its range (to see whether a line starts there) and up
+ * to MTX_MAX_LINE bytes after it (to finish its last line).
+ */
+static MtxEntry* parse_range(MPI_File fh, const MtxHeader* H, const char* filename, int rank,
+                             int p, long long* count, long long* file_entries) {
+    long long data = H->file_size - H->data_start;
+    long long start = H->data_start + data * rank / p;
+    long long end = H->data_start + data * (rank + 1) / p;
+    long long read_from = (rank == 0) ? start : start - 1;
+    long long read_to = end + MTX_MAX_LINE < H->file_size ? end + MTX_MAX_LINE : H->file_size;
+    long long len = read_to - read_from;
+
+    char* buf = checked_malloc(len + 1, "Matrix Market read buffer");
+    for (long long done = 0; done < len; done += MTX_READ_BLOCK) {
+        int piece = (int)(len - done < MTX_READ_BLOCK ? len - done : MTX_READ_BLOCK);
+        MPI_File_read_at(fh, read_from + done, buf + done, piece, MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+    buf[len] = '\0';
+
+    long long pos = 0;
+    if (rank > 0) {
+        // Skip the end of a line that started in the previous range
+        char* nl = memchr(buf, '\n', len);
+        pos = nl ? nl - buf + 1 : len;
+    }
+
+    long long cap = (end - start) / 16 + 16;
+    MtxEntry* E = checked_malloc(cap * sizeof(MtxEntry), "matrix entries");
+    *count = 0;
+    *file_entries = 0;
+    while (pos < len && read_from + pos < end) {
+        char* line = buf + pos;
+        char* nl = memchr(line, '\n', len - pos);
+        if (nl == NULL && read_to < H->file_size) {
+            fprintf(stderr, "Rank %d: Line longer than %d bytes in %s\n", rank, MTX_MAX_LINE,
+                    filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        long long line_len = nl ? nl - line : len - pos;
+        line[line_len] = '\0';
+        pos += line_len + 1;
+
+        char* s = line;
+        while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+        if (*s == '\0' || *s == '%') continue;
+        char* end_i;
+        char* end_j;
+        char* end_v = NULL;
+        long long i = strtoll(s, &end_i, 10);
+        long long j = strtoll(end_i, &end_j, 10);
+        double v = H->pattern ? 1.0 : strtod(end_j, &end_v);
+        if (end_i == s || end_j == end_i || (!H->pattern && end_v == end_j)) {
+            fprintf(stderr, "Rank %d: Malformed entry '%s' in %s\n", rank, line, filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (i < 1 || i > H->n_rows || j < 1 || j > H->n_cols) {
+            fprintf(stderr, "Rank %d: Entry (%lld, %lld) out of range in %s\n", rank, i, j,
+                    filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        push_entry(&E, count, &cap, (int)(i - 1), (int)(j - 1), v);
+        if (H->symmetric && i != j) {
+            push_entry(&E, count, &cap, (int)(j - 1), (int)(i - 1), v);
+        }
+        (*file_entries)++;
+    }
+    free(buf);
+    return E;
+}
+
+/**
+ * @brief Send entries to the processes owning their rows
+ *
+ * Entries must be grouped by destination in rank order (e.g. sorted by
+ * row). Process k receives the rows [offsets[k], offsets[k+1]); the
+ * received pieces are concatenated in source rank order.
+ */
+static void exchange_rows(MtxEntry** E, long long* count, const int* offsets, int p,
+                          MPI_Datatype entry_type) {
+    int* send_counts = checked_malloc(p * sizeof(int), "send counts");
+    int* send_displs = checked_malloc(p * sizeof(int), "send displacements");
+    int* recv_counts = checked_malloc(p * sizeof(int), "receive counts");
+    int* recv_displs = checked_malloc(p * sizeof(int), "receive displacements");
+
+    // First entry of each destination (entries are grouped by destination)
+    long long first = 0;
+    for (int k = 0; k < p; k++) {
+        long long lo = first, hi = *count;
+        while (lo < hi) {
+            long long mid = lo + (hi - lo) / 2;
+            if ((*E)[mid].row < offsets[k + 1]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        send_displs[k] = (int)first;
+        send_counts[k] = (int)(lo - first);
+        first = lo;
+    }
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    long long n_recv = 0;
+    for (int k = 0; k < p; k++) {
+        recv_displs[k] = (int)n_recv;
+        n_recv += recv_counts[k];
+    }
+    MtxEntry* R = checked_malloc(n_recv * sizeof(MtxEntry), "received entries");
+    MPI_Alltoallv(*E, send_counts, send_displs, entry_type,
+                  R, recv_counts, recv_displs, entry_type, MPI_COMM_WORLD);
+    free(*E);
+    *E = R;
+    *count = n_recv;
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+}
+
+/**
+ * @brief Row split of a distributed sample sort
+ *
+ * Each process contributes MTX_SAMPLES rows of its entries at regular
+ * positions; the sorted samples at multiples of the sample count / p
+ * become the boundaries, so each process receives about the same number
+ * of entries and rows are never split.
+ */
+static void sample_splitters(const MtxEntry* E, long long count, int n, int p, int* offsets) {
+    int n_samples = count > 0 ? MTX_SAMPLES : 0;
+    int* samples = checked_malloc(MTX_SAMPLES * sizeof(int), "samples");
+    for (int k = 0; k < n_samples; k++) {
+        samples[k] = E[count * k / MTX_SAMPLES].row;
+    }
+    int* sample_counts = checked_malloc(p * sizeof(int), "sample counts");
+    int* sample_displs = checked_malloc(p * sizeof(int), "sample displacements");
+    MPI_Allgather(&n_samples, 1, MPI_INT, sample_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    int total = 0;
+    for (int k = 0; k < p; k++) {
+        sample_displs[k] = total;
+        total += sample_counts[k];
+    }
+    int* all = checked_malloc(total * sizeof(int), "gathered samples");
+    MPI_Allgatherv(samples, n_samples, MPI_INT, all, sample_counts, sample_displs, MPI_INT,
+                   MPI_COMM_WORLD);
+    qsort(all, total, sizeof(int), int_compare);
+    offsets[0] = 0;
+    for (int k = 1; k < p; k++) {
+        offsets[k] = total > 0 ? all[(long long)total * k / p] : n;
+    }
+    offsets[p] = n;
+    free(samples);
+    free(sample_counts);
+    free(sample_displs);
+    free(all);
+}
+
+// Group entries by destination process (stable), as exchange_rows() expects
+static void bucket_by_rows(MtxEntry** E, long long count, const int* offsets, int p) {
+    long long* start = checked_malloc((p + 1) * sizeof(long long), "bucket offsets");
+    int* dest = checked_malloc(count * sizeof(int), "entry destinations");
+    for (int k = 0; k <= p; k++) {
+        start[k] = 0;
+    }
+    for (long long e = 0; e < count; e++) {
+        // Last process whose first row is <= row
+        int lo = 0, hi = p - 1, row = (*E)[e].row;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (offsets[mid] <= row) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        dest[e] = lo;
+        start[lo + 1]++;
+    }
+    for (int k = 0; k < p; k++) {
+        start[k + 1] += start[k];
+    }
+    MtxEntry* B = checked_malloc(count * sizeof(MtxEntry), "bucketed entries");
+    for (long long e = 0; e < count; e++) {
+        B[start[dest[e]]++] = (*E)[e];
+    }
+    free(*E);
+    *E = B;
+    free(dest);
+    free(start);
+}
+
+/**
+ * @brief Sort entries of rows [row_start, row_start + n_rows) by (row, column)
+ *
+ * Counting sort by row, then a sort of each row's columns, which are few.
+ */
+static void sort_rows(MtxEntry** E, long long count, int row_start, int n_rows) {
+    long long* start = checked_malloc((n_rows + 1) * sizeof(long long), "row offsets");
+    for (int i = 0; i <= n_rows; i++) {
+        start[i] = 0;
+    }
+    for (long long e = 0; e < count; e++) {
+        start[(*E)[e].row - row_start + 1]++;
+    }
+    for (int i = 0; i < n_rows; i++) {
+        start[i + 1] += start[i];
+    }
+    MtxEntry* S = checked_malloc(count * sizeof(MtxEntry), "sorted entries");
+    for (long long e = 0; e < count; e++) {
+        S[start[(*E)[e].row - row_start]++] = (*E)[e];
+    }
+    free(*E);
+    *E = S;
+    // start[i] is now the end of row i
+    long long begin = 0;
+    for (int i = 0; i < n_rows; i++) {
+        long long len = start[i] - begin;
+        if (len > 32) {
+            qsort(S + begin, len, sizeof(MtxEntry), entry_compare);
+        } else {
+            for (long long a = begin + 1; a < start[i]; a++) {
+                MtxEntry v = S[a];
+                long long b = a - 1;
+                while (b >= begin && S[b].col > v.col) {
+                    S[b + 1] = S[b];
+                    b--;
+                }
+                S[b + 1] = v;
+            }
+        }
+        begin = start[i];
+    }
+    free(start);
+}
+
+void read_mtx_parallel(const char* filename, int** ptr, int** cols, double** vals,
+                       int* local_n, int* local_nnz, int* global_n,
+                       int rank, int p, PartitionType part, double nnz_weight,
+                       RowDist* dist, MtxStats* stats) {
+    double t0 = MPI_Wtime();
+    MtxHeader H;
+    read_header(filename, rank, &H);
+    int n = (int)H.n_rows;
+    *global_n = n;
+
+    MPI_File fh;
+    int err = MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_RDONLY,
+                            MPI_INFO_NULL, &fh);
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Failed to open %s\n", rank, filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    long long count, file_entries;
+    MtxEntry* E = parse_range(fh, &H, filename, rank, p, &count, &file_entries);
+    MPI_File_close(&fh);
+    double t_parse = MPI_Wtime() - t0;
+
+    // Sample sort by (row, column)
+    t0 = MPI_Wtime();
+    MPI_Datatype entry_type;
+    MPI_Type_contiguous(sizeof(MtxEntry), MPI_BYTE, &entry_type);
+    MPI_Type_commit(&entry_type);
+    int* offsets = checked_malloc((p + 1) * sizeof(int), "sample sort offsets");
+    sample_splitters(E, count, n, p, offsets);
+    bucket_by_rows(&E, count, offsets, p);
+    exchange_rows(&E, &count, offsets, p, entry_type);
+    sort_rows(&E, count, offsets[rank], offsets[rank + 1] - offsets[rank]);
+
+    // Sum duplicates
+    long long kept = 0;
+    for (long long e = 0; e < count; e++) {
+        if (kept > 0 && E[kept - 1].row == E[e].row && E[kept - 1].col == E[e].col) {
+            E[kept - 1].val += E[e].val;
+        } else {
+            E[kept++] = E[e];
+        }
+    }
+    long long duplicates = count - kept;
+    count = kept;
+
+    // Requested split, computed from the row pointer of the sorted rows
+    int slice_start = offsets[rank];
+    int slice_n = offsets[rank + 1] - offsets[rank];
+    long long base = 0;
+    MPI_Exscan(&count, &base, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) base = 0;
+    long long* slice = checked_malloc((slice_n + 1) * sizeof(long long), "row pointer slice");
+    for (int i = 0; i <= slice_n; i++) {
+        slice[i] = 0;
+    }
+    for (long long e = 0; e < count; e++) {
+        slice[E[e].row - slice_start + 1]++;
+    }
+    slice[0] = base;
+    for (int i = 0; i < slice_n; i++) {
+        slice[i + 1] += slice[i];
+    }
+    rowdist_from_ptr_slice(dist, slice, slice_start, slice_n, n, p, part, nnz_weight);
+    free(slice);
+    free(offsets);
+
+    // Entries stay sorted: each source sends an ordered piece, in rank order
+    exchange_rows(&E, &count, dist->offsets, p, entry_type);
+    MPI_Type_free(&entry_type);
+    if (count > 2147483647LL) {
+        fprintf(stderr, "Rank %d: %lld local nonzeros exceed the 32-bit local index range; "
+                "use more processes\n", rank, count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int row_start = dist->offsets[rank];
+    *local_n = dist->counts[rank];
+    *local_nnz = (int)count;
+    *ptr = checked_malloc((*local_n + 1) * sizeof(int), "ptr");
+    for (int i = 0; i <= *local_n; i++) {
+        (*ptr)[i] = 0;
+    }
+    for (long long e = 0; e < count; e++) {
+        (*ptr)[E[e].row - row_start + 1]++;
+    }
+    for (int i = 0; i < *local_n; i++) {
+        (*ptr)[i + 1] += (*ptr)[i];
+    }
+    *cols = checked_malloc(count * sizeof(int), "cols");
+    *vals = checked_malloc(count * sizeof(double), "vals");
+    // Fill with the threaded SpMV's row split for first touch, as
+    // read_csr_parallel() does
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int row_begin, row_end;
+        csr_thread_rows(*ptr, *local_n, tid, n_threads, &row_begin, &row_end);
+        for (int j = (*ptr)[row_begin]; j < (*ptr)[row_end]; j++) {
+            (*cols)[j] = E[j].col;
+            (*vals)[j] = E[j].val;
+        }
+    }
+    free(E);
+    double t_sort = MPI_Wtime() - t0;
+
+    long long counts_local[3] = {file_entries, count, duplicates};
+    long long counts[3];
+    double times_local[2] = {t_parse, t_sort};
+    double times[2];
+    MPI_Allreduce(counts_local, counts, 3, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(times_local, times, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    if (rank == 0 && counts[0] != H.nnz) {
+        printf("Warning: %s lists %lld entries, its size line says %lld\n", filename,
+               counts[0], H.nnz);
+    }
+    if (stats != NULL) {
+        stats->file_entries = counts[0];
+        stats->entries = counts[1];
+        stats->duplicates = counts[2];
+        stats->bytes = (double)(H.file_size - H.data_start);
+        stats->t_parse = times[0];
+        stats->t_sort = times[1];
+    }
+}
+
+void mtx_report(const MtxStats* stats, int rank) {
+    if (rank != 0) return;
+    printf("Matrix Market: %lld entries read, %lld nonzeros stored, %lld duplicates summed\n",
+           stats->file_entries, stats->entries, stats->duplicates);
+    printf("  parse %.3fs (%.1f MB/s, %.2f M entries/s), sort %.3fs (%.2f M nonzeros/s)\n",
+           stats->t_parse,
+           stats->t_parse > 0.0 ? stats->bytes / stats->t_parse * 1e-6 : 0.0,
+           stats->t_parse > 0.0 ? stats->file_entries / stats->t_parse * 1e-6 : 0.0,
+           stats->t_sort,
+           stats->t_sort > 0.0 ? stats->entries / stats->t_sort * 1e-6 : 0.0);
+}
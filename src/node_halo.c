@@ -0,0 +1,415 @@
+/**
+ * @file node_halo.c
+ * @brief Implementation of the node-aware ghost exchange
+ */
+
+#include "node_halo.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define NODE_HALO_TAG 1005
+
+/**
+ * @brief Off-node entry requested by a process of the node
+ */
+typedef struct {
+    int node;       // Node of the owner
+    int owner;      // Owning process
+    int pos;        // Position in the owner's exported entries
+    int req;        // Index of the request, to send back the import offset
+} NodeRequest;
+
+static void* nh_alloc(size_t bytes) {
+    void* mem = malloc(bytes > 0 ? bytes : 1);
+    if (mem == NULL) {
+        fprintf(stderr, "Failed to allocate node halo plan\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return mem;
+}
+
+static int compare_int(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_request(const void* a, const void* b) {
+    const NodeRequest* x = a;
+    const NodeRequest* y = b;
+    if (x->node != y->node) return (x->node > y->node) - (x->node < y->node);
+    if (x->owner != y->owner) return (x->owner > y->owner) - (x->owner < y->owner);
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+// Exclusive prefix sum of counts into displs; returns the total
+static int prefix_sum(const int* counts, int* displs, int n) {
+    int total = 0;
+    for (int i = 0; i < n; i++) {
+        displs[i] = total;
+        total += counts[i];
+    }
+    return total;
+}
+
+void node_halo_setup(NodeHalo* nh, const HaloPlan* plan, int node_ranks) {
+    prof_begin(PROF_HALO_SETUP);
+    int rank, p;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &p);
+    memset(nh, 0, sizeof(NodeHalo));
+    nh->local_n = plan->local_n;
+    nh->n_ghost = plan->n_ghost;
+    int n_ghost = plan->n_ghost;
+
+    // Processes sharing memory, optionally split into smaller emulated nodes
+    MPI_Comm shm;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shm);
+    if (node_ranks > 0) {
+        int shm_rank;
+        MPI_Comm_rank(shm, &shm_rank);
+        MPI_Comm_split(shm, shm_rank / node_ranks, shm_rank, &nh->node_comm);
+        MPI_Comm_free(&shm);
+    } else {
+        nh->node_comm = shm;
+    }
+    MPI_Comm_rank(nh->node_comm, &nh->node_rank);
+    MPI_Comm_size(nh->node_comm, &nh->node_size);
+    int node_size = nh->node_size;
+
+    // Nodes are numbered by the rank of their first process among the first processes
+    MPI_Comm leaders;
+    MPI_Comm_split(MPI_COMM_WORLD, nh->node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+    int ids[2] = {0, 0};
+    if (leaders != MPI_COMM_NULL) {
+        MPI_Comm_rank(leaders, &ids[0]);
+        MPI_Comm_size(leaders, &ids[1]);
+        MPI_Comm_free(&leaders);
+    }
+    MPI_Bcast(ids, 2, MPI_INT, 0, nh->node_comm);
+    nh->node_id = ids[0];
+    nh->n_nodes = ids[1];
+    int n_nodes = nh->n_nodes;
+
+    // Node and node rank of every process, and the processes of every node
+    int mine[2] = {nh->node_id, nh->node_rank};
+    int* where = nh_alloc(2 * (size_t)p * sizeof(int));
+    MPI_Allgather(mine, 2, MPI_INT, where, 2, MPI_INT, MPI_COMM_WORLD);
+    int* node_start = calloc(n_nodes + 1, sizeof(int));
+    int* members = nh_alloc((size_t)p * sizeof(int));
+    if (node_start == NULL) {
+        fprintf(stderr, "Failed to allocate node halo plan\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int r = 0; r < p; r++) node_start[where[2 * r] + 1]++;
+    for (int j = 0; j < n_nodes; j++) node_start[j + 1] += node_start[j];
+    for (int r = 0; r < p; r++) members[node_start[where[2 * r]] + where[2 * r + 1]] = r;
+
+    // Exported entries: everything the per-process plan sends, once
+    int send_total = plan->n_send > 0 ?
+        plan->send_displs[plan->n_send - 1] + plan->send_counts[plan->n_send - 1] : 0;
+    nh->export_idx = nh_alloc((size_t)send_total * sizeof(int));
+    memcpy(nh->export_idx, plan->send_idx, (size_t)send_total * sizeof(int));
+    qsort(nh->export_idx, send_total, sizeof(int), compare_int);
+    for (int k = 0; k < send_total; k++) {
+        if (nh->n_export == 0 || nh->export_idx[k] != nh->export_idx[nh->n_export - 1]) {
+            nh->export_idx[nh->n_export++] = nh->export_idx[k];
+        }
+    }
+
+    // Position of each ghost in its owner's exported entries
+    int* send_pos = nh_alloc((size_t)send_total * sizeof(int));
+    for (int k = 0; k < send_total; k++) {
+        const int* pos = bsearch(&plan->send_idx[k], nh->export_idx, nh->n_export, sizeof(int),
+                                 compare_int);
+        send_pos[k] = (int)(pos - nh->export_idx);
+    }
+    int* ghost_pos = nh_alloc((size_t)n_ghost * sizeof(int));
+    int* ghost_owner = nh_alloc((size_t)n_ghost * sizeof(int));
+    MPI_Request* reqs = nh_alloc((size_t)(plan->n_recv + plan->n_send) * sizeof(MPI_Request));
+    for (int i = 0; i < plan->n_recv; i++) {
+        MPI_Irecv(ghost_pos + plan->recv_displs[i], plan->recv_counts[i], MPI_INT,
+                  plan->recv_ranks[i], NODE_HALO_TAG, MPI_COMM_WORLD, &reqs[i]);
+        for (int k = 0; k < plan->recv_counts[i]; k++) {
+            ghost_owner[plan->recv_displs[i] + k] = plan->recv_ranks[i];
+        }
+        if (where[2 * plan->recv_ranks[i]] != nh->node_id) {
+            nh->plan_msgs++;
+            nh->plan_entries += plan->recv_counts[i];
+        }
+    }
+    for (int i = 0; i < plan->n_send; i++) {
+        MPI_Isend(send_pos + plan->send_displs[i], plan->send_counts[i], MPI_INT,
+                  plan->send_ranks[i], NODE_HALO_TAG, MPI_COMM_WORLD, &reqs[plan->n_recv + i]);
+    }
+    MPI_Waitall(plan->n_recv + plan->n_send, reqs, MPI_STATUSES_IGNORE);
+    free(reqs);
+    free(send_pos);
+
+    // Off-node ghosts go to the process of this node handling the owner's node
+    int* req_counts = calloc(node_size, sizeof(int));
+    int* req_displs = nh_alloc((size_t)node_size * sizeof(int));
+    int* got_counts = nh_alloc((size_t)node_size * sizeof(int));
+    int* got_displs = nh_alloc((size_t)node_size * sizeof(int));
+    if (req_counts == NULL) {
+        fprintf(stderr, "Failed to allocate node halo plan\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int g = 0; g < n_ghost; g++) {
+        int node = where[2 * ghost_owner[g]];
+        if (node != nh->node_id) req_counts[node % node_size] += 2;
+    }
+    int req_total = prefix_sum(req_counts, req_displs, node_size);
+    int* req = nh_alloc((size_t)req_total * sizeof(int));
+    int* req_ghost = nh_alloc((size_t)req_total / 2 * sizeof(int));
+    int* fill = nh_alloc((size_t)node_size * sizeof(int));
+    memcpy(fill, req_displs, (size_t)node_size * sizeof(int));
+    for (int g = 0; g < n_ghost; g++) {
+        int node = where[2 * ghost_owner[g]];
+        if (node == nh->node_id) continue;
+        int at = fill[node % node_size];
+        req[at] = ghost_owner[g];
+        req[at + 1] = ghost_pos[g];
+        req_ghost[at / 2] = g;
+        fill[node % node_size] += 2;
+    }
+    MPI_Alltoall(req_counts, 1, MPI_INT, got_counts, 1, MPI_INT, nh->node_comm);
+    int got_total = prefix_sum(got_counts, got_displs, node_size);
+    int* got = nh_alloc((size_t)got_total * sizeof(int));
+    MPI_Alltoallv(req, req_counts, req_displs, MPI_INT, got, got_counts, got_displs, MPI_INT,
+                  nh->node_comm);
+
+    // Requests handled here, merged per remote node into the imported block
+    int n_got = got_total / 2;
+    NodeRequest* entries = nh_alloc((size_t)n_got * sizeof(NodeRequest));
+    for (int k = 0; k < n_got; k++) {
+        entries[k].owner = got[2 * k];
+        entries[k].pos = got[2 * k + 1];
+        entries[k].node = where[2 * entries[k].owner];
+        entries[k].req = k;
+    }
+    qsort(entries, n_got, sizeof(NodeRequest), compare_request);
+    int* offset = nh_alloc((size_t)n_got * sizeof(int));
+    int* import_key = nh_alloc(2 * (size_t)n_got * sizeof(int));
+    int* recv_node = nh_alloc((size_t)n_nodes * sizeof(int));
+    nh->recv_ranks = nh_alloc((size_t)n_nodes * sizeof(int));
+    nh->recv_counts = nh_alloc((size_t)n_nodes * sizeof(int));
+    nh->recv_displs = nh_alloc((size_t)n_nodes * sizeof(int));
+    for (int k = 0; k < n_got; k++) {
+        const NodeRequest* e = &entries[k];
+        int is_new = k == 0 || compare_request(e, &entries[k - 1]) != 0;
+        if (is_new) {
+            if (nh->n_recv == 0 || recv_node[nh->n_recv - 1] != e->node) {
+                int size_j = node_start[e->node + 1] - node_start[e->node];
+                recv_node[nh->n_recv] = e->node;
+                nh->recv_ranks[nh->n_recv] = members[node_start[e->node] + nh->node_id % size_j];
+                nh->recv_counts[nh->n_recv] = 0;
+                nh->recv_displs[nh->n_recv] = nh->n_import;
+                nh->n_recv++;
+            }
+            import_key[2 * nh->n_import] = e->owner;
+            import_key[2 * nh->n_import + 1] = e->pos;
+            nh->recv_counts[nh->n_recv - 1]++;
+            nh->n_import++;
+        }
+        offset[e->req] = nh->n_import - 1;
+    }
+    free(entries);
+    free(recv_node);
+
+    // Send the import offsets back to the requesting processes
+    for (int h = 0; h < node_size; h++) {
+        got_counts[h] /= 2;
+        got_displs[h] /= 2;
+        req_counts[h] /= 2;
+        req_displs[h] /= 2;
+    }
+    int* req_offset = nh_alloc((size_t)req_total / 2 * sizeof(int));
+    MPI_Alltoallv(offset, got_counts, got_displs, MPI_INT, req_offset, req_counts, req_displs,
+                  MPI_INT, nh->node_comm);
+    free(offset);
+    free(got);
+
+    // Tell one process of each remote node which of its node's entries we need
+    int* want = calloc(p, sizeof(int));
+    int* give = nh_alloc((size_t)p * sizeof(int));
+    if (want == NULL) {
+        fprintf(stderr, "Failed to allocate node halo plan\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < nh->n_recv; i++) want[nh->recv_ranks[i]] = 2 * nh->recv_counts[i];
+    MPI_Alltoall(want, 1, MPI_INT, give, 1, MPI_INT, MPI_COMM_WORLD);
+    for (int r = 0; r < p; r++) {
+        if (give[r] > 0) nh->n_send++;
+    }
+    nh->send_ranks = nh_alloc((size_t)nh->n_send * sizeof(int));
+    nh->send_counts = nh_alloc((size_t)nh->n_send * sizeof(int));
+    nh->send_displs = nh_alloc((size_t)nh->n_send * sizeof(int));
+    int sent = 0;
+    for (int r = 0, i = 0; r < p; r++) {
+        if (give[r] == 0) continue;
+        nh->send_ranks[i] = r;
+        nh->send_counts[i] = give[r] / 2;
+        nh->send_displs[i] = sent;
+        sent += give[r] / 2;
+        i++;
+    }
+    int* send_key = nh_alloc(2 * (size_t)sent * sizeof(int));
+    nh->reqs = nh_alloc((size_t)(nh->n_recv + nh->n_send) * sizeof(MPI_Request));
+    for (int i = 0; i < nh->n_send; i++) {
+        MPI_Irecv(send_key + 2 * nh->send_displs[i], 2 * nh->send_counts[i], MPI_INT,
+                  nh->send_ranks[i], NODE_HALO_TAG, MPI_COMM_WORLD, &nh->reqs[i]);
+    }
+    for (int i = 0; i < nh->n_recv; i++) {
+        MPI_Isend(import_key + 2 * nh->recv_displs[i], 2 * nh->recv_counts[i], MPI_INT,
+                  nh->recv_ranks[i], NODE_HALO_TAG, MPI_COMM_WORLD, &nh->reqs[nh->n_send + i]);
+    }
+    MPI_Waitall(nh->n_recv + nh->n_send, nh->reqs, MPI_STATUSES_IGNORE);
+    free(want);
+    free(give);
+    free(import_key);
+
+    // The shared window, and where every process's segment is
+    size_t seg_n = 2 * (size_t)(nh->n_export + nh->n_import);
+    MPI_Win_allocate_shared((MPI_Aint)(seg_n * sizeof(double)), sizeof(double), MPI_INFO_NULL,
+                            nh->node_comm, &nh->seg, &nh->win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, nh->win);
+    int sizes[2] = {nh->n_export, nh->n_import};
+    int* node_sizes = nh_alloc(2 * (size_t)node_size * sizeof(int));
+    MPI_Allgather(sizes, 2, MPI_INT, node_sizes, 2, MPI_INT, nh->node_comm);
+    double** base = nh_alloc((size_t)node_size * sizeof(double*));
+    for (int h = 0; h < node_size; h++) {
+        MPI_Aint bytes;
+        int disp_unit;
+        MPI_Win_shared_query(nh->win, h, &bytes, &disp_unit, &base[h]);
+    }
+
+    // Each ghost reads an exporting process of this node or an imported block
+    nh->ghost_src = nh_alloc(2 * (size_t)n_ghost * sizeof(double*));
+    for (int g = 0; g < n_ghost; g++) {
+        int owner = ghost_owner[g];
+        if (where[2 * owner] != nh->node_id) continue;
+        int h = where[2 * owner + 1];
+        for (int par = 0; par < 2; par++) {
+            nh->ghost_src[par * n_ghost + g] = base[h] + par * node_sizes[2 * h] + ghost_pos[g];
+        }
+    }
+    for (int h = 0; h < node_size; h++) {
+        double* imported = base[h] + 2 * node_sizes[2 * h];
+        for (int k = req_displs[h]; k < req_displs[h] + req_counts[h]; k++) {
+            int g = req_ghost[k];
+            for (int par = 0; par < 2; par++) {
+                nh->ghost_src[par * n_ghost + g] = imported + par * node_sizes[2 * h + 1] +
+                                                   req_offset[k];
+            }
+        }
+    }
+
+    // Entries sent to remote nodes, read from the exporting processes of this node
+    nh->send_src = nh_alloc(2 * (size_t)sent * sizeof(double*));
+    nh->send_buf = nh_alloc((size_t)sent * sizeof(double));
+    for (int k = 0; k < sent; k++) {
+        int h = where[2 * send_key[2 * k] + 1];
+        for (int par = 0; par < 2; par++) {
+            nh->send_src[par * sent + k] = base[h] + par * node_sizes[2 * h] + send_key[2 * k + 1];
+        }
+    }
+
+    free(send_key);
+    free(base);
+    free(node_sizes);
+    free(req);
+    free(req_ghost);
+    free(req_offset);
+    free(req_counts);
+    free(req_displs);
+    free(got_counts);
+    free(got_displs);
+    free(fill);
+    free(ghost_pos);
+    free(ghost_owner);
+    free(where);
+    free(node_start);
+    free(members);
+    prof_end(PROF_HALO_SETUP);
+}
+
+void node_halo_begin(NodeHalo* nh, double* x) {
+    prof_begin(PROF_HALO_BEGIN);
+    int par = nh->parity;
+    double* exported = nh->seg + (size_t)par * nh->n_export;
+    for (int k = 0; k < nh->n_export; k++) {
+        exported[k] = x[nh->export_idx[k]];
+    }
+    nh->x = x;
+    MPI_Win_sync(nh->win);
+    MPI_Barrier(nh->node_comm);
+    MPI_Win_sync(nh->win);
+
+    double* imported = nh->seg + 2 * (size_t)nh->n_export + (size_t)par * nh->n_import;
+    for (int i = 0; i < nh->n_recv; i++) {
+        MPI_Irecv(imported + nh->recv_displs[i], nh->recv_counts[i], MPI_DOUBLE,
+                  nh->recv_ranks[i], NODE_HALO_TAG, MPI_COMM_WORLD, &nh->reqs[i]);
+    }
+    int sent = nh->n_send > 0 ?
+        nh->send_displs[nh->n_send - 1] + nh->send_counts[nh->n_send - 1] : 0;
+    const double** src = nh->send_src + (size_t)par * sent;
+    for (int i = 0; i < nh->n_send; i++) {
+        double* buf = nh->send_buf + nh->send_displs[i];
+        for (int k = 0; k < nh->send_counts[i]; k++) {
+            buf[k] = *src[nh->send_displs[i] + k];
+        }
+        MPI_Isend(buf, nh->send_counts[i], MPI_DOUBLE, nh->send_ranks[i], NODE_HALO_TAG,
+                  MPI_COMM_WORLD, &nh->reqs[nh->n_recv + i]);
+    }
+    prof_end(PROF_HALO_BEGIN);
+}
+
+void node_halo_end(NodeHalo* nh) {
+    prof_begin(PROF_HALO_END);
+    MPI_Waitall(nh->n_recv + nh->n_send, nh->reqs, MPI_STATUSES_IGNORE);
+    MPI_Win_sync(nh->win);
+    MPI_Barrier(nh->node_comm);
+    MPI_Win_sync(nh->win);
+
+    // Both copies alternate, so a process refilling one cannot overwrite what others still read
+    double* ghost = nh->x + nh->local_n;
+    const double** src = nh->ghost_src + (size_t)nh->parity * nh->n_ghost;
+    for (int g = 0; g < nh->n_ghost; g++) {
+        ghost[g] = *src[g];
+    }
+    nh->parity ^= 1;
+    prof_end(PROF_HALO_END);
+}
+
+void node_halo_report(const NodeHalo* nh, int rank) {
+    long long local[4] = {nh->plan_msgs, nh->plan_entries, nh->n_recv, nh->n_import};
+    long long sum[4];
+    MPI_Reduce(local, sum, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Node-aware halo: %d nodes, %lld inter-node messages of %lld entries per "
+               "exchange (per-process plan: %lld messages of %lld entries)\n",
+               nh->n_nodes, sum[2], sum[3], sum[0], sum[1]);
+    }
+}
+
+void node_halo_free(NodeHalo* nh) {
+    MPI_Win_unlock_all(nh->win);
+    MPI_Win_free(&nh->win);
+    MPI_Comm_free(&nh->node_comm);
+    free(nh->export_idx);
+    free(nh->recv_ranks);
+    free(nh->recv_counts);
+    free(nh->recv_displs);
+    free(nh->send_ranks);
+    free(nh->send_counts);
+    free(nh->send_displs);
+    free(nh->send_src);
+    free(nh->send_buf);
+    free(nh->reqs);
+    free(nh->ghost_src);
+    memset(nh, 0, sizeof(NodeHalo));
+}
@@ -0,0 +1,162 @@
+/**
+ * @file partition.c
+ * @brief Implementation of the row distribution
+ */
+
+#include "partition.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+int partition_type_from_string(const char* name, PartitionType* type) {
+    if (strcmp(name, "rows") == 0) {
+        *type = PART_ROWS;
+    } else if (strcmp(name, "nnz") == 0) {
+        *type = PART_NNZ;
+    } else if (strcmp(name, "mixed") == 0) {
+        *type = PART_MIXED;
+    } else if (strcmp(name, "file") == 0) {
+        *type = PART_FILE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* partition_type_name(PartitionType type) {
+    switch (type) {
+        case PART_NNZ:   return "nnz";
+        case PART_MIXED: return "mixed";
+        case PART_FILE:  return "file";
+        case PART_ROWS:
+        default:         return "rows";
+    }
+}
+
+// Weight w of the nonzero count in the row cost
+static double partition_nnz_weight(PartitionType type, double nnz_weight) {
+    if (type == PART_NNZ || type == PART_FILE) return 1.0;
+    return (type == PART_MIXED) ? nnz_weight : 0.0;
+}
+
+static void rowdist_alloc(RowDist* dist, int p) {
+    dist->p = p;
+    dist->offsets = malloc((p + 1) * sizeof(int));
+    dist->counts = malloc(p * sizeof(int));
+    if (dist->offsets == NULL || dist->counts == NULL) {
+        fprintf(stderr, "Failed to allocate row distribution\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+void rowdist_from_ptr(RowDist* dist, const int* full_ptr, int n, int p,
+                      PartitionType type, double nnz_weight) {
+    rowdist_alloc(dist, p);
+    dist->global_n = n;
+
+    double w = partition_nnz_weight(type, nnz_weight);
+    double avg = (n > 0) ? (double)(full_ptr[n] - full_ptr[0]) / n : 0.0;
+    // Cumulative cost of rows [0, i); nondecreasing in i
+    #define ROW_COST(i) ((1.0 - w) * avg * (double)(i) + w * (double)(full_ptr[i] - full_ptr[0]))
+    double total = ROW_COST(n);
+
+    dist->offsets[0] = 0;
+    for (int k = 1; k < p; k++) {
+        double target = total * k / p;
+        // First row whose cumulative cost reaches the target
+        int lo = dist->offsets[k - 1], hi = n;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (ROW_COST(mid) < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        dist->offsets[k] = lo;
+    }
+    dist->offsets[p] = n;
+    #undef ROW_COST
+
+    for (int k = 0; k < p; k++) {
+        dist->counts[k] = dist->offsets[k + 1] - dist->offsets[k];
+    }
+}
+
+void rowdist_from_ptr_slice(RowDist* dist, const long long* ptr_slice, int slice_start,
+                            int slice_n, int n, int p, PartitionType type, double nnz_weight) {
+    rowdist_alloc(dist, p);
+    dist->global_n = n;
+
+    // ptr[0] and ptr[n] are the smallest and largest entries of any slice
+    long long ends[2] = {-ptr_slice[0], ptr_slice[slice_n]};
+    MPI_Allreduce(MPI_IN_PLACE, ends, 2, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    long long ptr0 = -ends[0];
+
+    double w = partition_nnz_weight(type, nnz_weight);
+    double avg = (n > 0) ? (double)(ends[1] - ptr0) / n : 0.0;
+    // Same cost as rowdist_from_ptr(), for rows of the slice
+    #define ROW_COST(i) ((1.0 - w) * avg * (double)(i) + \
+                         w * (double)(ptr_slice[(i) - slice_start] - ptr0))
+    double total = (1.0 - w) * avg * (double)n + w * (double)(ends[1] - ptr0);
+
+    // First row of the slice reaching each target; the smallest over all
+    // slices is the split point
+    for (int k = 1; k < p; k++) {
+        double target = total * k / p;
+        int lo = slice_start, hi = slice_start + slice_n;
+        if (ROW_COST(hi) < target) {
+            dist->offsets[k] = n;
+            continue;
+        }
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (ROW_COST(mid) < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        dist->offsets[k] = lo;
+    }
+    #undef ROW_COST
+    if (p > 1) {
+        MPI_Allreduce(MPI_IN_PLACE, dist->offsets + 1, p - 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    }
+    dist->offsets[0] = 0;
+    dist->offsets[p] = n;
+
+    for (int k = 0; k < p; k++) {
+        dist->counts[k] = dist->offsets[k + 1] - dist->offsets[k];
+    }
+}
+
+void rowdist_from_counts(RowDist* dist, int local_n, int p) {
+    rowdist_alloc(dist, p);
+    MPI_Allgather(&local_n, 1, MPI_INT, dist->counts, 1, MPI_INT, MPI_COMM_WORLD);
+    dist->offsets[0] = 0;
+    for (int k = 0; k < p; k++) {
+        dist->offsets[k + 1] = dist->offsets[k] + dist->counts[k];
+    }
+    dist->global_n = dist->offsets[p];
+}
+
+int rowdist_owner(const RowDist* dist, int row) {
+    int lo = 0, hi = dist->p - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (dist->offsets[mid] <= row) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+void rowdist_free(RowDist* dist) {
+    free(dist->offsets);
+    free(dist->counts);
+    memset(dist, 0, sizeof(RowDist));
+}
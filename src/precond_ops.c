@@ -0,0 +1,351 @@
+/**
+ * @file precond_ops.c
+ * @brief Implementation of the CG preconditioners
+ */
+
+#include "precond_ops.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+int pc_type_from_string(const char* name, PCType* type) {
+    if (strcmp(name, "none") == 0) {
+        *type = PC_NONE;
+    } else if (strcmp(name, "jacobi") == 0) {
+        *type = PC_JACOBI;
+    } else if (strcmp(name, "bjacobi") == 0) {
+        *type = PC_BJACOBI;
+    } else if (strcmp(name, "ssor") == 0) {
+        *type = PC_SSOR;
+    } else if (strcmp(name, "amg") == 0) {
+        *type = PC_AMG;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* pc_type_name(PCType type) {
+    switch (type) {
+        case PC_JACOBI:  return "jacobi";
+        case PC_BJACOBI: return "bjacobi";
+        case PC_SSOR:    return "ssor";
+        case PC_AMG:     return "amg";
+        case PC_NONE:
+        default:         return "none";
+    }
+}
+
+/**
+ * @brief Copy the on-process diagonal block with columns sorted in each row
+ *
+ * Aborts if a row has no nonzero diagonal entry.
+ */
+static void extract_diag_block(Preconditioner* pc, int* ptr, int* cols, double* vals) {
+    int n = pc->local_n;
+    pc->ptr = malloc((n + 1) * sizeof(int));
+    pc->diag_pos = malloc((n + 1) * sizeof(int));
+    if (pc->ptr == NULL || pc->diag_pos == NULL) {
+        fprintf(stderr, "Failed to allocate preconditioner block\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    pc->ptr[0] = 0;
+    for (int i = 0; i < n; i++) {
+        int count = 0;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            if (cols[j] < n) count++;
+        }
+        pc->ptr[i + 1] = pc->ptr[i] + count;
+    }
+
+    int block_nnz = pc->ptr[n];
+    pc->cols = malloc((block_nnz + 1) * sizeof(int));
+    pc->vals = malloc((block_nnz + 1) * sizeof(double));
+    if (pc->cols == NULL || pc->vals == NULL) {
+        fprintf(stderr, "Failed to allocate preconditioner block\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    for (int i = 0; i < n; i++) {
+        int pos = pc->ptr[i];
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            if (cols[j] >= n) continue;
+            // Insertion sort by column; rows are short
+            int k = pos++;
+            while (k > pc->ptr[i] && pc->cols[k - 1] > cols[j]) {
+                pc->cols[k] = pc->cols[k - 1];
+                pc->vals[k] = pc->vals[k - 1];
+                k--;
+            }
+            pc->cols[k] = cols[j];
+            pc->vals[k] = vals[j];
+        }
+
+        pc->diag_pos[i] = -1;
+        for (int j = pc->ptr[i]; j < pc->ptr[i + 1]; j++) {
+            if (pc->cols[j] == i) {
+                pc->diag_pos[i] = j;
+                break;
+            }
+        }
+        if (pc->diag_pos[i] < 0 || pc->vals[pc->diag_pos[i]] == 0.0) {
+            fprintf(stderr, "Preconditioner setup: zero diagonal in local row %d\n", i);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+}
+
+// In-place ILU(0) (IKJ variant) of the sorted diagonal block
+static void factor_ilu0(Preconditioner* pc) {
+    int n = pc->local_n;
+    int* marker = malloc((n + 1) * sizeof(int));
+    if (marker == NULL) {
+        fprintf(stderr, "Failed to allocate ILU(0) workspace\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < n; i++) marker[i] = -1;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = pc->ptr[i]; j < pc->ptr[i + 1]; j++) {
+            marker[pc->cols[j]] = j;
+        }
+        for (int j = pc->ptr[i]; j < pc->diag_pos[i]; j++) {
+            int k = pc->cols[j];
+            double lik = pc->vals[j] / pc->vals[pc->diag_pos[k]];
+            pc->vals[j] = lik;
+            for (int jj = pc->diag_pos[k] + 1; jj < pc->ptr[k + 1]; jj++) {
+                int m = marker[pc->cols[jj]];
+                if (m >= 0) pc->vals[m] -= lik * pc->vals[jj];
+            }
+        }
+        if (pc->vals[pc->diag_pos[i]] == 0.0) {
+            fprintf(stderr, "ILU(0) breakdown: zero pivot in local row %d\n", i);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (int j = pc->ptr[i]; j < pc->ptr[i + 1]; j++) {
+            marker[pc->cols[j]] = -1;
+        }
+    }
+    free(marker);
+}
+
+void precond_setup(Preconditioner* pc, PCType type, double omega,
+                   int* ptr, int* cols, double* vals, int local_n) {
+    memset(pc, 0, sizeof(Preconditioner));
+    pc->type = type;
+    pc->local_n = local_n;
+    pc->omega = omega;
+
+    prof_begin(PROF_PC_SETUP);
+    switch (type) {
+        case PC_JACOBI:
+            pc->inv_diag = malloc((local_n + 1) * sizeof(double));
+            if (pc->inv_diag == NULL) {
+                fprintf(stderr, "Failed to allocate Jacobi diagonal\n");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            for (int i = 0; i < local_n; i++) {
+                double diag = 0.0;
+                for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                    if (cols[j] == i) diag += vals[j];
+                }
+                if (diag == 0.0) {
+                    fprintf(stderr, "Jacobi setup: zero diagonal in local row %d\n", i);
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                pc->inv_diag[i] = 1.0 / diag;
+            }
+            break;
+        case PC_BJACOBI:
+            extract_diag_block(pc, ptr, cols, vals);
+            factor_ilu0(pc);
+            break;
+        case PC_SSOR:
+            extract_diag_block(pc, ptr, cols, vals);
+            break;
+        case PC_AMG:
+            fprintf(stderr, "AMG needs the ghost exchange plan: use precond_setup_amg()\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+            break;
+        case PC_NONE:
+        default:
+            break;
+    }
+    prof_end(PROF_PC_SETUP);
+}
+
+void precond_setup_amg(Preconditioner* pc, int* ptr, int* cols, double* vals, int local_n,
+                       HaloPlan* halo, const AmgOptions* opts, int verbose) {
+    memset(pc, 0, sizeof(Preconditioner));
+    pc->type = PC_AMG;
+    pc->local_n = local_n;
+    prof_begin(PROF_PC_SETUP);
+    pc->amg = amg_setup(ptr, cols, vals, local_n, halo, opts, verbose);
+    pc->work = malloc((2 * (size_t)local_n + 1) * sizeof(double));
+    if (pc->work == NULL) {
+        fprintf(stderr, "Failed to allocate AMG block workspace\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    prof_end(PROF_PC_SETUP);
+}
+
+void precond_apply(const Preconditioner* pc, const double* r, double* z) {
+    int n = pc->local_n;
+    prof_begin(PROF_PC_APPLY);
+    switch (pc->type) {
+        case PC_JACOBI:
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; i++) {
+                z[i] = pc->inv_diag[i] * r[i];
+            }
+            break;
+        case PC_BJACOBI:
+            // Triangular solves are sequential; each process runs them on one thread
+            // Forward solve with unit lower factor L
+            for (int i = 0; i < n; i++) {
+                double sum = r[i];
+                for (int j = pc->ptr[i]; j < pc->diag_pos[i]; j++) {
+                    sum -= pc->vals[j] * z[pc->cols[j]];
+                }
+                z[i] = sum;
+            }
+            // Backward solve with upper factor U
+            for (int i = n - 1; i >= 0; i--) {
+                double sum = z[i];
+                for (int j = pc->diag_pos[i] + 1; j < pc->ptr[i + 1]; j++) {
+                    sum -= pc->vals[j] * z[pc->cols[j]];
+                }
+                z[i] = sum / pc->vals[pc->diag_pos[i]];
+            }
+            break;
+        case PC_SSOR: {
+            // M = (D + wL) D^{-1} (D + wU) / (w (2 - w))
+            double w = pc->omega;
+            for (int i = 0; i < n; i++) {
+                double sum = r[i];
+                for (int j = pc->ptr[i]; j < pc->diag_pos[i]; j++) {
+                    sum -= w * pc->vals[j] * z[pc->cols[j]];
+                }
+                z[i] = sum / pc->vals[pc->diag_pos[i]];
+            }
+            for (int i = 0; i < n; i++) {
+                z[i] *= pc->vals[pc->diag_pos[i]];
+            }
+            for (int i = n - 1; i >= 0; i--) {
+                double sum = z[i];
+                for (int j = pc->diag_pos[i] + 1; j < pc->ptr[i + 1]; j++) {
+                    sum -= w * pc->vals[j] * z[pc->cols[j]];
+                }
+                z[i] = sum / pc->vals[pc->diag_pos[i]];
+            }
+            double scale = w * (2.0 - w);
+            for (int i = 0; i < n; i++) {
+                z[i] *= scale;
+            }
+            break;
+        }
+        case PC_AMG:
+            amg_apply(pc->amg, r, z);
+            break;
+        case PC_NONE:
+        default:
+            memcpy(z, r, n * sizeof(double));
+            break;
+    }
+    prof_end(PROF_PC_APPLY);
+}
+
+void precond_apply_block(const Preconditioner* pc, const double* R, double* Z, int k) {
+    int n = pc->local_n;
+    prof_begin(PROF_PC_APPLY);
+    switch (pc->type) {
+        case PC_JACOBI:
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; i++) {
+                for (int c = 0; c < k; c++) {
+                    Z[(size_t)i * k + c] = pc->inv_diag[i] * R[(size_t)i * k + c];
+                }
+            }
+            break;
+        case PC_BJACOBI:
+            for (int i = 0; i < n; i++) {
+                double* z = Z + (size_t)i * k;
+                memcpy(z, R + (size_t)i * k, k * sizeof(double));
+                for (int j = pc->ptr[i]; j < pc->diag_pos[i]; j++) {
+                    const double* zj = Z + (size_t)pc->cols[j] * k;
+                    for (int c = 0; c < k; c++) z[c] -= pc->vals[j] * zj[c];
+                }
+            }
+            for (int i = n - 1; i >= 0; i--) {
+                double* z = Z + (size_t)i * k;
+                for (int j = pc->diag_pos[i] + 1; j < pc->ptr[i + 1]; j++) {
+                    const double* zj = Z + (size_t)pc->cols[j] * k;
+                    for (int c = 0; c < k; c++) z[c] -= pc->vals[j] * zj[c];
+                }
+                double inv = 1.0 / pc->vals[pc->diag_pos[i]];
+                for (int c = 0; c < k; c++) z[c] *= inv;
+            }
+            break;
+        case PC_SSOR: {
+            double w = pc->omega;
+            for (int i = 0; i < n; i++) {
+                double* z = Z + (size_t)i * k;
+                memcpy(z, R + (size_t)i * k, k * sizeof(double));
+                for (int j = pc->ptr[i]; j < pc->diag_pos[i]; j++) {
+                    const double* zj = Z + (size_t)pc->cols[j] * k;
+                    for (int c = 0; c < k; c++) z[c] -= w * pc->vals[j] * zj[c];
+                }
+                double inv = 1.0 / pc->vals[pc->diag_pos[i]];
+                for (int c = 0; c < k; c++) z[c] *= inv;
+            }
+            for (int i = 0; i < n; i++) {
+                double d = pc->vals[pc->diag_pos[i]];
+                for (int c = 0; c < k; c++) Z[(size_t)i * k + c] *= d;
+            }
+            double scale = w * (2.0 - w);
+            for (int i = n - 1; i >= 0; i--) {
+                double* z = Z + (size_t)i * k;
+                for (int j = pc->diag_pos[i] + 1; j < pc->ptr[i + 1]; j++) {
+                    const double* zj = Z + (size_t)pc->cols[j] * k;
+                    for (int c = 0; c < k; c++) z[c] -= w * pc->vals[j] * zj[c];
+                }
+                double inv = 1.0 / pc->vals[pc->diag_pos[i]];
+                for (int c = 0; c < k; c++) z[c] *= inv;
+            }
+            for (size_t i = 0; i < (size_t)n * k; i++) {
+                Z[i] *= scale;
+            }
+            break;
+        }
+        case PC_AMG: {
+            // One V-cycle per column
+            double* r = pc->work;
+            double* z = pc->work + n;
+            for (int c = 0; c < k; c++) {
+                for (int i = 0; i < n; i++) r[i] = R[(size_t)i * k + c];
+                amg_apply(pc->amg, r, z);
+                for (int i = 0; i < n; i++) Z[(size_t)i * k + c] = z[i];
+            }
+            break;
+        }
+        case PC_NONE:
+        default:
+            memcpy(Z, R, (size_t)n * k * sizeof(double));
+            break;
+    }
+    prof_end(PROF_PC_APPLY);
+}
+
+void precond_free(Preconditioner* pc) {
+    free(pc->inv_diag);
+    free(pc->ptr);
+    free(pc->cols);
+    free(pc->vals);
+    free(pc->diag_pos);
+    amg_free(pc->amg);
+    free(pc->work);
+    memset(pc, 0, sizeof(Preconditioner));
+}
@@ -0,0 +1,210 @@
+/**
+ * @file profile.c
+ * @brief Implementation of the performance log
+ */
+
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+// Timeline records kept per process; later events are counted but dropped
+#define PROF_TRACE_MAX_RECORDS (1 << 21)
+// Upper bound on the text of one trace record
+#define PROF_TRACE_RECORD_BYTES 128
+
+static const char* const prof_names[PROF_N_EVENTS] = {
+    "MatLoad", "VecIO", "Checkpoint", "HaloSetUp", "PCSetUp", "CGSolve", "MatMult",
+    "HaloBegin", "HaloEnd", "VecDot", "VecReduce", "VecUpdate", "PCApply",
+    "MPI_Allreduce", "MPI_Sync", "MPI_Isend/Irecv", "MPI_Wait"};
+
+typedef struct {
+    int event;
+    double t0, t1;
+} ProfRecord;
+
+static int prof_initialized = 0;
+static int prof_active = 0;
+static int prof_sync = 0;
+static const char* prof_trace_file = NULL;
+static double prof_origin;
+static double prof_start[PROF_N_EVENTS];
+static double prof_time[PROF_N_EVENTS];
+static double prof_count[PROF_N_EVENTS];
+static double prof_bytes[PROF_N_EVENTS];   // Sent or reduced bytes of MPI events
+static ProfRecord* prof_trace = NULL;
+static int prof_n_trace = 0;
+static int prof_trace_cap = 0;
+static long long prof_dropped = 0;
+
+void prof_init(int sync, const char* trace_file) {
+    memset(prof_time, 0, sizeof(prof_time));
+    memset(prof_count, 0, sizeof(prof_count));
+    memset(prof_bytes, 0, sizeof(prof_bytes));
+    prof_sync = sync;
+    prof_trace_file = trace_file;
+    prof_initialized = 1;
+    PMPI_Barrier(MPI_COMM_WORLD);
+    prof_origin = MPI_Wtime();
+    prof_active = 1;
+}
+
+void prof_begin(ProfEvent event) {
+    if (!prof_active) return;
+    prof_start[event] = MPI_Wtime();
+}
+
+void prof_end(ProfEvent event) {
+    if (!prof_active) return;
+    double t = MPI_Wtime();
+    prof_time[event] += t - prof_start[event];
+    prof_count[event] += 1.0;
+    if (prof_trace_file == NULL) return;
+
+    if (prof_n_trace == prof_trace_cap) {
+        int cap = prof_trace_cap > 0 ? 2 * prof_trace_cap : 4096;
+        if (cap > PROF_TRACE_MAX_RECORDS) cap = PROF_TRACE_MAX_RECORDS;
+        ProfRecord* grown = cap > prof_trace_cap ?
+            realloc(prof_trace, cap * sizeof(ProfRecord)) : NULL;
+        if (grown == NULL) {
+            prof_dropped++;
+            return;
+        }
+        prof_trace = grown;
+        prof_trace_cap = cap;
+    }
+    ProfRecord* rec = &prof_trace[prof_n_trace++];
+    rec->event = event;
+    rec->t0 = prof_start[event];
+    rec->t1 = t;
+}
+
+int prof_mpi_logging(void) {
+    return prof_active;
+}
+
+int prof_mpi_sync(void) {
+    return prof_sync;
+}
+
+void prof_add_bytes(ProfEvent event, double bytes) {
+    prof_bytes[event] += bytes;
+}
+
+/**
+ * @brief Write the timeline of all processes as one Chrome trace file
+ *
+ * Each process formats its records (times in microseconds from the
+ * common origin, one trace process per rank) and writes them at its
+ * offset with collective MPI-IO.
+ */
+static void write_trace(int rank, int p) {
+    size_t cap = (size_t)(prof_n_trace + 2) * PROF_TRACE_RECORD_BYTES;
+    char* text = malloc(cap);
+    if (text == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate trace buffer\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    size_t len = 0;
+    len += snprintf(text + len, cap - len,
+                    "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                    "\"args\":{\"name\":\"rank %d\"}}",
+                    rank == 0 ? "{\"traceEvents\":[\n" : ",\n", rank, rank);
+    for (int i = 0; i < prof_n_trace; i++) {
+        const ProfRecord* rec = &prof_trace[i];
+        len += snprintf(text + len, cap - len,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+                        "\"ts\":%.3f,\"dur\":%.3f}",
+                        prof_names[rec->event], rank, (rec->t0 - prof_origin) * 1e6,
+                        (rec->t1 - rec->t0) * 1e6);
+    }
+    if (rank == p - 1) {
+        len += snprintf(text + len, cap - len, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    }
+
+    long long my_len = (long long)len, offset = 0;
+    MPI_Exscan(&my_len, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) offset = 0;
+    MPI_File fh;
+    int err = MPI_File_open(MPI_COMM_WORLD, (char*)prof_trace_file,
+                            MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+    if (err != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Rank 0: Failed to open %s for writing\n", prof_trace_file);
+        free(text);
+        return;
+    }
+    MPI_File_set_size(fh, 0);
+    MPI_File_write_at_all(fh, (MPI_Offset)offset, text, (int)len, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    free(text);
+
+    long long dropped;
+    MPI_Reduce(&prof_dropped, &dropped, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Wrote timeline to %s", prof_trace_file);
+        if (dropped > 0) printf(" (%lld events beyond the per-process limit dropped)", dropped);
+        printf("\n");
+    }
+}
+
+void prof_finalize(int rank, int p) {
+    if (!prof_initialized) return;
+    double t_wall = MPI_Wtime() - prof_origin;
+    prof_active = 0;
+
+    struct {
+        double value;
+        int rank;
+    } local_max[PROF_N_EVENTS], slowest[PROF_N_EVENTS];
+    for (int e = 0; e < PROF_N_EVENTS; e++) {
+        local_max[e].value = prof_time[e];
+        local_max[e].rank = rank;
+    }
+    double t_min[PROF_N_EVENTS], t_sum[PROF_N_EVENTS], count[PROF_N_EVENTS];
+    double bytes[PROF_N_EVENTS], wall;
+    MPI_Reduce(prof_time, t_min, PROF_N_EVENTS, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(prof_time, t_sum, PROF_N_EVENTS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local_max, slowest, PROF_N_EVENTS, MPI_DOUBLE_INT, MPI_MAXLOC, 0, MPI_COMM_WORLD);
+    MPI_Reduce(prof_count, count, PROF_N_EVENTS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(prof_bytes, bytes, PROF_N_EVENTS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&t_wall, &wall, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        printf("\nPerformance log: %d processes, %.3fs logged; "
+               "times are min/avg/max over processes\n", p, wall);
+        printf("%-16s %9s %10s %10s %10s %7s %6s %7s %10s\n", "Event", "Count",
+               "Min (s)", "Avg (s)", "Max (s)", "Max/Min", "%Time", "Slowest", "MB/proc");
+        // MPI events are only counted when profile_pmpi.c is linked in
+        int mpi_logged = 0;
+        for (int e = PROF_MPI_ALLREDUCE; e < PROF_N_EVENTS; e++) {
+            if (count[e] > 0.0) mpi_logged = 1;
+        }
+        for (int e = 0; e < PROF_N_EVENTS; e++) {
+            if (e == PROF_MPI_ALLREDUCE && mpi_logged) printf("-- MPI calls (PMPI) --\n");
+            if (count[e] == 0.0) continue;
+            double avg = t_sum[e] / p;
+            char ratio[16] = "-";
+            if (t_min[e] > 0.0) snprintf(ratio, sizeof(ratio), "%.2f", slowest[e].value / t_min[e]);
+            printf("%-16s %9.0f %10.3e %10.3e %10.3e %7s %6.1f %7d", prof_names[e], count[e],
+                   t_min[e], avg, slowest[e].value, ratio,
+                   wall > 0.0 ? 100.0 * avg / wall : 0.0, slowest[e].rank);
+            if (bytes[e] > 0.0) {
+                printf(" %10.4g", bytes[e] / p * 1e-6);
+            }
+            printf("\n");
+        }
+        if (prof_sync) {
+            printf("MPI_Sync is the wait for slower processes before each allreduce; "
+                   "MPI_Allreduce is then the reduction alone\n");
+        }
+    }
+
+    if (prof_trace_file != NULL) {
+        write_trace(rank, p);
+    }
+    free(prof_trace);
+    prof_trace = NULL;
+    prof_n_trace = prof_trace_cap = 0;
+    prof_initialized = 0;
+}
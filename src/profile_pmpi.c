@@ -0,0 +1,89 @@
+/**
+ * @file profile_pmpi.c
+ * @brief PMPI hooks of the performance log
+ *
+ * Kept apart from profile.c so that MPI interposition is opt-in: only
+ * programs that link this object have their MPI calls timed.
+ */
+
+#include "profile.h"
+#include <mpi.h>
+
+static void add_bytes(ProfEvent event, int count, MPI_Datatype datatype) {
+    int size;
+    PMPI_Type_size(datatype, &size);
+    prof_add_bytes(event, (double)count * size);
+}
+
+/*
+ * With logging off the hooks only forward the call. The barrier of
+ * -log_sync runs on the communicator of the collective, which every
+ * member enters, so it cannot deadlock.
+ */
+
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype datatype,
+                  MPI_Op op, MPI_Comm comm) {
+    if (!prof_mpi_logging()) return PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+    if (prof_mpi_sync()) {
+        prof_begin(PROF_MPI_SYNC);
+        PMPI_Barrier(comm);
+        prof_end(PROF_MPI_SYNC);
+    }
+    prof_begin(PROF_MPI_ALLREDUCE);
+    int err = PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+    prof_end(PROF_MPI_ALLREDUCE);
+    add_bytes(PROF_MPI_ALLREDUCE, count, datatype);
+    return err;
+}
+
+int MPI_Iallreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype datatype,
+                   MPI_Op op, MPI_Comm comm, MPI_Request* request) {
+    if (!prof_mpi_logging()) {
+        return PMPI_Iallreduce(sendbuf, recvbuf, count, datatype, op, comm, request);
+    }
+    if (prof_mpi_sync()) {
+        prof_begin(PROF_MPI_SYNC);
+        PMPI_Barrier(comm);
+        prof_end(PROF_MPI_SYNC);
+    }
+    prof_begin(PROF_MPI_ALLREDUCE);
+    int err = PMPI_Iallreduce(sendbuf, recvbuf, count, datatype, op, comm, request);
+    prof_end(PROF_MPI_ALLREDUCE);
+    add_bytes(PROF_MPI_ALLREDUCE, count, datatype);
+    return err;
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype datatype, int dest, int tag,
+              MPI_Comm comm, MPI_Request* request) {
+    if (!prof_mpi_logging()) return PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+    prof_begin(PROF_MPI_SEND);
+    int err = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+    prof_end(PROF_MPI_SEND);
+    add_bytes(PROF_MPI_SEND, count, datatype);
+    return err;
+}
+
+int MPI_Irecv(void* buf, int count, MPI_Datatype datatype, int source, int tag,
+              MPI_Comm comm, MPI_Request* request) {
+    if (!prof_mpi_logging()) return PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+    prof_begin(PROF_MPI_SEND);
+    int err = PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+    prof_end(PROF_MPI_SEND);
+    return err;
+}
+
+int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+    if (!prof_mpi_logging()) return PMPI_Wait(request, status);
+    prof_begin(PROF_MPI_WAIT);
+    int err = PMPI_Wait(request, status);
+    prof_end(PROF_MPI_WAIT);
+    return err;
+}
+
+int MPI_Waitall(int count, MPI_Request array_of_requests[], MPI_Status array_of_statuses[]) {
+    if (!prof_mpi_logging()) return PMPI_Waitall(count, array_of_requests, array_of_statuses);
+    prof_begin(PROF_MPI_WAIT);
+    int err = PMPI_Waitall(count, array_of_requests, array_of_statuses);
+    prof_end(PROF_MPI_WAIT);
+    return err;
+}
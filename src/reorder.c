@@ -0,0 +1,586 @@
+/**
+ * @file reorder.c
+ * @brief Implementation of load-time reordering and row redistribution
+ */
+
+#include "reorder.h"
+#include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int reorder_type_from_string(const char* name, ReorderType* type) {
+    if (strcmp(name, "none") == 0) {
+        *type = REORDER_NONE;
+    } else if (strcmp(name, "rcm") == 0) {
+        *type = REORDER_RCM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void* checked_malloc(size_t size, const char* what) {
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Failed to allocate %s\n", what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+/**
+ * @brief Breadth-first search from root over unnumbered nodes
+ *
+ * Marks reached nodes with stamp and returns the number of levels;
+ * the nodes of the last level are left in queue[*last_begin .. *count).
+ */
+static int bfs_levels(int root, const int* xadj, const int* adj, const int* numbered,
+                      int* mark, int stamp, int* queue, int* last_begin, int* count) {
+    int head = 0, tail = 0, levels = 0;
+    queue[tail++] = root;
+    mark[root] = stamp;
+    while (head < tail) {
+        int level_end = tail;
+        *last_begin = head;
+        levels++;
+        while (head < level_end) {
+            int v = queue[head++];
+            for (int j = xadj[v]; j < xadj[v + 1]; j++) {
+                int w = adj[j];
+                if (!numbered[w] && mark[w] != stamp) {
+                    mark[w] = stamp;
+                    queue[tail++] = w;
+                }
+            }
+        }
+    }
+    *count = tail;
+    return levels;
+}
+
+/**
+ * @brief Reverse Cuthill-McKee ordering
+ *
+ * Each connected component is numbered by a breadth-first search from a
+ * pseudo-peripheral node, visiting neighbors by increasing degree; the
+ * final ordering is reversed.
+ *
+ * @param perm Output: new index of each node (size: n)
+ */
+static void rcm_order(int n, const int* xadj, const int* adj, int* perm) {
+    int* degree = checked_malloc(n * sizeof(int), "RCM degrees");
+    int* by_degree = checked_malloc(n * sizeof(int), "RCM degree order");
+    int* numbered = calloc(n > 0 ? n : 1, sizeof(int));
+    int* mark = calloc(n > 0 ? n : 1, sizeof(int));
+    int* queue = checked_malloc(n * sizeof(int), "RCM queue");
+    int* order = checked_malloc(n * sizeof(int), "RCM ordering");
+    if (numbered == NULL || mark == NULL) {
+        fprintf(stderr, "Failed to allocate RCM workspace\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int max_degree = 0;
+    for (int v = 0; v < n; v++) {
+        degree[v] = 0;
+        for (int j = xadj[v]; j < xadj[v + 1]; j++) {
+            if (adj[j] != v) degree[v]++;
+        }
+        if (degree[v] > max_degree) max_degree = degree[v];
+    }
+
+    // Counting sort of nodes by degree, used to pick component start nodes
+    int* bucket = calloc(max_degree + 2, sizeof(int));
+    if (bucket == NULL) {
+        fprintf(stderr, "Failed to allocate RCM buckets\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int v = 0; v < n; v++) bucket[degree[v] + 1]++;
+    for (int d = 0; d <= max_degree; d++) bucket[d + 1] += bucket[d];
+    for (int v = 0; v < n; v++) by_degree[bucket[degree[v]]++] = v;
+    free(bucket);
+
+    int stamp = 0;
+    int n_ordered = 0;
+    for (int s = 0; s < n; s++) {
+        int root = by_degree[s];
+        if (numbered[root]) continue;
+
+        // Pseudo-peripheral node: move to a min-degree node of the last BFS
+        // level while the eccentricity keeps growing
+        int last_begin, count;
+        int levels = bfs_levels(root, xadj, adj, numbered, mark, ++stamp, queue,
+                                &last_begin, &count);
+        for (int pass = 0; pass < 5; pass++) {
+            int candidate = queue[last_begin];
+            for (int k = last_begin + 1; k < count; k++) {
+                if (degree[queue[k]] < degree[candidate]) candidate = queue[k];
+            }
+            int cand_levels = bfs_levels(candidate, xadj, adj, numbered, mark, ++stamp,
+                                         queue, &last_begin, &count);
+            if (cand_levels <= levels) break;
+            root = candidate;
+            levels = cand_levels;
+        }
+
+        // Cuthill-McKee numbering of the component
+        int head = n_ordered;
+        order[n_ordered++] = root;
+        numbered[root] = 1;
+        while (head < n_ordered) {
+            int v = order[head++];
+            int first = n_ordered;
+            for (int j = xadj[v]; j < xadj[v + 1]; j++) {
+                int w = adj[j];
+                if (numbered[w]) continue;
+                numbered[w] = 1;
+                // Insertion by increasing degree
+                int k = n_ordered++;
+                while (k > first && degree[order[k - 1]] > degree[w]) {
+                    order[k] = order[k - 1];
+                    k--;
+                }
+                order[k] = w;
+            }
+        }
+    }
+
+    for (int k = 0; k < n; k++) {
+        perm[order[k]] = n - 1 - k;
+    }
+
+    free(degree);
+    free(by_degree);
+    free(numbered);
+    free(mark);
+    free(queue);
+    free(order);
+}
+
+// Off-process nonzeros and maximum |row - col| of the local rows
+static void local_cut_stats(const int* ptr, const int* cols, int local_n, int row_start,
+                            double* stats) {
+    long long off = 0;
+    long long bandwidth = 0;
+    for (int i = 0; i < local_n; i++) {
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+            int c = cols[j];
+            if (c < row_start || c >= row_start + local_n) off++;
+            long long dist = (long long)c - (row_start + i);
+            if (dist < 0) dist = -dist;
+            if (dist > bandwidth) bandwidth = dist;
+        }
+    }
+    stats[0] = (double)off;
+    stats[1] = (double)bandwidth;
+}
+
+void reorder_matrix(ReorderType type, int** ptr, int** cols, double** vals,
+                    int* local_n, int* local_nnz, RowDist* dist,
+                    PartitionType part, double nnz_weight, int rank, int** old_rows) {
+    int p = dist->p;
+    int n = dist->global_n;
+    int row_start = dist->offsets[rank];
+    double t_start = MPI_Wtime();
+
+    double before[2];
+    local_cut_stats(*ptr, *cols, *local_n, row_start, before);
+    double off_before = 0;
+    MPI_Reduce(&before[0], &off_before, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Gather the graph structure on rank 0
+    int* row_len = checked_malloc(*local_n * sizeof(int), "row lengths");
+    for (int i = 0; i < *local_n; i++) {
+        row_len[i] = (*ptr)[i + 1] - (*ptr)[i];
+    }
+    int* nnz_counts = NULL;
+    int* nnz_displs = NULL;
+    int* gxadj = NULL;
+    int* gadj = NULL;
+    if (rank == 0) {
+        nnz_counts = checked_malloc(p * sizeof(int), "nnz counts");
+        nnz_displs = checked_malloc(p * sizeof(int), "nnz displacements");
+        gxadj = checked_malloc((n + 1) * sizeof(int), "global row pointer");
+    }
+    MPI_Gather(local_nnz, 1, MPI_INT, nnz_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(row_len, *local_n, MPI_INT, gxadj ? gxadj + 1 : NULL, dist->counts,
+                dist->offsets, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        gxadj[0] = 0;
+        for (int i = 0; i < n; i++) gxadj[i + 1] += gxadj[i];
+        nnz_displs[0] = 0;
+        for (int k = 1; k < p; k++) nnz_displs[k] = nnz_displs[k - 1] + nnz_counts[k - 1];
+        gadj = checked_malloc((size_t)gxadj[n] * sizeof(int), "global adjacency");
+    }
+    MPI_Gatherv(*cols, *local_nnz, MPI_INT, gadj, nnz_counts, nnz_displs, MPI_INT,
+                0, MPI_COMM_WORLD);
+
+    // Rank 0 computes the ordering and the new distribution, relabels the
+    // gathered columns and counts the off-process nonzeros they would give;
+    // with no cut to reduce (one process) only the bandwidth is at stake
+    int* perm = NULL;
+    int* new_offsets = checked_malloc((p + 1) * sizeof(int), "new offsets");
+    double off_after = 0;
+    int keep = 0;
+    if (rank == 0) {
+        perm = checked_malloc(n * sizeof(int), "permutation");
+        if (type == REORDER_RCM) {
+            rcm_order(n, gxadj, gadj, perm);
+        } else {
+            for (int i = 0; i < n; i++) perm[i] = i;
+        }
+        int* new_ptr = checked_malloc((n + 1) * sizeof(int), "reordered row pointer");
+        new_ptr[0] = 0;
+        for (int i = 0; i < n; i++) new_ptr[perm[i] + 1] = gxadj[i + 1] - gxadj[i];
+        for (int i = 0; i < n; i++) new_ptr[i + 1] += new_ptr[i];
+        RowDist new_dist;
+        rowdist_from_ptr(&new_dist, new_ptr, n, p, part, nnz_weight);
+        long long off = 0;
+        for (int i = 0; i < n; i++) {
+            int k = rowdist_owner(&new_dist, perm[i]);
+            int lo = new_dist.offsets[k];
+            int hi = new_dist.offsets[k + 1];
+            for (int j = gxadj[i]; j < gxadj[i + 1]; j++) {
+                gadj[j] = perm[gadj[j]];
+                if (gadj[j] < lo || gadj[j] >= hi) off++;
+            }
+        }
+        off_after = (double)off;
+        keep = off_before > 0 && off_after >= off_before;
+        memcpy(new_offsets, new_dist.offsets, (p + 1) * sizeof(int));
+        rowdist_free(&new_dist);
+        free(new_ptr);
+        free(gxadj);
+    }
+    MPI_Bcast(&keep, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (keep) {
+        if (rank == 0) {
+            printf("Reordering skipped: off-process nonzeros would go %.0f -> %.0f; "
+                   "keeping the file ordering\n", off_before, off_after);
+            free(gadj);
+            free(nnz_counts);
+            free(nnz_displs);
+            free(perm);
+        }
+        free(row_len);
+        free(new_offsets);
+        *old_rows = NULL;
+        return;
+    }
+
+    // Each process gets the new index of its own rows and its relabeled columns
+    int* local_perm = checked_malloc(*local_n * sizeof(int), "local permutation");
+    MPI_Scatterv(perm, dist->counts, dist->offsets, MPI_INT, local_perm, *local_n, MPI_INT,
+                 0, MPI_COMM_WORLD);
+    MPI_Scatterv(gadj, nnz_counts, nnz_displs, MPI_INT, *cols, *local_nnz, MPI_INT,
+                 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        free(perm);
+        free(gadj);
+        free(nnz_counts);
+        free(nnz_displs);
+    }
+    MPI_Bcast(new_offsets, p + 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    RowDist new_dist;
+    new_dist.p = p;
+    new_dist.global_n = n;
+    new_dist.offsets = new_offsets;
+    new_dist.counts = checked_malloc(p * sizeof(int), "new counts");
+    for (int k = 0; k < p; k++) {
+        new_dist.counts[k] = new_offsets[k + 1] - new_offsets[k];
+    }
+
+    // Pack rows by destination: header (new row, old row, length), cols, vals
+    int* dest = checked_malloc(*local_n * sizeof(int), "row destinations");
+    int* send_rows = calloc(p, sizeof(int));
+    int* send_nnz = calloc(p, sizeof(int));
+    if (send_rows == NULL || send_nnz == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate redistribution counts\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < *local_n; i++) {
+        dest[i] = rowdist_owner(&new_dist, local_perm[i]);
+        send_rows[dest[i]]++;
+        send_nnz[dest[i]] += row_len[i];
+    }
+
+    int* hdr_counts = checked_malloc(p * sizeof(int), "header counts");
+    int* hdr_displs = checked_malloc(p * sizeof(int), "header displacements");
+    int* nnz_displs_send = checked_malloc(p * sizeof(int), "send displacements");
+    hdr_displs[0] = 0;
+    nnz_displs_send[0] = 0;
+    for (int k = 0; k < p; k++) {
+        hdr_counts[k] = 3 * send_rows[k];
+        if (k > 0) {
+            hdr_displs[k] = hdr_displs[k - 1] + hdr_counts[k - 1];
+            nnz_displs_send[k] = nnz_displs_send[k - 1] + send_nnz[k - 1];
+        }
+    }
+
+    int* hdr_send = checked_malloc(3 * *local_n * sizeof(int), "row headers");
+    int* cols_send = checked_malloc(*local_nnz * sizeof(int), "column buffer");
+    double* vals_send = checked_malloc(*local_nnz * sizeof(double), "value buffer");
+    int* hdr_pos = checked_malloc(p * sizeof(int), "header positions");
+    int* nnz_pos = checked_malloc(p * sizeof(int), "nonzero positions");
+    memcpy(hdr_pos, hdr_displs, p * sizeof(int));
+    memcpy(nnz_pos, nnz_displs_send, p * sizeof(int));
+    for (int i = 0; i < *local_n; i++) {
+        int k = dest[i];
+        hdr_send[hdr_pos[k]++] = local_perm[i];
+        hdr_send[hdr_pos[k]++] = row_start + i;
+        hdr_send[hdr_pos[k]++] = row_len[i];
+        for (int j = (*ptr)[i]; j < (*ptr)[i + 1]; j++) {
+            cols_send[nnz_pos[k]] = (*cols)[j];
+            vals_send[nnz_pos[k]] = (*vals)[j];
+            nnz_pos[k]++;
+        }
+    }
+    free(*ptr);
+    free(*cols);
+    free(*vals);
+
+    int* hdr_recv_counts = checked_malloc(p * sizeof(int), "header receive counts");
+    int* hdr_recv_displs = checked_malloc(p * sizeof(int), "header receive displacements");
+    int* nnz_recv_counts = checked_malloc(p * sizeof(int), "receive counts");
+    int* nnz_recv_displs = checked_malloc(p * sizeof(int), "receive displacements");
+    MPI_Alltoall(hdr_counts, 1, MPI_INT, hdr_recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Alltoall(send_nnz, 1, MPI_INT, nnz_recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    hdr_recv_displs[0] = 0;
+    nnz_recv_displs[0] = 0;
+    for (int k = 1; k < p; k++) {
+        hdr_recv_displs[k] = hdr_recv_displs[k - 1] + hdr_recv_counts[k - 1];
+        nnz_recv_displs[k] = nnz_recv_displs[k - 1] + nnz_recv_counts[k - 1];
+    }
+    int new_local_n = new_dist.counts[rank];
+    int new_local_nnz = nnz_recv_displs[p - 1] + nnz_recv_counts[p - 1];
+
+    int* hdr_recv = checked_malloc(3 * new_local_n * sizeof(int), "received headers");
+    int* cols_recv = checked_malloc(new_local_nnz * sizeof(int), "received columns");
+    double* vals_recv = checked_malloc(new_local_nnz * sizeof(double), "received values");
+    MPI_Alltoallv(hdr_send, hdr_counts, hdr_displs, MPI_INT,
+                  hdr_recv, hdr_recv_counts, hdr_recv_displs, MPI_INT, MPI_COMM_WORLD);
+    MPI_Alltoallv(cols_send, send_nnz, nnz_displs_send, MPI_INT,
+                  cols_recv, nnz_recv_counts, nnz_recv_displs, MPI_INT, MPI_COMM_WORLD);
+    MPI_Alltoallv(vals_send, send_nnz, nnz_displs_send, MPI_DOUBLE,
+                  vals_recv, nnz_recv_counts, nnz_recv_displs, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    // Assemble the new local rows in increasing new global index
+    int new_start = new_dist.offsets[rank];
+    int* new_ptr = checked_malloc((new_local_n + 1) * sizeof(int), "ptr");
+    int* src_pos = checked_malloc(new_local_n * sizeof(int), "row sources");
+    *old_rows = checked_malloc(new_local_n * sizeof(int), "original row indices");
+    int pos = 0;
+    for (int r = 0; r < new_local_n; r++) {
+        int i = hdr_recv[3 * r] - new_start;
+        (*old_rows)[i] = hdr_recv[3 * r + 1];
+        new_ptr[i + 1] = hdr_recv[3 * r + 2];
+        src_pos[i] = pos;
+        pos += hdr_recv[3 * r + 2];
+    }
+    new_ptr[0] = 0;
+    for (int i = 0; i < new_local_n; i++) new_ptr[i + 1] += new_ptr[i];
+
+    int* new_cols = checked_malloc(new_local_nnz * sizeof(int), "cols");
+    double* new_vals = checked_malloc(new_local_nnz * sizeof(double), "vals");
+    // Copy with the threaded SpMV's row split so first touch places each
+    // thread's slice on its own NUMA node, as read_csr_parallel() does
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int row_begin, row_end;
+        csr_thread_rows(new_ptr, new_local_n, tid, n_threads, &row_begin, &row_end);
+        for (int i = row_begin; i < row_end; i++) {
+            int len = new_ptr[i + 1] - new_ptr[i];
+            memcpy(new_cols + new_ptr[i], cols_recv + src_pos[i], len * sizeof(int));
+            memcpy(new_vals + new_ptr[i], vals_recv + src_pos[i], len * sizeof(double));
+        }
+    }
+
+    *ptr = new_ptr;
+    *cols = new_cols;
+    *vals = new_vals;
+    *local_n = new_local_n;
+    *local_nnz = new_local_nnz;
+    rowdist_free(dist);
+    *dist = new_dist;
+
+    double after[2];
+    local_cut_stats(*ptr, *cols, *local_n, new_start, after);
+    double band_local[2] = {before[1], after[1]};
+    double band_max[2];
+    MPI_Reduce(band_local, band_max, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Reordering complete in %.3fs: off-process nonzeros %.0f -> %.0f, "
+               "bandwidth %.0f -> %.0f\n", MPI_Wtime() - t_start,
+               off_before, off_after, band_max[0], band_max[1]);
+    }
+
+    free(row_len);
+    free(local_perm);
+    free(dest);
+    free(send_rows);
+    free(send_nnz);
+    free(hdr_counts);
+    free(hdr_displs);
+    free(nnz_displs_send);
+    free(hdr_send);
+    free(cols_send);
+    free(vals_send);
+    free(hdr_pos);
+    free(nnz_pos);
+    free(hdr_recv_counts);
+    free(hdr_recv_displs);
+    free(nnz_recv_counts);
+    free(nnz_recv_displs);
+    free(hdr_recv);
+    free(cols_recv);
+    free(vals_recv);
+    free(src_pos);
+}
+
+// Rows [*lo, *hi) shared by the blocks [a0, a1) and [b0, b1); returns 0 if none
+static int block_overlap(int a0, int a1, int b0, int b1, int* lo, int* hi) {
+    *lo = a0 > b0 ? a0 : b0;
+    *hi = a1 < b1 ? a1 : b1;
+    return *lo < *hi;
+}
+
+void repartition_matrix(int** ptr, int** cols, double** vals, int* local_n, int* local_nnz,
+                        RowDist* dist, PartitionType part, double nnz_weight, int rank) {
+    int p = dist->p;
+    int old_start = dist->offsets[rank];
+    int old_end = old_start + *local_n;
+    double t_start = MPI_Wtime();
+
+    // The local rows' slice of the global row pointer gives the new split
+    long long nnz_start = 0;
+    long long nnz_local = *local_nnz;
+    MPI_Exscan(&nnz_local, &nnz_start, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) nnz_start = 0;
+    long long* slice = checked_malloc((*local_n + 1) * sizeof(long long), "row pointer slice");
+    for (int i = 0; i <= *local_n; i++) slice[i] = nnz_start + (*ptr)[i];
+    RowDist new_dist;
+    rowdist_from_ptr_slice(&new_dist, slice, old_start, *local_n, dist->global_n, p, part,
+                           nnz_weight);
+    free(slice);
+    int new_start = new_dist.offsets[rank];
+    int new_end = new_dist.offsets[rank + 1];
+    int new_local_n = new_end - new_start;
+
+    // Row lengths first: they place the columns and values received next
+    int* row_len = checked_malloc(*local_n * sizeof(int), "row lengths");
+    for (int i = 0; i < *local_n; i++) row_len[i] = (*ptr)[i + 1] - (*ptr)[i];
+    int* new_ptr = checked_malloc((new_local_n + 1) * sizeof(int), "ptr");
+    MPI_Request* req = checked_malloc(4 * p * sizeof(MPI_Request), "requests");
+    int n_req = 0;
+    int lo, hi;
+    for (int k = 0; k < p; k++) {
+        if (k == rank) continue;
+        if (block_overlap(new_start, new_end, dist->offsets[k], dist->offsets[k + 1], &lo, &hi)) {
+            MPI_Irecv(new_ptr + 1 + lo - new_start, hi - lo, MPI_INT, k, 0, MPI_COMM_WORLD,
+                      &req[n_req++]);
+        }
+        if (block_overlap(old_start, old_end, new_dist.offsets[k], new_dist.offsets[k + 1],
+                          &lo, &hi)) {
+            MPI_Isend(row_len + lo - old_start, hi - lo, MPI_INT, k, 0, MPI_COMM_WORLD,
+                      &req[n_req++]);
+        }
+    }
+    if (block_overlap(old_start, old_end, new_start, new_end, &lo, &hi)) {
+        memcpy(new_ptr + 1 + lo - new_start, row_len + lo - old_start, (hi - lo) * sizeof(int));
+    }
+    MPI_Waitall(n_req, req, MPI_STATUSES_IGNORE);
+    new_ptr[0] = 0;
+    for (int i = 0; i < new_local_n; i++) new_ptr[i + 1] += new_ptr[i];
+    int new_local_nnz = new_ptr[new_local_n];
+
+    int* new_cols = checked_malloc(new_local_nnz * sizeof(int), "cols");
+    double* new_vals = checked_malloc(new_local_nnz * sizeof(double), "vals");
+    // First touch with the threaded SpMV's row split, as read_csr_parallel() does
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int row_begin, row_end;
+        csr_thread_rows(new_ptr, new_local_n, tid, n_threads, &row_begin, &row_end);
+        int len = new_ptr[row_end] - new_ptr[row_begin];
+        memset(new_cols + new_ptr[row_begin], 0, len * sizeof(int));
+        memset(new_vals + new_ptr[row_begin], 0, len * sizeof(double));
+    }
+
+    // Columns and values of each shared block in one message each
+    n_req = 0;
+    for (int k = 0; k < p; k++) {
+        if (k == rank) continue;
+        if (block_overlap(new_start, new_end, dist->offsets[k], dist->offsets[k + 1], &lo, &hi)) {
+            int first = new_ptr[lo - new_start];
+            int count = new_ptr[hi - new_start] - first;
+            MPI_Irecv(new_cols + first, count, MPI_INT, k, 1, MPI_COMM_WORLD, &req[n_req++]);
+            MPI_Irecv(new_vals + first, count, MPI_DOUBLE, k, 2, MPI_COMM_WORLD, &req[n_req++]);
+        }
+        if (block_overlap(old_start, old_end, new_dist.offsets[k], new_dist.offsets[k + 1],
+                          &lo, &hi)) {
+            int first = (*ptr)[lo - old_start];
+            int count = (*ptr)[hi - old_start] - first;
+            MPI_Isend(*cols + first, count, MPI_INT, k, 1, MPI_COMM_WORLD, &req[n_req++]);
+            MPI_Isend(*vals + first, count, MPI_DOUBLE, k, 2, MPI_COMM_WORLD, &req[n_req++]);
+        }
+    }
+    long long moved = *local_n;
+    if (block_overlap(old_start, old_end, new_start, new_end, &lo, &hi)) {
+        int src = (*ptr)[lo - old_start];
+        int dst = new_ptr[lo - new_start];
+        int count = (*ptr)[hi - old_start] - src;
+        memcpy(new_cols + dst, *cols + src, count * sizeof(int));
+        memcpy(new_vals + dst, *vals + src, count * sizeof(double));
+        moved -= hi - lo;
+    }
+    MPI_Waitall(n_req, req, MPI_STATUSES_IGNORE);
+
+    free(*ptr);
+    free(*cols);
+    free(*vals);
+    *ptr = new_ptr;
+    *cols = new_cols;
+    *vals = new_vals;
+    *local_n = new_local_n;
+    *local_nnz = new_local_nnz;
+    rowdist_free(dist);
+    *dist = new_dist;
+
+    long long moved_sum = 0;
+    MPI_Reduce(&moved, &moved_sum, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Repartitioning complete in %.3fs: %lld rows moved to %s blocks\n",
+               MPI_Wtime() - t_start, moved_sum, partition_type_name(part));
+    }
+    free(row_len);
+    free(req);
+}
+
+long long reorder_fingerprint(const int* old_rows, int local_n, int row_start) {
+    unsigned long long local = 0, global = 0;
+    for (int i = 0; i < local_n; i++) {
+        if (old_rows[i] == row_start + i) continue;
+        // splitmix64 finalizer of the pair; unsigned sums wrap, so any order adds up alike
+        unsigned long long h = ((unsigned long long)(row_start + i) << 32) |
+                               (unsigned int)old_rows[i];
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        local += h ^ (h >> 31);
+    }
+    MPI_Allreduce(&local, &global, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    return (long long)global;
+}
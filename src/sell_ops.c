@@ -0,0 +1,205 @@
+/**
+ * @file sell_ops.c
+ * @brief Implementation of SELL-C-sigma storage and SpMV
+ */
+
+#include "sell_ops.h"
+#include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    int len;
+    int pos;    // Position in the input row list, keeps the sort stable
+    int row;
+} SellRowKey;
+
+static int compare_row_key(const void* a, const void* b) {
+    const SellRowKey* x = (const SellRowKey*)a;
+    const SellRowKey* y = (const SellRowKey*)b;
+    if (x->len != y->len) return (x->len < y->len) - (x->len > y->len);
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+void sell_from_csr(SellMatrix* A, const int* ptr, const int* cols, const double* vals,
+                   const int* rows, int n_rows, int chunk, int sigma) {
+    if (chunk < 1 || chunk > SELL_MAX_CHUNK) {
+        fprintf(stderr, "SELL: chunk height %d out of range [1, %d]\n", chunk, SELL_MAX_CHUNK);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memset(A, 0, sizeof(SellMatrix));
+    A->chunk = chunk;
+    A->sigma = sigma;
+    A->n_rows = n_rows;
+    A->n_chunks = (n_rows + chunk - 1) / chunk;
+
+    // Sort rows by decreasing length within each sigma window
+    SellRowKey* keys = malloc((n_rows + 1) * sizeof(SellRowKey));
+    if (keys == NULL) {
+        fprintf(stderr, "SELL: Failed to allocate row keys\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int k = 0; k < n_rows; k++) {
+        int i = rows ? rows[k] : k;
+        keys[k].len = ptr[i + 1] - ptr[i];
+        keys[k].pos = k;
+        keys[k].row = i;
+        A->nnz += keys[k].len;
+    }
+    if (sigma > 1) {
+        for (int w = 0; w < n_rows; w += sigma) {
+            int count = (n_rows - w < sigma) ? n_rows - w : sigma;
+            qsort(keys + w, count, sizeof(SellRowKey), compare_row_key);
+        }
+    }
+
+    size_t n_slots = (size_t)A->n_chunks * chunk;
+    A->rows = malloc((n_slots + 1) * sizeof(int));
+    A->chunk_ptr = malloc((A->n_chunks + 1) * sizeof(int));
+    if (A->rows == NULL || A->chunk_ptr == NULL) {
+        fprintf(stderr, "SELL: Failed to allocate chunk arrays\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    A->chunk_ptr[0] = 0;
+    for (int c = 0; c < A->n_chunks; c++) {
+        int width = 0;
+        for (int s = 0; s < chunk; s++) {
+            int k = c * chunk + s;
+            if (k < n_rows) {
+                A->rows[k] = keys[k].row;
+                if (keys[k].len > width) width = keys[k].len;
+            } else {
+                A->rows[k] = -1;
+            }
+        }
+        A->chunk_ptr[c + 1] = A->chunk_ptr[c] + width * chunk;
+    }
+    free(keys);
+
+    int stored = A->chunk_ptr[A->n_chunks];
+    A->cols = malloc((stored + 1) * sizeof(int));
+    A->vals = malloc((stored + 1) * sizeof(double));
+    if (A->cols == NULL || A->vals == NULL) {
+        fprintf(stderr, "SELL: Failed to allocate %d entries\n", stored);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Fill with the kernel's chunk split so first touch matches the SpMV threads
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int c_begin, c_end;
+        csr_thread_rows(A->chunk_ptr, A->n_chunks, tid, n_threads, &c_begin, &c_end);
+        for (int c = c_begin; c < c_end; c++) {
+            int base = A->chunk_ptr[c];
+            int width = (A->chunk_ptr[c + 1] - base) / chunk;
+            for (int s = 0; s < chunk; s++) {
+                int i = A->rows[c * chunk + s];
+                int len = (i >= 0) ? ptr[i + 1] - ptr[i] : 0;
+                // Padding repeats the last column so the gather stays in cache
+                int pad_col = (len > 0) ? cols[ptr[i] + len - 1] : 0;
+                for (int k = 0; k < width; k++) {
+                    int pos = base + k * chunk + s;
+                    if (k < len) {
+                        A->cols[pos] = cols[ptr[i] + k];
+                        A->vals[pos] = vals[ptr[i] + k];
+                    } else {
+                        A->cols[pos] = pad_col;
+                        A->vals[pos] = 0.0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Row sums of one chunk into sum[0 .. chunk)
+static void sell_chunk(const SellMatrix* A, int c, const double* x_ext, double* sum) {
+    int chunk = A->chunk;
+    int base = A->chunk_ptr[c];
+    int width = (A->chunk_ptr[c + 1] - base) / chunk;
+    const int* cols = A->cols + base;
+    const double* vals = A->vals + base;
+
+#if defined(__AVX512F__)
+    if (chunk % 8 == 0) {
+        for (int g = 0; g < chunk; g += 8) {
+            __m512d acc = _mm512_setzero_pd();
+            for (int k = 0; k < width; k++) {
+                __m256i idx = _mm256_loadu_si256((const __m256i*)(cols + k * chunk + g));
+                __m512d xv = _mm512_i32gather_pd(idx, x_ext, 8);
+                acc = _mm512_fmadd_pd(_mm512_loadu_pd(vals + k * chunk + g), xv, acc);
+            }
+            _mm512_storeu_pd(sum + g, acc);
+        }
+        return;
+    }
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+    if (chunk % 4 == 0) {
+        for (int g = 0; g < chunk; g += 4) {
+            __m256d acc = _mm256_setzero_pd();
+            for (int k = 0; k < width; k++) {
+                __m128i idx = _mm_loadu_si128((const __m128i*)(cols + k * chunk + g));
+                __m256d xv = _mm256_i32gather_pd(x_ext, idx, 8);
+                acc = _mm256_fmadd_pd(_mm256_loadu_pd(vals + k * chunk + g), xv, acc);
+            }
+            _mm256_storeu_pd(sum + g, acc);
+        }
+        return;
+    }
+#endif
+    for (int s = 0; s < chunk; s++) {
+        sum[s] = 0.0;
+    }
+    for (int k = 0; k < width; k++) {
+        for (int s = 0; s < chunk; s++) {
+            sum[s] += vals[k * chunk + s] * x_ext[cols[k * chunk + s]];
+        }
+    }
+}
+
+void mat_vec_sell(const SellMatrix* A, const double* x_ext, double* y) {
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int c_begin, c_end;
+        csr_thread_rows(A->chunk_ptr, A->n_chunks, tid, n_threads, &c_begin, &c_end);
+        double sum[SELL_MAX_CHUNK];
+        for (int c = c_begin; c < c_end; c++) {
+            sell_chunk(A, c, x_ext, sum);
+            const int* slot_rows = A->rows + (size_t)c * A->chunk;
+            for (int s = 0; s < A->chunk; s++) {
+                if (slot_rows[s] >= 0) y[slot_rows[s]] = sum[s];
+            }
+        }
+    }
+}
+
+long long sell_stored_entries(const SellMatrix* A) {
+    return A->n_chunks > 0 ? A->chunk_ptr[A->n_chunks] : 0;
+}
+
+void sell_free(SellMatrix* A) {
+    free(A->rows);
+    free(A->chunk_ptr);
+    free(A->cols);
+    free(A->vals);
+    memset(A, 0, sizeof(SellMatrix));
+}
@@ -4,15 +4,284 @@
  */
 
 #include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int sparse_format_from_string(const char* name, SparseFormat* format) {
+    if (strcmp(name, "csr") == 0) {
+        *format = SPARSE_FORMAT_CSR;
+    } else if (strcmp(name, "sell") == 0) {
+        *format = SPARSE_FORMAT_SELL;
+    } else if (strcmp(name, "compact") == 0) {
+        *format = SPARSE_FORMAT_COMPACT;
+    } else if (strcmp(name, "csr_unroll") == 0) {
+        *format = SPARSE_FORMAT_CSR_UNROLL;
+    } else if (strcmp(name, "bcsr") == 0) {
+        *format = SPARSE_FORMAT_BCSR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* sparse_format_name(SparseFormat format) {
+    switch (format) {
+        case SPARSE_FORMAT_SELL:    return "sell";
+        case SPARSE_FORMAT_COMPACT: return "compact";
+        case SPARSE_FORMAT_CSR_UNROLL: return "csr_unroll";
+        case SPARSE_FORMAT_BCSR:    return "bcsr";
+        case SPARSE_FORMAT_CSR:
+        default:                    return "csr";
+    }
+}
+
+void csr_thread_rows(const int* ptr, int local_n, int tid, int n_threads,
+                     int* row_begin, int* row_end) {
+    long long nnz = ptr[local_n] - ptr[0];
+    int bounds[2];
+    for (int b = 0; b < 2; b++) {
+        long long target = ptr[0] + nnz * (tid + b) / n_threads;
+        // First row whose start offset reaches the target
+        int lo = 0, hi = local_n;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (ptr[mid] < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        bounds[b] = lo;
+    }
+    *row_begin = bounds[0];
+    *row_end = (tid == n_threads - 1) ? local_n : bounds[1];
+}
+
+int* csr_thread_bounds(const int* ptr, const int* rows, int n_rows) {
+    int n_threads = 1;
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+#endif
+    int* bounds = malloc((n_threads + 1) * sizeof(int));
+    if (bounds == NULL) {
+        fprintf(stderr, "Failed to allocate thread bounds\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    long long total = 0;
+    for (int k = 0; k < n_rows; k++) {
+        total += ptr[rows[k] + 1] - ptr[rows[k]];
+    }
+
+    // Give each thread a contiguous slice of the list with ~total/n_threads nonzeros
+    long long acc = 0;
+    int t = 1;
+    bounds[0] = 0;
+    for (int k = 0; k < n_rows && t < n_threads; k++) {
+        acc += ptr[rows[k] + 1] - ptr[rows[k]];
+        while (t < n_threads && acc >= total * t / n_threads) {
+            bounds[t++] = k + 1;
+        }
+    }
+    while (t <= n_threads) {
+        bounds[t++] = n_rows;
+    }
+    return bounds;
+}
 
 void mat_vec_csr(int* ptr, int* cols, double* vals, 
-                 double* x_global, double* y_local,
-                 int local_n, int global_n) {
+                 double* x_ext, double* y_local,
+                 int local_n) {
+    #pragma omp parallel
+    {
+        int tid = 0, n_threads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        int row_begin, row_end;
+        csr_thread_rows(ptr, local_n, tid, n_threads, &row_begin, &row_end);
+        for (int i = row_begin; i < row_end; i++) {
+            double sum = 0.0;
+            for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                sum += vals[j] * x_ext[cols[j]];
+            }
+            y_local[i] = sum;
+        }
+    }
+}
+
+void mat_vec_csr_rows(int* ptr, int* cols, double* vals,
+                      double* x_ext, double* y_local,
+                      const int* rows, int n_rows, const int* bounds) {
+#ifdef _OPENMP
+    // bounds was computed for omp_get_max_threads() threads
+    int n_parts = omp_get_max_threads();
+    #pragma omp parallel num_threads(n_parts)
+#endif
+    {
+        int begin = 0, end = n_rows;
+#ifdef _OPENMP
+        if (bounds != NULL && omp_get_num_threads() == n_parts) {
+            begin = bounds[omp_get_thread_num()];
+            end = bounds[omp_get_thread_num() + 1];
+        } else {
+            int tid = omp_get_thread_num(), n_threads = omp_get_num_threads();
+            begin = (int)((long long)n_rows * tid / n_threads);
+            end = (int)((long long)n_rows * (tid + 1) / n_threads);
+        }
+#endif
+        for (int k = begin; k < end; k++) {
+            int i = rows[k];
+            double sum = 0.0;
+            for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                sum += vals[j] * x_ext[cols[j]];
+            }
+            y_local[i] = sum;
+        }
+    }
+}
+
+double mat_vec_csr_rows_dot(int* ptr, int* cols, double* vals,
+                            double* x_ext, double* y_local,
+                            const int* rows, int n_rows, const int* bounds) {
+    double xy = 0.0;
+#ifdef _OPENMP
+    int n_parts = omp_get_max_threads();
+    #pragma omp parallel num_threads(n_parts) reduction(+:xy)
+#endif
+    {
+        int begin = 0, end = n_rows;
+#ifdef _OPENMP
+        if (bounds != NULL && omp_get_num_threads() == n_parts) {
+            begin = bounds[omp_get_thread_num()];
+            end = bounds[omp_get_thread_num() + 1];
+        } else {
+            int tid = omp_get_thread_num(), n_threads = omp_get_num_threads();
+            begin = (int)((long long)n_rows * tid / n_threads);
+            end = (int)((long long)n_rows * (tid + 1) / n_threads);
+        }
+#endif
+        for (int k = begin; k < end; k++) {
+            int i = rows[k];
+            double sum = 0.0;
+            for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                sum += vals[j] * x_ext[cols[j]];
+            }
+            y_local[i] = sum;
+            // x_ext[i] is still in cache from the diagonal entry
+            xy += x_ext[i] * sum;
+        }
+    }
+    return xy;
+}
+
+double mat_vec_csr_rows_unroll(int* ptr, int* cols, double* vals,
+                               double* x_ext, double* y_local,
+                               const int* rows, int n_rows, const int* bounds) {
+    double xy = 0.0;
+#ifdef _OPENMP
+    int n_parts = omp_get_max_threads();
+    #pragma omp parallel num_threads(n_parts) reduction(+:xy)
+#endif
+    {
+        int begin = 0, end = n_rows;
+#ifdef _OPENMP
+        if (bounds != NULL && omp_get_num_threads() == n_parts) {
+            begin = bounds[omp_get_thread_num()];
+            end = bounds[omp_get_thread_num() + 1];
+        } else {
+            int tid = omp_get_thread_num(), n_threads = omp_get_num_threads();
+            begin = (int)((long long)n_rows * tid / n_threads);
+            end = (int)((long long)n_rows * (tid + 1) / n_threads);
+        }
+#endif
+        for (int k = begin; k < end; k++) {
+            int i = rows[k];
+            double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+            int j = ptr[i];
+            for (; j + 3 < ptr[i + 1]; j += 4) {
+                s0 += vals[j] * x_ext[cols[j]];
+                s1 += vals[j + 1] * x_ext[cols[j + 1]];
+                s2 += vals[j + 2] * x_ext[cols[j + 2]];
+                s3 += vals[j + 3] * x_ext[cols[j + 3]];
+            }
+            for (; j < ptr[i + 1]; j++) {
+                s0 += vals[j] * x_ext[cols[j]];
+            }
+            double sum = (s0 + s1) + (s2 + s3);
+            y_local[i] = sum;
+            xy += x_ext[i] * sum;
+        }
+    }
+    return xy;
+}
+
+void mat_mat_csr_rows(int* ptr, int* cols, double* vals,
+                      const double* X_ext, double* Y, int k,
+                      const int* rows, int n_rows, const int* bounds) {
+#ifdef _OPENMP
+    int n_parts = omp_get_max_threads();
+    #pragma omp parallel num_threads(n_parts)
+#endif
+    {
+        int begin = 0, end = n_rows;
+#ifdef _OPENMP
+        if (bounds != NULL && omp_get_num_threads() == n_parts) {
+            begin = bounds[omp_get_thread_num()];
+            end = bounds[omp_get_thread_num() + 1];
+        } else {
+            int tid = omp_get_thread_num(), n_threads = omp_get_num_threads();
+            begin = (int)((long long)n_rows * tid / n_threads);
+            end = (int)((long long)n_rows * (tid + 1) / n_threads);
+        }
+#endif
+        for (int r = begin; r < end; r++) {
+            int i = rows[r];
+            double* y = Y + (size_t)i * k;
+            for (int c = 0; c < k; c++) {
+                y[c] = 0.0;
+            }
+            for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                double a = vals[j];
+                const double* x = X_ext + (size_t)cols[j] * k;
+                for (int c = 0; c < k; c++) {
+                    y[c] += a * x[c];
+                }
+            }
+        }
+    }
+}
+
+void csr_split_rows(int* ptr, int* cols, int local_n,
+                    int** interior_rows, int* n_interior,
+                    int** boundary_rows, int* n_boundary) {
+    *interior_rows = malloc((local_n + 1) * sizeof(int));
+    *boundary_rows = malloc((local_n + 1) * sizeof(int));
+    if (*interior_rows == NULL || *boundary_rows == NULL) {
+        fprintf(stderr, "Failed to allocate interior/boundary row lists\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    *n_interior = 0;
+    *n_boundary = 0;
     for (int i = 0; i < local_n; i++) {
-        y_local[i] = 0.0;
+        int is_boundary = 0;
         for (int j = ptr[i]; j < ptr[i + 1]; j++) {
-            y_local[i] += vals[j] * x_global[cols[j]];
+            if (cols[j] >= local_n) {
+                is_boundary = 1;
+                break;
+            }
+        }
+        if (is_boundary) {
+            (*boundary_rows)[(*n_boundary)++] = i;
+        } else {
+            (*interior_rows)[(*n_interior)++] = i;
         }
     }
 }
-
@@ -0,0 +1,192 @@
+/**
+ * @file spmv_bench.c
+ * @brief Implementation of the SpMV format microbenchmark
+ */
+
+#include "spmv_bench.h"
+#include "bcsr_ops.h"
+#include "compact_ops.h"
+#include "sell_ops.h"
+#include "sparse_ops.h"
+#include "sym_ops.h"
+#include "vector_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+// Print one result line: slowest time per SpMV, aggregate rates
+static void report(const char* label, double t_local, double flops_local,
+                   double bytes_local, int reps, int rank) {
+    double t_max;
+    double local[2] = {flops_local, bytes_local};
+    double total[2];
+    MPI_Reduce(&t_local, &t_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, total, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        double t = t_max / reps;
+        printf("  %-12s %10.3e s/SpMV %8.3f GFLOP/s %8.3f GB/s\n", label, t,
+               t > 0.0 ? total[0] / t * 1e-9 : 0.0, t > 0.0 ? total[1] / t * 1e-9 : 0.0);
+    }
+}
+
+void spmv_benchmark(int* ptr, int* cols, double* vals, int local_n, int n_ghost,
+                    int row_start, int sell_chunk, int sell_sigma, int bcsr_block,
+                    int symmetric, int reps, int rank) {
+    if (reps < 1) reps = 1;
+    long long nnz = ptr[local_n];
+    double* x = vec_alloc(local_n + n_ghost);
+    double* y = vec_alloc(local_n);
+    if (x == NULL || y == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate benchmark vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n + n_ghost; i++) {
+        x[i] = 1.0;
+    }
+    double flops = 2.0 * nnz;
+    double vec_bytes = (double)(local_n + n_ghost) * sizeof(double) +
+                       (double)local_n * sizeof(double);
+
+    if (rank == 0) printf("SpMV benchmark (%d products per format):\n", reps);
+
+    if (symmetric) {
+        // Flops of the equivalent full matrix: off-diagonal entries count twice
+        long long n_diag = 0;
+        for (int i = 0; i < local_n; i++) {
+            for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+                if (cols[j] == i) n_diag++;
+            }
+        }
+        SymMatrix S;
+        sym_setup(&S, ptr, cols, vals, local_n, n_ghost);
+        mat_vec_sym_local(&S, x, y);
+        MPI_Barrier(MPI_COMM_WORLD);
+        double t0 = MPI_Wtime();
+        for (int r = 0; r < reps; r++) {
+            mat_vec_sym_local(&S, x, y);
+            mat_vec_sym_ghost(&S, x, y);
+        }
+        double t_sym = MPI_Wtime() - t0;
+        double sym_bytes = nnz * (sizeof(double) + sizeof(int)) +
+                           (local_n + 1.0) * sizeof(int) + vec_bytes;
+        report("csr-sym", t_sym, 2.0 * (2 * nnz - n_diag), sym_bytes, reps, rank);
+        sym_free(&S);
+        free(x);
+        free(y);
+        return;
+    }
+
+    // CSR
+    mat_vec_csr(ptr, cols, vals, x, y, local_n);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t0 = MPI_Wtime();
+    for (int r = 0; r < reps; r++) {
+        mat_vec_csr(ptr, cols, vals, x, y, local_n);
+    }
+    double t_csr = MPI_Wtime() - t0;
+    double csr_bytes = nnz * (sizeof(double) + sizeof(int)) +
+                       (local_n + 1.0) * sizeof(int) + vec_bytes;
+    report("csr", t_csr, flops, csr_bytes, reps, rank);
+
+    // CSR with the unrolled row kernel
+    int* rows = malloc((local_n + 1) * sizeof(int));
+    if (rows == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate benchmark rows\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n; i++) {
+        rows[i] = i;
+    }
+    int* bounds = csr_thread_bounds(ptr, rows, local_n);
+    mat_vec_csr_rows_unroll(ptr, cols, vals, x, y, rows, local_n, bounds);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    for (int r = 0; r < reps; r++) {
+        mat_vec_csr_rows_unroll(ptr, cols, vals, x, y, rows, local_n, bounds);
+    }
+    double t_unroll = MPI_Wtime() - t0;
+    report("csr_unroll", t_unroll, flops, csr_bytes, reps, rank);
+    free(rows);
+    free(bounds);
+
+    // SELL-C-sigma
+    SellMatrix A;
+    double t_convert = MPI_Wtime();
+    sell_from_csr(&A, ptr, cols, vals, NULL, local_n, sell_chunk, sell_sigma);
+    t_convert = MPI_Wtime() - t_convert;
+    mat_vec_sell(&A, x, y);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    for (int r = 0; r < reps; r++) {
+        mat_vec_sell(&A, x, y);
+    }
+    double t_sell = MPI_Wtime() - t0;
+    long long stored = sell_stored_entries(&A);
+    double sell_bytes = stored * (sizeof(double) + sizeof(int)) +
+                        (A.n_chunks + 1.0) * sizeof(int) +
+                        (double)A.n_chunks * A.chunk * sizeof(int) + vec_bytes;
+    char label[32];
+    snprintf(label, sizeof(label), "sell-%d-%d", sell_chunk, sell_sigma);
+    report(label, t_sell, flops, sell_bytes, reps, rank);
+
+    double conv_local[3] = {(double)nnz, (double)stored, t_convert};
+    double conv[3];
+    MPI_Reduce(conv_local, conv, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&conv_local[2], &conv[2], 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("  SELL padding: %.3f stored entries per nonzero, conversion %.3fs\n",
+               conv[0] > 0.0 ? conv[1] / conv[0] : 1.0, conv[2]);
+    }
+
+    // Block CSR; processes owning fewer rows than a block report no time
+    BcsrMatrix B;
+    memset(&B, 0, sizeof(BcsrMatrix));
+    if (local_n >= bcsr_block) {
+        bcsr_from_csr(&B, ptr, cols, vals, NULL, local_n, local_n, local_n + n_ghost,
+                      bcsr_block, row_start);
+        mat_vec_bcsr(&B, x, y);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    for (int r = 0; r < reps && B.n_groups > 0; r++) {
+        mat_vec_bcsr(&B, x, y);
+    }
+    double t_bcsr = MPI_Wtime() - t0;
+    long long bcsr_stored = bcsr_stored_entries(&B);
+    double bcsr_bytes = bcsr_stored * sizeof(double) +
+                        (bcsr_stored / ((long long)bcsr_block * bcsr_block)) * sizeof(int) +
+                        (B.n_groups + 1.0) * sizeof(int) +
+                        (double)B.n_groups * bcsr_block * sizeof(int) + vec_bytes;
+    snprintf(label, sizeof(label), "bcsr-%dx%d", bcsr_block, bcsr_block);
+    report(label, t_bcsr, flops, bcsr_bytes, reps, rank);
+    double fill_local[2] = {(double)nnz, (double)bcsr_stored};
+    double fill[2];
+    MPI_Reduce(fill_local, fill, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("  BCSR fill: %.3f stored entries per nonzero\n",
+               fill[0] > 0.0 ? fill[1] / fill[0] : 1.0);
+    }
+    bcsr_free(&B);
+
+    // Compact storage, float and bf16 values
+    const char* cmp_labels[2] = {"compact-f32", "compact-bf16"};
+    CompactValueType cmp_types[2] = {COMPACT_FLOAT, COMPACT_BF16};
+    for (int k = 0; k < 2; k++) {
+        CompactMatrix C;
+        compact_from_csr(&C, ptr, cols, vals, NULL, local_n, cmp_types[k]);
+        mat_vec_compact(&C, x, y);
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        for (int r = 0; r < reps; r++) {
+            mat_vec_compact(&C, x, y);
+        }
+        double t_cmp = MPI_Wtime() - t0;
+        report(cmp_labels[k], t_cmp, flops, compact_bytes(&C) + vec_bytes, reps, rank);
+        compact_free(&C);
+    }
+
+    sell_free(&A);
+    free(x);
+    free(y);
+}
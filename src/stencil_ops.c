@@ -0,0 +1,324 @@
+/**
+ * @file stencil_ops.c
+ * @brief Implementation of the matrix-free Laplacians
+ */
+
+#include "stencil_ops.h"
+#include "profile.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define STENCIL_TAG 1003
+
+int stencil_type_from_string(const char* name, StencilType* type) {
+    if (strcmp(name, "poisson2d") == 0) {
+        *type = STENCIL_POISSON2D;
+    } else if (strcmp(name, "poisson3d") == 0) {
+        *type = STENCIL_POISSON3D;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* stencil_type_name(StencilType type) {
+    return type == STENCIL_POISSON2D ? "poisson2d" : "poisson3d";
+}
+
+static void* checked_alloc(size_t n, int rank) {
+    double* ptr = calloc(n > 0 ? n : 1, sizeof(double));
+    if (ptr == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate stencil arrays\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+static int stencil_tiles(const StencilOp* st) {
+    int tiles_x = (st->nx + st->tile_x - 1) / st->tile_x;
+    int tiles_y = (st->rows + st->tile_y - 1) / st->tile_y;
+    return tiles_x * tiles_y;
+}
+
+void stencil_setup(StencilOp* st, StencilType type, int nx, int ny, int nz,
+                   int rank, int p, RowDist* dist) {
+    memset(st, 0, sizeof(StencilOp));
+    int three_d = (type == STENCIL_POISSON3D);
+    if (!three_d) nz = 1;
+    long long n = (long long)nx * ny * nz;
+    long long n_planes = three_d ? nz : ny;
+    if (nx < 1 || ny < 1 || nz < 1 || n > INT_MAX || n_planes < p) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Invalid %s size (%lld points, %lld planes for %d processes)\n",
+                    stencil_type_name(type), n, n_planes, p);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    st->type = type;
+    st->nx = nx;
+    st->ny = ny;
+    st->nz = nz;
+    st->rank = rank;
+    st->p = p;
+    st->plane = three_d ? nx * ny : nx;
+    st->rows = three_d ? ny : 1;
+    st->n_planes = (int)n_planes;
+    st->plane_start = (int)(n_planes * rank / p);
+    st->local_planes = (int)(n_planes * (rank + 1) / p) - st->plane_start;
+    st->local_n = st->local_planes * st->plane;
+    st->n_ghost = 2 * st->plane;
+    st->zero = checked_alloc(st->plane, rank);
+
+    // Three input planes and the output of a tile fit the cache budget
+    int budget = STENCIL_TILE_BYTES / (4 * (int)sizeof(double));
+    st->tile_x = nx < budget ? nx : budget;
+    st->tile_y = budget / st->tile_x;
+    if (st->tile_y > st->rows) st->tile_y = st->rows;
+#ifdef _OPENMP
+    // Enough tiles to keep every thread busy
+    int threads = omp_get_max_threads();
+    while (stencil_tiles(st) < threads && st->tile_y > 1) st->tile_y = (st->tile_y + 1) / 2;
+    while (stencil_tiles(st) < threads && st->tile_x > 1) st->tile_x = (st->tile_x + 1) / 2;
+#endif
+
+    rowdist_from_counts(dist, st->local_n, p);
+}
+
+static double harmonic(double a, double b) {
+    return 2.0 * a * b / (a + b);
+}
+
+void stencil_set_coefficients(StencilOp* st, const double* k) {
+    int nx = st->nx, plane = st->plane, rows = st->rows, local_n = st->local_n;
+    int three_d = (st->type == STENCIL_POISSON3D);
+    if (st->diag == NULL) {
+        st->diag = checked_alloc(local_n, st->rank);
+        st->cx = checked_alloc(local_n, st->rank);
+        if (three_d) st->cy = checked_alloc(local_n, st->rank);
+        st->cz = checked_alloc((size_t)local_n + plane, st->rank);
+    }
+
+    // Coefficients of the last plane below the slab and the first plane above it
+    int has_lo = st->rank > 0, has_hi = st->rank < st->p - 1;
+    int lo_rank = has_lo ? st->rank - 1 : MPI_PROC_NULL;
+    int hi_rank = has_hi ? st->rank + 1 : MPI_PROC_NULL;
+    double* k_lo = checked_alloc(plane, st->rank);
+    double* k_hi = checked_alloc(plane, st->rank);
+    MPI_Sendrecv(k, plane, MPI_DOUBLE, lo_rank, STENCIL_TAG,
+                 k_hi, plane, MPI_DOUBLE, hi_rank, STENCIL_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(k + (size_t)(st->local_planes - 1) * plane, plane, MPI_DOUBLE, hi_rank,
+                 STENCIL_TAG, k_lo, plane, MPI_DOUBLE, lo_rank, STENCIL_TAG, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+
+    // A face on the boundary couples with the point's own coefficient
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < local_n; j++) {
+        int x = j % nx, y = (j / nx) % rows, kk = j / plane;
+        double kj = k[j];
+        double sum = 0.0;
+
+        double f = x > 0 ? harmonic(kj, k[j - 1]) : kj;
+        st->cx[j] = x > 0 ? f : 0.0;
+        sum += f + (x < nx - 1 ? harmonic(kj, k[j + 1]) : kj);
+
+        if (three_d) {
+            f = y > 0 ? harmonic(kj, k[j - nx]) : kj;
+            st->cy[j] = y > 0 ? f : 0.0;
+            sum += f + (y < rows - 1 ? harmonic(kj, k[j + nx]) : kj);
+        }
+
+        int below = kk > 0 || has_lo;
+        f = below ? harmonic(kj, kk > 0 ? k[j - plane] : k_lo[j]) : kj;
+        st->cz[j] = below ? f : 0.0;
+        sum += f;
+        int above = kk < st->local_planes - 1 || has_hi;
+        f = above ? harmonic(kj, kk < st->local_planes - 1 ? k[j + plane] : k_hi[j - kk * plane])
+                  : kj;
+        if (kk == st->local_planes - 1) st->cz[j + plane] = above ? f : 0.0;
+        sum += f;
+
+        st->diag[j] = sum;
+    }
+    free(k_lo);
+    free(k_hi);
+}
+
+void stencil_fill_layers(const StencilOp* st, double contrast, double* k) {
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < st->local_n; j++) {
+        int layer = (int)((long long)(j % st->nx) * STENCIL_N_LAYERS / st->nx);
+        k[j] = (layer % 2 == 1) ? contrast : 1.0;
+    }
+}
+
+/**
+ * @brief Constant coefficients on x in [x0, x1) of one row
+ *
+ * c is the row of x, ym/yp the rows at y - 1 and y + 1, zm/zp the rows
+ * in the previous and next plane (zeros beyond the boundary).
+ */
+static void row_constant(double diag, const double* c, const double* ym, const double* yp,
+                         const double* zm, const double* zp, double* y, int nx, int x0, int x1) {
+    int lo = x0 > 0 ? x0 : 1;
+    int hi = x1 < nx - 1 ? x1 : nx - 1;
+    if (x0 == 0) {
+        y[0] = diag * c[0] - ym[0] - yp[0] - zm[0] - zp[0] - (nx > 1 ? c[1] : 0.0);
+    }
+    #pragma omp simd
+    for (int i = lo; i < hi; i++) {
+        y[i] = diag * c[i] - c[i - 1] - c[i + 1] - ym[i] - yp[i] - zm[i] - zp[i];
+    }
+    if (x1 == nx && nx > 1) {
+        int i = nx - 1;
+        y[i] = diag * c[i] - c[i - 1] - ym[i] - yp[i] - zm[i] - zp[i];
+    }
+}
+
+/**
+ * @brief Variable coefficients on x in [x0, x1) of one row
+ *
+ * As row_constant(), with the couplings of the row's points: d, cx, cy
+ * and cz, and cyp/czp for the y + 1 and next plane neighbors.
+ */
+static void row_variable(const double* d, const double* cx, const double* cy, const double* cyp,
+                         const double* cz, const double* czp, const double* c,
+                         const double* ym, const double* yp, const double* zm, const double* zp,
+                         double* y, int nx, int x0, int x1) {
+    int lo = x0 > 0 ? x0 : 1;
+    int hi = x1 < nx - 1 ? x1 : nx - 1;
+    if (x0 == 0) {
+        y[0] = d[0] * c[0] - cy[0] * ym[0] - cyp[0] * yp[0] - cz[0] * zm[0] - czp[0] * zp[0] -
+               (nx > 1 ? cx[1] * c[1] : 0.0);
+    }
+    #pragma omp simd
+    for (int i = lo; i < hi; i++) {
+        y[i] = d[i] * c[i] - cx[i] * c[i - 1] - cx[i + 1] * c[i + 1] - cy[i] * ym[i] -
+               cyp[i] * yp[i] - cz[i] * zm[i] - czp[i] * zp[i];
+    }
+    if (x1 == nx && nx > 1) {
+        int i = nx - 1;
+        y[i] = d[i] * c[i] - cx[i] * c[i - 1] - cy[i] * ym[i] - cyp[i] * yp[i] -
+               cz[i] * zm[i] - czp[i] * zp[i];
+    }
+}
+
+/**
+ * @brief y = A x on planes [k0, k1) of the slab
+ *
+ * Each tile runs through the planes in order, so the planes it reads
+ * were loaded into cache by the previous one or two planes.
+ */
+static void stencil_sweep(const StencilOp* st, const double* x, const double* lo,
+                          const double* hi, double* y, int k0, int k1) {
+    int nx = st->nx, plane = st->plane, rows = st->rows;
+    int tiles_x = (nx + st->tile_x - 1) / st->tile_x;
+    int n_tiles = stencil_tiles(st);
+    double c0 = (st->type == STENCIL_POISSON3D) ? 6.0 : 4.0;
+    const double* zero = st->zero;
+
+    #pragma omp parallel for schedule(static)
+    for (int t = 0; t < n_tiles; t++) {
+        int x0 = (t % tiles_x) * st->tile_x;
+        int x1 = x0 + st->tile_x < nx ? x0 + st->tile_x : nx;
+        int y0 = (t / tiles_x) * st->tile_y;
+        int y1 = y0 + st->tile_y < rows ? y0 + st->tile_y : rows;
+        for (int k = k0; k < k1; k++) {
+            size_t base = (size_t)k * plane;
+            const double* xc = x + base;
+            const double* zm = k > 0 ? xc - plane : lo;
+            const double* zp = k < st->local_planes - 1 ? xc + plane : hi;
+            for (int r = y0; r < y1; r++) {
+                size_t o = (size_t)r * nx;
+                const double* ym = r > 0 ? xc + o - nx : zero;
+                const double* yp = r < rows - 1 ? xc + o + nx : zero;
+                if (st->diag == NULL) {
+                    row_constant(c0, xc + o, ym, yp, zm + o, zp + o, y + base + o, nx, x0, x1);
+                } else {
+                    size_t j = base + o;
+                    const double* cy = st->cy != NULL ? st->cy + j : zero;
+                    const double* cyp = (st->cy != NULL && r < rows - 1) ? cy + nx : zero;
+                    row_variable(st->diag + j, st->cx + j, cy, cyp, st->cz + j,
+                                 st->cz + j + plane, xc + o, ym, yp, zm + o, zp + o,
+                                 y + j, nx, x0, x1);
+                }
+            }
+        }
+    }
+}
+
+void stencil_apply(void* data, double* x_ext, double* y) {
+    StencilOp* st = data;
+    int plane = st->plane, nl = st->local_planes;
+    int has_lo = st->rank > 0, has_hi = st->rank < st->p - 1;
+    double* lo_ghost = x_ext + st->local_n;
+    double* hi_ghost = lo_ghost + plane;
+
+    prof_begin(PROF_HALO_BEGIN);
+    int n_req = 0;
+    if (has_lo) {
+        MPI_Irecv(lo_ghost, plane, MPI_DOUBLE, st->rank - 1, STENCIL_TAG, MPI_COMM_WORLD,
+                  &st->reqs[n_req++]);
+        MPI_Isend(x_ext, plane, MPI_DOUBLE, st->rank - 1, STENCIL_TAG, MPI_COMM_WORLD,
+                  &st->reqs[n_req++]);
+    }
+    if (has_hi) {
+        MPI_Irecv(hi_ghost, plane, MPI_DOUBLE, st->rank + 1, STENCIL_TAG, MPI_COMM_WORLD,
+                  &st->reqs[n_req++]);
+        MPI_Isend(x_ext + (size_t)(nl - 1) * plane, plane, MPI_DOUBLE, st->rank + 1,
+                  STENCIL_TAG, MPI_COMM_WORLD, &st->reqs[n_req++]);
+    }
+    prof_end(PROF_HALO_BEGIN);
+
+    const double* lo = has_lo ? lo_ghost : st->zero;
+    const double* hi = has_hi ? hi_ghost : st->zero;
+    // Planes away from the slab boundary while the ghost planes travel
+    if (nl > 2) stencil_sweep(st, x_ext, lo, hi, y, 1, nl - 1);
+
+    prof_begin(PROF_HALO_END);
+    MPI_Waitall(n_req, st->reqs, MPI_STATUSES_IGNORE);
+    prof_end(PROF_HALO_END);
+
+    stencil_sweep(st, x_ext, lo, hi, y, 0, 1);
+    if (nl > 1) stencil_sweep(st, x_ext, lo, hi, y, nl - 1, nl);
+}
+
+void stencil_diagonal(void* data, double* diag) {
+    StencilOp* st = data;
+    if (st->diag != NULL) {
+        memcpy(diag, st->diag, st->local_n * sizeof(double));
+        return;
+    }
+    double c0 = (st->type == STENCIL_POISSON3D) ? 6.0 : 4.0;
+    for (int i = 0; i < st->local_n; i++) {
+        diag[i] = c0;
+    }
+}
+
+void stencil_linear_op(StencilOp* st, CGLinearOp* op) {
+    op->data = st;
+    op->local_n = st->local_n;
+    op->n_ghost = st->n_ghost;
+    op->apply = stencil_apply;
+    op->diagonal = stencil_diagonal;
+}
+
+long long stencil_nnz(const StencilOp* st) {
+    long long nx = st->nx, ny = st->ny, nz = st->nz;
+    long long couplings = (nx - 1) * ny * nz + nx * (ny - 1) * nz;
+    if (st->type == STENCIL_POISSON3D) couplings += nx * ny * (nz - 1);
+    return nx * ny * nz + 2 * couplings;
+}
+
+void stencil_free(StencilOp* st) {
+    free(st->zero);
+    free(st->diag);
+    free(st->cx);
+    free(st->cy);
+    free(st->cz);
+    memset(st, 0, sizeof(StencilOp));
+}
@@ -0,0 +1,263 @@
+/**
+ * @file sym_ops.c
+ * @brief Implementation of the symmetric (upper-triangle) SpMV
+ */
+
+#include "sym_ops.h"
+#include "sparse_ops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void csr_keep_upper(int* ptr, int* cols, double* vals, int local_n, int* local_nnz,
+                    int row_start) {
+    int pos = 0;
+    int start = ptr[0];
+    for (int i = 0; i < local_n; i++) {
+        int end = ptr[i + 1];
+        for (int j = start; j < end; j++) {
+            if (cols[j] >= row_start + i) {
+                cols[pos] = cols[j];
+                vals[pos] = vals[j];
+                pos++;
+            }
+        }
+        start = end;
+        ptr[i + 1] = pos;
+    }
+    ptr[0] = 0;
+    *local_nnz = pos;
+}
+
+void sym_setup(SymMatrix* S, int* ptr, int* cols, double* vals, int local_n, int n_ghost) {
+    memset(S, 0, sizeof(SymMatrix));
+    S->local_n = local_n;
+    S->n_ghost = n_ghost;
+    S->ptr = ptr;
+    S->cols = cols;
+    S->vals = vals;
+    S->n_threads = 1;
+#ifdef _OPENMP
+    S->n_threads = omp_get_max_threads();
+#endif
+    int n_threads = S->n_threads;
+    int ext_n = local_n + n_ghost;
+
+    S->row_bounds = malloc((n_threads + 1) * sizeof(int));
+    S->bufs = malloc(n_threads * sizeof(double*));
+    S->buf_hi = malloc(n_threads * sizeof(int));
+    S->y_ghost = malloc((n_ghost + 1) * sizeof(double));
+    if (S->row_bounds == NULL || S->bufs == NULL || S->buf_hi == NULL || S->y_ghost == NULL) {
+        fprintf(stderr, "Failed to allocate symmetric SpMV state\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    // Sort each row by column, so the diagonal comes first and ghost
+    // columns (>= local_n) last; the kernel relies on this order
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < local_n; i++) {
+        for (int j = ptr[i] + 1; j < ptr[i + 1]; j++) {
+            int c = cols[j];
+            double v = vals[j];
+            int k = j;
+            while (k > ptr[i] && cols[k - 1] > c) {
+                cols[k] = cols[k - 1];
+                vals[k] = vals[k - 1];
+                k--;
+            }
+            cols[k] = c;
+            vals[k] = v;
+        }
+    }
+
+    for (int t = 0; t < n_threads; t++) {
+        int row_begin, row_end;
+        csr_thread_rows(ptr, local_n, t, n_threads, &row_begin, &row_end);
+        S->row_bounds[t] = row_begin;
+        S->row_bounds[t + 1] = row_end;
+    }
+
+    // Each buffer is allocated and zeroed by the thread that will use it
+    int failed = 0;
+    #pragma omp parallel num_threads(n_threads) reduction(+:failed)
+    {
+        int tid = 0, team = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        team = omp_get_num_threads();
+#endif
+        for (int t = tid; t < n_threads; t += team) {
+            int len = ext_n - S->row_bounds[t + 1];
+            S->bufs[t] = calloc(len + 1, sizeof(double));
+            if (S->bufs[t] == NULL) failed++;
+            S->buf_hi[t] = S->row_bounds[t + 1];
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "Failed to allocate symmetric SpMV buffers\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int* interior_rows;
+    int n_interior;
+    csr_split_rows(ptr, cols, local_n, &interior_rows, &n_interior,
+                   &S->boundary_rows, &S->n_boundary);
+    free(interior_rows);
+}
+
+void mat_vec_sym_local(SymMatrix* S, const double* x_ext, double* y) {
+    int local_n = S->local_n;
+    int n_ghost = S->n_ghost;
+    int n_threads = S->n_threads;
+    const int* ptr = S->ptr;
+    const int* cols = S->cols;
+    const double* vals = S->vals;
+
+    #pragma omp parallel num_threads(n_threads)
+    {
+        int tid = 0, team = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        team = omp_get_num_threads();
+#endif
+        // Rows [rb, re) of a slot are written directly only by that slot;
+        // transposed entries always have column > row, so writes past re
+        // go to the slot's buffer
+        for (int t = tid; t < n_threads; t += team) {
+            int rb = S->row_bounds[t], re = S->row_bounds[t + 1];
+            double* buf = S->bufs[t];
+            int hi = re;
+            for (int i = rb; i < re; i++) {
+                y[i] = 0.0;
+            }
+            for (int i = rb; i < re; i++) {
+                // Rows are sorted: diagonal, owned columns, ghost columns
+                double xi = x_ext[i];
+                double sum = 0.0;
+                int j = ptr[i];
+                int end = ptr[i + 1];
+                if (j < end && cols[j] == i) {
+                    sum = vals[j] * xi;
+                    j++;
+                }
+                for (; j < end && cols[j] < re; j++) {
+                    sum += vals[j] * x_ext[cols[j]];
+                    y[cols[j]] += vals[j] * xi;
+                }
+                for (; j < end && cols[j] < local_n; j++) {
+                    sum += vals[j] * x_ext[cols[j]];
+                    buf[cols[j] - re] += vals[j] * xi;
+                }
+                for (; j < end; j++) {
+                    buf[cols[j] - re] += vals[j] * xi;
+                }
+                if (end > ptr[i] && cols[end - 1] >= hi) hi = cols[end - 1] + 1;
+                y[i] += sum;
+            }
+            S->buf_hi[t] = hi;
+        }
+
+        #pragma omp barrier
+
+        // Each slot sums the buffers of lower slots over its own rows, and
+        // an even share of the ghost rows, then clears what it read
+        for (int t = tid; t < n_threads; t += team) {
+            int rb = S->row_bounds[t], re = S->row_bounds[t + 1];
+            for (int u = 0; u < t; u++) {
+                int u_end = S->row_bounds[u + 1];
+                int lo = rb > u_end ? rb : u_end;
+                int up = re < S->buf_hi[u] ? re : S->buf_hi[u];
+                double* buf = S->bufs[u];
+                for (int c = lo; c < up; c++) {
+                    y[c] += buf[c - u_end];
+                    buf[c - u_end] = 0.0;
+                }
+            }
+            int gb = local_n + (int)((long long)n_ghost * t / n_threads);
+            int ge = local_n + (int)((long long)n_ghost * (t + 1) / n_threads);
+            for (int c = gb; c < ge; c++) {
+                S->y_ghost[c - local_n] = 0.0;
+            }
+            for (int u = 0; u < n_threads; u++) {
+                int u_end = S->row_bounds[u + 1];
+                int up = ge < S->buf_hi[u] ? ge : S->buf_hi[u];
+                double* buf = S->bufs[u];
+                for (int c = gb; c < up; c++) {
+                    S->y_ghost[c - local_n] += buf[c - u_end];
+                    buf[c - u_end] = 0.0;
+                }
+            }
+        }
+    }
+}
+
+void mat_vec_sym_ghost(const SymMatrix* S, const double* x_ext, double* y) {
+    int local_n = S->local_n;
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < S->n_boundary; k++) {
+        int i = S->boundary_rows[k];
+        double sum = 0.0;
+        for (int j = S->ptr[i + 1] - 1; j >= S->ptr[i] && S->cols[j] >= local_n; j--) {
+            sum += S->vals[j] * x_ext[S->cols[j]];
+        }
+        y[i] += sum;
+    }
+}
+
+void sym_expand_local(const SymMatrix* S, int** ptr, int** cols, double** vals) {
+    int n = S->local_n;
+    int* count = calloc(n + 1, sizeof(int));
+    if (count == NULL) {
+        fprintf(stderr, "Failed to allocate expanded block\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = S->ptr[i]; j < S->ptr[i + 1]; j++) {
+            int c = S->cols[j];
+            if (c >= n) continue;
+            count[i + 1]++;
+            if (c != i) count[c + 1]++;
+        }
+    }
+    for (int i = 0; i < n; i++) count[i + 1] += count[i];
+
+    *ptr = count;
+    *cols = malloc((count[n] + 1) * sizeof(int));
+    *vals = malloc((count[n] + 1) * sizeof(double));
+    int* pos = malloc((n + 1) * sizeof(int));
+    if (*cols == NULL || *vals == NULL || pos == NULL) {
+        fprintf(stderr, "Failed to allocate expanded block\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memcpy(pos, count, n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        for (int j = S->ptr[i]; j < S->ptr[i + 1]; j++) {
+            int c = S->cols[j];
+            if (c >= n) continue;
+            (*cols)[pos[i]] = c;
+            (*vals)[pos[i]++] = S->vals[j];
+            if (c != i) {
+                (*cols)[pos[c]] = i;
+                (*vals)[pos[c]++] = S->vals[j];
+            }
+        }
+    }
+    free(pos);
+}
+
+void sym_free(SymMatrix* S) {
+    if (S->bufs != NULL) {
+        for (int t = 0; t < S->n_threads; t++) {
+            free(S->bufs[t]);
+        }
+    }
+    free(S->bufs);
+    free(S->row_bounds);
+    free(S->buf_hi);
+    free(S->boundary_rows);
+    free(S->y_ghost);
+    memset(S, 0, sizeof(SymMatrix));
+}
@@ -4,63 +4,384 @@
  */
 
 #include "vector_ops.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <mpi.h>
 
+double* vec_alloc(int n) {
+    // aligned_alloc() needs a size that is a multiple of the alignment
+    size_t bytes = (size_t)(n > 0 ? n : 1) * sizeof(double);
+    bytes = (bytes + VEC_ALIGN - 1) / VEC_ALIGN * VEC_ALIGN;
+    double* v = aligned_alloc(VEC_ALIGN, bytes);
+    if (v == NULL) return NULL;
+    // First touch with the same static schedule the vector loops use
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        v[i] = 0.0;
+    }
+    return v;
+}
+
 double dot(double* u, double* v, int n) {
+    prof_begin(PROF_DOT);
     double sum = 0.0;
+    #pragma omp parallel for simd reduction(+:sum) schedule(static)
     for (int i = 0; i < n; i++) {
         sum += u[i] * v[i];
     }
+    prof_end(PROF_DOT);
+    return sum;
+}
+
+double axpy2_dot(double* x, double* r, const double* d, const double* q,
+                 double alpha, int n) {
+    prof_begin(PROF_UPDATE);
+    double sum = 0.0;
+    // One pass over x, r, d and q instead of an update and a separate dot
+    #pragma omp parallel for simd reduction(+:sum) schedule(static)
+    for (int i = 0; i < n; i++) {
+        x[i] += alpha * d[i];
+        double ri = r[i] - alpha * q[i];
+        r[i] = ri;
+        sum += ri * ri;
+    }
+    prof_end(PROF_UPDATE);
     return sum;
 }
 
+void xpby(double* y, const double* x, double beta, int n) {
+    prof_begin(PROF_UPDATE);
+    #pragma omp parallel for simd schedule(static)
+    for (int i = 0; i < n; i++) {
+        y[i] = x[i] + beta * y[i];
+    }
+    prof_end(PROF_UPDATE);
+}
+
 double dot_allreduce(double local) {
     double global;
+    prof_begin(PROF_REDUCE);
     MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    prof_end(PROF_REDUCE);
     return global;
 }
 
-double* read_vector(const char* filename, int n, int rank) {
-    double* vec = malloc(n * sizeof(double));
-    if (vec == NULL) {
-        fprintf(stderr, "Rank %d: Failed to allocate vector\n", rank);
-        return NULL;
+void allreduce_sum(double* local, double* global, int count) {
+    prof_begin(PROF_REDUCE);
+    MPI_Allreduce(local, global, count, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    prof_end(PROF_REDUCE);
+}
+
+// Number of values on the first line of f; rewinds f
+static int count_columns(FILE* f) {
+    int count = 0, in_token = 0, c;
+    while ((c = fgetc(f)) != EOF && c != '\n') {
+        int space = (c == ' ' || c == '\t' || c == '\r');
+        if (!space && !in_token) count++;
+        in_token = !space;
+    }
+    rewind(f);
+    return count;
+}
+
+int vec_file_is_binary(const char* filename) {
+    size_t len = strlen(filename);
+    return len >= 4 && strcmp(filename + len - 4, ".bin") == 0;
+}
+
+// File row of each local row: rows[i], or row_start + i
+static int* local_file_rows(const int* rows, int local_n, int row_start) {
+    int* file_rows = malloc((local_n + 1) * sizeof(int));
+    if (file_rows == NULL) {
+        fprintf(stderr, "Failed to allocate vector row list\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n; i++) {
+        file_rows[i] = rows ? rows[i] : row_start + i;
+    }
+    return file_rows;
+}
+
+/**
+ * @brief Collect the file rows of all processes on rank 0, in rank order
+ *
+ * Used by the text path, where rank 0 reads or writes the whole file and
+ * scatters or gathers rows. counts and displs are allocated on rank 0.
+ */
+static int* gather_file_rows(const int* rows, int local_n, int row_start, int global_n,
+                             int** counts, int** displs, int rank) {
+    int p;
+    MPI_Comm_size(MPI_COMM_WORLD, &p);
+    int* file_rows = local_file_rows(rows, local_n, row_start);
+    int* all_rows = NULL;
+    *counts = NULL;
+    *displs = NULL;
+    if (rank == 0) {
+        all_rows = malloc(((size_t)global_n + 1) * sizeof(int));
+        *counts = malloc(p * sizeof(int));
+        *displs = malloc(p * sizeof(int));
+        if (all_rows == NULL || *counts == NULL || *displs == NULL) {
+            fprintf(stderr, "Rank 0: Failed to allocate vector row lists\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Gather(&local_n, 1, MPI_INT, *counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        (*displs)[0] = 0;
+        for (int r = 1; r < p; r++) {
+            (*displs)[r] = (*displs)[r - 1] + (*counts)[r - 1];
+        }
+    }
+    MPI_Gatherv(file_rows, local_n, MPI_INT, all_rows, *counts, *displs, MPI_INT,
+                0, MPI_COMM_WORLD);
+    free(file_rows);
+    return all_rows;
+}
+
+// File row of a local row, sorted by file row for a file view
+typedef struct {
+    int row;
+    int index;
+} RowIndex;
+
+static int compare_row_index(const void* a, const void* b) {
+    const RowIndex* x = a;
+    const RowIndex* y = b;
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+/**
+ * @brief File view selecting the given rows of a binary vector file
+ *
+ * Sorts the rows (file views need increasing offsets) and returns in
+ * order[] the local row stored at each position of the view.
+ */
+static void set_row_view(MPI_File fh, const int* rows, int local_n, MPI_Datatype row_type,
+                         int* order) {
+    int* disp = malloc((local_n + 1) * sizeof(int));
+    RowIndex* sorted = malloc((local_n + 1) * sizeof(RowIndex));
+    if (disp == NULL || sorted == NULL) {
+        fprintf(stderr, "Failed to allocate vector file view\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n; i++) {
+        sorted[i].row = rows[i];
+        sorted[i].index = i;
     }
-    
+    // Rows come from a permutation, so the keys are distinct
+    qsort(sorted, local_n, sizeof(RowIndex), compare_row_index);
+    for (int i = 0; i < local_n; i++) {
+        order[i] = sorted[i].index;
+        disp[i] = sorted[i].row;
+    }
+    free(sorted);
+    MPI_Datatype file_type;
+    MPI_Type_create_indexed_block(local_n, 1, disp, row_type, &file_type);
+    MPI_Type_commit(&file_type);
+    MPI_File_set_view(fh, VEC_BINARY_HEADER_BYTES, MPI_DOUBLE, file_type, "native",
+                      MPI_INFO_NULL);
+    MPI_Type_free(&file_type);
+    free(disp);
+}
+
+double* read_vectors(const char* filename, int global_n, int local_n, int row_start,
+                     const int* rows, int* k, int rank) {
+    // Rank 0 detects the format; a text file is read whole on rank 0
+    int info[2] = {-1, 0};      // {format: -1 error, 0 text, 1 binary; columns}
+    double* full = NULL;
     if (rank == 0) {
-        FILE* f = fopen(filename, "r");
+        FILE* f = fopen(filename, "rb");
         if (f == NULL) {
             fprintf(stderr, "Rank 0: Failed to open %s\n", filename);
-            free(vec);
-            return NULL;
+        } else {
+            char magic[8] = {0};
+            long long dims[2];
+            if (fread(magic, 1, 8, f) == 8 && memcmp(magic, VEC_BINARY_MAGIC, 8) == 0) {
+                if (fread(dims, sizeof(long long), 2, f) != 2 || dims[0] != global_n ||
+                    dims[1] < 1 || dims[1] > INT_MAX) {
+                    fprintf(stderr, "Rank 0: %s does not hold %d rows\n", filename, global_n);
+                } else {
+                    info[0] = 1;
+                    info[1] = (int)dims[1];
+                }
+            } else {
+                rewind(f);
+                int cols = count_columns(f);
+                full = malloc(((size_t)global_n * cols + 1) * sizeof(double));
+                if (cols == 0 || full == NULL) {
+                    fprintf(stderr, "Rank 0: Failed to read the first line of %s\n", filename);
+                    cols = 0;
+                }
+                for (size_t i = 0; cols > 0 && i < (size_t)global_n * cols; i++) {
+                    if (fscanf(f, "%lf", &full[i]) != 1) {
+                        fprintf(stderr, "Rank 0: Failed to read %d rows of %d values from %s\n",
+                                global_n, cols, filename);
+                        cols = 0;
+                    }
+                }
+                if (cols > 0) {
+                    info[0] = 0;
+                    info[1] = cols;
+                }
+            }
+            fclose(f);
         }
-        for (int i = 0; i < n; i++) {
-            if (fscanf(f, "%lf", &vec[i]) != 1) {
-                fprintf(stderr, "Rank 0: Failed to read %d values from %s\n", n, filename);
-                free(vec);
-                fclose(f);
-                return NULL;
+    }
+    MPI_Bcast(info, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    if (info[0] < 0) {
+        free(full);
+        return NULL;
+    }
+    int cols = info[1];
+    double* X = vec_alloc(local_n * cols);
+    if (X == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(cols, MPI_DOUBLE, &row_type);
+    MPI_Type_commit(&row_type);
+
+    if (info[0] == 1) {
+        // Each process reads only its own rows, directly into X when contiguous
+        MPI_File fh;
+        MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+        if (rows == NULL) {
+            MPI_Offset offset = VEC_BINARY_HEADER_BYTES +
+                                (MPI_Offset)row_start * cols * sizeof(double);
+            MPI_File_read_at_all(fh, offset, X, local_n, row_type, MPI_STATUS_IGNORE);
+        } else {
+            int* order = malloc((local_n + 1) * sizeof(int));
+            double* buf = malloc(((size_t)local_n * cols + 1) * sizeof(double));
+            if (order == NULL || buf == NULL) {
+                fprintf(stderr, "Rank %d: Failed to allocate vector read buffer\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
             }
+            set_row_view(fh, rows, local_n, row_type, order);
+            MPI_File_read_all(fh, buf, local_n, row_type, MPI_STATUS_IGNORE);
+            for (int i = 0; i < local_n; i++) {
+                memcpy(X + (size_t)order[i] * cols, buf + (size_t)i * cols,
+                       cols * sizeof(double));
+            }
+            free(order);
+            free(buf);
         }
-        fclose(f);
+        MPI_File_close(&fh);
+    } else {
+        // Text fallback: rank 0 scatters the rows each process owns
+        int* counts;
+        int* displs;
+        int* all_rows = gather_file_rows(rows, local_n, row_start, global_n,
+                                         &counts, &displs, rank);
+        double* send = NULL;
+        if (rank == 0) {
+            send = malloc(((size_t)global_n * cols + 1) * sizeof(double));
+            if (send == NULL) {
+                fprintf(stderr, "Rank 0: Failed to allocate vector scatter buffer\n");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            for (int j = 0; j < global_n; j++) {
+                memcpy(send + (size_t)j * cols, full + (size_t)all_rows[j] * cols,
+                       cols * sizeof(double));
+            }
+        }
+        MPI_Scatterv(send, counts, displs, row_type, X, local_n, row_type, 0, MPI_COMM_WORLD);
+        free(send);
+        free(all_rows);
+        free(counts);
+        free(displs);
     }
-    MPI_Bcast(vec, n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    return vec;
+    MPI_Type_free(&row_type);
+    free(full);
+    *k = cols;
+    return X;
 }
 
-void write_vector(const char* filename, double* x, int n, int rank) {
+void write_vectors(const char* filename, const double* X, int global_n, int local_n,
+                   int row_start, const int* rows, int k, int rank) {
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(k, MPI_DOUBLE, &row_type);
+    MPI_Type_commit(&row_type);
+
+    if (vec_file_is_binary(filename)) {
+        MPI_File fh;
+        int err = MPI_File_open(MPI_COMM_WORLD, (char*)filename,
+                                MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
+        if (err != MPI_SUCCESS) {
+            if (rank == 0) fprintf(stderr, "Rank 0: Failed to open %s for writing\n", filename);
+            MPI_Type_free(&row_type);
+            return;
+        }
+        MPI_File_set_size(fh, 0);
+        char header[VEC_BINARY_HEADER_BYTES];
+        long long dims[2] = {global_n, k};
+        memcpy(header, VEC_BINARY_MAGIC, 8);
+        memcpy(header + 8, dims, sizeof(dims));
+        MPI_File_write_at_all(fh, 0, header, rank == 0 ? VEC_BINARY_HEADER_BYTES : 0,
+                              MPI_BYTE, MPI_STATUS_IGNORE);
+        if (rows == NULL) {
+            MPI_Offset offset = VEC_BINARY_HEADER_BYTES +
+                                (MPI_Offset)row_start * k * sizeof(double);
+            MPI_File_write_at_all(fh, offset, X, local_n, row_type, MPI_STATUS_IGNORE);
+        } else {
+            int* order = malloc((local_n + 1) * sizeof(int));
+            double* buf = malloc(((size_t)local_n * k + 1) * sizeof(double));
+            if (order == NULL || buf == NULL) {
+                fprintf(stderr, "Rank %d: Failed to allocate vector write buffer\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            set_row_view(fh, rows, local_n, row_type, order);
+            for (int i = 0; i < local_n; i++) {
+                memcpy(buf + (size_t)i * k, X + (size_t)order[i] * k, k * sizeof(double));
+            }
+            MPI_File_write_all(fh, buf, local_n, row_type, MPI_STATUS_IGNORE);
+            free(order);
+            free(buf);
+        }
+        MPI_File_close(&fh);
+        MPI_Type_free(&row_type);
+        return;
+    }
+
+    // Text: gather to rank 0 in file order, one row per line
+    int* counts;
+    int* displs;
+    int* all_rows = gather_file_rows(rows, local_n, row_start, global_n, &counts, &displs, rank);
+    double* recv = NULL;
+    double* full = NULL;
+    if (rank == 0) {
+        recv = malloc(((size_t)global_n * k + 1) * sizeof(double));
+        full = malloc(((size_t)global_n * k + 1) * sizeof(double));
+        if (recv == NULL || full == NULL) {
+            fprintf(stderr, "Rank 0: Failed to allocate vector gather buffer\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Gatherv(X, local_n, row_type, recv, counts, displs, row_type, 0, MPI_COMM_WORLD);
+    MPI_Type_free(&row_type);
     if (rank == 0) {
+        for (int j = 0; j < global_n; j++) {
+            memcpy(full + (size_t)all_rows[j] * k, recv + (size_t)j * k, k * sizeof(double));
+        }
         FILE* f = fopen(filename, "w");
         if (f == NULL) {
             fprintf(stderr, "Rank 0: Failed to open %s for writing\n", filename);
-            return;
-        }
-        for (int i = 0; i < n; i++) {
-            fprintf(f, "%.12g\n", x[i]);
+        } else {
+            for (int i = 0; i < global_n; i++) {
+                for (int c = 0; c < k; c++) {
+                    fprintf(f, c + 1 < k ? "%.12g " : "%.12g\n", full[(size_t)i * k + c]);
+                }
+            }
+            fclose(f);
         }
-        fclose(f);
     }
+    free(recv);
+    free(full);
+    free(all_rows);
+    free(counts);
+    free(displs);
 }
 
@@ -0,0 +1,406 @@
+/**
+ * @file cg_bench.c
+ * @brief Benchmark of the solver kernels on generated matrices
+ *
+ * Generates a model problem directly in distributed form (see matgen.h),
+ * then measures the distributed SpMV (ghost exchange plus local product),
+ * the latency of a one-value MPI_Allreduce and the time per CG iteration.
+ * Each run appends one record to a CSV or JSON Lines file, so runs at
+ * different process counts (scripts/run_local.sh bench) build a scaling
+ * table. With -weak the problem grows with the number of processes:
+ * the last grid dimension (or the row count) is multiplied by p.
+ * With -matrix_free the Poisson problems run on the stencil operator of
+ * stencil_ops.h instead of a generated matrix.
+ *
+ * Usage: mpirun -np <p> bin/cg_bench [-matrix <type>] [-size <n>] [-weak]
+ *        [-matrix_free] [-contrast <c>] [-iters <n>] [-reps <n>] [-output <file>]
+ *        [solver options]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cg_solver.h"
+#include "halo.h"
+#include "matgen.h"
+#include "partition.h"
+#include "sparse_ops.h"
+#include "stencil_ops.h"
+#include "vector_ops.h"
+
+static void print_usage(const char* prog_name) {
+    printf("Usage: %s [options]\n", prog_name);
+    printf("Options:\n");
+    printf("  -matrix <type>    poisson2d, poisson3d, poisson3d27, banded, random (default: poisson3d)\n");
+    printf("  -size <n>         Grid points per dimension, or rows of banded/random\n");
+    printf("                    (default: 1000 2D, 100 3D, 64 27-point, 1000000 rows)\n");
+    printf("  -width <w>        Half bandwidth of banded, off-diagonals per row of random (default: 8)\n");
+    printf("  -seed <s>         Seed of the random matrix (default: 1)\n");
+    printf("  -weak             Grow the problem with the process count (weak scaling)\n");
+    printf("  -matrix_free      Apply poisson2d/poisson3d as a stencil, without a matrix\n");
+    printf("  -contrast <c>     With -matrix_free, coefficient of every other layer (default: 1)\n");
+    printf("  -iters <n>        Timed CG iterations (default: 100)\n");
+    printf("  -reps <n>         Timed SpMVs (default: 100) and allreduces (10x)\n");
+    printf("  -output <file>    Append the record to file, JSON Lines if named *.json\n");
+    printf("                    (default: bench_results.csv)\n");
+    printf("  -method <name>    CG variant: cg, cgcg, pipecg, sstep (default: cg)\n");
+    printf("  -sstep_s <n>      Iterations per block of -method sstep (default: 4)\n");
+    printf("  -node_halo        CG ghost exchange once per node through shared memory\n");
+    printf("  -node_ranks <n>   Processes per node of -node_halo (default: all sharing memory)\n");
+    printf("  -pc <name>        Preconditioner: none, jacobi, bjacobi, ssor, amg (default: none)\n");
+    printf("  -format <name>    SpMV storage format of the CG run: csr, sell, compact (default: csr)\n");
+    printf("  -partition <name> Row split: rows, nnz, mixed (default: nnz)\n");
+    printf("  -partition_weight <w> Nonzero weight in [0, 1] for -partition mixed (default: 0.5)\n");
+}
+
+/**
+ * @brief Append one result record; the CSV header is written to a new file
+ */
+static void write_record(const char* filename, const char* const* keys,
+                         const char* const* values, int n_fields) {
+    size_t len = strlen(filename);
+    int json = len >= 5 && strcmp(filename + len - 5, ".json") == 0;
+    FILE* f = fopen(filename, "a");
+    if (f == NULL) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    if (json) {
+        fprintf(f, "{");
+        for (int i = 0; i < n_fields; i++) {
+            // Numbers start with a digit or sign; everything else is quoted
+            int number = strchr("0123456789-", values[i][0]) != NULL;
+            fprintf(f, "%s\"%s\": %s%s%s", i > 0 ? ", " : "", keys[i],
+                    number ? "" : "\"", values[i], number ? "" : "\"");
+        }
+        fprintf(f, "}\n");
+    } else {
+        if (ftell(f) == 0) {
+            for (int i = 0; i < n_fields; i++) fprintf(f, "%s%s", i > 0 ? "," : "", keys[i]);
+            fprintf(f, "\n");
+        }
+        for (int i = 0; i < n_fields; i++) fprintf(f, "%s%s", i > 0 ? "," : "", values[i]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+int main(int argc, char* argv[]) {
+#ifdef _OPENMP
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#else
+    MPI_Init(&argc, &argv);
+#endif
+    int rank, p;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &p);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    MatGenParams gen = {MATGEN_POISSON3D, 0, 0, 0, 8, 1};
+    int size = 0;
+    int weak = 0;
+    int matrix_free = 0;
+    double contrast = 1.0;
+    int iters = 100;
+    int reps = 100;
+    const char* output = "bench_results.csv";
+    const char* method_name = "cg";
+    PartitionType part = PART_NNZ;
+    double part_weight = 0.5;
+    CGOptions opts;
+    cg_options_default(&opts);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-matrix") == 0 && i + 1 < argc) {
+            if (matgen_type_from_string(argv[++i], &gen.type) != 0) {
+                if (rank == 0) fprintf(stderr, "Error: Unknown matrix '%s'\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-width") == 0 && i + 1 < argc) {
+            gen.width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            gen.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-weak") == 0) {
+            weak = 1;
+        }
+        else if (strcmp(argv[i], "-matrix_free") == 0) {
+            matrix_free = 1;
+        }
+        else if (strcmp(argv[i], "-contrast") == 0 && i + 1 < argc) {
+            contrast = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-iters") == 0 && i + 1 < argc) {
+            iters = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-method") == 0 && i + 1 < argc) {
+            method_name = argv[++i];
+            if (cg_method_from_string(method_name, &opts.method) != 0) {
+                if (rank == 0) fprintf(stderr, "Error: Unknown method '%s'\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-sstep_s") == 0 && i + 1 < argc) {
+            opts.sstep_s = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-node_halo") == 0) {
+            opts.node_halo = 1;
+        }
+        else if (strcmp(argv[i], "-node_ranks") == 0 && i + 1 < argc) {
+            opts.node_ranks = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-pc") == 0 && i + 1 < argc) {
+            if (pc_type_from_string(argv[++i], &opts.pc) != 0) {
+                if (rank == 0) fprintf(stderr, "Error: Unknown preconditioner '%s'\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-format") == 0 && i + 1 < argc) {
+            if (sparse_format_from_string(argv[++i], &opts.format) != 0) {
+                if (rank == 0) fprintf(stderr, "Error: Unknown format '%s'\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-partition") == 0 && i + 1 < argc) {
+            if (partition_type_from_string(argv[++i], &part) != 0 || part == PART_FILE) {
+                if (rank == 0) fprintf(stderr, "Error: Unknown partition '%s'\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-partition_weight") == 0 && i + 1 < argc) {
+            part_weight = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            if (rank == 0) print_usage(argv[0]);
+            MPI_Finalize();
+            return 0;
+        }
+        else {
+            if (rank == 0) {
+                fprintf(stderr, "Error: Unknown or incomplete option '%s'\n", argv[i]);
+                print_usage(argv[0]);
+            }
+            MPI_Finalize();
+            return 1;
+        }
+    }
+    if (iters < 1 || reps < 1) {
+        if (rank == 0) fprintf(stderr, "Error: -iters and -reps must be positive\n");
+        MPI_Finalize();
+        return 1;
+    }
+    if (matrix_free && gen.type != MATGEN_POISSON2D && gen.type != MATGEN_POISSON3D) {
+        if (rank == 0) fprintf(stderr, "Error: -matrix_free needs -matrix poisson2d or poisson3d\n");
+        MPI_Finalize();
+        return 1;
+    }
+    if (contrast <= 0.0 || (contrast != 1.0 && !matrix_free)) {
+        if (rank == 0) fprintf(stderr, "Error: -contrast needs -matrix_free and a positive value\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Grid of the generated matrix; weak scaling stretches the last dimension
+    switch (gen.type) {
+        case MATGEN_POISSON2D:
+            gen.nx = gen.ny = size > 0 ? size : 1000;
+            if (weak) gen.ny *= p;
+            break;
+        case MATGEN_POISSON3D:
+        case MATGEN_POISSON3D27:
+            gen.nx = gen.ny = gen.nz = size > 0 ? size : (gen.type == MATGEN_POISSON3D ? 100 : 64);
+            if (weak) gen.nz *= p;
+            break;
+        default:
+            gen.nx = size > 0 ? size : 1000000;
+            if (weak) gen.nx *= p;
+            break;
+    }
+
+    int local_n, local_nnz, global_n;
+    int* ptr = NULL;
+    int* cols = NULL;
+    double* vals = NULL;
+    RowDist dist;
+    HaloPlan halo;
+    StencilOp stencil;
+    CGLinearOp stencil_op;
+    int n_ghost;
+    double local_counts[3];
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t0 = MPI_Wtime();
+    if (matrix_free) {
+        StencilType type = gen.type == MATGEN_POISSON2D ? STENCIL_POISSON2D : STENCIL_POISSON3D;
+        stencil_setup(&stencil, type, gen.nx, gen.ny, gen.nz, rank, p, &dist);
+        if (contrast != 1.0) {
+            double* k = vec_alloc(stencil.local_n);
+            if (k == NULL) {
+                fprintf(stderr, "Rank %d: Failed to allocate coefficients\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            stencil_fill_layers(&stencil, contrast, k);
+            stencil_set_coefficients(&stencil, k);
+            free(k);
+        }
+        stencil_linear_op(&stencil, &stencil_op);
+        local_n = stencil.local_n;
+        global_n = dist.global_n;
+        n_ghost = stencil.n_ghost;
+        // Per-process SpMV traffic: coefficients, x with ghosts, y; and ghosts received
+        int n_coef = stencil.diag == NULL ? 0 : (type == STENCIL_POISSON3D ? 4 : 3);
+        int neighbors = (rank > 0) + (rank < p - 1);
+        local_counts[0] = rank == 0 ? (double)stencil_nnz(&stencil) : 0.0;
+        local_counts[1] = ((double)local_n * n_coef + 2.0 * local_n + neighbors * stencil.plane) *
+                          sizeof(double);
+        local_counts[2] = (double)neighbors * stencil.plane * sizeof(double);
+    } else {
+        matgen_generate(&gen, &ptr, &cols, &vals, &local_n, &local_nnz, &global_n,
+                        rank, p, part, part_weight, &dist);
+        halo_setup(ptr, cols, &dist, rank, &halo);
+        n_ghost = halo.n_ghost;
+        // Per-process SpMV traffic: matrix arrays, x with ghosts, y; and ghosts received
+        local_counts[0] = (double)local_nnz;
+        local_counts[1] = (double)local_nnz * (sizeof(double) + sizeof(int)) +
+                          (local_n + 1.0) * sizeof(int) +
+                          (2.0 * local_n + halo.n_ghost) * sizeof(double);
+        local_counts[2] = (double)halo.n_ghost * sizeof(double);
+    }
+    double t_setup = MPI_Wtime() - t0;
+
+    double counts[3];
+    MPI_Allreduce(local_counts, counts, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Benchmark: %s%s n=%d nnz=%.0f (%s scaling), %d processes x %d threads\n",
+               matgen_type_name(gen.type), matrix_free ? " (matrix-free)" : "", global_n,
+               counts[0], weak ? "weak" : "strong", p, threads);
+    }
+
+    // Distributed SpMV: ghost exchange and local product
+    double* x = vec_alloc(local_n + n_ghost);
+    double* y = vec_alloc(local_n);
+    double* b = vec_alloc(local_n);
+    if (x == NULL || y == NULL || b == NULL) {
+        fprintf(stderr, "Rank %d: Failed to allocate benchmark vectors\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < local_n; i++) {
+        x[i] = 1.0;
+        b[i] = 1.0;
+    }
+    for (int r = 0; r <= reps; r++) {
+        // The first product is an untimed warm-up
+        if (r == 1) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            t0 = MPI_Wtime();
+        }
+        if (matrix_free) {
+            stencil_apply(&stencil, x, y);
+        } else {
+            halo_exchange(&halo, x);
+            mat_vec_csr(ptr, cols, vals, x, y, local_n);
+        }
+    }
+    double t_spmv = (MPI_Wtime() - t0) / reps;
+
+    // Latency of the scalar reduction every CG iteration waits for
+    double one = 1.0, sum;
+    int allreduce_reps = 10 * reps;
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    for (int r = 0; r < allreduce_reps; r++) {
+        MPI_Allreduce(&one, &sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+    double t_allreduce = (MPI_Wtime() - t0) / allreduce_reps;
+
+    // Fixed number of CG iterations: tolerance zero never converges early
+    memset(x, 0, local_n * sizeof(double));
+    opts.max_iter = iters;
+    opts.tol = 0.0;
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    int done = matrix_free ? cg_solver_op(&stencil_op, b, x, &dist, rank, &opts)
+                           : cg_solver(ptr, cols, vals, b, x, local_n, local_nnz, &dist, &halo,
+                                       rank, p, &opts);
+    double t_cg = MPI_Wtime() - t0;
+
+    double local_times[3] = {t_spmv, t_allreduce, t_cg};
+    double times[3];
+    MPI_Reduce(local_times, times, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        double t_iter = done > 0 ? times[2] / done : 0.0;
+        double gflops = times[0] > 0.0 ? 2.0 * counts[0] / times[0] * 1e-9 : 0.0;
+        double gbs = times[0] > 0.0 ? counts[1] / times[0] * 1e-9 : 0.0;
+        printf("SpMV %.3e s (%.3f GFLOP/s, %.3f GB/s, %.0f halo bytes), allreduce %.2f us, "
+               "CG %.3e s/iteration over %d iterations\n",
+               times[0], gflops, gbs, counts[2], times[1] * 1e6, t_iter, done);
+
+        static const char* keys[] = {
+            "matrix", "scaling", "ranks", "threads", "n", "nnz", "method", "pc", "format",
+            "setup_s", "iterations", "time_per_iter_s", "spmv_s", "spmv_gflops",
+            "spmv_bytes", "spmv_gbs", "halo_bytes", "allreduce_us"};
+        enum { N_FIELDS = sizeof(keys) / sizeof(keys[0]) };
+        char buf[N_FIELDS][64];
+        const char* values[N_FIELDS];
+        snprintf(buf[0], 64, "%s", matgen_type_name(gen.type));
+        snprintf(buf[1], 64, "%s", weak ? "weak" : "strong");
+        snprintf(buf[2], 64, "%d", p);
+        snprintf(buf[3], 64, "%d", threads);
+        snprintf(buf[4], 64, "%d", global_n);
+        snprintf(buf[5], 64, "%.0f", counts[0]);
+        snprintf(buf[6], 64, "%s", method_name);
+        snprintf(buf[7], 64, "%s", pc_type_name(opts.pc));
+        snprintf(buf[8], 64, "%s", matrix_free ? "stencil" : sparse_format_name(opts.format));
+        snprintf(buf[9], 64, "%.6e", t_setup);
+        snprintf(buf[10], 64, "%d", done);
+        snprintf(buf[11], 64, "%.6e", t_iter);
+        snprintf(buf[12], 64, "%.6e", times[0]);
+        snprintf(buf[13], 64, "%.4f", gflops);
+        snprintf(buf[14], 64, "%.0f", counts[1]);
+        snprintf(buf[15], 64, "%.4f", gbs);
+        snprintf(buf[16], 64, "%.0f", counts[2]);
+        snprintf(buf[17], 64, "%.3f", times[1] * 1e6);
+        for (int i = 0; i < N_FIELDS; i++) values[i] = buf[i];
+        write_record(output, keys, values, N_FIELDS);
+        printf("Appended results to %s\n", output);
+    }
+
+    if (matrix_free) {
+        stencil_free(&stencil);
+    } else {
+        halo_free(&halo);
+    }
+    rowdist_free(&dist);
+    free(ptr);
+    free(cols);
+    free(vals);
+    free(x);
+    free(y);
+    free(b);
+    MPI_Finalize();
+    return 0;
+}